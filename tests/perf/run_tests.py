@@ -79,10 +79,10 @@ def translate_test(test):
 	if "speed" == name:
 		threads = test[1]
 		mode = test[2]
-		mode_keys = ["str",    "fmti",       "str-off",        "slowf-off"]
-		mode_vals = ["string", "3 integers", "string, off", "slow function, off"]
+		mode_keys = ["str",    "fmti",       "str-off",        "slowf-off",          "async",         "async-pt",                    "fmti-deferred",        "str-nopidcache",       "str-coarse",           "str-tsc",           "fmti-fastfmt",            "fmti-fmtcache",            "mem"]
+		mode_vals = ["string", "3 integers", "string, off", "slow function, off", "string, async", "string, async per thread", "3 integers, deferred", "string, no pid cache", "string, coarse clock", "string, TSC clock", "3 integers, fast format", "3 integers, format cache", "memory dump"]
 		tr_mode = take_map(mode, mode_keys, mode_vals)
-		order = 10 * threads + take_order(mode, mode_keys)
+		order = 100 * threads + take_order(mode, mode_keys)
 		return 6000 + order, "Speed: %i %s, %s" % (threads, take_plural(threads, "thread", "s"), tr_mode)
 	if type(test) is tuple or type(test) is list:
 		return 31416, ", ".join(test)
@@ -34,6 +34,13 @@ extern int XLOG_INT_VALUE;
 	const char *XLOG_STRING_VALUE = XLOG_STRING_LITERAL;
 	int XLOG_INT_VALUE = XLOG_INT_LITERAL;
 #endif
+#ifdef TEST_FORMAT_MEM
+	/* Memory dump of a typical packet size. */
+	extern unsigned char XLOG_MEM_VALUE[1500];
+	#ifndef TEST_SWITCH_MODULE
+		unsigned char XLOG_MEM_VALUE[1500];
+	#endif
+#endif
 #ifdef TEST_FORMAT_SLOW_FUNC
 	#include <chrono>
 	#include <thread>
@@ -64,7 +71,19 @@ extern int XLOG_INT_VALUE;
 
 #ifdef TEST_LIBRARY_ZF_LOG
 	#include <zf_log.h>
-	#ifdef TEST_NULL_SINK
+	#if defined(TEST_NULL_SINK) && defined(TEST_ASYNC)
+		static const zf_log_output g_null_output =
+		{
+			ZF_LOG_PUT_STD, 0, [](const zf_log_message *, void *){}
+		};
+		#define _XLOG_INIT_SINK() \
+			zf_log_async_start(0); \
+			zf_log_set_output_v(ZF_LOG_OUT_ASYNC(&g_null_output))
+	#elif defined(TEST_NULL_SINK) && defined(TEST_DEFERRED)
+		#define _XLOG_INIT_SINK() \
+			zf_log_set_output_v(ZF_LOG_PUT_DEFERRED, 0, \
+								[](const zf_log_message *, void *){})
+	#elif defined(TEST_NULL_SINK)
 		#define _XLOG_INIT_SINK() \
 			zf_log_set_output_v(ZF_LOG_PUT_STD, 0, \
 								[](const zf_log_message *, void *){})
@@ -87,6 +106,9 @@ extern int XLOG_INT_VALUE;
 		#define XLOG_STATEMENT() ZF_LOGI(XLOG_MESSAGE_3INT_VALUES_PRINTF)
 	#elif defined(TEST_FORMAT_SLOW_FUNC)
 		#define XLOG_STATEMENT() ZF_LOGI(XLOG_MESSAGE_SLOW_FUNC_PRINTF)
+	#elif defined(TEST_FORMAT_MEM)
+		#define XLOG_STATEMENT() ZF_LOGI_MEM(XLOG_MEM_VALUE, sizeof(XLOG_MEM_VALUE), \
+											 XLOG_MESSAGE_STR_LITERAL_PRINTF)
 	#else
 		#define XLOG_STATEMENT() ZF_LOGI(XLOG_MESSAGE_STR_LITERAL_PRINTF)
 	#endif
@@ -0,0 +1,256 @@
+#define ZF_LOG_ASYNC
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#include <zf_log.c>
+#include <zf_test.h>
+
+enum { THREADS = 4, LINES = 2000, QUEUE_SZ = 8 };
+
+static pthread_t g_main_thread;
+static unsigned g_next[THREADS];
+static unsigned g_total;
+static unsigned g_on_main_thread;
+static unsigned g_bad;
+static unsigned g_last_t;
+static unsigned g_unordered;
+
+static void mock_output_callback(const zf_log_message *msg, void *arg)
+{
+	unsigned t, i;
+	(void)arg;
+	*msg->p = 0;
+	if (2 != sscanf(msg->msg_b, "t%u %u", &t, &i) ||
+		THREADS <= t || g_next[t] != i)
+	{
+		++g_bad;
+	}
+	else
+	{
+		++g_next[t];
+		if (g_last_t > t)
+		{
+			++g_unordered;
+		}
+		g_last_t = t;
+	}
+	if (pthread_equal(pthread_self(), g_main_thread))
+	{
+		++g_on_main_thread;
+	}
+	++g_total;
+}
+
+static const zf_log_output g_output =
+{
+	ZF_LOG_PUT_STD, 0, mock_output_callback
+};
+
+static void reset()
+{
+	for (unsigned t = 0; THREADS > t; ++t)
+	{
+		g_next[t] = 0;
+	}
+	g_total = 0;
+	g_on_main_thread = 0;
+	g_bad = 0;
+	g_last_t = 0;
+	g_unordered = 0;
+}
+
+static void *producer(void *arg)
+{
+	const unsigned t = (unsigned)(size_t)arg;
+	for (unsigned i = 0; LINES > i; ++i)
+	{
+		ZF_LOGI("t%u %u", t, i);
+	}
+	return 0;
+}
+
+static void test_not_started()
+{
+	reset();
+	ZF_LOGI("t0 0");
+	TEST_VERIFY_EQUAL(g_total, 1);
+	TEST_VERIFY_EQUAL(g_on_main_thread, 1);
+	TEST_VERIFY_EQUAL(g_bad, 0);
+}
+
+static void test_flush()
+{
+	pthread_t threads[THREADS];
+	reset();
+	TEST_VERIFY_EQUAL(zf_log_async_start(QUEUE_SZ), 0);
+	for (unsigned t = 0; THREADS > t; ++t)
+	{
+		pthread_create(threads + t, 0, producer, (void *)(size_t)t);
+	}
+	for (unsigned t = 0; THREADS > t; ++t)
+	{
+		pthread_join(threads[t], 0);
+	}
+	zf_log_async_flush();
+	TEST_VERIFY_EQUAL(g_total, THREADS * LINES);
+	TEST_VERIFY_EQUAL(g_on_main_thread, 0);
+	TEST_VERIFY_EQUAL(g_bad, 0);
+	zf_log_async_stop();
+}
+
+static void test_stop()
+{
+	reset();
+	TEST_VERIFY_EQUAL(zf_log_async_start(QUEUE_SZ), 0);
+	producer(0);
+	zf_log_async_stop();
+	TEST_VERIFY_EQUAL(g_total, LINES);
+	TEST_VERIFY_EQUAL(g_on_main_thread, 0);
+	TEST_VERIFY_EQUAL(g_bad, 0);
+	/* goes directly to the target output once stopped */
+	ZF_LOGI("t0 %u", (unsigned)LINES);
+	TEST_VERIFY_EQUAL(g_total, LINES + 1);
+	TEST_VERIFY_EQUAL(g_on_main_thread, 1);
+	TEST_VERIFY_EQUAL(g_bad, 0);
+}
+
+static int g_started[THREADS];
+
+static void *starter(void *arg)
+{
+	const unsigned t = (unsigned)(size_t)arg;
+	g_started[t] = zf_log_async_start(QUEUE_SZ);
+	producer(arg);
+	return 0;
+}
+
+static void test_concurrent_start()
+{
+	/* Only one of the threads starts the writer thread, others find it
+	 * running.
+	 */
+	pthread_t threads[THREADS];
+	reset();
+	for (unsigned t = 0; THREADS > t; ++t)
+	{
+		pthread_create(threads + t, 0, starter, (void *)(size_t)t);
+	}
+	for (unsigned t = 0; THREADS > t; ++t)
+	{
+		pthread_join(threads[t], 0);
+		TEST_VERIFY_EQUAL(g_started[t], 0);
+	}
+	zf_log_async_stop();
+	TEST_VERIFY_EQUAL(g_total, THREADS * LINES);
+	TEST_VERIFY_EQUAL(g_on_main_thread, 0);
+	TEST_VERIFY_EQUAL(g_bad, 0);
+}
+
+#if ZF_LOG_ASYNC_PER_THREAD
+static void test_order()
+{
+	/* Each thread queues its lines after the previous one exited, so output
+	 * must have them in the same order, even though they sit in different
+	 * queues.
+	 */
+	reset();
+	TEST_VERIFY_EQUAL(zf_log_async_start(QUEUE_SZ), 0);
+	for (unsigned t = 0; THREADS > t; ++t)
+	{
+		pthread_t thread;
+		pthread_create(&thread, 0, producer, (void *)(size_t)t);
+		pthread_join(thread, 0);
+	}
+	zf_log_async_flush();
+	TEST_VERIFY_EQUAL(g_total, THREADS * LINES);
+	TEST_VERIFY_EQUAL(g_unordered, 0);
+	TEST_VERIFY_EQUAL(g_bad, 0);
+	zf_log_async_stop();
+}
+
+static unsigned rings_count()
+{
+	unsigned n = 0;
+	pthread_mutex_lock(&g_async_lock);
+	for (async_ring *r = g_async.rings; 0 != r; r = r->next)
+	{
+		++n;
+	}
+	pthread_mutex_unlock(&g_async_lock);
+	return n;
+}
+
+static int g_logged;
+static int g_exit;
+
+static void *waiting_producer(void *arg)
+{
+	producer(arg);
+	__atomic_store_n(&g_logged, 1, __ATOMIC_RELEASE);
+	while (!__atomic_load_n(&g_exit, __ATOMIC_ACQUIRE))
+	{
+		sched_yield();
+	}
+	return 0;
+}
+
+static void test_reclaim()
+{
+	/* Queues of exited threads are freed by the writer thread once empty.
+	 */
+	reset();
+	const unsigned n = rings_count();
+	TEST_VERIFY_EQUAL(zf_log_async_start(QUEUE_SZ), 0);
+	pthread_t threads[THREADS];
+	for (unsigned t = 0; THREADS > t; ++t)
+	{
+		pthread_create(threads + t, 0, producer, (void *)(size_t)t);
+	}
+	for (unsigned t = 0; THREADS > t; ++t)
+	{
+		pthread_join(threads[t], 0);
+	}
+	zf_log_async_flush();
+	for (unsigned i = 0; 1000 > i && n != rings_count(); ++i)
+	{
+		usleep(1000);
+	}
+	TEST_VERIFY_EQUAL(rings_count(), n);
+	TEST_VERIFY_EQUAL(g_total, THREADS * LINES);
+	TEST_VERIFY_EQUAL(g_bad, 0);
+
+	/* Thread that exits when asynchronous output is stopped frees its queue
+	 * itself.
+	 */
+	reset();
+	pthread_create(threads, 0, waiting_producer, 0);
+	while (!__atomic_load_n(&g_logged, __ATOMIC_ACQUIRE))
+	{
+		sched_yield();
+	}
+	zf_log_async_stop();
+	TEST_VERIFY_EQUAL(rings_count(), n + 1);
+	__atomic_store_n(&g_exit, 1, __ATOMIC_RELEASE);
+	pthread_join(threads[0], 0);
+	TEST_VERIFY_EQUAL(rings_count(), n);
+	TEST_VERIFY_EQUAL(g_total, LINES);
+	TEST_VERIFY_EQUAL(g_bad, 0);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	g_main_thread = pthread_self();
+	zf_log_set_output_v(ZF_LOG_OUT_ASYNC(&g_output));
+
+	TEST_EXECUTE(test_not_started());
+	TEST_EXECUTE(test_flush());
+	TEST_EXECUTE(test_stop());
+	TEST_EXECUTE(test_concurrent_start());
+#if ZF_LOG_ASYNC_PER_THREAD
+	TEST_EXECUTE(test_order());
+	TEST_EXECUTE(test_reclaim());
+#endif
+
+	return TEST_RUNNER_EXIT_CODE();
+}
@@ -0,0 +1,245 @@
+#if defined(_WIN32) || defined(_WIN64)
+	#define _CRT_SECURE_NO_WARNINGS
+#endif
+#define ZF_LOG_INSTRUMENTED 1
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#define ZF_LOG_TAG "TAG"
+#define ZF_LOG_DECODE_NO_MAIN
+#include <zf_log_decode.c>
+#include <zf_test.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_LINES 16
+typedef struct lines
+{
+	char line[MAX_LINES][ZF_LOG_BUF_SZ];
+	size_t n;
+}
+lines;
+
+static lines g_expected;
+static lines g_decoded;
+static unsigned g_second;
+static char g_path[1024];
+
+static void mock_time_callback(struct tm *const tm, time_t *const sec,
+							   unsigned *const nsec)
+{
+	/* Like time_callback(), local time is not provided when not used. */
+	memset(tm, 0, sizeof(*tm));
+#if _ZF_LOG_MESSAGE_FORMAT_LOCALTIME_USED
+	tm->tm_sec = (int)g_second;
+	tm->tm_min = 34;
+	tm->tm_hour = 12;
+	tm->tm_mday = 23;
+	tm->tm_mon = 11;
+	tm->tm_year = 2016 - 1900;
+#endif
+	*sec = 1482496440 + g_second; /* 2016-12-23 12:34:00 UTC */
+	*nsec = 789012345;
+}
+
+static void lines_output_callback(const zf_log_message *msg, void *arg)
+{
+	lines *const l = (lines *)arg;
+	if (MAX_LINES <= l->n)
+	{
+		fprintf(stderr, "too many lines produced\n");
+		exit(1);
+	}
+	const size_t len = (size_t)(msg->p - msg->buf);
+	memcpy(l->line[l->n], msg->buf, len);
+	l->line[l->n++][len] = 0;
+}
+
+static const zf_log_output g_expected_output =
+{
+	ZF_LOG_PUT_STD, &g_expected, lines_output_callback
+};
+static const zf_log_output g_decoded_output =
+{
+	ZF_LOG_PUT_STD, &g_decoded, lines_output_callback
+};
+static const zf_log_spec g_expected_spec =
+{
+	ZF_LOG_GLOBAL_FORMAT, &g_expected_output
+};
+
+/* Writes the same message into the binary file and into the expected lines.
+ */
+#define LOG_BOTH(level, ...) \
+	do { \
+		ZF_LOG##level(__VA_ARGS__); \
+		ZF_LOG##level##_AUX(&g_expected_spec, __VA_ARGS__); \
+	} while (0)
+
+static void write_session(const unsigned second)
+{
+	zf_log_binary *const b = zf_log_binary_open(g_path);
+	TEST_VERIFY_TRUE(0 != b);
+	zf_log_set_output_v(ZF_LOG_OUT_BINARY(b));
+	g_second = second;
+	LOG_BOTH(I, "info %i %s", 1, "one");
+	LOG_BOTH(W, "warn %.2f", 2.5);
+	zf_log_set_tag_prefix("prefix");
+	LOG_BOTH(E, "error %c%c", 'o', 'k');
+	zf_log_set_tag_prefix(0);
+	LOG_BOTH(I, "info again %i", 2);
+	zf_log_set_output_v(ZF_LOG_OUT_STDERR);
+	zf_log_binary_close(b);
+}
+
+static void write_other_tag(const unsigned second)
+{
+#undef ZF_LOG_TAG
+#define ZF_LOG_TAG "NET"
+	zf_log_binary *const b = zf_log_binary_open(g_path);
+	TEST_VERIFY_TRUE(0 != b);
+	zf_log_set_output_v(ZF_LOG_OUT_BINARY(b));
+	g_second = second;
+	LOG_BOTH(W, "net %u", 3u);
+	zf_log_set_output_v(ZF_LOG_OUT_STDERR);
+	zf_log_binary_close(b);
+#undef ZF_LOG_TAG
+#define ZF_LOG_TAG "TAG"
+}
+
+static void write_reused_format(void)
+{
+	/* Format string pointer is the same, but the string is not. */
+	char fmt[32];
+	zf_log_binary *const b = zf_log_binary_open(g_path);
+	TEST_VERIFY_TRUE(0 != b);
+	zf_log_set_output_v(ZF_LOG_OUT_BINARY(b));
+	g_second = 50;
+	strcpy(fmt, "first %i");
+	LOG_BOTH(I, fmt, 1);
+	strcpy(fmt, "second %s");
+	LOG_BOTH(I, fmt, "two");
+	strcpy(fmt, "first %i");
+	LOG_BOTH(I, fmt, 3);
+	zf_log_set_output_v(ZF_LOG_OUT_STDERR);
+	zf_log_binary_close(b);
+}
+
+static void decode(const decode_filter *const filter)
+{
+	decode_dict dict = {0, 0, 0, 0};
+	FILE *const in = fopen(g_path, "rb");
+	TEST_VERIFY_TRUE(0 != in);
+	g_decoded.n = 0;
+	TEST_VERIFY_EQUAL(decode_stream(in, g_path, filter, &dict, &g_decoded_output), 0);
+	fclose(in);
+	dict_clear(&dict);
+}
+
+static void verify_decoded(const size_t *const expected, const size_t n)
+{
+	TEST_VERIFY_EQUAL(g_decoded.n, n);
+	for (size_t i = 0; n > i; ++i)
+	{
+		const char *const e = g_expected.line[expected[i]];
+		TEST_VERIFY_TRUE_MSG(0 == strcmp(e, g_decoded.line[i]),
+							 "\"%s\" != \"%s\"", e, g_decoded.line[i]);
+	}
+}
+
+static void test_decode_all()
+{
+	static const size_t expected[] = {0, 1, 2, 3, 4, 5, 6, 7, 8};
+	const decode_filter filter = {0, 0, 0, ~0ull};
+	decode(&filter);
+	verify_decoded(expected, _countof(expected));
+}
+
+static void test_filter_level()
+{
+	static const size_t expected[] = {1, 2, 5, 6, 8};
+	const decode_filter filter = {ZF_LOG_WARN, 0, 0, ~0ull};
+	decode(&filter);
+	verify_decoded(expected, _countof(expected));
+}
+
+static void test_filter_tag()
+{
+	static const size_t expected[] = {8};
+	const decode_filter filter = {0, "NET", 0, ~0ull};
+	decode(&filter);
+	verify_decoded(expected, _countof(expected));
+}
+
+static void test_filter_time()
+{
+	static const size_t expected[] = {4, 5, 6, 7};
+	decode_filter filter = {0, 0, 0, ~0ull};
+	TEST_VERIFY_EQUAL(parse_time("2016-12-23 12:34:20", &filter.time_b), 0);
+	TEST_VERIFY_EQUAL(parse_time("2016-12-23 12:34:30", &filter.time_e), 0);
+	decode(&filter);
+	verify_decoded(expected, _countof(expected));
+}
+
+static void test_reused_format()
+{
+	static const size_t expected[] = {9, 10, 11};
+	remove(g_path);
+	write_reused_format();
+	const decode_filter filter = {0, 0, 0, ~0ull};
+	decode(&filter);
+	verify_decoded(expected, _countof(expected));
+}
+
+static void test_parse_level()
+{
+	TEST_VERIFY_EQUAL(parse_level("V"), ZF_LOG_VERBOSE);
+	TEST_VERIFY_EQUAL(parse_level("I"), ZF_LOG_INFO);
+	TEST_VERIFY_EQUAL(parse_level("F"), ZF_LOG_FATAL);
+	TEST_VERIFY_EQUAL(parse_level("X"), -1);
+	TEST_VERIFY_EQUAL(parse_level("II"), -1);
+}
+
+static void test_not_binary()
+{
+	decode_dict dict = {0, 0, 0, 0};
+	const decode_filter filter = {0, 0, 0, ~0ull};
+	FILE *const f = fopen(g_path, "wb");
+	TEST_VERIFY_TRUE(0 != f);
+	fputs("plain text", f);
+	fclose(f);
+	FILE *const in = fopen(g_path, "rb");
+	TEST_VERIFY_TRUE(0 != in);
+	TEST_VERIFY_NOT_EQUAL(decode_stream(in, g_path, &filter, &dict, &g_decoded_output), 0);
+	fclose(in);
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	/* Time filter takes local time. */
+#if defined(_WIN32) || defined(_WIN64)
+	_putenv("TZ=UTC");
+	_tzset();
+#else
+	setenv("TZ", "UTC", 1);
+	tzset();
+#endif
+	g_time_cb = mock_time_callback;
+	(void)g_pid_cb; /* not used when format has no PID and TID */
+	snprintf(g_path, sizeof(g_path), "%s.zlog", argv[0]);
+	remove(g_path);
+	write_session(10);
+	write_session(20);
+	write_other_tag(40);
+
+	TEST_EXECUTE(test_decode_all());
+	TEST_EXECUTE(test_filter_level());
+	TEST_EXECUTE(test_filter_tag());
+	TEST_EXECUTE(test_filter_time());
+	TEST_EXECUTE(test_reused_format());
+	TEST_EXECUTE(test_parse_level());
+	TEST_EXECUTE(test_not_binary());
+
+	remove(g_path);
+	return TEST_RUNNER_EXIT_CODE();
+}
@@ -0,0 +1,387 @@
+#define ZF_LOG_BUFFERED_FILE
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#define ZF_LOG_TAG "TAG"
+#include <zf_log.c>
+#include <zf_test.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+enum { THREADS = 4, LINES = 2000 };
+
+static char g_path[1024];
+static pthread_t g_main_thread;
+
+static const char *gen_path(const unsigned gen, const char *const suffix)
+{
+	static char path[1024 + 32];
+	if (0 == gen)
+	{
+		return g_path;
+	}
+	snprintf(path, sizeof(path), "%s.%u%s", g_path, gen, suffix);
+	return path;
+}
+
+static size_t file_size_of(const char *const path)
+{
+	struct stat st;
+	return 0 == stat(path, &st)? (size_t)st.st_size: 0;
+}
+
+static int file_exists(const char *const path)
+{
+	struct stat st;
+	return 0 == stat(path, &st);
+}
+
+static size_t file_size(void)
+{
+	return file_size_of(g_path);
+}
+
+static char *file_read_from(const char *const path, size_t *const sz)
+{
+	*sz = file_size_of(path);
+	char *const s = (char *)malloc(*sz + 1);
+	FILE *const f = fopen(path, "rb");
+	TEST_VERIFY_TRUE(0 != s && 0 != f);
+	TEST_VERIFY_EQUAL(fread(s, 1, *sz, f), *sz);
+	fclose(f);
+	s[*sz] = 0;
+	return s;
+}
+
+static char *file_read(size_t *const sz)
+{
+	return file_read_from(g_path, sz);
+}
+
+static size_t count_lines(void)
+{
+	size_t sz, n = 0;
+	char *const s = file_read(&sz);
+	for (size_t i = 0; sz > i; ++i)
+	{
+		n += '\n' == s[i];
+	}
+	free(s);
+	return n;
+}
+
+/* Returns numbers from the first and the last "line N" message in the file.
+ */
+static void line_range(const char *const path, unsigned *const first,
+					   unsigned *const last)
+{
+	size_t sz;
+	char *const s = file_read_from(path, &sz);
+	const char *p = strstr(s, "TAG line ");
+	TEST_VERIFY_TRUE(0 != p);
+	*first = (unsigned)strtoul(p + 9, 0, 10);
+	for (; 0 != p; p = strstr(p + 1, "TAG line "))
+	{
+		*last = (unsigned)strtoul(p + 9, 0, 10);
+	}
+	free(s);
+}
+
+static void remove_all(void)
+{
+	static const char *const suffixes[] = {"", ".z"};
+	remove(g_path);
+	for (unsigned gen = 1; 4 >= gen; ++gen)
+	{
+		for (size_t i = 0; _countof(suffixes) > i; ++i)
+		{
+			remove(gen_path(gen, suffixes[i]));
+		}
+	}
+}
+
+static zf_log_file *open_rotating(const unsigned buf_sz, const unsigned flush_ms,
+								 const zf_log_rotation *const rotation)
+{
+	remove_all();
+	zf_log_file *const f = zf_log_file_open_rotating(g_path, buf_sz, flush_ms,
+													 rotation);
+	TEST_VERIFY_TRUE(0 != f);
+	zf_log_set_output_v(ZF_LOG_OUT_FILE(f));
+	return f;
+}
+
+static zf_log_file *open_file(const unsigned buf_sz, const unsigned flush_ms)
+{
+	remove_all();
+	zf_log_file *const f = zf_log_file_open(g_path, buf_sz, flush_ms);
+	TEST_VERIFY_TRUE(0 != f);
+	zf_log_set_output_v(ZF_LOG_OUT_FILE(f));
+	return f;
+}
+
+static void close_file(zf_log_file *const f)
+{
+	zf_log_set_output_v(ZF_LOG_OUT_STDERR);
+	zf_log_file_close(f);
+}
+
+static void test_buffer_full()
+{
+	zf_log_file *const f = open_file(256, 60000);
+	unsigned i = 0;
+	while (0 == file_size())
+	{
+		ZF_LOGI("line %u", i++);
+	}
+	TEST_VERIFY_GREATER_OR_EQUAL(i, 2);
+	/* Only complete lines are written. */
+	TEST_VERIFY_EQUAL(count_lines(), i);
+	ZF_LOGI("line %u", i++);
+	TEST_VERIFY_EQUAL(count_lines(), i - 1);
+	zf_log_file_flush(f);
+	TEST_VERIFY_EQUAL(count_lines(), i);
+	close_file(f);
+}
+
+static void test_fatal()
+{
+	zf_log_file *const f = open_file(0, 60000);
+	ZF_LOGI("before fatal");
+	TEST_VERIFY_EQUAL(file_size(), 0);
+	ZF_LOGF("fatal");
+	TEST_VERIFY_EQUAL(count_lines(), 2);
+	close_file(f);
+}
+
+static void test_deadline()
+{
+	zf_log_file *f = open_file(0, 0);
+	ZF_LOGI("written right away");
+	TEST_VERIFY_EQUAL(count_lines(), 1);
+	close_file(f);
+
+	f = open_file(0, 10);
+	ZF_LOGI("first");
+	const struct timespec delay = {0, 50 * 1000000};
+	nanosleep(&delay, 0);
+	ZF_LOGI("second");
+	TEST_VERIFY_EQUAL(count_lines(), 2);
+	close_file(f);
+}
+
+static void test_close()
+{
+	zf_log_file *const f = open_file(0, 60000);
+	ZF_LOGI("buffered");
+	TEST_VERIFY_EQUAL(file_size(), 0);
+	close_file(f);
+	TEST_VERIFY_EQUAL(count_lines(), 1);
+}
+
+static void *producer(void *arg)
+{
+	const unsigned t = (unsigned)(size_t)arg;
+	for (unsigned i = 0; LINES > i; ++i)
+	{
+		ZF_LOGI("t%u %u", t, i);
+	}
+	return 0;
+}
+
+static void test_threads()
+{
+	pthread_t threads[THREADS];
+	zf_log_file *const f = open_file(4096, 60000);
+	for (unsigned t = 0; THREADS > t; ++t)
+	{
+		pthread_create(threads + t, 0, producer, (void *)(size_t)t);
+	}
+	for (unsigned t = 0; THREADS > t; ++t)
+	{
+		pthread_join(threads[t], 0);
+	}
+	close_file(f);
+	unsigned next[THREADS] = {0};
+	unsigned total = 0, bad = 0;
+	size_t sz;
+	char *const s = file_read(&sz);
+	for (char *line = s, *e; 0 != (e = strchr(line, '\n')); line = e + 1)
+	{
+		unsigned t, i;
+		*e = 0;
+		const char *const m = strstr(line, "TAG ");
+		if (0 == m || 2 != sscanf(m, "TAG t%u %u", &t, &i) ||
+			THREADS <= t || next[t] != i)
+		{
+			++bad;
+		}
+		else
+		{
+			++next[t];
+		}
+		++total;
+	}
+	free(s);
+	TEST_VERIFY_EQUAL(total, THREADS * LINES);
+	TEST_VERIFY_EQUAL(bad, 0);
+}
+
+static void test_rotate_size()
+{
+	const zf_log_rotation rotation = {1024, 0, 2, 0, 0, 0};
+	zf_log_file *const f = open_rotating(256, 60000, &rotation);
+	for (unsigned i = 0; 200 > i; ++i)
+	{
+		ZF_LOGI("line %u", i);
+	}
+	close_file(f);
+	TEST_VERIFY_TRUE(file_exists(gen_path(1, "")));
+	TEST_VERIFY_TRUE(file_exists(gen_path(2, "")));
+	TEST_VERIFY_TRUE(!file_exists(gen_path(3, "")));
+	unsigned first[3], last[3];
+	for (unsigned gen = 0; 2 >= gen; ++gen)
+	{
+		TEST_VERIFY_TRUE(1024 >= file_size_of(gen_path(gen, "")));
+		line_range(gen_path(gen, ""), first + gen, last + gen);
+	}
+	/* Generations are consecutive, the newest lines are in the current file. */
+	TEST_VERIFY_EQUAL(last[0], 199);
+	TEST_VERIFY_EQUAL(last[1] + 1, first[0]);
+	TEST_VERIFY_EQUAL(last[2] + 1, first[1]);
+}
+
+typedef struct compress_state
+{
+	unsigned calls;
+	unsigned on_main_thread;
+	int ret;
+}
+compress_state;
+
+static int copy_compress(const char *const src, const char *const dst, void *arg)
+{
+	compress_state *const state = (compress_state *)arg;
+	size_t sz;
+	char *const s = file_read_from(src, &sz);
+	FILE *const f = fopen(dst, "wb");
+	TEST_VERIFY_TRUE(0 != f);
+	TEST_VERIFY_EQUAL(fwrite(s, 1, sz, f), sz);
+	fclose(f);
+	free(s);
+	++state->calls;
+	if (pthread_equal(pthread_self(), g_main_thread))
+	{
+		++state->on_main_thread;
+	}
+	return state->ret;
+}
+
+static void test_rotate_compress()
+{
+	compress_state state = {0, 0, 0};
+	const zf_log_rotation rotation = {1024, 0, 3, copy_compress, &state, ".z"};
+	zf_log_file *const f = open_rotating(256, 60000, &rotation);
+	for (unsigned i = 0; 100 > i; ++i)
+	{
+		ZF_LOGI("line %u", i);
+	}
+	close_file(f);
+	TEST_VERIFY_GREATER_OR_EQUAL(state.calls, 3);
+	TEST_VERIFY_EQUAL(state.on_main_thread, 0);
+	for (unsigned gen = 1; 3 >= gen; ++gen)
+	{
+		TEST_VERIFY_TRUE(file_exists(gen_path(gen, ".z")));
+		TEST_VERIFY_TRUE(!file_exists(gen_path(gen, "")));
+	}
+	TEST_VERIFY_TRUE(!file_exists(gen_path(4, ".z")));
+}
+
+static void test_rotate_compress_failure()
+{
+	compress_state state = {0, 0, -1};
+	const zf_log_rotation rotation = {1024, 0, 2, copy_compress, &state, ".z"};
+	zf_log_file *const f = open_rotating(256, 60000, &rotation);
+	for (unsigned i = 0; 100 > i; ++i)
+	{
+		ZF_LOGI("line %u", i);
+	}
+	close_file(f);
+	TEST_VERIFY_GREATER_OR_EQUAL(state.calls, 2);
+	/* Kept uncompressed, partial output is removed. */
+	TEST_VERIFY_TRUE(file_exists(gen_path(1, "")));
+	TEST_VERIFY_TRUE(file_exists(gen_path(2, "")));
+	TEST_VERIFY_TRUE(!file_exists(gen_path(1, ".z")));
+	TEST_VERIFY_TRUE(!file_exists(gen_path(3, "")));
+}
+
+static void test_rotate_leftover()
+{
+	/* Pending file left by previous process is neither overwritten nor lost.
+	 */
+	char pending[1024 + 32];
+	snprintf(pending, sizeof(pending), "%s.rotated.0", g_path);
+	FILE *const p = fopen(pending, "wb");
+	TEST_VERIFY_TRUE(0 != p);
+	fputs("leftover\n", p);
+	fclose(p);
+	const zf_log_rotation rotation = {1024, 0, 2, 0, 0, 0};
+	zf_log_file *const f = open_rotating(256, 60000, &rotation);
+	for (unsigned i = 0; 30 > i; ++i)
+	{
+		ZF_LOGI("line %u", i);
+	}
+	close_file(f);
+	TEST_VERIFY_TRUE(!file_exists(pending));
+	unsigned first, last;
+	line_range(gen_path(1, ""), &first, &last);
+	TEST_VERIFY_EQUAL(first, 0);
+	size_t sz;
+	char *const s = file_read_from(gen_path(2, ""), &sz);
+	TEST_VERIFY_EQUAL(strcmp(s, "leftover\n"), 0);
+	free(s);
+	TEST_VERIFY_TRUE(!file_exists(gen_path(3, "")));
+}
+
+static void test_rotate_period()
+{
+	const time_t now = time(0);
+	const time_t next = file_next_boundary(now, 3600);
+	TEST_VERIFY_TRUE(now < next && now + 3600 >= next);
+
+	const zf_log_rotation rotation = {0, 3600, 1, 0, 0, 0};
+	zf_log_file *const f = open_rotating(0, 60000, &rotation);
+	ZF_LOGI("line 0");
+	/* Pretend that boundary was crossed. */
+	f->rotate_at = time(0);
+	ZF_LOGI("line 1");
+	close_file(f);
+	unsigned first, last;
+	line_range(gen_path(1, ""), &first, &last);
+	TEST_VERIFY_EQUAL(first, 0);
+	TEST_VERIFY_EQUAL(last, 0);
+	line_range(g_path, &first, &last);
+	TEST_VERIFY_EQUAL(first, 1);
+	TEST_VERIFY_EQUAL(last, 1);
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	g_main_thread = pthread_self();
+	snprintf(g_path, sizeof(g_path), "%s.log", argv[0]);
+
+	TEST_EXECUTE(test_buffer_full());
+	TEST_EXECUTE(test_fatal());
+	TEST_EXECUTE(test_deadline());
+	TEST_EXECUTE(test_close());
+	TEST_EXECUTE(test_threads());
+	TEST_EXECUTE(test_rotate_size());
+	TEST_EXECUTE(test_rotate_compress());
+	TEST_EXECUTE(test_rotate_compress_failure());
+	TEST_EXECUTE(test_rotate_leftover());
+	TEST_EXECUTE(test_rotate_period());
+
+	remove_all();
+	return TEST_RUNNER_EXIT_CODE();
+}
@@ -0,0 +1,73 @@
+#define ZF_LOG_RECORDER
+#define ZF_LOG_RECORDER_SZ 8
+#define ZF_LOG_CAPTURE
+#define ZF_LOG_LEVEL ZF_LOG_VERBOSE
+#define ZF_LOG_OUTPUT_LEVEL g_module_output_lvl
+static int g_module_output_lvl;
+#include <zf_log.c>
+#include <zf_test.h>
+#include <string.h>
+
+static unsigned g_lines;
+static char g_last[ZF_LOG_BUF_SZ];
+
+static void output_callback(const zf_log_message *msg, void *arg)
+{
+	(void)arg;
+	const size_t len = (size_t)(msg->p - msg->msg_b);
+	memcpy(g_last, msg->msg_b, len);
+	g_last[len] = 0;
+	++g_lines;
+}
+
+static unsigned g_dumped;
+static char g_dump_last[ZF_LOG_BUF_SZ];
+
+static void dump_callback(const zf_log_message *msg, void *arg)
+{
+	(void)arg;
+	const size_t len = (size_t)(msg->p - msg->msg_b);
+	memcpy(g_dump_last, msg->msg_b, len);
+	g_dump_last[len] = 0;
+	++g_dumped;
+}
+
+static const zf_log_output c_dump_output =
+{
+	ZF_LOG_PUT_STD, 0, dump_callback
+};
+
+/* Module with its own "output" log level keeps it when "capture" log level
+ * is set, even below global "output" log level.
+ */
+static void test_module_output_level()
+{
+	g_module_output_lvl = ZF_LOG_DEBUG;
+	zf_log_set_output_level(ZF_LOG_WARN);
+	ZF_LOGD("debug");
+	TEST_VERIFY_EQUAL(g_lines, 1);
+	zf_log_set_capture_level(ZF_LOG_VERBOSE);
+	TEST_VERIFY_EQUAL(_zf_log_global_output_lvl, ZF_LOG_WARN);
+	ZF_LOGD("debug");
+	TEST_VERIFY_EQUAL(g_lines, 2);
+	ZF_LOGV("verbose");
+	TEST_VERIFY_EQUAL(g_lines, 2);
+	TEST_VERIFY_EQUAL(strcmp(g_last, "debug"), 0);
+	zf_log_recorder_dump(&c_dump_output);
+	TEST_VERIFY_EQUAL(g_dumped, 2);
+	TEST_VERIFY_EQUAL(strcmp(g_dump_last, "verbose"), 0);
+	zf_log_set_capture_level(ZF_LOG_NONE);
+	ZF_LOGV("verbose");
+	TEST_VERIFY_EQUAL(g_lines, 2);
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, output_callback);
+
+	TEST_EXECUTE(test_module_output_level());
+
+	return TEST_RUNNER_EXIT_CODE();
+}
@@ -12,5 +12,6 @@ int main(int argc, char *argv[])
 	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, mock_output_callback);
 	ZF_LOGI("log from cpp, argc=%i", argc);
 	ZF_LOGI_MEM(argv, argc * sizeof(*argv), "log from cpp, argv pointers:");
+	ZF_LOGI_EVERY_N(2, "log from cpp, every second time");
 	return 0;
 }
@@ -0,0 +1,187 @@
+#define ZF_LOG_CRASH_HANDLER
+#define ZF_LOG_ASYNC
+#define ZF_LOG_BUFFERED_FILE
+#define ZF_LOG_RECORDER
+#define ZF_LOG_CAPTURE
+#define ZF_LOG_LEVEL ZF_LOG_DEBUG
+#define ZF_LOG_TAG "TAG"
+#include <zf_log.c>
+#include <zf_test.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+
+static char g_path[1024];
+
+static size_t read_all(const int fd, char *const buf, const size_t sz)
+{
+	size_t n = 0;
+	ssize_t r;
+	while (sz - 1 > n && 0 < (r = read(fd, buf + n, sz - 1 - n)))
+	{
+		n += (size_t)r;
+	}
+	buf[n] = 0;
+	return n;
+}
+
+static void test_signal_safe_write()
+{
+	int fds[2];
+	char buf[256], expected[64];
+	TEST_VERIFY_EQUAL(pipe(fds), 0);
+	TEST_VERIFY_EQUAL(zf_log_crash_handler_install(fds[1]), 0);
+	zf_log_write_signal_safe(ZF_LOG_WARN, "TAG", "hello");
+	zf_log_set_tag_prefix("prefix");
+	zf_log_write_signal_safe(ZF_LOG_ERROR, 0, "world");
+	zf_log_set_tag_prefix(0);
+	zf_log_crash_handler_remove();
+	close(fds[1]);
+	read_all(fds[0], buf, sizeof(buf));
+	close(fds[0]);
+
+	char *const second = strchr(buf, '\n') + 1;
+	second[-1] = 0;
+	unsigned long long sec;
+	unsigned msec, pid;
+	TEST_VERIFY_EQUAL(sscanf(buf, "%llu.%u %u", &sec, &msec, &pid), 3);
+	TEST_VERIFY_TRUE(1482496440ull < sec);
+	TEST_VERIFY_TRUE(1000 > msec);
+	TEST_VERIFY_EQUAL(pid, (unsigned)getpid());
+	strcpy(expected, " W TAG hello");
+	TEST_VERIFY_EQUAL(strcmp(buf + strlen(buf) - strlen(expected), expected), 0);
+	strcpy(expected, " E prefix world\n");
+	TEST_VERIFY_EQUAL(strcmp(second + strlen(second) - strlen(expected), expected), 0);
+}
+
+static int alt_stack_on(void)
+{
+	stack_t ss;
+	return 0 == sigaltstack(0, &ss) && 0 == (SS_DISABLE & ss.ss_flags);
+}
+
+static void *remove_thread(void *arg)
+{
+	(void)arg;
+	zf_log_crash_handler_remove();
+	return 0;
+}
+
+static void *thread_install_thread(void *arg)
+{
+	*(int *)arg = !alt_stack_on() &&
+			0 == zf_log_crash_handler_thread_install() && alt_stack_on();
+	return 0;
+}
+
+static void test_alt_stack()
+{
+	pthread_t thread;
+	TEST_VERIFY_EQUAL(zf_log_crash_handler_install(-1), 0);
+	TEST_VERIFY_TRUE(alt_stack_on());
+	void *const sp = g_crash_thread_stack;
+	/* Stack of this thread stays registered and allocated. */
+	TEST_VERIFY_EQUAL(pthread_create(&thread, 0, remove_thread, 0), 0);
+	TEST_VERIFY_EQUAL(pthread_join(thread, 0), 0);
+	TEST_VERIFY_TRUE(alt_stack_on());
+	TEST_VERIFY_TRUE(sp == g_crash_thread_stack);
+
+	int ok = 0;
+	TEST_VERIFY_EQUAL(pthread_create(&thread, 0, thread_install_thread, &ok), 0);
+	TEST_VERIFY_EQUAL(pthread_join(thread, 0), 0);
+	TEST_VERIFY_TRUE(ok);
+
+	TEST_VERIFY_EQUAL(zf_log_crash_handler_install(-1), 0);
+	zf_log_crash_handler_remove();
+	TEST_VERIFY_FALSE(alt_stack_on());
+	TEST_VERIFY_TRUE(0 == g_crash_thread_stack);
+}
+
+static int g_blocked;
+
+static void blocking_output_callback(const zf_log_message *msg, void *arg)
+{
+	(void)msg;
+	(void)arg;
+	__atomic_store_n(&g_blocked, 1, __ATOMIC_RELEASE);
+	for (;;)
+	{
+		pause();
+	}
+}
+
+static void crash(const int fd)
+{
+	static const zf_log_output blocking_output =
+	{
+		ZF_LOG_PUT_STD, 0, blocking_output_callback
+	};
+	zf_log_set_output_level(ZF_LOG_INFO);
+	zf_log_set_capture_level(ZF_LOG_DEBUG);
+	ZF_LOGD("recorded");
+	zf_log_file *const f = zf_log_file_open(g_path, 0, 60000);
+	zf_log_set_output_v(ZF_LOG_OUT_FILE(f));
+	ZF_LOGI("buffered");
+	zf_log_async_start(0);
+	zf_log_set_output_v(ZF_LOG_OUT_ASYNC(&blocking_output));
+	ZF_LOGI("blocks consumer");
+	while (!__atomic_load_n(&g_blocked, __ATOMIC_ACQUIRE))
+	{
+		sched_yield();
+	}
+	ZF_LOGI("queued");
+	zf_log_crash_handler_install(fd);
+	abort();
+}
+
+static void test_crash()
+{
+	int fds[2];
+	static char buf[64 * 1024];
+	remove(g_path);
+	TEST_VERIFY_EQUAL(pipe(fds), 0);
+	const pid_t pid = fork();
+	if (0 == pid)
+	{
+		close(fds[0]);
+		crash(fds[1]);
+	}
+	close(fds[1]);
+	read_all(fds[0], buf, sizeof(buf));
+	close(fds[0]);
+	int status;
+	TEST_VERIFY_EQUAL(waitpid(pid, &status, 0), pid);
+	TEST_VERIFY_TRUE(WIFSIGNALED(status));
+	TEST_VERIFY_EQUAL(WTERMSIG(status), SIGABRT);
+
+	char expected[64];
+	snprintf(expected, sizeof(expected), " F Crashed with signal %i\n", SIGABRT);
+	TEST_VERIFY_TRUE(0 != strstr(buf, expected));
+	/* Pending line of the asynchronous output goes first. */
+	const char *const queued = strstr(buf, " TAG queued\n");
+	const char *const recorded = strstr(buf, " TAG recorded\n");
+	TEST_VERIFY_TRUE(0 != queued);
+	TEST_VERIFY_TRUE(0 != recorded);
+	TEST_VERIFY_TRUE(queued < recorded);
+
+	FILE *const f = fopen(g_path, "rb");
+	TEST_VERIFY_TRUE(0 != f);
+	const size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[n] = 0;
+	TEST_VERIFY_TRUE(0 != strstr(buf, " TAG buffered\n"));
+	remove(g_path);
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	snprintf(g_path, sizeof(g_path), "%s.log", argv[0]);
+
+	TEST_EXECUTE(test_signal_safe_write());
+	TEST_EXECUTE(test_alt_stack());
+	TEST_EXECUTE(test_crash());
+
+	return TEST_RUNNER_EXIT_CODE();
+}
@@ -0,0 +1,104 @@
+#define ZF_LOG_INSTRUMENTED 1
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#define ZF_LOG_TAG "TAG"
+#include <zf_log.c>
+#include <zf_test.h>
+#include <stdio.h>
+#include <string.h>
+
+static char g_line[ZF_LOG_BUF_SZ];
+static unsigned g_minute;
+static unsigned g_second;
+static unsigned g_msec;
+
+static void mock_time_callback(struct tm *const tm, time_t *const sec,
+							   unsigned *const nsec)
+{
+	memset(tm, 0, sizeof(*tm));
+	tm->tm_sec = (int)g_second;
+	tm->tm_min = (int)g_minute;
+	tm->tm_hour = 12;
+	tm->tm_mday = 23;
+	tm->tm_mon = 11;
+	tm->tm_year = 2016 - 1900;
+	*sec = 1482496440 + 60 * (g_minute - 34) + g_second;
+	*nsec = g_msec * 1000000;
+}
+
+static void mock_pid_callback(int *const pid, int *const tid)
+{
+	*pid = 9876;
+	*tid = 5432;
+}
+
+static void line_output_callback(const zf_log_message *msg, void *arg)
+{
+	(void)arg;
+	const size_t len = (size_t)(msg->p - msg->buf);
+	memcpy(g_line, msg->buf, len);
+	g_line[len] = 0;
+}
+
+static void verify_line(const unsigned minute, const unsigned second,
+						const unsigned msec, const int lvl)
+{
+	char expected[ZF_LOG_BUF_SZ];
+	g_minute = minute;
+	g_second = second;
+	g_msec = msec;
+	if (ZF_LOG_WARN == lvl)
+	{
+		ZF_LOGW("message");
+	}
+	else
+	{
+		ZF_LOGI("message");
+	}
+	snprintf(expected, sizeof(expected),
+			 "12-23 12:%02u:%02u.%03u  9876  5432 %c TAG message",
+			 minute, second, msec, ZF_LOG_WARN == lvl? 'W': 'I');
+	TEST_VERIFY_TRUE_MSG(0 == strcmp(expected, g_line),
+						 "\"%s\" != \"%s\"", expected, g_line);
+}
+
+static void test_second_change()
+{
+	verify_line(34, 56, 1, ZF_LOG_INFO);
+	verify_line(34, 56, 2, ZF_LOG_WARN);
+	verify_line(34, 57, 3, ZF_LOG_INFO);
+	verify_line(35, 57, 4, ZF_LOG_INFO);
+	verify_line(34, 56, 999, ZF_LOG_WARN);
+}
+
+static void *thread_line(void *arg)
+{
+	(void)arg;
+	verify_line(34, 58, 5, ZF_LOG_INFO);
+	return 0;
+}
+
+static void test_threads()
+{
+	pthread_t thread;
+	verify_line(34, 56, 1, ZF_LOG_INFO);
+	pthread_create(&thread, 0, thread_line, 0);
+	pthread_join(thread, 0);
+	verify_line(34, 58, 6, ZF_LOG_INFO);
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	g_time_cb = mock_time_callback;
+	g_pid_cb = mock_pid_callback;
+	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, line_output_callback);
+
+#ifdef CTX_CACHE
+	TEST_VERIFY_EQUAL(CTX_PREFIX_FIELDS, 10);
+#endif
+	TEST_EXECUTE(test_second_change());
+	TEST_EXECUTE(test_threads());
+
+	return TEST_RUNNER_EXIT_CODE();
+}
@@ -0,0 +1,157 @@
+#define ZF_LOG_DEDUP
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#define ZF_LOG_TAG "TAG"
+#include <zf_log.c>
+#include <zf_test.h>
+#include <stdio.h>
+#include <string.h>
+
+enum { MAX_LINES = 16 };
+
+static char g_lines[MAX_LINES][ZF_LOG_BUF_SZ];
+static char g_tags[MAX_LINES][ZF_LOG_BUF_SZ];
+static unsigned g_n;
+
+static void mock_output_callback(const zf_log_message *msg, void *arg)
+{
+	(void)arg;
+	if (MAX_LINES == g_n)
+	{
+		return;
+	}
+	const size_t len = (size_t)(msg->p - msg->msg_b);
+	memcpy(g_lines[g_n], msg->msg_b, len);
+	g_lines[g_n][len] = 0;
+	strcpy(g_tags[g_n], 0 != msg->tag? msg->tag: "");
+	++g_n;
+}
+
+static const zf_log_output c_mock_output =
+{
+	ZF_LOG_PUT_STD, 0, mock_output_callback
+};
+
+static void verify_lines(const char *const *const lines, const unsigned n)
+{
+	TEST_VERIFY_EQUAL(g_n, n);
+	for (unsigned i = 0; n > i && g_n > i; ++i)
+	{
+		TEST_VERIFY_TRUE_MSG(0 == strcmp(lines[i], g_lines[i]),
+							 "\"%s\" != \"%s\"", lines[i], g_lines[i]);
+	}
+	g_n = 0;
+}
+
+static void test_collapse()
+{
+	zf_log_dedup *const d = zf_log_dedup_open(&c_mock_output, 0);
+	TEST_VERIFY_TRUE(0 != d);
+	zf_log_set_output_v(ZF_LOG_OUT_DEDUP(d));
+	for (unsigned i = 0; 5 > i; ++i)
+	{
+		ZF_LOGW("retry %i", 1);
+	}
+	ZF_LOGW("done");
+	ZF_LOGW("retry 1");
+	ZF_LOGW("retry 1");
+	ZF_LOGW("done");
+	static const char *const lines[] =
+	{
+		"retry 1",
+		"last message repeated 4 times",
+		"done",
+		"retry 1",
+		"last message repeated 1 time",
+		"done",
+	};
+	verify_lines(lines, _countof(lines));
+	TEST_VERIFY_EQUAL(strcmp(g_tags[1], "TAG"), 0);
+	zf_log_set_output_v(ZF_LOG_OUT_STDERR);
+	zf_log_dedup_close(d);
+	TEST_VERIFY_EQUAL(g_n, 0);
+}
+
+static void test_key()
+{
+	zf_log_dedup *const d = zf_log_dedup_open(&c_mock_output, 0);
+	zf_log_set_output_v(ZF_LOG_OUT_DEDUP(d));
+	/* Level and tag are part of the key. */
+	ZF_LOGW("msg");
+	ZF_LOGE("msg");
+	ZF_LOG_WRITE(ZF_LOG_ERROR, "OTHER", "msg");
+	ZF_LOG_WRITE(ZF_LOG_ERROR, 0, "msg");
+	ZF_LOG_WRITE(ZF_LOG_ERROR, 0, "msg");
+	/* FATAL lines are never held. */
+	ZF_LOGF("msg");
+	ZF_LOGF("msg");
+	static const char *const lines[] =
+	{
+		"msg",
+		"msg",
+		"msg",
+		"msg",
+		"last message repeated 1 time",
+		"msg",
+		"msg",
+	};
+	verify_lines(lines, _countof(lines));
+	TEST_VERIFY_EQUAL(strcmp(g_tags[2], "OTHER"), 0);
+	TEST_VERIFY_EQUAL(strcmp(g_tags[4], ""), 0);
+	zf_log_set_output_v(ZF_LOG_OUT_STDERR);
+	zf_log_dedup_close(d);
+}
+
+static void test_flush()
+{
+	zf_log_dedup *const d = zf_log_dedup_open(&c_mock_output, 0);
+	zf_log_set_output_v(ZF_LOG_OUT_DEDUP(d));
+	ZF_LOGI("msg");
+	zf_log_dedup_flush(d);
+	ZF_LOGI("msg");
+	ZF_LOGI("msg");
+	zf_log_dedup_flush(d);
+	/* Run continues after flush. */
+	ZF_LOGI("msg");
+	zf_log_set_output_v(ZF_LOG_OUT_STDERR);
+	zf_log_dedup_close(d);
+	static const char *const lines[] =
+	{
+		"msg",
+		"last message repeated 2 times",
+		"last message repeated 1 time",
+	};
+	verify_lines(lines, _countof(lines));
+}
+
+static void test_timeout()
+{
+	zf_log_dedup *const d = zf_log_dedup_open(&c_mock_output, 50);
+	zf_log_set_output_v(ZF_LOG_OUT_DEDUP(d));
+	const struct timespec ts = {0, 60 * 1000000};
+	ZF_LOGI("msg");
+	ZF_LOGI("msg");
+	nanosleep(&ts, 0);
+	ZF_LOGI("msg");
+	ZF_LOGI("msg");
+	zf_log_set_output_v(ZF_LOG_OUT_STDERR);
+	zf_log_dedup_close(d);
+	static const char *const lines[] =
+	{
+		"msg",
+		"last message repeated 2 times",
+		"last message repeated 1 time",
+	};
+	verify_lines(lines, _countof(lines));
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	TEST_EXECUTE(test_collapse());
+	TEST_EXECUTE(test_key());
+	TEST_EXECUTE(test_flush());
+	TEST_EXECUTE(test_timeout());
+
+	return TEST_RUNNER_EXIT_CODE();
+}
@@ -0,0 +1,218 @@
+#define ZF_LOG_DEFERRED
+#define ZF_LOG_INSTRUMENTED 1
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#define ZF_LOG_TAG "TAG"
+#include <zf_log.c>
+#include <zf_test.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+#define MAX_LINES 8
+static char g_lines[MAX_LINES][ZF_LOG_BUF_SZ];
+static size_t g_line;
+static char g_record[ZF_LOG_BUF_SZ];
+static unsigned g_record_sz;
+
+static void mock_time_callback(struct tm *const tm, time_t *const sec,
+							   unsigned *const nsec)
+{
+	memset(tm, 0, sizeof(*tm));
+	tm->tm_sec = 56;
+	tm->tm_min = 34;
+	tm->tm_hour = 12;
+	tm->tm_mday = 23;
+	tm->tm_mon = 11;
+	tm->tm_year = 2016 - 1900;
+	*sec = 1482496496; /* 2016-12-23 12:34:56 UTC */
+	*nsec = 789012345;
+}
+
+static void mock_pid_callback(int *const pid, int *const tid)
+{
+	*pid = 9876;
+	*tid = 5432;
+}
+
+static void line_output_callback(const zf_log_message *msg, void *arg)
+{
+	(void)arg;
+	if (MAX_LINES <= g_line)
+	{
+		fprintf(stderr, "too many lines produced\n");
+		exit(1);
+	}
+	const size_t len = (size_t)(msg->p - msg->buf);
+	memcpy(g_lines[g_line], msg->buf, len);
+	g_lines[g_line++][len] = 0;
+}
+
+static void record_output_callback(const zf_log_message *msg, void *arg)
+{
+	(void)arg;
+	g_record_sz = (unsigned)(msg->p - msg->buf);
+	memcpy(g_record, msg->buf, g_record_sz);
+}
+
+static const zf_log_output g_line_output =
+{
+	ZF_LOG_PUT_STD, 0, line_output_callback
+};
+static const zf_log_output g_deferred_output =
+{
+	ZF_LOG_OUT_DEFERRED(&g_line_output)
+};
+static const zf_log_output g_record_output =
+{
+	ZF_LOG_PUT_DEFERRED, 0, record_output_callback
+};
+static const zf_log_spec g_direct_spec =
+{
+	ZF_LOG_GLOBAL_FORMAT, &g_line_output
+};
+static const zf_log_spec g_deferred_spec =
+{
+	ZF_LOG_GLOBAL_FORMAT, &g_deferred_output
+};
+
+static void reset()
+{
+	for (size_t i = 0; MAX_LINES > i; ++i)
+	{
+		g_lines[i][0] = 0;
+	}
+	g_line = 0;
+	g_record_sz = 0;
+}
+
+/* Deferred output must produce exactly the same lines as the direct one.
+ */
+#define VERIFY_DEFERRED(...) \
+	do { \
+		reset(); \
+		ZF_LOGI_AUX(&g_direct_spec, __VA_ARGS__); \
+		ZF_LOGI_AUX(&g_deferred_spec, __VA_ARGS__); \
+		TEST_VERIFY_EQUAL(g_line, 2); \
+		TEST_VERIFY_TRUE_MSG(0 == strcmp(g_lines[0], g_lines[1]), \
+							 "\"%s\" != \"%s\"", g_lines[0], g_lines[1]); \
+	} while (0)
+
+static void test_integers()
+{
+	VERIFY_DEFERRED("no arguments");
+	VERIFY_DEFERRED("%i %d %u %x %X %o", -1, 42, 42u, 0xabcu, 0xabcu, 8u);
+	VERIFY_DEFERRED("%hhi %hhu %hi %hu", 300, 300u, 70000, 70000u);
+	VERIFY_DEFERRED("%li %lu %lli %llx", -3l, 3ul, -9000000000ll, 0xffffffffffull);
+	VERIFY_DEFERRED("%zu %zx %td %jd %ju", sizeof(int), (size_t)-1,
+					(ptrdiff_t)-5, (intmax_t)-6, (uintmax_t)7);
+	VERIFY_DEFERRED("[%5i] [%-5i] [%05i] [%+i] [% i] [%#x] [%.3i]",
+					1, 2, 3, 4, 5, 6u, 7);
+	VERIFY_DEFERRED("[%*i] [%-*i] [%.*i] [%*.*i]", 6, 1, 6, 2, 4, 3, 8, 5, 4);
+	VERIFY_DEFERRED("%c%c%c %5c", 'a', 'b', 'c', 'd');
+	VERIFY_DEFERRED("100%% %i%%", 50);
+}
+
+static void test_floats()
+{
+	VERIFY_DEFERRED("%f %e %g %a", 1.5, -2.25e10, 0.000125, 1.0);
+	VERIFY_DEFERRED("%8.3f %-10.2E %G %lf", 3.14159, 2.5, 1e-10, 7.0);
+	VERIFY_DEFERRED("%Lf %.2Le", (long double)1.25, (long double)3.5e100);
+	VERIFY_DEFERRED("%*.*f", 10, 2, 3.14159);
+}
+
+static void test_strings()
+{
+	char s[] = "string";
+	const char nt[4] = {'a', 'b', 'c', 'd'};
+	VERIFY_DEFERRED("%s [%10s] [%-10s] [%.3s]", s, s, s, s);
+	VERIFY_DEFERRED("[%*s] [%.*s] [%*.*s]", 8, s, 2, s, 5, 1, s);
+	VERIFY_DEFERRED("%s", "");
+	VERIFY_DEFERRED("%p %p", (void *)s, (void *)0);
+	/* Not null terminated, but precision limits the length. */
+	VERIFY_DEFERRED("%.4s", nt);
+#if defined(__GLIBC__)
+	/* Volatile, so compiler can't see that it's null. */
+	const char *volatile n = 0;
+	VERIFY_DEFERRED("%s", n);
+#endif
+}
+
+static void test_not_deferrable()
+{
+	VERIFY_DEFERRED("%ls %lc %i", L"wide", (wint_t)L'c', 42);
+}
+
+static void test_memory()
+{
+	const char mem[] = "Here's to the crazy ones. The misfits.";
+	reset();
+	ZF_LOGI_MEM_AUX(&g_direct_spec, mem, sizeof(mem), "mem %i", 1);
+	ZF_LOGI_MEM_AUX(&g_deferred_spec, mem, sizeof(mem), "mem %i", 1);
+	TEST_VERIFY_EQUAL(g_line % 2, 0);
+	TEST_VERIFY_GREATER_OR_EQUAL(g_line, 4);
+	for (size_t i = 0, n = g_line / 2; n > i; ++i)
+	{
+		TEST_VERIFY_TRUE_MSG(0 == strcmp(g_lines[i], g_lines[n + i]),
+							 "\"%s\" != \"%s\"", g_lines[i], g_lines[n + i]);
+	}
+}
+
+static void test_render_later()
+{
+	char s[] = "before";
+	int v = 1;
+	reset();
+	zf_log_set_tag_prefix("prefix");
+	ZF_LOGI_AUX(&g_direct_spec, "%s %i", s, v);
+	zf_log_set_output_p(&g_record_output);
+	ZF_LOGI("%s %i", s, v);
+	zf_log_set_output_p(&g_line_output);
+	TEST_VERIFY_NOT_EQUAL(g_record_sz, 0);
+	TEST_VERIFY_EQUAL(g_line, 1);
+	/* Arguments are copied into the record. */
+	strcpy(s, "after");
+	v = 2;
+	zf_log_render_deferred(g_record, g_record_sz, &g_line_output);
+	TEST_VERIFY_EQUAL(g_line, 2);
+	TEST_VERIFY_TRUE_MSG(0 == strcmp(g_lines[0], g_lines[1]),
+						 "\"%s\" != \"%s\"", g_lines[0], g_lines[1]);
+	/* Truncated record is ignored. */
+	zf_log_render_deferred(g_record, sizeof(deferred_hdr) - 1, &g_line_output);
+	TEST_VERIFY_EQUAL(g_line, 2);
+	zf_log_set_tag_prefix(0);
+}
+
+static void test_mask()
+{
+	static const zf_log_output msg_only_output =
+	{
+		ZF_LOG_PUT_MSG, 0, line_output_callback
+	};
+	reset();
+	zf_log_set_output_p(&g_record_output);
+	ZF_LOGI("value=%i", 42);
+	zf_log_set_output_p(&g_line_output);
+	zf_log_render_deferred(g_record, g_record_sz, &msg_only_output);
+	TEST_VERIFY_EQUAL(g_line, 1);
+	TEST_VERIFY_EQUAL(strcmp(g_lines[0], "value=42"), 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	g_time_cb = mock_time_callback;
+	g_pid_cb = mock_pid_callback;
+	zf_log_set_output_p(&g_line_output);
+
+	TEST_EXECUTE(test_integers());
+	TEST_EXECUTE(test_floats());
+	TEST_EXECUTE(test_strings());
+	TEST_EXECUTE(test_not_deferrable());
+	TEST_EXECUTE(test_memory());
+	TEST_EXECUTE(test_render_later());
+	TEST_EXECUTE(test_mask());
+
+	return TEST_RUNNER_EXIT_CODE();
+}
@@ -0,0 +1,172 @@
+#define ZF_LOG_DYNAMIC_SITES
+#define ZF_LOG_LEVEL ZF_LOG_VERBOSE
+#define ZF_LOG_TAG "TAG"
+#include <zf_log.c>
+#include <zf_test.h>
+#include <stdio.h>
+#include <string.h>
+
+static unsigned g_lines;
+static char g_msg[ZF_LOG_BUF_SZ];
+
+static void mock_output_callback(const zf_log_message *msg, void *arg)
+{
+	(void)arg;
+	const size_t len = (size_t)(msg->p - msg->msg_b);
+	memcpy(g_msg, msg->msg_b, len);
+	g_msg[len] = 0;
+	++g_lines;
+}
+
+static unsigned g_debug_line;
+static unsigned g_info_line;
+
+static unsigned log_debug()
+{
+	const unsigned n = g_lines;
+	g_debug_line = __LINE__ + 1;
+	ZF_LOGD("debug");
+	return g_lines - n;
+}
+
+static unsigned log_info()
+{
+	const unsigned n = g_lines;
+	g_info_line = __LINE__ + 1;
+	ZF_LOGI("info");
+	return g_lines - n;
+}
+
+static unsigned log_lvl(const int lvl)
+{
+	const unsigned n = g_lines;
+	ZF_LOG_WRITE(lvl, "LVL", "lvl");
+	return g_lines - n;
+}
+
+static const zf_log_dynamic_site *g_found;
+
+static void find_debug_site(const zf_log_dynamic_site *const site, void *arg)
+{
+	(void)arg;
+	if (g_debug_line == site->src.line)
+	{
+		g_found = site;
+	}
+}
+
+static void test_output_level()
+{
+	zf_log_set_output_level(ZF_LOG_INFO);
+	TEST_VERIFY_EQUAL(log_debug(), 0);
+	TEST_VERIFY_EQUAL(log_info(), 1);
+	TEST_VERIFY_EQUAL(log_lvl(ZF_LOG_DEBUG), 0);
+	TEST_VERIFY_EQUAL(log_lvl(ZF_LOG_WARN), 1);
+	zf_log_set_output_level(ZF_LOG_DEBUG);
+	TEST_VERIFY_EQUAL(log_debug(), 1);
+	TEST_VERIFY_EQUAL(log_lvl(ZF_LOG_DEBUG), 1);
+	zf_log_set_output_level(ZF_LOG_INFO);
+	TEST_VERIFY_EQUAL(log_debug(), 0);
+}
+
+static void test_tag_level()
+{
+	zf_log_set_output_level(ZF_LOG_INFO);
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level("TAG", ZF_LOG_DEBUG), 0);
+	TEST_VERIFY_EQUAL(log_debug(), 1);
+	TEST_VERIFY_EQUAL(log_lvl(ZF_LOG_DEBUG), 0);
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level("LVL", ZF_LOG_DEBUG), 0);
+	TEST_VERIFY_EQUAL(log_lvl(ZF_LOG_DEBUG), 1);
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level("TAG", ZF_LOG_ERROR), 0);
+	TEST_VERIFY_EQUAL(log_info(), 0);
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level("TAG", 0), 0);
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level("LVL", 0), 0);
+	TEST_VERIFY_EQUAL(log_debug(), 0);
+	TEST_VERIFY_EQUAL(log_info(), 1);
+	TEST_VERIFY_EQUAL(log_lvl(ZF_LOG_DEBUG), 0);
+}
+
+static void test_enum()
+{
+	const unsigned n = zf_log_enum_sites(find_debug_site, 0);
+	TEST_VERIFY_GREATER_OR_EQUAL(n, 3);
+	TEST_VERIFY_TRUE(0 != g_found);
+	TEST_VERIFY_EQUAL(strcmp(g_found->src.file, "test_dynamic_sites.c"), 0);
+	TEST_VERIFY_EQUAL(strcmp(g_found->tag, "TAG"), 0);
+	TEST_VERIFY_EQUAL(g_found->lvl, ZF_LOG_DEBUG);
+#if ZF_LOG_SRCLOC_SHORT != _ZF_LOG_SRCLOC
+	TEST_VERIFY_EQUAL(strcmp(g_found->src.func, "log_debug"), 0);
+#endif
+	/* Disabled statement is a single flag check. */
+	zf_log_set_output_level(ZF_LOG_INFO);
+	TEST_VERIFY_EQUAL(g_found->on, 0);
+}
+
+static void test_set_sites()
+{
+	char pattern[64];
+	zf_log_set_output_level(ZF_LOG_INFO);
+	snprintf(pattern, sizeof(pattern), "line=%u", g_debug_line);
+	TEST_VERIFY_EQUAL(zf_log_set_sites(pattern, ZF_LOG_SITE_ON), 1);
+	TEST_VERIFY_EQUAL(log_debug(), 1);
+	TEST_VERIFY_EQUAL(strcmp(g_msg, "debug"), 0);
+	TEST_VERIFY_EQUAL(log_lvl(ZF_LOG_DEBUG), 0);
+	/* Level change doesn't affect statements with explicit mode. */
+	zf_log_set_output_level(ZF_LOG_ERROR);
+	TEST_VERIFY_EQUAL(log_debug(), 1);
+	zf_log_set_output_level(ZF_LOG_INFO);
+	TEST_VERIFY_EQUAL(zf_log_set_sites(pattern, ZF_LOG_SITE_DEFAULT), 1);
+	TEST_VERIFY_EQUAL(log_debug(), 0);
+
+#if ZF_LOG_SRCLOC_SHORT != _ZF_LOG_SRCLOC
+	snprintf(pattern, sizeof(pattern), "func=log_info");
+#else
+	snprintf(pattern, sizeof(pattern), "func= line=%u", g_info_line);
+#endif
+	TEST_VERIFY_EQUAL(zf_log_set_sites(pattern, ZF_LOG_SITE_OFF), 1);
+	TEST_VERIFY_EQUAL(log_info(), 0);
+	TEST_VERIFY_EQUAL(zf_log_set_sites(pattern, ZF_LOG_SITE_DEFAULT), 1);
+	TEST_VERIFY_EQUAL(log_info(), 1);
+
+	TEST_VERIFY_EQUAL(zf_log_set_sites("tag=L?L", ZF_LOG_SITE_OFF), 1);
+	TEST_VERIFY_EQUAL(log_lvl(ZF_LOG_ERROR), 0);
+	TEST_VERIFY_EQUAL(zf_log_set_sites("tag=L*", ZF_LOG_SITE_DEFAULT), 1);
+	TEST_VERIFY_EQUAL(log_lvl(ZF_LOG_ERROR), 1);
+}
+
+static void test_pattern()
+{
+	const int n = (int)zf_log_enum_sites(find_debug_site, 0);
+	char pattern[64];
+	TEST_VERIFY_EQUAL(zf_log_set_sites("", ZF_LOG_SITE_DEFAULT), n);
+	TEST_VERIFY_EQUAL(zf_log_set_sites(0, ZF_LOG_SITE_DEFAULT), n);
+	TEST_VERIFY_EQUAL(zf_log_set_sites("file=*.c", ZF_LOG_SITE_DEFAULT), n);
+	TEST_VERIFY_EQUAL(zf_log_set_sites("file=test_dynamic_*", ZF_LOG_SITE_DEFAULT), n);
+	TEST_VERIFY_EQUAL(zf_log_set_sites("file=*.h", ZF_LOG_SITE_DEFAULT), 0);
+	TEST_VERIFY_EQUAL(zf_log_set_sites("  tag=TAG  file=*  ", ZF_LOG_SITE_DEFAULT), 2);
+	snprintf(pattern, sizeof(pattern), "line=%u-%u", g_debug_line, g_info_line);
+	TEST_VERIFY_EQUAL(zf_log_set_sites(pattern, ZF_LOG_SITE_DEFAULT), 2);
+	TEST_VERIFY_EQUAL(zf_log_set_sites("line=1-2", ZF_LOG_SITE_DEFAULT), 0);
+
+	TEST_VERIFY_EQUAL(zf_log_set_sites("file", ZF_LOG_SITE_ON), -1);
+	TEST_VERIFY_EQUAL(zf_log_set_sites("name=x", ZF_LOG_SITE_ON), -1);
+	TEST_VERIFY_EQUAL(zf_log_set_sites("line=x", ZF_LOG_SITE_ON), -1);
+	TEST_VERIFY_EQUAL(zf_log_set_sites("line=1-", ZF_LOG_SITE_ON), -1);
+	TEST_VERIFY_EQUAL(zf_log_set_sites("line=", ZF_LOG_SITE_ON), -1);
+	TEST_VERIFY_EQUAL(zf_log_set_sites("", 3), -1);
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, mock_output_callback);
+
+	TEST_EXECUTE(test_output_level());
+	TEST_EXECUTE(test_tag_level());
+	TEST_EXECUTE(test_enum());
+	TEST_EXECUTE(test_set_sites());
+	TEST_EXECUTE(test_pattern());
+
+	return TEST_RUNNER_EXIT_CODE();
+}
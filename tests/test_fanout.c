@@ -0,0 +1,150 @@
+#define ZF_LOG_SRCLOC ZF_LOG_SRCLOC_LONG
+#define ZF_LOG_MESSAGE_CTX_FORMAT (LEVEL, S(" "))
+#define ZF_LOG_MESSAGE_SRC_FORMAT (S("@src "))
+#define ZF_LOG_MEM_WIDTH 4
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#define ZF_LOG_TAG "TAG"
+#include <zf_log.c>
+#include <zf_test.h>
+#include <string.h>
+
+typedef struct sink_calls
+{
+	unsigned n;
+	char lines[4][ZF_LOG_BUF_SZ];
+	char tags[4][ZF_LOG_BUF_SZ];
+}
+sink_calls;
+
+static sink_calls g_calls[5];
+
+/* Writes EOL and terminates the tag, as some real callbacks do, so next sink
+ * must get the line restored.
+ */
+static void mock_output_callback(const zf_log_message *msg, void *arg)
+{
+	sink_calls *const c = (sink_calls *)arg;
+	if (_countof(c->lines) == c->n)
+	{
+		return;
+	}
+	const size_t len = (size_t)(msg->p - msg->buf);
+	memcpy(c->lines[c->n], msg->buf, len);
+	c->lines[c->n][len] = 0;
+	const size_t tag_len = (size_t)(msg->tag_e - msg->tag_b);
+	memcpy(c->tags[c->n], msg->tag_b, tag_len);
+	c->tags[c->n][tag_len] = 0;
+	++c->n;
+	memcpy(msg->p, ZF_LOG_EOL, sizeof(ZF_LOG_EOL));
+	*msg->tag_e = 0;
+}
+
+static const zf_log_sink c_sinks[] =
+{
+	{ZF_LOG_VERBOSE, {ZF_LOG_PUT_CTX | ZF_LOG_PUT_SRC, g_calls + 0, mock_output_callback}},
+	{ZF_LOG_VERBOSE, {ZF_LOG_PUT_MSG, g_calls + 1, mock_output_callback}},
+	{ZF_LOG_ERROR, {ZF_LOG_PUT_STD, g_calls + 2, mock_output_callback}},
+	{ZF_LOG_INFO, {ZF_LOG_PUT_TAG | ZF_LOG_PUT_MSG, g_calls + 3, mock_output_callback}},
+	{ZF_LOG_VERBOSE, {ZF_LOG_PUT_STD, g_calls + 4, mock_output_callback}},
+};
+
+static const zf_log_fanout c_fanout = {c_sinks, _countof(c_sinks)};
+
+static void reset_calls()
+{
+	memset(g_calls, 0, sizeof(g_calls));
+}
+
+static void verify_call(const unsigned sink, const unsigned i,
+						const char *const line, const char *const tag)
+{
+	const sink_calls *const c = g_calls + sink;
+	TEST_VERIFY_TRUE_MSG(i < c->n, "sink %u: %u calls", sink, c->n);
+	TEST_VERIFY_TRUE_MSG(0 == strcmp(c->lines[i], line),
+						 "sink %u: \"%s\" != \"%s\"", sink, c->lines[i], line);
+	TEST_VERIFY_TRUE_MSG(0 == strcmp(c->tags[i], tag),
+						 "sink %u: \"%s\" != \"%s\"", sink, c->tags[i], tag);
+}
+
+static void test_mask()
+{
+	TEST_VERIFY_EQUAL(zf_log_fanout_mask(&c_fanout), ZF_LOG_PUT_STD);
+	const zf_log_sink sinks[] =
+	{
+		{0, {ZF_LOG_PUT_MSG | ZF_LOG_PUT_MEM_BATCH, 0, mock_output_callback}},
+		{0, {ZF_LOG_PUT_TAG | ZF_LOG_PUT_MSG | ZF_LOG_PUT_MEM_BATCH |
+			 ZF_LOG_PUT_MEM_OFFSET, 0, mock_output_callback}},
+	};
+	zf_log_fanout fanout = {sinks, 1};
+	TEST_VERIFY_EQUAL(zf_log_fanout_mask(&fanout),
+					  ZF_LOG_PUT_MSG | ZF_LOG_PUT_MEM_BATCH);
+	/* Sinks put different fields, so memory dump can't be batched. */
+	fanout.count = 2;
+	TEST_VERIFY_EQUAL(zf_log_fanout_mask(&fanout),
+					  ZF_LOG_PUT_TAG | ZF_LOG_PUT_MSG | ZF_LOG_PUT_MEM_OFFSET);
+	fanout.count = 0;
+	TEST_VERIFY_EQUAL(zf_log_fanout_mask(&fanout), 0);
+}
+
+static void test_views()
+{
+	zf_log_set_output_v(ZF_LOG_OUT_FANOUT(&c_fanout));
+	reset_calls();
+	ZF_LOGI("hello %i", 42);
+	ZF_LOGE("error");
+	verify_call(0, 0, "I @src ", "");
+	verify_call(1, 0, "hello 42", "");
+	verify_call(3, 0, "TAG hello 42", "TAG");
+	verify_call(4, 0, "I TAG @src hello 42", "TAG");
+	verify_call(0, 1, "E @src ", "");
+	verify_call(1, 1, "error", "");
+	verify_call(2, 0, "E TAG @src error", "TAG");
+	verify_call(3, 1, "TAG error", "TAG");
+	verify_call(4, 1, "E TAG @src error", "TAG");
+	TEST_VERIFY_EQUAL(g_calls[2].n, 1);
+}
+
+static void test_mem()
+{
+	const zf_log_sink sinks[] =
+	{
+		{0, {ZF_LOG_PUT_MSG, g_calls + 0, mock_output_callback}},
+		{0, {ZF_LOG_PUT_CTX | ZF_LOG_PUT_MSG, g_calls + 1, mock_output_callback}},
+	};
+	const zf_log_fanout fanout = {sinks, _countof(sinks)};
+	zf_log_set_output_v(ZF_LOG_OUT_FANOUT(&fanout));
+	reset_calls();
+	ZF_LOGI_MEM("abcdef", 6, "dump");
+	verify_call(0, 0, "dump", "");
+	verify_call(0, 1, "61626364  abcd", "");
+	verify_call(0, 2, "6566      ef", "");
+	verify_call(1, 0, "I dump", "");
+	verify_call(1, 1, "I 61626364  abcd", "");
+	verify_call(1, 2, "I 6566      ef", "");
+}
+
+static void test_aux()
+{
+	static const zf_log_output output = {
+		ZF_LOG_PUT_STD, (void *)&c_fanout, zf_log_out_fanout_callback
+	};
+	static const zf_log_spec spec = {ZF_LOG_GLOBAL_FORMAT, &output};
+	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, mock_output_callback);
+	reset_calls();
+	ZF_LOGW_AUX(&spec, "aux");
+	verify_call(1, 0, "aux", "");
+	verify_call(4, 0, "W TAG @src aux", "TAG");
+	TEST_VERIFY_EQUAL(g_calls[2].n, 0);
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	TEST_EXECUTE(test_mask());
+	TEST_EXECUTE(test_views());
+	TEST_EXECUTE(test_mem());
+	TEST_EXECUTE(test_aux());
+
+	return TEST_RUNNER_EXIT_CODE();
+}
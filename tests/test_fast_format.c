@@ -0,0 +1,149 @@
+#define ZF_LOG_FAST_FORMAT
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#define ZF_LOG_TAG "TAG"
+#include <zf_log.c>
+#include <zf_test.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+static char g_msg[ZF_LOG_BUF_SZ];
+static size_t g_msg_len;
+/* Hidden from compiler, so it will not complain about null arguments. */
+static const char *volatile g_null;
+
+static void mock_output_callback(const zf_log_message *msg, void *arg)
+{
+	(void)arg;
+	g_msg_len = (size_t)(msg->p - msg->msg_b);
+	memcpy(g_msg, msg->msg_b, g_msg_len);
+	g_msg[g_msg_len] = 0;
+}
+
+/* Compares with vsnprintf() output, truncated the same way line would be.
+ */
+#define VERIFY_FORMAT(...) \
+	do { \
+		char expected[4 * ZF_LOG_BUF_SZ]; \
+		snprintf(expected, sizeof(expected), __VA_ARGS__); \
+		ZF_LOGI(__VA_ARGS__); \
+		TEST_VERIFY_TRUE_MSG(0 == strncmp(expected, g_msg, g_msg_len) && \
+							 (strlen(expected) == g_msg_len || \
+							  ZF_LOG_BUF_SZ / 2 < g_msg_len), \
+							 "\"%s\" != \"%s\"", expected, g_msg); \
+	} while (0)
+
+static void test_integers()
+{
+	VERIFY_FORMAT("%d %i %u", 0, -1, 1u);
+	VERIFY_FORMAT("%d %d", INT_MIN, INT_MAX);
+	VERIFY_FORMAT("%u %x %X", UINT_MAX, 0xdeadbeefu, 0xdeadbeefu);
+	VERIFY_FORMAT("%ld %lu %lx", LONG_MIN, ULONG_MAX, ULONG_MAX);
+	VERIFY_FORMAT("%lld %llu %llx", LLONG_MIN, ULLONG_MAX, 0x123456789abcdefull);
+	VERIFY_FORMAT("%hhd %hhu %hd %hu", 300, 300, 70000, 70000);
+	VERIFY_FORMAT("%zu %td %jd %ju", (size_t)12345, (ptrdiff_t)-7,
+				  (intmax_t)-5, (uintmax_t)5);
+	VERIFY_FORMAT("[%5d] [%-5d] [%05d]", 42, 42, 42);
+	VERIFY_FORMAT("[%5d] [%-5d] [%05d]", -42, -42, -42);
+	VERIFY_FORMAT("[%*d] [%*d] [%0*x]", 6, 7, -6, 7, 8, 0xabu);
+	VERIFY_FORMAT("[%2d] [%08X]", 123456, 0xabcu);
+	for (unsigned long long v = 1; ULLONG_MAX / 7 > v; v *= 7)
+	{
+		VERIFY_FORMAT("%llu %llu", v, v - 1);
+	}
+}
+
+static void test_strings()
+{
+	VERIFY_FORMAT("%s", "");
+	VERIFY_FORMAT("a %s b %s c", "x", "yz");
+	VERIFY_FORMAT("[%10s] [%-10s] [%2s]", "str", "str", "string");
+	VERIFY_FORMAT("[%.3s] [%.10s] [%5.2s] [%-5.2s]", "string", "str", "str", "str");
+	VERIFY_FORMAT("[%.*s] [%*.*s] [%.*s]", 2, "string", -6, 3, "string", -1, "string");
+	VERIFY_FORMAT("[%c] [%3c] [%-3c]", 'a', 'b', 'c');
+	VERIFY_FORMAT("100%%");
+	VERIFY_FORMAT("%p %20p %-20p", (void *)&g_msg, (void *)&g_msg, (void *)&g_msg);
+	VERIFY_FORMAT("%p [%5p]", (const void *)g_null, (const void *)g_null);
+	VERIFY_FORMAT("%s [%8s] [%.2s]", g_null, g_null, g_null);
+}
+
+static void test_fallback()
+{
+	VERIFY_FORMAT("%d %f %s", 1, 2.5, "three");
+	VERIFY_FORMAT("%s %.3e %d %g", "one", 2.5, 3, 4.0);
+	VERIFY_FORMAT("%+d % d %#x %#o %.3d", 1, 2, 3u, 4u, 5);
+	VERIFY_FORMAT("%d %Lf", 1, (long double)2.5);
+}
+
+static void test_many_conversions()
+{
+	VERIFY_FORMAT("%d %u %x %X %c %s %p %d %u %x %s %d",
+				  -1, 2u, 3u, 4u, '5', "6", (void *)&g_msg, 8, 9u, 10u, "11", 12);
+	VERIFY_FORMAT("%d %u %x %f %c %s %d %d %u %x %s %d",
+				  -1, 2u, 3u, 4.0, '5', "6", 7, 8, 9u, 10u, "11", 12);
+	VERIFY_FORMAT("%d %s %d %s %d %s %d %s %d %s %d",
+				  1, "a", 2, "b", 3, g_null, 4, "c", 5, "d", 6);
+}
+
+static void test_truncation()
+{
+	char s[2 * ZF_LOG_BUF_SZ];
+	memset(s, 'x', sizeof(s) - 1);
+	s[sizeof(s) - 1] = 0;
+	VERIFY_FORMAT("%s", s);
+	VERIFY_FORMAT("%s %d", s, 1);
+	VERIFY_FORMAT("%1000d %s", 1, "tail");
+	VERIFY_FORMAT("%-1000s%d", "x", 1);
+	VERIFY_FORMAT("%s %f", s, 1.0);
+}
+
+#if ZF_LOG_FORMAT_CACHE
+/* Format that meets a slot which is being filled is parsed without taking
+ * another slot.
+ */
+static void test_busy_slot()
+{
+	static const char fmt[] = "%d busy %s";
+	fmt_plan *const first = g_fmt_plans + fmt_plan_index(fmt);
+	const char *const key = first->fmt;
+	first->fmt = c_fmt_plan_busy;
+	VERIFY_FORMAT(fmt, 1, "two");
+	for (unsigned i = 0; ZF_LOG_FORMAT_CACHE_SZ > i; ++i)
+	{
+		TEST_VERIFY_TRUE(fmt != g_fmt_plans[i].fmt);
+	}
+	first->fmt = key;
+	VERIFY_FORMAT(fmt, 1, "two");
+	VERIFY_FORMAT(fmt, 3, "four");
+	unsigned slots = 0;
+	for (unsigned i = 0; ZF_LOG_FORMAT_CACHE_SZ > i; ++i)
+	{
+		slots += fmt == g_fmt_plans[i].fmt;
+	}
+	TEST_VERIFY_TRUE(1 >= slots);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, mock_output_callback);
+
+	TEST_EXECUTE(test_integers());
+	TEST_EXECUTE(test_strings());
+	TEST_EXECUTE(test_fallback());
+	TEST_EXECUTE(test_many_conversions());
+	TEST_EXECUTE(test_truncation());
+#if ZF_LOG_FORMAT_CACHE
+	/* Now with parsed format strings taken from the cache. */
+	TEST_EXECUTE(test_integers());
+	TEST_EXECUTE(test_strings());
+	TEST_EXECUTE(test_fallback());
+	TEST_EXECUTE(test_many_conversions());
+	TEST_EXECUTE(test_truncation());
+	TEST_EXECUTE(test_busy_slot());
+#endif
+
+	return TEST_RUNNER_EXIT_CODE();
+}
@@ -0,0 +1,197 @@
+#define ZF_LOG_RECORDER
+#define ZF_LOG_RECORDER_SZ 8
+#define ZF_LOG_LEVEL ZF_LOG_VERBOSE
+#define ZF_LOG_TAG "TAG"
+#define ZF_LOG_TAG_LEVELS
+#define ZF_LOG_CAPTURE
+#include <zf_log.c>
+#include <zf_test.h>
+#include <stdio.h>
+#include <string.h>
+
+enum { MAX_LINES = 32 };
+
+typedef struct lines
+{
+	char text[MAX_LINES][ZF_LOG_BUF_SZ];
+	unsigned n;
+}
+lines;
+
+static lines g_output;
+static lines g_dump;
+
+static void lines_output_callback(const zf_log_message *msg, void *arg)
+{
+	lines *const l = (lines *)arg;
+	if (MAX_LINES == l->n)
+	{
+		return;
+	}
+	const size_t len = (size_t)(msg->p - msg->msg_b);
+	memcpy(l->text[l->n], msg->msg_b, len);
+	l->text[l->n][len] = 0;
+	++l->n;
+}
+
+static const zf_log_output c_dump_output =
+{
+	ZF_LOG_PUT_STD, &g_dump, lines_output_callback
+};
+
+static void verify_lines(lines *const l, const char *const *const text,
+						 const unsigned n)
+{
+	TEST_VERIFY_EQUAL(l->n, n);
+	for (unsigned i = 0; n > i && l->n > i; ++i)
+	{
+		TEST_VERIFY_TRUE_MSG(0 == strcmp(text[i], l->text[i]),
+							 "\"%s\" != \"%s\"", text[i], l->text[i]);
+	}
+	l->n = 0;
+}
+
+static void clear_recorder()
+{
+	for (unsigned i = 0; ZF_LOG_RECORDER_SZ > i; ++i)
+	{
+		ZF_LOGF("clear");
+	}
+	g_output.n = 0;
+}
+
+static void test_capture()
+{
+	zf_log_set_output_level(ZF_LOG_INFO);
+	zf_log_set_capture_level(ZF_LOG_DEBUG);
+	clear_recorder();
+	TEST_VERIFY_TRUE(ZF_LOG_ON_DEBUG);
+	TEST_VERIFY_FALSE(ZF_LOG_ON_VERBOSE);
+	ZF_LOGV("verbose");
+	ZF_LOGD("debug");
+	ZF_LOGI("info");
+	static const char *const output[] = {"info"};
+	verify_lines(&g_output, output, _countof(output));
+	g_dump.n = 0;
+	zf_log_recorder_dump(&c_dump_output);
+	TEST_VERIFY_EQUAL(g_dump.n, ZF_LOG_RECORDER_SZ);
+	g_dump.n -= 2;
+	static const char *const dump[] = {"debug", "info"};
+	TEST_VERIFY_EQUAL(strcmp(g_dump.text[g_dump.n], dump[0]), 0);
+	TEST_VERIFY_EQUAL(strcmp(g_dump.text[g_dump.n + 1], dump[1]), 0);
+	g_dump.n = 0;
+
+	/* Output level change keeps capture level. */
+	zf_log_set_output_level(ZF_LOG_WARN);
+	ZF_LOGD("debug");
+	ZF_LOGI("info");
+	TEST_VERIFY_EQUAL(g_output.n, 0);
+	zf_log_set_output_level(ZF_LOG_VERBOSE);
+	ZF_LOGV("verbose");
+	TEST_VERIFY_EQUAL(g_output.n, 1);
+	g_output.n = 0;
+}
+
+static void test_wrap()
+{
+	zf_log_set_output_level(ZF_LOG_INFO);
+	zf_log_set_capture_level(ZF_LOG_DEBUG);
+	for (unsigned i = 0; 3 * ZF_LOG_RECORDER_SZ > i; ++i)
+	{
+		ZF_LOGD("line %u", i);
+	}
+	TEST_VERIFY_EQUAL(g_output.n, 0);
+	zf_log_recorder_dump(&c_dump_output);
+	TEST_VERIFY_EQUAL(g_dump.n, ZF_LOG_RECORDER_SZ);
+	for (unsigned i = 0; ZF_LOG_RECORDER_SZ > i && g_dump.n > i; ++i)
+	{
+		char expected[32];
+		snprintf(expected, sizeof(expected), "line %u", 2 * ZF_LOG_RECORDER_SZ + i);
+		TEST_VERIFY_EQUAL(strcmp(g_dump.text[i], expected), 0);
+	}
+	g_dump.n = 0;
+}
+
+static void test_tag_level()
+{
+	zf_log_set_output_level(ZF_LOG_WARN);
+	zf_log_set_capture_level(ZF_LOG_VERBOSE);
+	clear_recorder();
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level(ZF_LOG_TAG, ZF_LOG_DEBUG), 0);
+	ZF_LOGV("verbose");
+	ZF_LOGD("debug");
+	static const char *const output[] = {"debug"};
+	verify_lines(&g_output, output, _countof(output));
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level(ZF_LOG_TAG, 0), 0);
+	ZF_LOGD("debug");
+	TEST_VERIFY_EQUAL(g_output.n, 0);
+	zf_log_recorder_dump(&c_dump_output);
+	TEST_VERIFY_EQUAL(g_dump.n, ZF_LOG_RECORDER_SZ);
+	g_dump.n -= 3;
+	TEST_VERIFY_EQUAL(strcmp(g_dump.text[g_dump.n], "verbose"), 0);
+	TEST_VERIFY_EQUAL(strcmp(g_dump.text[g_dump.n + 1], "debug"), 0);
+	TEST_VERIFY_EQUAL(strcmp(g_dump.text[g_dump.n + 2], "debug"), 0);
+	g_dump.n = 0;
+}
+
+static void test_fatal()
+{
+	zf_log_set_output_level(ZF_LOG_INFO);
+	zf_log_set_capture_level(ZF_LOG_DEBUG);
+	clear_recorder();
+	zf_log_recorder_set_fatal_output(&c_dump_output);
+	ZF_LOGD("context");
+	ZF_LOGF("fatal");
+	zf_log_recorder_set_fatal_output(0);
+	static const char *const output[] = {"fatal"};
+	verify_lines(&g_output, output, _countof(output));
+	TEST_VERIFY_EQUAL(g_dump.n, ZF_LOG_RECORDER_SZ);
+	g_dump.n -= 2;
+	TEST_VERIFY_EQUAL(strcmp(g_dump.text[g_dump.n], "context"), 0);
+	TEST_VERIFY_EQUAL(strcmp(g_dump.text[g_dump.n + 1], "fatal"), 0);
+	g_dump.n = 0;
+}
+
+static void test_off()
+{
+	zf_log_set_output_level(ZF_LOG_INFO);
+	zf_log_set_capture_level(ZF_LOG_FATAL);
+	clear_recorder();
+	zf_log_set_capture_level(ZF_LOG_NONE);
+	TEST_VERIFY_FALSE(ZF_LOG_ON_DEBUG);
+	ZF_LOGD("debug");
+	ZF_LOGI("info");
+	static const char *const output[] = {"info"};
+	verify_lines(&g_output, output, _countof(output));
+	zf_log_recorder_dump(&c_dump_output);
+	TEST_VERIFY_EQUAL(g_dump.n, ZF_LOG_RECORDER_SZ);
+	for (unsigned i = 0; g_dump.n > i; ++i)
+	{
+		TEST_VERIFY_EQUAL(strcmp(g_dump.text[i], "clear"), 0);
+	}
+	g_dump.n = 0;
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+#ifdef TEST_DEFERRED
+	/* Recorder keeps binary records and renders them when dumped. */
+	static const zf_log_output text_output =
+	{
+		ZF_LOG_PUT_STD, &g_output, lines_output_callback
+	};
+	zf_log_set_output_v(ZF_LOG_OUT_DEFERRED(&text_output));
+#else
+	zf_log_set_output_v(ZF_LOG_PUT_STD, &g_output, lines_output_callback);
+#endif
+
+	TEST_EXECUTE(test_capture());
+	TEST_EXECUTE(test_wrap());
+	TEST_EXECUTE(test_tag_level());
+	TEST_EXECUTE(test_fatal());
+	TEST_EXECUTE(test_off());
+
+	return TEST_RUNNER_EXIT_CODE();
+}
@@ -0,0 +1,220 @@
+#define ZF_LOG_LARGE_MESSAGES
+#define ZF_LOG_ASYNC
+#define ZF_LOG_MAX_LINE_SZ (16 * 1024)
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#define ZF_LOG_TAG "TAG"
+#define ZF_LOG_CUSTOM_VSNPRINTF counting_vsnprintf
+#include <stdarg.h>
+#include <stddef.h>
+static int counting_vsnprintf(char *s, size_t sz, const char *fmt, va_list va);
+#include <zf_log.c>
+#include <zf_test.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+static unsigned g_vsnprintf_calls;
+
+static int counting_vsnprintf(char *s, size_t sz, const char *fmt, va_list va)
+{
+	++g_vsnprintf_calls;
+	return vsnprintf(s, sz, fmt, va);
+}
+
+static char g_text[2 * ZF_LOG_MAX_LINE_SZ];
+static char g_msg[2 * ZF_LOG_MAX_LINE_SZ];
+static char g_tag[64];
+static size_t g_msg_len;
+static size_t g_nested_len;
+static int g_nested;
+
+static void mock_output_callback(const zf_log_message *msg, void *arg)
+{
+	(void)arg;
+	if (g_nested)
+	{
+		g_nested = 0;
+		ZF_LOGI("%s", g_text);
+		g_nested = 1;
+		g_nested_len = g_msg_len;
+	}
+	g_msg_len = (size_t)(msg->p - msg->msg_b);
+	memcpy(g_msg, msg->msg_b, g_msg_len);
+	g_msg[g_msg_len] = 0;
+	const size_t tag_len = (size_t)(msg->tag_e - msg->tag_b);
+	memcpy(g_tag, msg->tag_b, tag_len);
+	g_tag[tag_len] = 0;
+}
+
+static void set_text(const size_t len)
+{
+	for (size_t i = 0; len > i; ++i)
+	{
+		g_text[i] = (char)('a' + i % 26);
+	}
+	g_text[len] = 0;
+}
+
+static void test_short()
+{
+	ZF_LOGI("short %i", 42);
+	TEST_VERIFY_EQUAL(strcmp(g_msg, "short 42"), 0);
+}
+
+static void test_large()
+{
+	const size_t sizes[] = {ZF_LOG_BUF_SZ - 64, ZF_LOG_BUF_SZ, 3000, 10000};
+	for (unsigned i = 0; _countof(sizes) > i; ++i)
+	{
+		set_text(sizes[i]);
+		ZF_LOGI("%s", g_text);
+		TEST_VERIFY_EQUAL(g_msg_len, sizes[i]);
+		TEST_VERIFY_EQUAL(strcmp(g_msg, g_text), 0);
+		TEST_VERIFY_EQUAL(strcmp(g_tag, "TAG"), 0);
+	}
+	ZF_LOGI("%s", "short");
+	TEST_VERIFY_EQUAL(strcmp(g_msg, "short"), 0);
+}
+
+static void test_format_passes()
+{
+	/* Length of the message is taken from the first formatting. */
+	set_text(3000);
+	g_vsnprintf_calls = 0;
+	ZF_LOGI("%s", g_text);
+	TEST_VERIFY_EQUAL(g_msg_len, 3000);
+	TEST_VERIFY_TRUE(2 >= g_vsnprintf_calls);
+}
+
+static void test_ceiling()
+{
+	set_text(ZF_LOG_MAX_LINE_SZ + 100);
+	ZF_LOGI("%s", g_text);
+	TEST_VERIFY_TRUE(ZF_LOG_MAX_LINE_SZ - 256 < g_msg_len);
+	TEST_VERIFY_TRUE(ZF_LOG_MAX_LINE_SZ > g_msg_len);
+	TEST_VERIFY_EQUAL(strncmp(g_msg, g_text, g_msg_len), 0);
+}
+
+static void test_nested()
+{
+	/* Line logged from output callback can't take the buffer that is in use
+	 * and is truncated.
+	 */
+	set_text(3000);
+	g_nested = 1;
+	ZF_LOGI("%s", g_text);
+	g_nested = 0;
+	TEST_VERIFY_TRUE(ZF_LOG_BUF_SZ > g_nested_len);
+	TEST_VERIFY_EQUAL(g_msg_len, 3000);
+	TEST_VERIFY_EQUAL(strcmp(g_msg, g_text), 0);
+}
+
+static const zf_log_output g_async_output =
+{
+	ZF_LOG_PUT_STD, 0, mock_output_callback
+};
+
+static void test_async()
+{
+	/* Line that doesn't fit into the queue slot is not truncated. */
+	TEST_VERIFY_EQUAL(zf_log_async_start(0), 0);
+	zf_log_set_output_v(ZF_LOG_OUT_ASYNC(&g_async_output));
+	const size_t sizes[] = {3999, 10000, 100};
+	for (unsigned i = 0; _countof(sizes) > i; ++i)
+	{
+		set_text(sizes[i]);
+		ZF_LOGI("%s", g_text);
+		zf_log_async_flush();
+		TEST_VERIFY_EQUAL(g_msg_len, sizes[i]);
+		TEST_VERIFY_EQUAL(strcmp(g_msg, g_text), 0);
+		TEST_VERIFY_EQUAL(strcmp(g_tag, "TAG"), 0);
+	}
+	zf_log_async_stop();
+	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, mock_output_callback);
+}
+
+enum { THREADS = 4, LINES = 16, LINE_LEN = 3 * PIPE_BUF };
+
+static void *producer(void *arg)
+{
+	char text[LINE_LEN + 1];
+	memset(text, 'a' + (int)(size_t)arg, LINE_LEN);
+	text[LINE_LEN] = 0;
+	for (unsigned i = 0; LINES > i; ++i)
+	{
+		ZF_LOGI("%s", text);
+		ZF_LOGI("%c", text[0]);
+	}
+	return 0;
+}
+
+static int same_chars(const char *const s, const size_t len)
+{
+	for (size_t i = 1; len > i; ++i)
+	{
+		if (s[0] != s[i])
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void test_stderr(const char *const path)
+{
+	/* Lines longer than PIPE_BUF don't interleave with other lines. */
+	const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	TEST_VERIFY_TRUE(0 <= fd);
+	const int saved = dup(STDERR_FILENO);
+	dup2(fd, STDERR_FILENO);
+	close(fd);
+	zf_log_set_output_v(ZF_LOG_PUT_MSG, 0, zf_log_out_stderr_callback);
+	pthread_t threads[THREADS];
+	for (unsigned t = 0; THREADS > t; ++t)
+	{
+		pthread_create(threads + t, 0, producer, (void *)(size_t)t);
+	}
+	for (unsigned t = 0; THREADS > t; ++t)
+	{
+		pthread_join(threads[t], 0);
+	}
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, mock_output_callback);
+
+	static char line[2 * LINE_LEN];
+	FILE *const f = fopen(path, "r");
+	TEST_VERIFY_TRUE(0 != f);
+	unsigned long_lines = 0, short_lines = 0;
+	while (0 != fgets(line, sizeof(line), f))
+	{
+		const size_t len = strlen(line) - 1;
+		TEST_VERIFY_EQUAL(line[len], '\n');
+		TEST_VERIFY_TRUE(1 == len || LINE_LEN == len);
+		TEST_VERIFY_EQUAL(same_chars(line, len), 1);
+		LINE_LEN == len? ++long_lines: ++short_lines;
+	}
+	fclose(f);
+	remove(path);
+	TEST_VERIFY_EQUAL(long_lines, THREADS * LINES);
+	TEST_VERIFY_EQUAL(short_lines, THREADS * LINES);
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	char path[1024];
+	snprintf(path, sizeof(path), "%s.log", argv[0]);
+	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, mock_output_callback);
+
+	TEST_EXECUTE(test_short());
+	TEST_EXECUTE(test_large());
+	TEST_EXECUTE(test_format_passes());
+	TEST_EXECUTE(test_ceiling());
+	TEST_EXECUTE(test_nested());
+	TEST_EXECUTE(test_async());
+	TEST_EXECUTE(test_stderr(path));
+
+	return TEST_RUNNER_EXIT_CODE();
+}
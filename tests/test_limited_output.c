@@ -0,0 +1,168 @@
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#include <zf_log.c>
+#include <zf_test.h>
+#include <stdio.h>
+#include <string.h>
+
+static unsigned g_lines;
+static char g_msg[ZF_LOG_BUF_SZ];
+static char g_src[ZF_LOG_BUF_SZ];
+static unsigned g_args;
+
+static void mock_output_callback(const zf_log_message *msg, void *arg)
+{
+	(void)arg;
+	size_t len = (size_t)(msg->p - msg->msg_b);
+	memcpy(g_msg, msg->msg_b, len);
+	g_msg[len] = 0;
+	len = (size_t)(msg->msg_b - msg->tag_e);
+	memcpy(g_src, msg->tag_e, len);
+	g_src[len] = 0;
+	++g_lines;
+}
+
+static unsigned arg(const unsigned v)
+{
+	++g_args;
+	return v;
+}
+
+static void verify_msg(const char *const expected)
+{
+	TEST_VERIFY_TRUE_MSG(0 == strcmp(expected, g_msg),
+						 "\"%s\" != \"%s\"", expected, g_msg);
+}
+
+static void test_every_n()
+{
+	g_lines = g_args = 0;
+	for (unsigned i = 0; 10 > i; ++i)
+	{
+		ZF_LOGI_EVERY_N(3, "msg %u", arg(i));
+		if (0 == i)
+		{
+			verify_msg("msg 0");
+		}
+	}
+	TEST_VERIFY_EQUAL(g_lines, 4);
+	TEST_VERIFY_EQUAL(g_args, 4);
+	verify_msg("msg 9 (suppressed 2)");
+	g_lines = 0;
+	for (unsigned i = 0; 10 > i; ++i)
+	{
+		ZF_LOGI_EVERY_N(1, "msg");
+		ZF_LOGI_EVERY_N(0, "msg");
+	}
+	TEST_VERIFY_EQUAL(g_lines, 20);
+}
+
+static void test_first_n()
+{
+	g_lines = g_args = 0;
+	for (unsigned i = 0; 5 > i; ++i)
+	{
+		ZF_LOGI_FIRST_N(2, "msg %u", arg(i));
+	}
+	TEST_VERIFY_EQUAL(g_lines, 2);
+	TEST_VERIFY_EQUAL(g_args, 2);
+	verify_msg("msg 1");
+}
+
+static void sleep_ms(const unsigned ms)
+{
+	const struct timespec ts = {0, (long)ms * 1000000};
+	nanosleep(&ts, 0);
+}
+
+static void log_rate(const unsigned i)
+{
+	ZF_LOGI_RATE(20, 2, "msg %u", arg(i));
+}
+
+static void test_rate()
+{
+	g_lines = g_args = 0;
+	/* Burst passes, the rest is suppressed until bucket refills. */
+	for (unsigned i = 0; 5 > i; ++i)
+	{
+		log_rate(i);
+	}
+	TEST_VERIFY_EQUAL(g_lines, 2);
+	TEST_VERIFY_EQUAL(g_args, 2);
+	verify_msg("msg 1");
+	sleep_ms(60);
+	log_rate(5);
+	TEST_VERIFY_EQUAL(g_lines, 3);
+	verify_msg("msg 5 (suppressed 3)");
+	g_lines = 0;
+	for (unsigned i = 0; 5 > i; ++i)
+	{
+		ZF_LOGI_RATE(0, 10, "msg");
+	}
+	TEST_VERIFY_EQUAL(g_lines, 0);
+}
+
+static void test_sample()
+{
+	g_lines = g_args = 0;
+	for (unsigned i = 0; 4000 > i; ++i)
+	{
+		ZF_LOGI_SAMPLE(4, "msg %u", arg(i));
+	}
+	TEST_VERIFY_GREATER_OR_EQUAL(g_lines, 700);
+	TEST_VERIFY_TRUE(1300 > g_lines);
+	TEST_VERIFY_EQUAL(g_args, g_lines);
+	g_lines = 0;
+	for (unsigned i = 0; 10 > i; ++i)
+	{
+		ZF_LOGI_SAMPLE(1, "msg");
+	}
+	TEST_VERIFY_EQUAL(g_lines, 10);
+}
+
+static void log_every_2(const unsigned i)
+{
+	ZF_LOGI_EVERY_N(2, "msg %u", i);
+}
+
+static void test_turned_off()
+{
+	g_lines = 0;
+	zf_log_set_output_level(ZF_LOG_WARN);
+	for (unsigned i = 0; 5 > i; ++i)
+	{
+		log_every_2(i);
+	}
+	TEST_VERIFY_EQUAL(g_lines, 0);
+	zf_log_set_output_level(ZF_LOG_INFO);
+	log_every_2(5);
+	log_every_2(6);
+	log_every_2(7);
+	TEST_VERIFY_EQUAL(g_lines, 2);
+	verify_msg("msg 7 (suppressed 1)");
+}
+
+static void test_src()
+{
+	/* Same source location as regular statement on the same line. */
+	char expected[ZF_LOG_BUF_SZ];
+	ZF_LOGI("msg"); strcpy(expected, g_src); ZF_LOGI_FIRST_N(1, "msg");
+	TEST_VERIFY_TRUE_MSG(0 == strcmp(expected, g_src),
+						 "\"%s\" != \"%s\"", expected, g_src);
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, mock_output_callback);
+
+	TEST_EXECUTE(test_every_n());
+	TEST_EXECUTE(test_first_n());
+	TEST_EXECUTE(test_rate());
+	TEST_EXECUTE(test_sample());
+	TEST_EXECUTE(test_turned_off());
+	TEST_EXECUTE(test_src());
+
+	return TEST_RUNNER_EXIT_CODE();
+}
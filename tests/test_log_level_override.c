@@ -1,5 +1,9 @@
 #define ZF_LOG_LEVEL 0
-#define ZF_LOG_OUTPUT_LEVEL g_output_level
+#if defined(ZF_LOG_TAG_LEVELS)
+	#define ZF_LOG_TAG "net"
+#else
+	#define ZF_LOG_OUTPUT_LEVEL g_output_level
+#endif
 #include <zf_log.c>
 #include <zf_test.h>
 
@@ -14,6 +18,75 @@ static const int c_levels[] =
 	ZF_LOG_NONE,
 };
 
+#if defined(ZF_LOG_TAG_LEVELS)
+static int g_output_level = 0;
+
+static void verify_level_checks()
+{
+	TEST_VERIFY_EQUAL(!!ZF_LOG_ON_VERBOSE, g_output_level <= ZF_LOG_VERBOSE);
+	TEST_VERIFY_EQUAL(!!ZF_LOG_ON_DEBUG, g_output_level <= ZF_LOG_DEBUG);
+	TEST_VERIFY_EQUAL(!!ZF_LOG_ON_INFO, g_output_level <= ZF_LOG_INFO);
+	TEST_VERIFY_EQUAL(!!ZF_LOG_ON_WARN, g_output_level <= ZF_LOG_WARN);
+	TEST_VERIFY_EQUAL(!!ZF_LOG_ON_ERROR, g_output_level <= ZF_LOG_ERROR);
+	TEST_VERIFY_EQUAL(!!ZF_LOG_ON_FATAL, g_output_level <= ZF_LOG_FATAL);
+}
+
+static void test_level_checks()
+{
+	/* Tag without own level follows global output level. */
+	for (unsigned i = 0; _countof(c_levels) > i; ++i)
+	{
+		zf_log_set_output_level(c_levels[i]);
+		g_output_level = c_levels[i];
+		verify_level_checks();
+	}
+	for (unsigned i = 0; _countof(c_levels) > i; ++i)
+	{
+		zf_log_set_output_level(c_levels[i]);
+		for (unsigned j = 0; _countof(c_levels) > j; ++j)
+		{
+			TEST_VERIFY_EQUAL(zf_log_set_tag_level("net", c_levels[j]), 0);
+			g_output_level = c_levels[j];
+			verify_level_checks();
+		}
+		TEST_VERIFY_EQUAL(zf_log_set_tag_level("net", 0), 0);
+		g_output_level = c_levels[i];
+		verify_level_checks();
+	}
+}
+
+static void test_tag_slots()
+{
+	zf_log_set_output_level(ZF_LOG_WARN);
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level("net", ZF_LOG_DEBUG), 0);
+	/* Same slot for the same tag, other tags are not affected. */
+	TEST_VERIFY_EQUAL(_zf_log_tag_lvl_, _zf_log_tag_output_lvl("net"));
+	TEST_VERIFY_EQUAL(*_zf_log_tag_output_lvl("net"), ZF_LOG_DEBUG);
+	TEST_VERIFY_EQUAL(*_zf_log_tag_output_lvl("disk"), ZF_LOG_WARN);
+	TEST_VERIFY_EQUAL(_zf_log_tag_output_lvl(0), &_zf_log_global_output_lvl);
+	TEST_VERIFY_EQUAL(_zf_log_tag_output_lvl(""), &_zf_log_global_output_lvl);
+	zf_log_set_output_level(ZF_LOG_INFO);
+	TEST_VERIFY_EQUAL(*_zf_log_tag_output_lvl("net"), ZF_LOG_DEBUG);
+	TEST_VERIFY_EQUAL(*_zf_log_tag_output_lvl("disk"), ZF_LOG_INFO);
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level("net", 0), 0);
+	TEST_VERIFY_EQUAL(*_zf_log_tag_output_lvl("net"), ZF_LOG_INFO);
+
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level(0, ZF_LOG_DEBUG), -1);
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level("", ZF_LOG_DEBUG), -1);
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level("net", -1), -1);
+	/* When table is full, tag follows global output level. */
+	char tag[16];
+	for (unsigned i = 0; ZF_LOG_TAG_SLOTS > i; ++i)
+	{
+		snprintf(tag, sizeof(tag), "t%u", i);
+		_zf_log_tag_output_lvl(tag);
+	}
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level(tag, ZF_LOG_DEBUG), -1);
+	TEST_VERIFY_EQUAL(_zf_log_tag_output_lvl(tag), &_zf_log_global_output_lvl);
+	TEST_VERIFY_EQUAL(zf_log_set_tag_level("net", ZF_LOG_ERROR), 0);
+	TEST_VERIFY_EQUAL(*_zf_log_tag_lvl_, ZF_LOG_ERROR);
+}
+#else
 static int g_output_level = 0;
 
 static void test_level_checks()
@@ -34,12 +107,16 @@ static void test_level_checks()
 		}
 	}
 }
+#endif
 
 int main(int argc, char *argv[])
 {
 	TEST_RUNNER_CREATE(argc, argv);
 
 	TEST_EXECUTE(test_level_checks());
+#if defined(ZF_LOG_TAG_LEVELS)
+	TEST_EXECUTE(test_tag_slots());
+#endif
 
 	return TEST_RUNNER_EXIT_CODE();
 }
@@ -24,6 +24,15 @@
 #define MESSAGE_EXPECTED_PRINTF_FMT__MINUTE       "34"
 #define MESSAGE_EXPECTED_PRINTF_FMT__SECOND       "56"
 #define MESSAGE_EXPECTED_PRINTF_FMT__MILLISECOND  "789"
+#define MESSAGE_EXPECTED_PRINTF_FMT__MICROSECOND  "789012"
+#define MESSAGE_EXPECTED_PRINTF_FMT__NANOSECOND   "789012345"
+#define MESSAGE_EXPECTED_PRINTF_FMT__UTC_YEAR     "2016"
+#define MESSAGE_EXPECTED_PRINTF_FMT__UTC_MONTH    "12"
+#define MESSAGE_EXPECTED_PRINTF_FMT__UTC_DAY      "23"
+#define MESSAGE_EXPECTED_PRINTF_FMT__UTC_HOUR     "12"
+#define MESSAGE_EXPECTED_PRINTF_FMT__UTC_MINUTE   "34"
+#define MESSAGE_EXPECTED_PRINTF_FMT__UTC_SECOND   "56"
+#define MESSAGE_EXPECTED_PRINTF_FMT__EPOCH_US     "1482496496789012"
 #define MESSAGE_EXPECTED_PRINTF_FMT__PID          " 9876"
 #define MESSAGE_EXPECTED_PRINTF_FMT__TID          " 5432"
 #define MESSAGE_EXPECTED_PRINTF_FMT__LEVEL        "I"
@@ -45,6 +54,15 @@
 #define MESSAGE_EXPECTED_PRINTF_VAL__MINUTE
 #define MESSAGE_EXPECTED_PRINTF_VAL__SECOND
 #define MESSAGE_EXPECTED_PRINTF_VAL__MILLISECOND
+#define MESSAGE_EXPECTED_PRINTF_VAL__MICROSECOND
+#define MESSAGE_EXPECTED_PRINTF_VAL__NANOSECOND
+#define MESSAGE_EXPECTED_PRINTF_VAL__UTC_YEAR
+#define MESSAGE_EXPECTED_PRINTF_VAL__UTC_MONTH
+#define MESSAGE_EXPECTED_PRINTF_VAL__UTC_DAY
+#define MESSAGE_EXPECTED_PRINTF_VAL__UTC_HOUR
+#define MESSAGE_EXPECTED_PRINTF_VAL__UTC_MINUTE
+#define MESSAGE_EXPECTED_PRINTF_VAL__UTC_SECOND
+#define MESSAGE_EXPECTED_PRINTF_VAL__EPOCH_US
 #define MESSAGE_EXPECTED_PRINTF_VAL__PID
 #define MESSAGE_EXPECTED_PRINTF_VAL__TID
 #define MESSAGE_EXPECTED_PRINTF_VAL__LEVEL
@@ -114,7 +132,8 @@ static void reset()
 	g_line = 0;
 }
 
-static void mock_time_callback(struct tm *const tm, unsigned *const msec)
+static void mock_time_callback(struct tm *const tm, time_t *const sec,
+							   unsigned *const nsec)
 {
 	memset(tm, 0, sizeof(*tm));
 	tm->tm_sec = 56;
@@ -123,7 +142,8 @@ static void mock_time_callback(struct tm *const tm, unsigned *const msec)
 	tm->tm_mday = 23;
 	tm->tm_mon = 11;
 	tm->tm_year = 2016 - 1900;
-	*msec = 789;
+	*sec = 1482496496; /* 2016-12-23 12:34:56 UTC */
+	*nsec = 789012345;
 }
 
 static void mock_pid_callback(int *const pid, int *const tid)
@@ -0,0 +1,84 @@
+#include <zf_log.c>
+#include <zf_test.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef void (*kernel_fn)(const unsigned char *d, size_t n,
+						  char *hex, char *ascii);
+
+enum { MAX_N = 256 + 64 };
+
+static unsigned char g_data[MAX_N + 32];
+
+static void verify_kernel(const kernel_fn kernel)
+{
+	char hex[2 * MAX_N + 1], ascii[MAX_N + 1];
+	char expected_hex[2 * MAX_N + 1], expected_ascii[MAX_N + 1];
+	for (size_t offset = 0; 32 > offset; offset += 7)
+	{
+		for (size_t n = 0; MAX_N >= n; ++n)
+		{
+			memset(hex, '#', sizeof(hex));
+			memset(ascii, '#', sizeof(ascii));
+			memset(expected_hex, '#', sizeof(expected_hex));
+			memset(expected_ascii, '#', sizeof(expected_ascii));
+			mem_hex_scalar(g_data + offset, n, expected_hex, expected_ascii);
+			kernel(g_data + offset, n, hex, ascii);
+			TEST_VERIFY_TRUE_MSG(0 == memcmp(hex, expected_hex, sizeof(hex)),
+								 "hex mismatch, offset %u, size %u",
+								 (unsigned)offset, (unsigned)n);
+			TEST_VERIFY_TRUE_MSG(0 == memcmp(ascii, expected_ascii, sizeof(ascii)),
+								 "ascii mismatch, offset %u, size %u",
+								 (unsigned)offset, (unsigned)n);
+		}
+	}
+}
+
+/* Every available kernel must match the scalar one, as well as the selected
+ * one.
+ */
+static void verify_kernels()
+{
+#ifdef MEM_HEX_SSE2
+	verify_kernel(mem_hex_sse2);
+#endif
+#ifdef MEM_HEX_AVX2
+	if (__builtin_cpu_supports("avx2"))
+	{
+		verify_kernel(mem_hex_avx2);
+	}
+#endif
+#ifdef MEM_HEX_NEON
+	verify_kernel(mem_hex_neon);
+#endif
+	verify_kernel(mem_hex);
+}
+
+static void test_all_bytes()
+{
+	for (unsigned i = 0; sizeof(g_data) > i; ++i)
+	{
+		g_data[i] = (unsigned char)i;
+	}
+	verify_kernels();
+}
+
+static void test_random_bytes()
+{
+	srand(42);
+	for (unsigned i = 0; sizeof(g_data) > i; ++i)
+	{
+		g_data[i] = (unsigned char)rand();
+	}
+	verify_kernels();
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	TEST_EXECUTE(test_all_bytes());
+	TEST_EXECUTE(test_random_bytes());
+
+	return TEST_RUNNER_EXIT_CODE();
+}
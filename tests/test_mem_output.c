@@ -0,0 +1,106 @@
+#define ZF_LOG_MEM_WIDTH 16
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#define ZF_LOG_TAG "TAG"
+#include <zf_log.c>
+#include <zf_test.h>
+#include <string.h>
+
+enum { MAX_CALLS = 8 };
+
+static char g_calls[MAX_CALLS][4 * ZF_LOG_BUF_SZ];
+static unsigned g_calls_n;
+
+static void mock_output_callback(const zf_log_message *msg, void *arg)
+{
+	(void)arg;
+	const size_t len = (size_t)(msg->p - msg->buf);
+	if (MAX_CALLS == g_calls_n || sizeof(g_calls[0]) <= len)
+	{
+		return;
+	}
+	memcpy(g_calls[g_calls_n], msg->buf, len);
+	g_calls[g_calls_n][len] = 0;
+	++g_calls_n;
+}
+
+static const char c_mem[40] = "0123456789abcdef\x01\x7f\x80\xff Hello, World!";
+
+static const char *const c_lines[] =
+{
+	"30313233343536373839616263646566  0123456789abcdef",
+	"017f80ff2048656c6c6f2c20576f726c  \?\?\?\? Hello, Worl",
+	"6421000000000000                  d!\?\?\?\?\?\?",
+};
+
+static void verify_calls(const char *const *const calls, const unsigned n)
+{
+	TEST_VERIFY_EQUAL(g_calls_n, n);
+	for (unsigned i = 0; n > i && g_calls_n > i; ++i)
+	{
+		TEST_VERIFY_TRUE_MSG(0 == strcmp(calls[i], g_calls[i]),
+							 "\"%s\" != \"%s\"", calls[i], g_calls[i]);
+	}
+	g_calls_n = 0;
+}
+
+static void test_lines()
+{
+	zf_log_set_output_v(ZF_LOG_PUT_MSG, 0, mock_output_callback);
+	ZF_LOGI_MEM(c_mem, sizeof(c_mem), "dump");
+	const char *const calls[] = {"dump", c_lines[0], c_lines[1], c_lines[2]};
+	verify_calls(calls, _countof(calls));
+}
+
+static void test_offset()
+{
+	zf_log_set_output_v(ZF_LOG_PUT_MSG | ZF_LOG_PUT_MEM_OFFSET, 0,
+						mock_output_callback);
+	ZF_LOGI_MEM(c_mem, sizeof(c_mem), "dump");
+	char lines[3][ZF_LOG_BUF_SZ];
+	for (unsigned i = 0; _countof(lines) > i; ++i)
+	{
+		snprintf(lines[i], sizeof(lines[i]), "%08x  %s", 16 * i, c_lines[i]);
+	}
+	const char *const calls[] = {"dump", lines[0], lines[1], lines[2]};
+	verify_calls(calls, _countof(calls));
+}
+
+static void test_batch()
+{
+	char batch[4 * ZF_LOG_BUF_SZ];
+	zf_log_set_output_v(ZF_LOG_PUT_MSG | ZF_LOG_PUT_MEM_BATCH, 0,
+						mock_output_callback);
+	ZF_LOGI_MEM(c_mem, sizeof(c_mem), "dump");
+	snprintf(batch, sizeof(batch), "%s" ZF_LOG_EOL "%s" ZF_LOG_EOL "%s",
+			 c_lines[0], c_lines[1], c_lines[2]);
+	const char *const calls[] = {"dump", batch};
+	verify_calls(calls, _countof(calls));
+
+	/* Each line gets its own copy of the line prefix. */
+	zf_log_set_output_v(ZF_LOG_PUT_TAG | ZF_LOG_PUT_MSG | ZF_LOG_PUT_MEM_OFFSET |
+						ZF_LOG_PUT_MEM_BATCH, 0, mock_output_callback);
+	ZF_LOGI_MEM(c_mem, sizeof(c_mem), "dump");
+	snprintf(batch, sizeof(batch),
+			 "TAG 00000000  %s" ZF_LOG_EOL "TAG 00000010  %s" ZF_LOG_EOL
+			 "TAG 00000020  %s", c_lines[0], c_lines[1], c_lines[2]);
+	const char *const tagged[] = {"TAG dump", batch};
+	verify_calls(tagged, _countof(tagged));
+
+	/* Single line dump. */
+	zf_log_set_output_v(ZF_LOG_PUT_MSG | ZF_LOG_PUT_MEM_BATCH, 0,
+						mock_output_callback);
+	ZF_LOGI_MEM(c_mem, 16, "dump");
+	const char *const single[] = {"dump", c_lines[0]};
+	verify_calls(single, _countof(single));
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	TEST_EXECUTE(test_lines());
+	TEST_EXECUTE(test_offset());
+	TEST_EXECUTE(test_batch());
+
+	return TEST_RUNNER_EXIT_CODE();
+}
@@ -0,0 +1,92 @@
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#include <zf_log.c>
+#include <zf_test.h>
+#include <sys/wait.h>
+
+static void *thread_tid(void *arg)
+{
+	int pid;
+	pid_callback(&pid, (int *)arg);
+	return 0;
+}
+
+static void test_values()
+{
+	int pid, tid;
+	for (unsigned i = 0; 2 > i; ++i)
+	{
+		pid_callback(&pid, &tid);
+		TEST_VERIFY_EQUAL(pid, getpid());
+		TEST_VERIFY_EQUAL(tid, get_tid());
+	}
+	/* Cache is actually used, not just correct. */
+	TEST_VERIFY_EQUAL(g_pcache_state, 1);
+	TEST_VERIFY_EQUAL(g_pcache_pid, pid);
+	TEST_VERIFY_EQUAL(g_pcache_tid, tid);
+}
+
+static void test_threads()
+{
+	int pid, tid, thread_tids[2];
+	pthread_t threads[2];
+	pid_callback(&pid, &tid);
+	for (unsigned i = 0; 2 > i; ++i)
+	{
+		pthread_create(threads + i, 0, thread_tid, thread_tids + i);
+	}
+	for (unsigned i = 0; 2 > i; ++i)
+	{
+		pthread_join(threads[i], 0);
+	}
+	TEST_VERIFY_NOT_EQUAL(thread_tids[0], tid);
+	TEST_VERIFY_NOT_EQUAL(thread_tids[1], tid);
+	TEST_VERIFY_NOT_EQUAL(thread_tids[0], thread_tids[1]);
+}
+
+static void test_fork()
+{
+	int pid, tid;
+	pid_callback(&pid, &tid);
+	const pid_t child = fork();
+	TEST_VERIFY_TRUE(0 <= child);
+	if (0 == child)
+	{
+		/* Values cached by parent must not be used. */
+		pid_callback(&pid, &tid);
+		_exit(pid == getpid() && tid == get_tid()? 0: 1);
+	}
+	int status;
+	TEST_VERIFY_EQUAL(waitpid(child, &status, 0), child);
+	TEST_VERIFY_TRUE(WIFEXITED(status));
+	TEST_VERIFY_EQUAL(WEXITSTATUS(status), 0);
+}
+
+static void test_not_cached()
+{
+	/* As if pthread_atfork() was not available. */
+	int pid, tid;
+	const int state = g_pcache_state;
+	g_pcache_state = -1;
+	pcache_reset();
+	for (unsigned i = 0; 2 > i; ++i)
+	{
+		pid_callback(&pid, &tid);
+		TEST_VERIFY_EQUAL(pid, getpid());
+		TEST_VERIFY_EQUAL(tid, get_tid());
+		TEST_VERIFY_EQUAL(g_pcache_pid, 0);
+		TEST_VERIFY_EQUAL(g_pcache_tid, 0);
+	}
+	g_pcache_state = state;
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	TEST_EXECUTE(test_values());
+	TEST_EXECUTE(test_threads());
+	TEST_EXECUTE(test_fork());
+	TEST_EXECUTE(test_not_cached());
+
+	return TEST_RUNNER_EXIT_CODE();
+}
@@ -50,11 +50,31 @@ static void test_function()
 	TEST_VERIFY_EQUAL(strcmp(expected, g_srcloc), 0);
 }
 
+static void test_file_path()
+{
+	/* Callers built without compile-time base name pass full path. */
+	_zf_log_write_d("func", "/some/dir/test_source_location.c", 42,
+					ZF_LOG_INFO, 0, "test message");
+
+	char expected[64];
+	snprintf(expected, sizeof(expected), "func@%s:42", c_filename);
+	TEST_VERIFY_EQUAL(strcmp(expected, g_srcloc), 0);
+}
+
+static void test_file_name()
+{
+#ifdef _ZF_LOG_FILE_NAME
+	TEST_VERIFY_EQUAL(strcmp(c_filename, _ZF_LOG_FILE_NAME), 0);
+#endif
+}
+
 int main(int argc, char *argv[])
 {
 	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, mock_output_callback);
 
 	TEST_RUNNER_CREATE(argc, argv);
 	TEST_EXECUTE(test_function());
+	TEST_EXECUTE(test_file_path());
+	TEST_EXECUTE(test_file_name());
 	return TEST_RUNNER_EXIT_CODE();
 }
@@ -0,0 +1,142 @@
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#define ZF_LOG_MESSAGE_CTX_FORMAT ()
+#define ZF_LOG_MESSAGE_SRC_FORMAT ()
+#include <zf_log.c>
+#include <zf_test.h>
+#include <stdio.h>
+#include <string.h>
+
+static char g_line[ZF_LOG_BUF_SZ];
+static char g_tag[ZF_LOG_BUF_SZ];
+
+static void line_output_callback(const zf_log_message *msg, void *arg)
+{
+	(void)arg;
+	size_t len = (size_t)(msg->p - msg->buf);
+	memcpy(g_line, msg->buf, len);
+	g_line[len] = 0;
+	len = (size_t)(msg->tag_e - msg->tag_b);
+	memcpy(g_tag, msg->tag_b, len);
+	g_tag[len] = 0;
+}
+
+static void verify_line(const char *const tag, const char *const line,
+						const char *const expected_tag)
+{
+	ZF_LOG_WRITE(ZF_LOG_INFO, tag, "msg");
+	TEST_VERIFY_TRUE_MSG(0 == strcmp(line, g_line),
+						 "\"%s\" != \"%s\"", line, g_line);
+	TEST_VERIFY_TRUE_MSG(0 == strcmp(expected_tag, g_tag),
+						 "\"%s\" != \"%s\"", expected_tag, g_tag);
+}
+
+static void test_prefix()
+{
+	for (unsigned i = 0; 2 > i; ++i)
+	{
+		zf_log_set_tag_prefix(0);
+		verify_line("TAG", "TAG msg", "TAG");
+		verify_line("TAG", "TAG msg", "TAG");
+		verify_line(0, "msg", "");
+		verify_line("", "msg", "");
+		zf_log_set_tag_prefix("prefix");
+		verify_line("TAG", "prefix.TAG msg", "prefix.TAG");
+		verify_line(0, "prefix msg", "prefix");
+		zf_log_set_tag_prefix("");
+		verify_line("TAG", "TAG msg", "TAG");
+	}
+}
+
+static void test_prefix_buffer()
+{
+	char prefix[16];
+	strcpy(prefix, "one");
+	zf_log_set_tag_prefix(prefix);
+	verify_line("TAG", "one.TAG msg", "one.TAG");
+	/* Same pointer, but different content. */
+	strcpy(prefix, "two");
+	zf_log_set_tag_prefix(prefix);
+	verify_line("TAG", "two.TAG msg", "two.TAG");
+	zf_log_set_tag_prefix(0);
+}
+
+static void test_tag_buffer()
+{
+	char tag[16];
+	strcpy(tag, "first");
+	verify_line(tag, "first msg", "first");
+	strcpy(tag, "other");
+	verify_line(tag, "other msg", "other");
+	strcpy(tag, "short");
+	verify_line(tag, "short msg", "short");
+	strcpy(tag, "sh");
+	verify_line(tag, "sh msg", "sh");
+	strcpy(tag, "");
+	verify_line(tag, "msg", "");
+}
+
+static void test_long_tag()
+{
+	char tag[128], line[256];
+	memset(tag, 'x', sizeof(tag) - 1);
+	tag[sizeof(tag) - 1] = 0;
+	snprintf(line, sizeof(line), "%s msg", tag);
+	verify_line(tag, line, tag);
+	verify_line(tag, line, tag);
+}
+
+static unsigned g_mismatches;
+
+static void thread_output_callback(const zf_log_message *msg, void *arg)
+{
+	(void)arg;
+	const size_t len = (size_t)(msg->tag_e - msg->tag_b);
+	if (len != strlen(msg->tag) || 0 != memcmp(msg->tag_b, msg->tag, len))
+	{
+		__atomic_fetch_add(&g_mismatches, 1, __ATOMIC_RELAXED);
+	}
+}
+
+static void *thread_lines(void *arg)
+{
+	(void)arg;
+	char tag[16];
+	for (unsigned i = 0; 1000 > i; ++i)
+	{
+		snprintf(tag, sizeof(tag), "T%u", i % 3);
+		ZF_LOG_WRITE(ZF_LOG_INFO, tag, "msg");
+	}
+	return 0;
+}
+
+static void test_threads()
+{
+	pthread_t threads[2];
+	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, thread_output_callback);
+	for (unsigned i = 0; _countof(threads) > i; ++i)
+	{
+		pthread_create(threads + i, 0, thread_lines, 0);
+	}
+	for (unsigned i = 0; _countof(threads) > i; ++i)
+	{
+		pthread_join(threads[i], 0);
+	}
+	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, line_output_callback);
+	TEST_VERIFY_EQUAL(g_mismatches, 0);
+	verify_line("T1", "T1 msg", "T1");
+}
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	zf_log_set_output_v(ZF_LOG_PUT_STD, 0, line_output_callback);
+
+	TEST_EXECUTE(test_prefix());
+	TEST_EXECUTE(test_prefix_buffer());
+	TEST_EXECUTE(test_tag_buffer());
+	TEST_EXECUTE(test_long_tag());
+	TEST_EXECUTE(test_threads());
+
+	return TEST_RUNNER_EXIT_CODE();
+}
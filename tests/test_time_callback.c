@@ -0,0 +1,155 @@
+#define ZF_LOG_LEVEL ZF_LOG_INFO
+#include <zf_log.c>
+#include <zf_test.h>
+
+static time_t tm_seconds(struct tm *const tm)
+{
+	tm->tm_isdst = -1;
+	return mktime(tm);
+}
+
+static void *thread_time(void *arg)
+{
+	time_t sec;
+	unsigned nsec;
+	time_callback((struct tm *)arg, &sec, &nsec);
+	return 0;
+}
+
+static void test_local_time()
+{
+	for (unsigned i = 0; 3 > i; ++i)
+	{
+		struct tm tm;
+		time_t sec;
+		unsigned nsec;
+		const time_t before = time(0);
+		time_callback(&tm, &sec, &nsec);
+		const time_t after = time(0);
+		const time_t t = tm_seconds(&tm);
+		TEST_VERIFY_GREATER_OR_EQUAL(999999999, nsec);
+		TEST_VERIFY_EQUAL(t, sec);
+		/* Coarse clock could lag behind time() by a tick. */
+		TEST_VERIFY_GREATER_OR_EQUAL(t + 1, before);
+		TEST_VERIFY_GREATER_OR_EQUAL(after, t);
+	}
+}
+
+static void test_threads()
+{
+	struct tm tm, thread_tm;
+	time_t sec;
+	unsigned nsec;
+	pthread_t thread;
+	time_callback(&tm, &sec, &nsec);
+	pthread_create(&thread, 0, thread_time, &thread_tm);
+	pthread_join(thread, 0);
+	const time_t t = tm_seconds(&tm);
+	const time_t thread_t = tm_seconds(&thread_tm);
+	TEST_VERIFY_GREATER_OR_EQUAL(thread_t, t);
+	TEST_VERIFY_GREATER_OR_EQUAL(t + 2, thread_t);
+}
+
+static long long ns_diff(const struct tm *const tm, const unsigned nsec,
+						 const struct timespec *const ts)
+{
+	struct tm t = *tm;
+	return ((long long)tm_seconds(&t) - ts->tv_sec) * 1000000000 +
+		   (long long)nsec - ts->tv_nsec;
+}
+
+#ifdef TSC
+static void test_tsc()
+{
+	const struct timespec delay = {0, 20 * 1000000};
+	struct tm tm;
+	time_t sec;
+	unsigned nsec;
+	struct timespec ts;
+	time_callback(&tm, &sec, &nsec);
+	nanosleep(&delay, 0);
+	for (unsigned i = 0; 100 > i; ++i)
+	{
+		if (i % 10 == 0)
+		{
+			nanosleep(&delay, 0);
+		}
+		time_callback(&tm, &sec, &nsec);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		const long long d = ns_diff(&tm, nsec, &ts);
+		/* Converted counter value must be close to the wall clock. */
+		TEST_VERIFY_TRUE_MSG(-5000000 < d && 0 >= d - 1000000, "diff %lli ns", d);
+	}
+	if (0 < g_tsc.state)
+	{
+		TEST_VERIFY_NOT_EQUAL(g_tsc.mult, 0);
+	}
+}
+#endif
+
+static void test_subsecond()
+{
+	struct tm tm;
+	time_t sec;
+	unsigned nsec;
+	struct timespec b, e;
+	clock_gettime(CLOCK_REALTIME, &b);
+	time_callback(&tm, &sec, &nsec);
+	clock_gettime(CLOCK_REALTIME, &e);
+	/* Coarse clock could lag behind by a tick. */
+	TEST_VERIFY_TRUE(-100000000 < ns_diff(&tm, nsec, &b));
+	TEST_VERIFY_TRUE(0 >= ns_diff(&tm, nsec, &e) - 1000000);
+}
+
+#if _ZF_LOG_MESSAGE_FORMAT_UTC_USED
+static void test_utc_time()
+{
+	/* Epoch, leap days, century years and dates before epoch. */
+	static const time_t times[] =
+	{
+		0, 86399, 951782400, 951868799, 1482496496, 4107542400,
+		4107628799, 13574563200, -1, -86400, -2208988800,
+	};
+	for (size_t i = 0; _countof(times) > i; ++i)
+	{
+		struct tm expected, actual;
+		TEST_VERIFY_TRUE(0 != gmtime_r(times + i, &expected));
+		utc_time(times[i], &actual);
+		TEST_VERIFY_EQUAL(actual.tm_year, expected.tm_year);
+		TEST_VERIFY_EQUAL(actual.tm_mon, expected.tm_mon);
+		TEST_VERIFY_EQUAL(actual.tm_mday, expected.tm_mday);
+		TEST_VERIFY_EQUAL(actual.tm_hour, expected.tm_hour);
+		TEST_VERIFY_EQUAL(actual.tm_min, expected.tm_min);
+		TEST_VERIFY_EQUAL(actual.tm_sec, expected.tm_sec);
+	}
+	/* Every day over several 400 years cycles. */
+	for (time_t t = -12219292800; 32503680000 > t; t += 86400 - 1)
+	{
+		struct tm expected, actual;
+		gmtime_r(&t, &expected);
+		utc_time(t, &actual);
+		TEST_VERIFY_TRUE_MSG(actual.tm_year == expected.tm_year &&
+							 actual.tm_mon == expected.tm_mon &&
+							 actual.tm_mday == expected.tm_mday &&
+							 actual.tm_sec == expected.tm_sec,
+							 "mismatch at %lli", (long long)t);
+	}
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	TEST_RUNNER_CREATE(argc, argv);
+
+	TEST_EXECUTE(test_local_time());
+	TEST_EXECUTE(test_threads());
+	TEST_EXECUTE(test_subsecond());
+#ifdef TSC
+	TEST_EXECUTE(test_tsc());
+#endif
+#if _ZF_LOG_MESSAGE_FORMAT_UTC_USED
+	TEST_EXECUTE(test_utc_time());
+#endif
+
+	return TEST_RUNNER_EXIT_CODE();
+}
@@ -118,6 +118,265 @@
 #else
 	#define ZF_LOG_OPTIMIZE_SIZE 0
 #endif
+/* When defined, process id and thread id will be obtained from the system for
+ * each log line. By default they are cached (process id process-wide, thread id
+ * in thread-local storage), which saves a system call per line on some
+ * platforms. Cache is reset in child process after fork() (see pthread_atfork()),
+ * so it's only needed when child processes are created by other means (e.g.
+ * direct clone() system call) and continue to log, or when pthread library
+ * can't be linked (cache requires it). Ignored on Windows and when
+ * ZF_LOG_OPTIMIZE_SIZE is defined (cache is not used).
+ */
+#ifdef ZF_LOG_NO_PID_CACHE
+	#undef ZF_LOG_NO_PID_CACHE
+	#define ZF_LOG_NO_PID_CACHE 1
+#else
+	#define ZF_LOG_NO_PID_CACHE 0
+#endif
+/* Clock used for log line timestamps (ignored on Windows):
+ * - ZF_LOG_CLOCK_REALTIME - clock_gettime(CLOCK_REALTIME), which on Linux is
+ *   served by vDSO without entering the kernel. Default.
+ * - ZF_LOG_CLOCK_REALTIME_COARSE - clock_gettime(CLOCK_REALTIME_COARSE). Even
+ *   cheaper, but resolution is one scheduler tick (usually 1-4 ms). Falls back
+ *   to CLOCK_REALTIME on platforms that don't have it.
+ * - ZF_LOG_CLOCK_GETTIMEOFDAY - gettimeofday().
+ * - ZF_LOG_CLOCK_TSC - CPU timestamp counter (rdtsc on x86, cntvct_el0 on
+ *   arm64 Linux) converted to wall time using calibration against
+ *   CLOCK_REALTIME, which is refreshed every ZF_LOG_TSC_CALIBRATION_MS
+ *   by whichever thread notices it's due. Costs a few nanoseconds per line.
+ *   Falls back to CLOCK_REALTIME when timestamp counter is not invariant (or
+ *   platform is not supported) and during first ZF_LOG_TSC_WARMUP_MS after
+ *   start while initial calibration is in progress.
+ * Example:
+ *
+ *   CC_ARGS := -DZF_LOG_CLOCK=ZF_LOG_CLOCK_REALTIME_COARSE
+ */
+#define ZF_LOG_CLOCK_REALTIME        0
+#define ZF_LOG_CLOCK_REALTIME_COARSE 1
+#define ZF_LOG_CLOCK_GETTIMEOFDAY    2
+#define ZF_LOG_CLOCK_TSC             3
+#ifndef ZF_LOG_CLOCK
+	#define ZF_LOG_CLOCK ZF_LOG_CLOCK_REALTIME
+#endif
+/* How often (in milliseconds) timestamp counter calibration is refreshed when
+ * ZF_LOG_CLOCK is ZF_LOG_CLOCK_TSC. Can't exceed 4000, since conversion uses
+ * 64-bit fixed point arithmetic.
+ */
+#ifndef ZF_LOG_TSC_CALIBRATION_MS
+	#define ZF_LOG_TSC_CALIBRATION_MS 1000
+#endif
+/* Length of the initial timestamp counter calibration interval in
+ * milliseconds.
+ */
+#ifndef ZF_LOG_TSC_WARMUP_MS
+	#define ZF_LOG_TSC_WARMUP_MS 10
+#endif
+/* When defined, asynchronous output facility will be compiled in (ignored on
+ * Windows). It allows to move output callback invocation (and hence file or
+ * socket IO) to a dedicated writer thread. Requires POSIX threads. See
+ * ZF_LOG_OUT_ASYNC in zf_log.h for details. Disabled by default.
+ */
+#ifdef ZF_LOG_ASYNC
+	#undef ZF_LOG_ASYNC
+	#if defined(_WIN32) || defined(_WIN64)
+		#define ZF_LOG_ASYNC 0
+	#else
+		#define ZF_LOG_ASYNC 1
+	#endif
+#else
+	#define ZF_LOG_ASYNC 0
+#endif
+/* When defined, asynchronous output (see ZF_LOG_ASYNC, which is implied) will
+ * give each logging thread its own single-producer queue instead of one queue
+ * shared by all threads (ignored on Windows). Producers don't share any
+ * written memory, so logging from many threads scales better. Writer thread
+ * merges the queues by the time of lines. Disabled by default.
+ */
+#ifdef ZF_LOG_ASYNC_PER_THREAD
+	#undef ZF_LOG_ASYNC_PER_THREAD
+	#if defined(_WIN32) || defined(_WIN64)
+		#define ZF_LOG_ASYNC_PER_THREAD 0
+	#else
+		#define ZF_LOG_ASYNC_PER_THREAD 1
+		#undef ZF_LOG_ASYNC
+		#define ZF_LOG_ASYNC 1
+	#endif
+#else
+	#define ZF_LOG_ASYNC_PER_THREAD 0
+#endif
+/* When defined, deferred output facility will be compiled in. It allows to
+ * skip message formatting on the calling thread: instead of the text line,
+ * output callback receives a compact binary record with format string pointer
+ * and raw argument values. See ZF_LOG_OUT_DEFERRED in zf_log.h for details.
+ * Disabled by default.
+ */
+#ifdef ZF_LOG_DEFERRED
+	#undef ZF_LOG_DEFERRED
+	#define ZF_LOG_DEFERRED 1
+#else
+	#define ZF_LOG_DEFERRED 0
+#endif
+/* When defined, buffered file output facility will be compiled in (ignored on
+ * Windows). It collects log lines in a large per-file buffer and writes them
+ * with a single writev() call when the buffer is full or flush deadline is
+ * reached. See ZF_LOG_OUT_FILE in zf_log.h for details. Disabled by default.
+ */
+#ifdef ZF_LOG_BUFFERED_FILE
+	#undef ZF_LOG_BUFFERED_FILE
+	#if defined(_WIN32) || defined(_WIN64)
+		#define ZF_LOG_BUFFERED_FILE 0
+	#else
+		#define ZF_LOG_BUFFERED_FILE 1
+	#endif
+#else
+	#define ZF_LOG_BUFFERED_FILE 0
+#endif
+/* When defined, duplicate collapsing output facility will be compiled in
+ * (ignored on Windows). It holds consecutive identical log lines and writes a
+ * single "last message repeated N times" line instead. See ZF_LOG_OUT_DEDUP in
+ * zf_log.h for details. Disabled by default.
+ */
+#ifdef ZF_LOG_DEDUP
+	#undef ZF_LOG_DEDUP
+	#if defined(_WIN32) || defined(_WIN64)
+		#define ZF_LOG_DEDUP 0
+	#else
+		#define ZF_LOG_DEDUP 1
+	#endif
+#else
+	#define ZF_LOG_DEDUP 0
+#endif
+/* When defined, flight recorder will be compiled in (ignored on Windows). It
+ * keeps recent log lines in memory, including ones below "output" log level,
+ * so they could be written when something goes wrong. See
+ * zf_log_set_capture_level() in zf_log.h for details. Disabled by default.
+ */
+#ifdef ZF_LOG_RECORDER
+	#undef ZF_LOG_RECORDER
+	#if defined(_WIN32) || defined(_WIN64)
+		#define ZF_LOG_RECORDER 0
+	#else
+		#define ZF_LOG_RECORDER 1
+	#endif
+#else
+	#define ZF_LOG_RECORDER 0
+#endif
+/* When defined, signal-safe write function and crash handler will be compiled
+ * in (ignored on Windows). Crash handler writes lines that are still pending in
+ * asynchronous output, buffered log files and flight recorder, followed by the
+ * backtrace. See zf_log_crash_handler_install() in zf_log.h for details.
+ * Disabled by default.
+ */
+#ifdef ZF_LOG_CRASH_HANDLER
+	#undef ZF_LOG_CRASH_HANDLER
+	#if defined(_WIN32) || defined(_WIN64)
+		#define ZF_LOG_CRASH_HANDLER 0
+	#else
+		#define ZF_LOG_CRASH_HANDLER 1
+	#endif
+#else
+	#define ZF_LOG_CRASH_HANDLER 0
+#endif
+/* When defined, built-in formatter will be used for the message text instead
+ * of vsnprintf(). It handles "%d", "%i", "%u", "%x", "%X", "%s", "%c" and "%%"
+ * (plus "%p" with glibc, since its output is implementation-defined) with "-"
+ * and "0" flags, width, "*" and length modifiers (plus precision for "%s")
+ * itself and passes the rest of the format string to vsnprintf() (or
+ * ZF_LOG_CUSTOM_VSNPRINTF) when it meets anything else, e.g. floating point
+ * conversion. Output is the same as of vsnprintf(). Disabled by default.
+ */
+#ifdef ZF_LOG_FAST_FORMAT
+	#undef ZF_LOG_FAST_FORMAT
+	#define ZF_LOG_FAST_FORMAT 1
+#else
+	#define ZF_LOG_FAST_FORMAT 0
+#endif
+/* When defined, built-in formatter (see ZF_LOG_FAST_FORMAT, which is implied)
+ * will keep parsed format strings in a lock-free table keyed by format string
+ * address (ignored on Windows). Next time the same format is used, its literal
+ * text is copied in chunks and conversions are done without parsing. Since key
+ * is the address, format strings must have static storage duration (string
+ * literals are fine), as with deferred output. Format string built at runtime
+ * could be parsed with the plan of another one that had the same address.
+ * Format strings that don't fit into the table (see ZF_LOG_FORMAT_CACHE_SZ)
+ * are parsed every time. Disabled by default.
+ */
+#ifdef ZF_LOG_FORMAT_CACHE
+	#undef ZF_LOG_FORMAT_CACHE
+	#if defined(_WIN32) || defined(_WIN64)
+		#define ZF_LOG_FORMAT_CACHE 0
+	#else
+		#define ZF_LOG_FORMAT_CACHE 1
+		#undef ZF_LOG_FAST_FORMAT
+		#define ZF_LOG_FAST_FORMAT 1
+	#endif
+#else
+	#define ZF_LOG_FORMAT_CACHE 0
+#endif
+/* When defined, message that doesn't fit into the log line buffer will be
+ * formatted again into a per-thread buffer that grows on demand, up to
+ * ZF_LOG_MAX_LINE_SZ bytes (ignored on Windows). Such lines could be longer
+ * than PIPE_BUF, so stderr output writes every line under a lock, which keeps
+ * lines from interleaving (lock is not contended unless threads write at the
+ * same time). Asynchronous output copies such lines to the heap, since they
+ * don't fit into the queue slot. Messages logged from output callback of a
+ * line that already uses that buffer are truncated as usual. Disabled by
+ * default.
+ */
+#ifdef ZF_LOG_LARGE_MESSAGES
+	#undef ZF_LOG_LARGE_MESSAGES
+	#if defined(_WIN32) || defined(_WIN64)
+		#define ZF_LOG_LARGE_MESSAGES 0
+	#else
+		#define ZF_LOG_LARGE_MESSAGES 1
+	#endif
+#else
+	#define ZF_LOG_LARGE_MESSAGES 0
+#endif
+/* Default number of log lines that asynchronous output queue can hold. Each
+ * queue slot takes a little more than ZF_LOG_BUF_SZ bytes. Rounded up to the
+ * power of two. See zf_log_async_start() for details.
+ */
+#ifndef ZF_LOG_ASYNC_QUEUE_SZ
+	#define ZF_LOG_ASYNC_QUEUE_SZ 1024
+#endif
+/* Default number of log lines that each per-thread queue can hold (see
+ * ZF_LOG_ASYNC_PER_THREAD). Rounded up to the power of two.
+ */
+#ifndef ZF_LOG_ASYNC_THREAD_QUEUE_SZ
+	#define ZF_LOG_ASYNC_THREAD_QUEUE_SZ 256
+#endif
+/* Default size of the buffered file output buffer in bytes. See
+ * zf_log_file_open() for details.
+ */
+#ifndef ZF_LOG_FILE_BUF_SZ
+	#define ZF_LOG_FILE_BUF_SZ (64 * 1024)
+#endif
+/* Maximum number of distinct tags that can have their own output log level.
+ * See zf_log_set_tag_level() for details.
+ */
+#ifndef ZF_LOG_TAG_SLOTS
+	#define ZF_LOG_TAG_SLOTS 64
+#endif
+/* Number of log lines that flight recorder keeps. Must be a power of two. Each
+ * line takes a little more than ZF_LOG_BUF_SZ bytes of static memory. See
+ * zf_log_set_capture_level() for details.
+ */
+#ifndef ZF_LOG_RECORDER_SZ
+	#define ZF_LOG_RECORDER_SZ 256
+#endif
+/* Number of format strings that format cache can hold (see
+ * ZF_LOG_FORMAT_CACHE). Each takes about 200 bytes. Must be a power of two.
+ */
+#ifndef ZF_LOG_FORMAT_CACHE_SZ
+	#define ZF_LOG_FORMAT_CACHE_SZ 256
+#endif
+/* Maximum size of the log line buffer in bytes, including ZF_LOG_EOL_SZ. See
+ * ZF_LOG_LARGE_MESSAGES for details.
+ */
+#ifndef ZF_LOG_MAX_LINE_SZ
+	#define ZF_LOG_MAX_LINE_SZ (64 * 1024)
+#endif
 /* Size of the log line buffer. The buffer is allocated on stack. It limits
  * maximum length of a log line.
  */
@@ -149,8 +408,24 @@
 /* Specifies log message context format. Log message context includes date,
  * time, process id, thread id and message's log level. Custom information can
  * be added as well. Supported fields: YEAR, MONTH, DAY, HOUR, MINUTE, SECOND,
- * MILLISECOND, PID, TID, LEVEL, S(str), F_INIT(statements),
- * F_UINT(width, value).
+ * MILLISECOND, MICROSECOND, NANOSECOND, UTC_YEAR, UTC_MONTH, UTC_DAY,
+ * UTC_HOUR, UTC_MINUTE, UTC_SECOND, EPOCH_US, PID, TID, LEVEL, S(str),
+ * F_INIT(statements), F_UINT(width, value).
+ *
+ * MILLISECOND, MICROSECOND and NANOSECOND are fractional part of the second
+ * with 3, 6 and 9 digits respectively (e.g. SECOND, S("."), MICROSECOND).
+ * Actual resolution depends on the clock (see ZF_LOG_CLOCK).
+ *
+ * UTC_XXX fields are the same as calendar fields above, but in UTC. EPOCH_US
+ * is number of microseconds since 1970-01-01 00:00:00 UTC. When only these
+ * (and fractional second fields) are used, local time zone conversion is not
+ * performed at all, which makes them noticeably cheaper. ISO 8601 timestamp
+ * can be produced with:
+ *
+ *   #define ZF_LOG_MESSAGE_CTX_FORMAT \
+ *       (UTC_YEAR, S("-"), UTC_MONTH, S("-"), UTC_DAY, S("T"), \
+ *        UTC_HOUR, S(":"), UTC_MINUTE, S(":"), UTC_SECOND, S("."), \
+ *        MICROSECOND, S("Z "), LEVEL, S(" "))
  *
  * Must be defined as a tuple, for example:
  *
@@ -245,6 +520,15 @@
 #define MINUTE MINUTE
 #define SECOND SECOND
 #define MILLISECOND MILLISECOND
+#define MICROSECOND MICROSECOND
+#define NANOSECOND NANOSECOND
+#define UTC_YEAR UTC_YEAR
+#define UTC_MONTH UTC_MONTH
+#define UTC_DAY UTC_DAY
+#define UTC_HOUR UTC_HOUR
+#define UTC_MINUTE UTC_MINUTE
+#define UTC_SECOND UTC_SECOND
+#define EPOCH_US EPOCH_US
 #define PID PID
 #define TID TID
 #define LEVEL LEVEL
@@ -304,6 +588,7 @@
 	#include <windows.h>
 #else
 	#include <unistd.h>
+	#include <pthread.h>
 	#include <sys/time.h>
 	#if defined(__linux__)
 		#include <linux/limits.h>
@@ -321,8 +606,43 @@
 		#include <sys/syscall.h>
 	#endif
 #endif
-#if defined(__MACH__) || defined(_AIX)
-	#include <pthread.h>
+#if ZF_LOG_ASYNC
+	#include <sched.h>
+#endif
+#if ZF_LOG_BUFFERED_FILE
+	#include <dirent.h>
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <spawn.h>
+	#include <sys/uio.h>
+	#include <sys/wait.h>
+#endif
+#if ZF_LOG_DEFERRED || ZF_LOG_FAST_FORMAT
+	#include <stdint.h>
+#endif
+#if ZF_LOG_LARGE_MESSAGES
+	#include <errno.h>
+#endif
+#if ZF_LOG_CRASH_HANDLER
+	#include <errno.h>
+	#include <signal.h>
+	#if defined(__GLIBC__) || defined(__APPLE__)
+		#include <execinfo.h>
+		#define CRASH_BACKTRACE
+	#endif
+#endif
+#if ZF_LOG_CLOCK == ZF_LOG_CLOCK_TSC && defined(__GNUC__) && \
+	(defined(__x86_64__) || defined(__i386__))
+	#include <cpuid.h>
+#endif
+#if !ZF_LOG_OPTIMIZE_SIZE && defined(__GNUC__) && \
+	(defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+	#include <immintrin.h>
+	#define MEM_HEX_SSE2
+	#define MEM_HEX_AVX2
+#elif !ZF_LOG_OPTIMIZE_SIZE && defined(__GNUC__) && defined(__aarch64__)
+	#include <arm_neon.h>
+	#define MEM_HEX_NEON
 #endif
 
 #define INLINE _ZF_LOG_INLINE
@@ -448,6 +768,15 @@
 #define _ZF_LOG_MESSAGE_FORMAT_MASK__S(s)         (1<<15)
 #define _ZF_LOG_MESSAGE_FORMAT_MASK__F_INIT(expr) (0<<16)
 #define _ZF_LOG_MESSAGE_FORMAT_MASK__F_UINT(w, v) (1<<17)
+#define _ZF_LOG_MESSAGE_FORMAT_MASK__MICROSECOND  (1<<18)
+#define _ZF_LOG_MESSAGE_FORMAT_MASK__NANOSECOND   (1<<19)
+#define _ZF_LOG_MESSAGE_FORMAT_MASK__UTC_YEAR     (1<<20)
+#define _ZF_LOG_MESSAGE_FORMAT_MASK__UTC_MONTH    (1<<21)
+#define _ZF_LOG_MESSAGE_FORMAT_MASK__UTC_DAY      (1<<22)
+#define _ZF_LOG_MESSAGE_FORMAT_MASK__UTC_HOUR     (1<<23)
+#define _ZF_LOG_MESSAGE_FORMAT_MASK__UTC_MINUTE   (1<<24)
+#define _ZF_LOG_MESSAGE_FORMAT_MASK__UTC_SECOND   (1<<25)
+#define _ZF_LOG_MESSAGE_FORMAT_MASK__EPOCH_US     (1<<26)
 #define _ZF_LOG_MESSAGE_FORMAT_MASK(field) \
 	_PP_CONCAT_3(_ZF_LOG_MESSAGE_FORMAT_MASK_, _, field)
 
@@ -473,14 +802,31 @@
 	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(field, ZF_LOG_MESSAGE_TAG_FORMAT) || \
 	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(field, ZF_LOG_MESSAGE_SRC_FORMAT))
 
-#define _ZF_LOG_MESSAGE_FORMAT_DATETIME_USED \
+/* Local calendar fields are the only ones that need time zone conversion.
+ */
+#define _ZF_LOG_MESSAGE_FORMAT_LOCALTIME_USED \
 	(_ZF_LOG_MESSAGE_FORMAT_CONTAINS(YEAR, ZF_LOG_MESSAGE_CTX_FORMAT) || \
 	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(MONTH, ZF_LOG_MESSAGE_CTX_FORMAT) || \
 	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(DAY, ZF_LOG_MESSAGE_CTX_FORMAT) || \
 	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(HOUR, ZF_LOG_MESSAGE_CTX_FORMAT) || \
 	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(MINUTE, ZF_LOG_MESSAGE_CTX_FORMAT) || \
-	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(SECOND, ZF_LOG_MESSAGE_CTX_FORMAT) || \
-	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(MILLISECOND, ZF_LOG_MESSAGE_CTX_FORMAT))
+	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(SECOND, ZF_LOG_MESSAGE_CTX_FORMAT))
+
+#define _ZF_LOG_MESSAGE_FORMAT_UTC_USED \
+	(_ZF_LOG_MESSAGE_FORMAT_CONTAINS(UTC_YEAR, ZF_LOG_MESSAGE_CTX_FORMAT) || \
+	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(UTC_MONTH, ZF_LOG_MESSAGE_CTX_FORMAT) || \
+	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(UTC_DAY, ZF_LOG_MESSAGE_CTX_FORMAT) || \
+	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(UTC_HOUR, ZF_LOG_MESSAGE_CTX_FORMAT) || \
+	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(UTC_MINUTE, ZF_LOG_MESSAGE_CTX_FORMAT) || \
+	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(UTC_SECOND, ZF_LOG_MESSAGE_CTX_FORMAT))
+
+#define _ZF_LOG_MESSAGE_FORMAT_DATETIME_USED \
+	(_ZF_LOG_MESSAGE_FORMAT_LOCALTIME_USED || \
+	 _ZF_LOG_MESSAGE_FORMAT_UTC_USED || \
+	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(MILLISECOND, ZF_LOG_MESSAGE_CTX_FORMAT) || \
+	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(MICROSECOND, ZF_LOG_MESSAGE_CTX_FORMAT) || \
+	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(NANOSECOND, ZF_LOG_MESSAGE_CTX_FORMAT) || \
+	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(EPOCH_US, ZF_LOG_MESSAGE_CTX_FORMAT))
 
 #if defined(_MSC_VER) && !defined(__INTEL_COMPILER)
 	#pragma warning(disable:4204) /* nonstandard extension used: non-constant aggregate initializer */
@@ -500,7 +846,7 @@
 	#endif
 #endif
 
-#if ZF_LOG_OPTIMIZE_SIZE
+#if ZF_LOG_OPTIMIZE_SIZE || ZF_LOG_DEFERRED
 	#ifndef _ZF_LOG_SNPRINTF
 		#if (defined(_MSC_VER) && !defined(__INTEL_COMPILER)) || defined(__MINGW64__)
 			static int fake_snprintf(char *s, size_t sz, const char *fmt, ...)
@@ -518,10 +864,13 @@
 	#endif
 #endif
 
-typedef void (*time_cb)(struct tm *const tm, unsigned *const usec);
+typedef void (*time_cb)(struct tm *const tm, time_t *const sec,
+						unsigned *const nsec);
 typedef void (*pid_cb)(int *const pid, int *const tid);
 typedef void (*buffer_cb)(zf_log_message *msg, char *buf);
 
+/* File is a base name already, see SRC_FILE().
+ */
 typedef struct src_location
 {
 	const char *const func;
@@ -530,6 +879,16 @@ typedef struct src_location
 }
 src_location;
 
+typedef struct ctx_values
+{
+	struct tm tm;
+	time_t sec;
+	unsigned nsec;
+	int pid;
+	int tid;
+}
+ctx_values;
+
 typedef struct mem_block
 {
 	const void *const d;
@@ -537,7 +896,8 @@ typedef struct mem_block
 }
 mem_block;
 
-static void time_callback(struct tm *const tm, unsigned *const usec);
+static void time_callback(struct tm *const tm, time_t *const sec,
+						  unsigned *const nsec);
 static void pid_callback(int *const pid, int *const tid);
 static void buffer_callback(zf_log_message *msg, char *buf);
 
@@ -648,6 +1008,14 @@ static INSTRUMENTED_CONST buffer_cb g_buffer_cb = buffer_callback;
 	#define OUT_DEBUGSTRING OUT_DEBUGSTRING_MASK, 0, out_debugstring_callback
 #endif
 
+#if ZF_LOG_LARGE_MESSAGES
+/* Lines could be longer than PIPE_BUF, so all lines are written with the lock
+ * held. Otherwise short line could get in the middle of the long one when
+ * write() doesn't take it at once.
+ */
+static pthread_mutex_t g_stderr_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 void zf_log_out_stderr_callback(const zf_log_message *const msg, void *arg)
 {
 	VAR_UNUSED(arg);
@@ -659,6 +1027,22 @@ void zf_log_out_stderr_callback(const zf_log_message *const msg, void *arg)
 	DWORD written;
 	WriteFile(GetStdHandle(STD_ERROR_HANDLE), msg->buf,
 			  (DWORD)(msg->p - msg->buf + eol_len), &written, 0);
+#elif ZF_LOG_LARGE_MESSAGES
+	const size_t len = (size_t)(msg->p - msg->buf) + eol_len;
+	pthread_mutex_lock(&g_stderr_lock);
+	for (const char *p = msg->buf, *const e = p + len; e != p;)
+	{
+		const ssize_t n = write(STDERR_FILENO, p, (size_t)(e - p));
+		if (0 < n)
+		{
+			p += n;
+		}
+		else if (0 == n || EINTR != errno)
+		{
+			break;
+		}
+	}
+	pthread_mutex_unlock(&g_stderr_lock);
 #else
 	/* write() is atomic for buffers less than or equal to PIPE_BUF. */
 	RETVAL_UNUSED(write(STDERR_FILENO, msg->buf,
@@ -691,6 +1075,7 @@ static const zf_log_output out_stderr = {ZF_LOG_OUT_STDERR};
 #if !ZF_LOG_EXTERN_GLOBAL_OUTPUT_LEVEL
 	ZF_LOG_DEFINE_GLOBAL_OUTPUT_LEVEL = 0;
 #endif
+int _zf_log_global_capture_lvl = ZF_LOG_NONE;
 
 const zf_log_spec _zf_log_stderr_spec =
 {
@@ -739,64 +1124,236 @@ static char lvl_char(const int lvl)
 	#define __atomic_sub_fetch(vp, n, model) __sync_sub_and_fetch(vp, n)
 	#define __atomic_or_fetch(vp, n, model) __sync_or_and_fetch(vp, n)
 	#define __atomic_and_fetch(vp, n, model) __sync_and_and_fetch(vp, n)
+	#define __atomic_store_n(vp, v, model) \
+		do { __sync_synchronize(); *(vp) = (v); __sync_synchronize(); } while (0)
+	#define __atomic_thread_fence(model) __sync_synchronize()
 	/* Note: will not store old value of *vp in *ep (non-standard behaviour) */
 	#define __atomic_compare_exchange_n(vp, ep, d, weak, smodel, fmodel) \
 		__sync_bool_compare_and_swap(vp, *(ep), d)
 #endif
 
-#if !ZF_LOG_OPTIMIZE_SIZE && !defined(_WIN32) && !defined(_WIN64)
-#define TCACHE
-#define TCACHE_STALE (0x40000000)
-#define TCACHE_FLUID (0x40000000 | 0x80000000)
-static unsigned g_tcache_mode = TCACHE_STALE;
-static struct timeval g_tcache_tv = {0, 0};
+#if !defined(_WIN32) && !defined(_WIN64)
+	#if ZF_LOG_CLOCK == ZF_LOG_CLOCK_REALTIME_COARSE && defined(CLOCK_REALTIME_COARSE)
+		#define TIME_CLOCK CLOCK_REALTIME_COARSE
+	#else
+		#define TIME_CLOCK CLOCK_REALTIME
+	#endif
+#endif
+
+#if ZF_LOG_CLOCK == ZF_LOG_CLOCK_TSC && !defined(_WIN32) && !defined(_WIN64) && \
+	defined(__GNUC__) && _ZF_LOG_MESSAGE_FORMAT_DATETIME_USED && \
+	(defined(__x86_64__) || defined(__i386__) || \
+	 (defined(__aarch64__) && defined(__linux__)))
+/* Wall time is computed from the timestamp counter as ns + (tsc - anchor) *
+ * mult / 2^32, where mult is nanoseconds per tick measured over the last
+ * calibration interval. Calibration is protected by a sequence lock: writer
+ * makes seq odd while updating, reader retries with the clock when seq is odd
+ * or changed. Readers never block - thread that fails to grab the lock for
+ * recalibration just uses the clock this time. Conversion is valid for at
+ * most period ticks since anchor, which also guarantees no overflow.
+ */
+#define TSC
+#if 4000 < ZF_LOG_TSC_CALIBRATION_MS
+	#error ZF_LOG_TSC_CALIBRATION_MS must not exceed 4000
+#endif
+typedef struct tsc_calibration
+{
+	unsigned seq;
+	int state; /* 0 - not checked yet, 1 - invariant, -1 - not usable */
+	unsigned long long tsc;
+	unsigned long long ns;
+	unsigned long long mult;
+	unsigned long long period;
+}
+tsc_calibration;
+
+static tsc_calibration g_tsc;
+
+static INLINE unsigned long long tsc_read(void)
+{
+	#if defined(__x86_64__) || defined(__i386__)
+	unsigned lo, hi;
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return (unsigned long long)hi << 32 | lo;
+	#else
+	unsigned long long v;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+	return v;
+	#endif
+}
+
+static int tsc_invariant(void)
+{
+	#if defined(__x86_64__) || defined(__i386__)
+	/* CPUID.80000007H:EDX[8] - TSC runs at constant rate in all ACPI P-, C-
+	 * and T-states.
+	 */
+	unsigned eax, ebx, ecx, edx;
+	return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+	#else
+	/* Generic timer counter has fixed frequency by architecture. */
+	return 1;
+	#endif
+}
 
-static struct tm g_tcache_tm;
+static unsigned long long clock_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000 + (unsigned)ts.tv_nsec;
+}
 
-static INLINE int tcache_get(const struct timeval *const tv, struct tm *const tm)
+/* Must be called with the lock held. Restarts calibration when the clock or
+ * the counter went backwards (e.g. wall clock was set).
+ */
+static void tsc_update(const unsigned long long tsc, const unsigned long long ns)
 {
-	unsigned mode;
-	mode = __atomic_load_n(&g_tcache_mode, __ATOMIC_RELAXED);
-	if (0 == (mode & TCACHE_FLUID))
+	tsc_calibration *const c = &g_tsc;
+	unsigned long long mult = 0, period = 0;
+	if (0 != c->ns && tsc > c->tsc && ns > c->ns)
 	{
-		mode = __atomic_fetch_add(&g_tcache_mode, 1, __ATOMIC_ACQUIRE);
-		if (0 == (mode & TCACHE_FLUID))
+		if (0 == c->mult && ZF_LOG_TSC_WARMUP_MS * 1000000ull > ns - c->ns)
 		{
-			if (g_tcache_tv.tv_sec == tv->tv_sec)
-			{
-				*tm = g_tcache_tm;
-				__atomic_sub_fetch(&g_tcache_mode, 1, __ATOMIC_RELEASE);
-				return !0;
-			}
-			__atomic_or_fetch(&g_tcache_mode, TCACHE_STALE, __ATOMIC_RELAXED);
+			return;
+		}
+		const double ns_per_tick = (double)(ns - c->ns) / (double)(tsc - c->tsc);
+		mult = (unsigned long long)(ns_per_tick * 4294967296.0);
+		period = (unsigned long long)(ZF_LOG_TSC_CALIBRATION_MS * 1000000.0 /
+									  ns_per_tick);
+		if (0 == mult || 0 == period)
+		{
+			mult = 0;
+			period = 0;
 		}
-		__atomic_sub_fetch(&g_tcache_mode, 1, __ATOMIC_RELEASE);
 	}
-	return 0;
+	__atomic_store_n(&c->tsc, tsc, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->ns, ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->mult, mult, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->period, period, __ATOMIC_RELAXED);
+}
+
+static unsigned long long tsc_now_slow(void)
+{
+	tsc_calibration *const c = &g_tsc;
+	int state = __atomic_load_n(&c->state, __ATOMIC_RELAXED);
+	if (0 == state)
+	{
+		state = tsc_invariant()? 1: -1;
+		__atomic_store_n(&c->state, state, __ATOMIC_RELAXED);
+	}
+	if (0 > state)
+	{
+		return clock_ns();
+	}
+	const unsigned long long tsc_b = tsc_read();
+	const unsigned long long ns = clock_ns();
+	const unsigned long long tsc = tsc_b + (tsc_read() - tsc_b) / 2;
+	unsigned seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+	if (0 == (seq & 1) &&
+		__atomic_compare_exchange_n(&c->seq, &seq, seq + 1, 0,
+									__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	{
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		tsc_update(tsc, ns);
+		__atomic_store_n(&c->seq, seq + 2, __ATOMIC_RELEASE);
+	}
+	return ns;
+}
+
+static INLINE unsigned long long tsc_now(void)
+{
+	tsc_calibration *const c = &g_tsc;
+	const unsigned seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+	const unsigned long long mult = __atomic_load_n(&c->mult, __ATOMIC_RELAXED);
+	if (0 == (seq & 1) && 0 != mult)
+	{
+		const unsigned long long tsc = tsc_read();
+		const unsigned long long d = tsc - __atomic_load_n(&c->tsc, __ATOMIC_RELAXED);
+		const unsigned long long ns = __atomic_load_n(&c->ns, __ATOMIC_RELAXED);
+		const unsigned long long period = __atomic_load_n(&c->period, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (d < period && seq == __atomic_load_n(&c->seq, __ATOMIC_RELAXED))
+		{
+			return ns + (d * mult >> 32);
+		}
+	}
+	return tsc_now_slow();
+}
+#endif
+
+#if !ZF_LOG_OPTIMIZE_SIZE && !defined(_WIN32) && !defined(_WIN64) && \
+	defined(__GNUC__) && _ZF_LOG_MESSAGE_FORMAT_LOCALTIME_USED
+/* Broken-down time for the current second is cached per thread, so threads
+ * never compete for the same cache line and localtime_r() is called once a
+ * second per thread.
+ */
+#define TCACHE
+typedef struct tcache
+{
+	time_t sec;
+	int valid;
+	struct tm tm;
+}
+tcache;
+
+static __thread tcache g_tcache;
+#endif
+
+#if !ZF_LOG_OPTIMIZE_SIZE && !ZF_LOG_NO_PID_CACHE && \
+	!defined(_WIN32) && !defined(_WIN64) && defined(__GNUC__) && \
+	(_ZF_LOG_MESSAGE_FORMAT_CONTAINS(PID, ZF_LOG_MESSAGE_CTX_FORMAT) || \
+	 _ZF_LOG_MESSAGE_FORMAT_CONTAINS(TID, ZF_LOG_MESSAGE_CTX_FORMAT))
+/* Process id is cached process-wide, thread id in thread-local storage. Zero
+ * means not cached yet. Child process created by fork() starts with empty
+ * cache, since both values are different there. Values are not cached when
+ * pthread_atfork() fails.
+ */
+#define PCACHE
+static int g_pcache_pid;
+static __thread int g_pcache_tid;
+static int g_pcache_state; /* 0 - not known yet, 1 - cache is used, -1 - not */
+
+static void pcache_reset(void)
+{
+	__atomic_store_n(&g_pcache_pid, 0, __ATOMIC_RELAXED);
+	g_pcache_tid = 0;
 }
 
-static INLINE void tcache_set(const struct timeval *const tv, struct tm *const tm)
+/* Threads could race to register the handler, which is harmless.
+ */
+static int pcache_enabled(void)
 {
-	unsigned stale = TCACHE_STALE;
-	if (__atomic_compare_exchange_n(&g_tcache_mode, &stale, TCACHE_FLUID,
-									0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	int state = __atomic_load_n(&g_pcache_state, __ATOMIC_RELAXED);
+	if (0 == state)
 	{
-		g_tcache_tv = *tv;
-		g_tcache_tm = *tm;
-		__atomic_and_fetch(&g_tcache_mode, ~TCACHE_FLUID, __ATOMIC_RELEASE);
+		state = 0 == pthread_atfork(0, 0, pcache_reset)? 1: -1;
+		__atomic_store_n(&g_pcache_state, state, __ATOMIC_RELAXED);
 	}
+	return 0 < state;
 }
 #endif
 
-static void time_callback(struct tm *const tm, unsigned *const msec)
+static void time_callback(struct tm *const tm, time_t *const sec,
+						  unsigned *const nsec)
 {
 #if !_ZF_LOG_MESSAGE_FORMAT_DATETIME_USED
 	VAR_UNUSED(tm);
-	VAR_UNUSED(msec);
+	VAR_UNUSED(sec);
+	VAR_UNUSED(nsec);
 #else
 	#if defined(_WIN32) || defined(_WIN64)
+	/* FILETIME is number of 100 ns intervals since 1601-01-01 UTC. */
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	const unsigned long long t = ((unsigned long long)ft.dwHighDateTime << 32 |
+								  ft.dwLowDateTime) - 116444736000000000ull;
+	*sec = (time_t)(t / 10000000);
+	*nsec = (unsigned)(t % 10000000) * 100;
+		#if _ZF_LOG_MESSAGE_FORMAT_LOCALTIME_USED
+	FILETIME lft;
 	SYSTEMTIME st;
-	GetLocalTime(&st);
+	FileTimeToLocalFileTime(&ft, &lft);
+	FileTimeToSystemTime(&lft, &st);
 	tm->tm_year = st.wYear;
 	tm->tm_mon = st.wMonth - 1;
 	tm->tm_mday = st.wDay;
@@ -804,24 +1361,96 @@ static void time_callback(struct tm *const tm, unsigned *const msec)
 	tm->tm_hour = st.wHour;
 	tm->tm_min = st.wMinute;
 	tm->tm_sec = st.wSecond;
-	*msec = st.wMilliseconds;
+		#else
+	VAR_UNUSED(tm);
+		#endif
 	#else
+		#if defined(TSC)
+	const unsigned long long ns = tsc_now();
+	*sec = (time_t)(ns / 1000000000);
+	*nsec = (unsigned)(ns % 1000000000);
+		#elif ZF_LOG_CLOCK == ZF_LOG_CLOCK_GETTIMEOFDAY
 	struct timeval tv;
 	gettimeofday(&tv, 0);
-		#ifndef TCACHE
-		localtime_r(&tv.tv_sec, tm);
+	*sec = tv.tv_sec;
+	*nsec = (unsigned)tv.tv_usec * 1000;
 		#else
-		if (!tcache_get(&tv, tm))
-		{
-			localtime_r(&tv.tv_sec, tm);
-			tcache_set(&tv, tm);
-		}
+	struct timespec ts;
+	clock_gettime(TIME_CLOCK, &ts);
+	*sec = ts.tv_sec;
+	*nsec = (unsigned)ts.tv_nsec;
+		#endif
+		#if !_ZF_LOG_MESSAGE_FORMAT_LOCALTIME_USED
+	VAR_UNUSED(tm);
+		#elif !defined(TCACHE)
+	localtime_r(sec, tm);
+		#else
+	tcache *const c = &g_tcache;
+	if (!c->valid || c->sec != *sec)
+	{
+		localtime_r(sec, &c->tm);
+		c->sec = *sec;
+		c->valid = 1;
+	}
+	*tm = c->tm;
 		#endif
-	*msec = (unsigned)tv.tv_usec / 1000;
 	#endif
 #endif
 }
 
+#if _ZF_LOG_MESSAGE_FORMAT_UTC_USED
+/* Converts seconds since epoch to UTC calendar fields. Days to civil date
+ * conversion is done arithmetically (proleptic Gregorian calendar), so no
+ * time zone database lookups or locks are involved.
+ */
+static void utc_time(const time_t t, struct tm *const tm)
+{
+	long long days = (long long)t / 86400;
+	long long secs = (long long)t % 86400;
+	if (0 > secs)
+	{
+		secs += 86400;
+		--days;
+	}
+	/* Shift epoch to 0000-03-01, so leap day is the last day of the year. */
+	days += 719468;
+	const long long era = (0 <= days? days: days - 146096) / 146097;
+	const unsigned doe = (unsigned)(days - era * 146097);
+	const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const unsigned mp = (5 * doy + 2) / 153;
+	const unsigned month = 10 > mp? mp + 3: mp - 9;
+	tm->tm_year = (int)(yoe + era * 400 + (2 >= month) - 1900);
+	tm->tm_mon = (int)month - 1;
+	tm->tm_mday = (int)(doy - (153 * mp + 2) / 5 + 1);
+	tm->tm_hour = (int)(secs / 3600);
+	tm->tm_min = (int)(secs / 60 % 60);
+	tm->tm_sec = (int)(secs % 60);
+}
+#endif
+
+#if _ZF_LOG_MESSAGE_FORMAT_CONTAINS(TID, ZF_LOG_MESSAGE_CTX_FORMAT)
+static INLINE int get_tid(void)
+{
+	#if defined(_WIN32) || defined(_WIN64)
+	return (int)GetCurrentThreadId();
+	#elif defined(__ANDROID__)
+	return gettid();
+	#elif defined(__linux__)
+	return (int)syscall(SYS_gettid);
+	#elif defined(__MACH__)
+	return (int)pthread_mach_thread_np(pthread_self());
+	#elif defined(_AIX)
+	pthread_t t = pthread_self();
+	struct __pthrdsinfo tinfo;
+	pthread_getthrds_np(&t, PTHRDSINFO_QUERY_TID, &tinfo, sizeof(tinfo), NULL, 0);
+	return (int)tinfo.__pi_tid;
+	#else
+		#define Platform not supported
+	#endif
+}
+#endif
+
 static void pid_callback(int *const pid, int *const tid)
 {
 #if !_ZF_LOG_MESSAGE_FORMAT_CONTAINS(PID, ZF_LOG_MESSAGE_CTX_FORMAT)
@@ -829,6 +1458,15 @@ static void pid_callback(int *const pid, int *const tid)
 #else
 	#if defined(_WIN32) || defined(_WIN64)
 	*pid = GetCurrentProcessId();
+	#elif defined(PCACHE)
+	if (0 == (*pid = __atomic_load_n(&g_pcache_pid, __ATOMIC_RELAXED)))
+	{
+		*pid = getpid();
+		if (pcache_enabled())
+		{
+			__atomic_store_n(&g_pcache_pid, *pid, __ATOMIC_RELAXED);
+		}
+	}
 	#else
 	*pid = getpid();
 	#endif
@@ -837,21 +1475,17 @@ static void pid_callback(int *const pid, int *const tid)
 #if !_ZF_LOG_MESSAGE_FORMAT_CONTAINS(TID, ZF_LOG_MESSAGE_CTX_FORMAT)
 	VAR_UNUSED(tid);
 #else
-	#if defined(_WIN32) || defined(_WIN64)
-	*tid = GetCurrentThreadId();
-	#elif defined(__ANDROID__)
-	*tid = gettid();
-	#elif defined(__linux__)
-	*tid = syscall(SYS_gettid);
-	#elif defined(__MACH__)
-	*tid = (int)pthread_mach_thread_np(pthread_self());
-	#elif defined(_AIX)
-	pthread_t t = pthread_self();
-	struct __pthrdsinfo tinfo;
-	pthread_getthrds_np(&t, PTHRDSINFO_QUERY_TID, &tinfo, sizeof(tinfo), NULL, 0);
-	*tid = (int)tinfo.__pi_tid;
+	#if defined(PCACHE)
+	if (0 == (*tid = g_pcache_tid))
+	{
+		*tid = get_tid();
+		if (pcache_enabled())
+		{
+			g_pcache_tid = *tid;
+		}
+	}
 	#else
-		#define Platform not supported
+	*tid = get_tid();
 	#endif
 #endif
 }
@@ -861,6 +1495,54 @@ static void buffer_callback(zf_log_message *msg, char *buf)
 	msg->e = (msg->p = msg->buf = buf) + g_buf_sz;
 }
 
+#if ZF_LOG_LARGE_MESSAGES
+/* Per-thread buffer for messages that don't fit into the log line buffer (see
+ * ZF_LOG_LARGE_MESSAGES). It's freed when thread exits.
+ */
+typedef struct large_buf
+{
+	char *buf;
+	size_t sz;
+	int taken;
+}
+large_buf;
+
+STATIC_ASSERT(max_line_sz_not_less_than_buf_sz, ZF_LOG_BUF_SZ <= ZF_LOG_MAX_LINE_SZ);
+static __thread large_buf g_large_buf;
+static pthread_key_t g_large_buf_key;
+static pthread_once_t g_large_buf_once = PTHREAD_ONCE_INIT;
+
+static void large_buf_key_create(void)
+{
+	if (0 != pthread_key_create(&g_large_buf_key, free))
+	{
+		/* Buffers will leak when threads exit. */
+		g_large_buf_key = (pthread_key_t)-1;
+	}
+}
+
+static int large_buf_reserve(large_buf *const lb, const size_t sz)
+{
+	if (lb->sz >= sz)
+	{
+		return 0;
+	}
+	char *const buf = (char *)realloc(lb->buf, sz);
+	if (0 == buf)
+	{
+		return -1;
+	}
+	pthread_once(&g_large_buf_once, large_buf_key_create);
+	if ((pthread_key_t)-1 != g_large_buf_key)
+	{
+		pthread_setspecific(g_large_buf_key, buf);
+	}
+	lb->buf = buf;
+	lb->sz = sz;
+	return 0;
+}
+#endif
+
 #if _ZF_LOG_MESSAGE_FORMAT_CONTAINS(FUNCTION, ZF_LOG_MESSAGE_SRC_FORMAT)
 static const char *funcname(const char *func)
 {
@@ -881,6 +1563,9 @@ static const char *filename(const char *file)
 	}
 	return f;
 }
+	#define SRC_FILE(file) filename(file)
+#else
+	#define SRC_FILE(file) (file)
 #endif
 
 static INLINE size_t nprintf_size(zf_log_message *const msg)
@@ -934,6 +1619,12 @@ static INLINE char *put_uint_r(const unsigned v, const unsigned w, const char wc
 	return put_integer_r(v, 0, w, wc, e);
 }
 
+static INLINE char *put_ullong_r(unsigned long long v, char *p)
+{
+	do { *--p = '0' + v % 10; } while (0 != (v /= 10));
+	return p;
+}
+
 static INLINE char *put_int_r(const int v, const unsigned w, const char wc,
 							  char *const e)
 {
@@ -994,6 +1685,15 @@ static INLINE char *put_uint(unsigned v, const unsigned w, const char wc,
 #define _ZF_LOG_MESSAGE_FORMAT_INIT__MINUTE
 #define _ZF_LOG_MESSAGE_FORMAT_INIT__SECOND
 #define _ZF_LOG_MESSAGE_FORMAT_INIT__MILLISECOND
+#define _ZF_LOG_MESSAGE_FORMAT_INIT__MICROSECOND
+#define _ZF_LOG_MESSAGE_FORMAT_INIT__NANOSECOND
+#define _ZF_LOG_MESSAGE_FORMAT_INIT__UTC_YEAR
+#define _ZF_LOG_MESSAGE_FORMAT_INIT__UTC_MONTH
+#define _ZF_LOG_MESSAGE_FORMAT_INIT__UTC_DAY
+#define _ZF_LOG_MESSAGE_FORMAT_INIT__UTC_HOUR
+#define _ZF_LOG_MESSAGE_FORMAT_INIT__UTC_MINUTE
+#define _ZF_LOG_MESSAGE_FORMAT_INIT__UTC_SECOND
+#define _ZF_LOG_MESSAGE_FORMAT_INIT__EPOCH_US
 #define _ZF_LOG_MESSAGE_FORMAT_INIT__PID
 #define _ZF_LOG_MESSAGE_FORMAT_INIT__TID
 #define _ZF_LOG_MESSAGE_FORMAT_INIT__LEVEL
@@ -1018,6 +1718,15 @@ static INLINE char *put_uint(unsigned v, const unsigned w, const char wc,
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__MINUTE       "%02u"
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__SECOND       "%02u"
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__MILLISECOND  "%03u"
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__MICROSECOND  "%06u"
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__NANOSECOND   "%09u"
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__UTC_YEAR     "%04u"
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__UTC_MONTH    "%02u"
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__UTC_DAY      "%02u"
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__UTC_HOUR     "%02u"
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__UTC_MINUTE   "%02u"
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__UTC_SECOND   "%02u"
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__EPOCH_US     "%llu"
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__PID          "%5i"
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__TID          "%5i"
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT__LEVEL        "%c"
@@ -1031,23 +1740,35 @@ static INLINE char *put_uint(unsigned v, const unsigned w, const char wc,
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT(field) \
 	_PP_CONCAT_3(_ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT_, _, field)
 
+#define EPOCH_US_VALUE(ctx) \
+	((unsigned long long)(ctx)->sec * 1000000 + (ctx)->nsec / 1000)
+
 /* Implements generation of printf-like format parameters for log message
  * format specification.
  */
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__
-#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__YEAR         ,(unsigned)(tm.tm_year + 1900)
-#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__MONTH        ,(unsigned)(tm.tm_mon + 1)
-#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__DAY          ,(unsigned)tm.tm_mday
-#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__HOUR         ,(unsigned)tm.tm_hour
-#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__MINUTE       ,(unsigned)tm.tm_min
-#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__SECOND       ,(unsigned)tm.tm_sec
-#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__MILLISECOND  ,(unsigned)msec
-#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__PID          ,pid
-#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__TID          ,tid
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__YEAR         ,(unsigned)(ctx->tm.tm_year + 1900)
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__MONTH        ,(unsigned)(ctx->tm.tm_mon + 1)
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__DAY          ,(unsigned)ctx->tm.tm_mday
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__HOUR         ,(unsigned)ctx->tm.tm_hour
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__MINUTE       ,(unsigned)ctx->tm.tm_min
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__SECOND       ,(unsigned)ctx->tm.tm_sec
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__MILLISECOND  ,ctx->nsec / 1000000
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__MICROSECOND  ,ctx->nsec / 1000
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__NANOSECOND   ,ctx->nsec
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__UTC_YEAR     ,(unsigned)(utc.tm_year + 1900)
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__UTC_MONTH    ,(unsigned)(utc.tm_mon + 1)
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__UTC_DAY      ,(unsigned)utc.tm_mday
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__UTC_HOUR     ,(unsigned)utc.tm_hour
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__UTC_MINUTE   ,(unsigned)utc.tm_min
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__UTC_SECOND   ,(unsigned)utc.tm_sec
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__EPOCH_US     ,EPOCH_US_VALUE(ctx)
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__PID          ,ctx->pid
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__TID          ,ctx->tid
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__LEVEL        ,(char)lvl_char(msg->lvl)
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__TAG          UNDEFINED
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__FUNCTION     ,funcname(src->func)
-#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__FILENAME     ,filename(src->file)
+#define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__FILENAME     ,src->file
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__FILELINE     ,src->line
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__S(s)
 #define _ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL__F_INIT(expr)
@@ -1058,15 +1779,24 @@ static INLINE char *put_uint(unsigned v, const unsigned w, const char wc,
 /* Implements generation of put_xxx_t statements for log message specification.
  */
 #define _ZF_LOG_MESSAGE_FORMAT_PUT_R__
-#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__YEAR         p = put_uint_r(tm.tm_year + 1900, 4, '0', p);
-#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__MONTH        p = put_uint_r((unsigned)tm.tm_mon + 1, 2, '0', p);
-#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__DAY          p = put_uint_r((unsigned)tm.tm_mday, 2, '0', p);
-#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__HOUR         p = put_uint_r((unsigned)tm.tm_hour, 2, '0', p);
-#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__MINUTE       p = put_uint_r((unsigned)tm.tm_min, 2, '0', p);
-#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__SECOND       p = put_uint_r((unsigned)tm.tm_sec, 2, '0', p);
-#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__MILLISECOND  p = put_uint_r(msec, 3, '0', p);
-#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__PID          p = put_int_r(pid, 5, ' ', p);
-#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__TID          p = put_int_r(tid, 5, ' ', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__YEAR         p = put_uint_r(ctx->tm.tm_year + 1900, 4, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__MONTH        p = put_uint_r((unsigned)ctx->tm.tm_mon + 1, 2, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__DAY          p = put_uint_r((unsigned)ctx->tm.tm_mday, 2, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__HOUR         p = put_uint_r((unsigned)ctx->tm.tm_hour, 2, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__MINUTE       p = put_uint_r((unsigned)ctx->tm.tm_min, 2, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__SECOND       p = put_uint_r((unsigned)ctx->tm.tm_sec, 2, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__MILLISECOND  p = put_uint_r(ctx->nsec / 1000000, 3, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__MICROSECOND  p = put_uint_r(ctx->nsec / 1000, 6, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__NANOSECOND   p = put_uint_r(ctx->nsec, 9, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__UTC_YEAR     p = put_uint_r((unsigned)utc.tm_year + 1900, 4, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__UTC_MONTH    p = put_uint_r((unsigned)utc.tm_mon + 1, 2, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__UTC_DAY      p = put_uint_r((unsigned)utc.tm_mday, 2, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__UTC_HOUR     p = put_uint_r((unsigned)utc.tm_hour, 2, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__UTC_MINUTE   p = put_uint_r((unsigned)utc.tm_min, 2, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__UTC_SECOND   p = put_uint_r((unsigned)utc.tm_sec, 2, '0', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__EPOCH_US     p = put_ullong_r(EPOCH_US_VALUE(ctx), p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__PID          p = put_int_r(ctx->pid, 5, ' ', p);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R__TID          p = put_int_r(ctx->tid, 5, ' ', p);
 #define _ZF_LOG_MESSAGE_FORMAT_PUT_R__LEVEL        *--p = lvl_char(msg->lvl);
 #define _ZF_LOG_MESSAGE_FORMAT_PUT_R__TAG          UNDEFINED
 #define _ZF_LOG_MESSAGE_FORMAT_PUT_R__FUNCTION     UNDEFINED
@@ -1078,23 +1808,123 @@ static INLINE char *put_uint(unsigned v, const unsigned w, const char wc,
 #define _ZF_LOG_MESSAGE_FORMAT_PUT_R(field) \
 	_PP_CONCAT_3(_ZF_LOG_MESSAGE_FORMAT_PUT_R_, _, field)
 
-static void put_ctx(zf_log_message *const msg)
-{
-	_PP_MAP(_ZF_LOG_MESSAGE_FORMAT_INIT, ZF_LOG_MESSAGE_CTX_FORMAT)
-#if !_ZF_LOG_MESSAGE_FORMAT_FIELDS(ZF_LOG_MESSAGE_CTX_FORMAT)
-	VAR_UNUSED(msg);
-#else
-	#if _ZF_LOG_MESSAGE_FORMAT_DATETIME_USED
-	struct tm tm;
-	unsigned msec;
-	g_time_cb(&tm, &msec);
-	#endif
-	#if _ZF_LOG_MESSAGE_FORMAT_CONTAINS(PID, ZF_LOG_MESSAGE_CTX_FORMAT) || \
-		_ZF_LOG_MESSAGE_FORMAT_CONTAINS(TID, ZF_LOG_MESSAGE_CTX_FORMAT)
-	int pid, tid;
-	g_pid_cb(&pid, &tid);
+/* Fields that change at most once a second. Leading run of such fields in
+ * context format is rendered once a second per thread and then copied as is
+ * (see CTX_CACHE).
+ */
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__             0
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__YEAR         1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__MONTH        1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__DAY          1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__HOUR         1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__MINUTE       1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__SECOND       1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__MILLISECOND  0
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__MICROSECOND  0
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__NANOSECOND   0
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__UTC_YEAR     1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__UTC_MONTH    1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__UTC_DAY      1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__UTC_HOUR     1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__UTC_MINUTE   1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__UTC_SECOND   1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__EPOCH_US     0
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__PID          0
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__TID          0
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__LEVEL        0
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__S(s)         1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__F_INIT(expr) 0
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY__F_UINT(w, v) 0
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY(field) \
+	_PP_CONCAT_3(_ZF_LOG_MESSAGE_FORMAT_SECONDLY_, _, field)
+
+/* Evaluates to the number of leading fields in format that change at most
+ * once a second. For (a, b, c) it expands into:
+ *
+ *   0 + SECONDLY(a) * (1 + SECONDLY(b) * (1 + SECONDLY(c) * (1)))
+ */
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY_OPEN(field) \
+	+ _ZF_LOG_MESSAGE_FORMAT_SECONDLY(field) * (1
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY_CLOSE(field) )
+#define _ZF_LOG_MESSAGE_FORMAT_SECONDLY_PREFIX(format) \
+	(0 _PP_MAP(_ZF_LOG_MESSAGE_FORMAT_SECONDLY_OPEN, format) \
+	   _PP_MAP(_ZF_LOG_MESSAGE_FORMAT_SECONDLY_CLOSE, format))
+#define _ZF_LOG_MESSAGE_FORMAT_ONE(field) + 1
+
+#define CTX_BUF_SZ 128
+
+#if !ZF_LOG_OPTIMIZE_SIZE && !defined(_WIN32) && !defined(_WIN64) && \
+	defined(__GNUC__) && \
+	(_ZF_LOG_MESSAGE_FORMAT_LOCALTIME_USED || _ZF_LOG_MESSAGE_FORMAT_UTC_USED) && \
+	_ZF_LOG_MESSAGE_FORMAT_SECONDLY_PREFIX(ZF_LOG_MESSAGE_CTX_FORMAT)
+/* Rendered leading part of the context that only depends on the current
+ * second (e.g. "12-23 12:34:56.") is cached per thread, so each line copies it
+ * and renders only the rest. Cache is keyed by seconds since epoch.
+ */
+#define CTX_CACHE
+#define CTX_PREFIX_FIELDS \
+	_ZF_LOG_MESSAGE_FORMAT_SECONDLY_PREFIX(ZF_LOG_MESSAGE_CTX_FORMAT)
+#define CTX_FIELDS (0 _PP_MAP(_ZF_LOG_MESSAGE_FORMAT_ONE, ZF_LOG_MESSAGE_CTX_FORMAT))
+/* Both expand into straight-line code where f_idx is known at compile time
+ * for every field, so conditions are folded away.
+ */
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R_SUFFIX(field) \
+	if (CTX_PREFIX_FIELDS < f_idx--) { _ZF_LOG_MESSAGE_FORMAT_PUT_R(field) }
+#define _ZF_LOG_MESSAGE_FORMAT_PUT_R_PREFIX(field) \
+	if (CTX_PREFIX_FIELDS >= f_idx--) { _ZF_LOG_MESSAGE_FORMAT_PUT_R(field) }
+
+typedef struct ctx_cache
+{
+	time_t sec;
+	unsigned len;
+	int valid;
+	char buf[CTX_BUF_SZ];
+}
+ctx_cache;
+
+static __thread ctx_cache g_ctx_cache;
+#endif
+
+#if ZF_LOG_ASYNC_PER_THREAD && _ZF_LOG_MESSAGE_FORMAT_DATETIME_USED
+/* Time of the last context put by the thread (0 when already taken). Per
+ * thread asynchronous output stamps the line with it instead of reading the
+ * clock once more.
+ */
+#define CTX_TS
+static __thread unsigned long long g_ctx_ts;
+#endif
+
+static INLINE void get_ctx(ctx_values *const ctx)
+{
+#if _ZF_LOG_MESSAGE_FORMAT_DATETIME_USED
+	g_time_cb(&ctx->tm, &ctx->sec, &ctx->nsec);
+	#ifdef CTX_TS
+	g_ctx_ts = (unsigned long long)ctx->sec * 1000000000u + ctx->nsec;
 	#endif
+#endif
+#if _ZF_LOG_MESSAGE_FORMAT_CONTAINS(PID, ZF_LOG_MESSAGE_CTX_FORMAT) || \
+	_ZF_LOG_MESSAGE_FORMAT_CONTAINS(TID, ZF_LOG_MESSAGE_CTX_FORMAT)
+	g_pid_cb(&ctx->pid, &ctx->tid);
+#endif
+#if !_ZF_LOG_MESSAGE_FORMAT_DATETIME_USED && \
+	!_ZF_LOG_MESSAGE_FORMAT_CONTAINS(PID, ZF_LOG_MESSAGE_CTX_FORMAT) && \
+	!_ZF_LOG_MESSAGE_FORMAT_CONTAINS(TID, ZF_LOG_MESSAGE_CTX_FORMAT)
+	VAR_UNUSED(ctx);
+#endif
+}
 
+static void put_ctx_values(zf_log_message *const msg,
+						   const ctx_values *const ctx)
+{
+	_PP_MAP(_ZF_LOG_MESSAGE_FORMAT_INIT, ZF_LOG_MESSAGE_CTX_FORMAT)
+#if !_ZF_LOG_MESSAGE_FORMAT_FIELDS(ZF_LOG_MESSAGE_CTX_FORMAT)
+	VAR_UNUSED(msg);
+	VAR_UNUSED(ctx);
+#else
+	#if _ZF_LOG_MESSAGE_FORMAT_UTC_USED
+	struct tm utc;
+	utc_time(ctx->sec, &utc);
+	#endif
 	#if ZF_LOG_OPTIMIZE_SIZE
 	int n;
 	n = _ZF_LOG_SNPRINTF(msg->p, nprintf_size(msg),
@@ -1102,20 +1932,57 @@ static void put_ctx(zf_log_message *const msg)
 						 _PP_MAP(_ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL, ZF_LOG_MESSAGE_CTX_FORMAT));
 	put_nprintf(msg, n);
 	#else
-	char buf[64];
+	char buf[CTX_BUF_SZ];
 	char *const e = buf + sizeof(buf);
 	char *p = e;
+		#ifndef CTX_CACHE
 	_PP_RMAP(_ZF_LOG_MESSAGE_FORMAT_PUT_R, ZF_LOG_MESSAGE_CTX_FORMAT)
+		#else
+	ctx_cache *const c = &g_ctx_cache;
+	unsigned f_idx = CTX_FIELDS;
+	_PP_RMAP(_ZF_LOG_MESSAGE_FORMAT_PUT_R_SUFFIX, ZF_LOG_MESSAGE_CTX_FORMAT)
+	if (c->valid && c->sec == ctx->sec)
+	{
+		p -= c->len;
+		memcpy(p, c->buf, c->len);
+	}
+	else
+	{
+		char *const s = p;
+		f_idx = CTX_FIELDS;
+		_PP_RMAP(_ZF_LOG_MESSAGE_FORMAT_PUT_R_PREFIX, ZF_LOG_MESSAGE_CTX_FORMAT)
+		c->len = (unsigned)(s - p);
+		memcpy(c->buf, p, c->len);
+		c->sec = ctx->sec;
+		c->valid = 1;
+	}
+		#endif
 	msg->p = put_stringn(p, e, msg->p, msg->e);
 	#endif
+	#if !_ZF_LOG_MESSAGE_FORMAT_DATETIME_USED && \
+		!_ZF_LOG_MESSAGE_FORMAT_CONTAINS(PID, ZF_LOG_MESSAGE_CTX_FORMAT) && \
+		!_ZF_LOG_MESSAGE_FORMAT_CONTAINS(TID, ZF_LOG_MESSAGE_CTX_FORMAT)
+	VAR_UNUSED(ctx);
+	#endif
+#endif
+}
+
+static void put_ctx(zf_log_message *const msg)
+{
+#if !_ZF_LOG_MESSAGE_FORMAT_FIELDS(ZF_LOG_MESSAGE_CTX_FORMAT)
+	put_ctx_values(msg, 0);
+#else
+	ctx_values ctx;
+	get_ctx(&ctx);
+	put_ctx_values(msg, &ctx);
 #endif
 }
 
-#define PUT_TAG(msg, tag, prefix_delim, tag_delim) \
+#define PUT_TAG(msg, prefix, tag, prefix_delim, tag_delim) \
 	do { \
 		const char *ch; \
 		msg->tag_b = msg->p; \
-		if (0 != (ch = _zf_log_tag_prefix)) { \
+		if (0 != (ch = prefix)) { \
 			for (;msg->e != msg->p && 0 != (*msg->p = *ch); ++msg->p, ++ch) {} \
 		} \
 		if (0 != (ch = tag) && 0 != tag[0]) { \
@@ -1130,6 +1997,115 @@ static void put_ctx(zf_log_message *const msg)
 		} \
 	} _ZF_LOG_ONCE
 
+#if !ZF_LOG_OPTIMIZE_SIZE && !defined(_WIN32) && !defined(_WIN64) && \
+	defined(__GNUC__) && \
+	_ZF_LOG_MESSAGE_FORMAT_CONTAINS(TAG(,), ZF_LOG_MESSAGE_TAG_FORMAT)
+/* Rendered tag ("prefix.tag ") is cached per thread, so it can be copied with
+ * a single memcpy(). Entries are keyed by tag, tag prefix and delimiter
+ * pointers plus tag prefix generation, which is bumped by
+ * zf_log_set_tag_prefix(). Since tag could be a reused buffer (not a string
+ * literal), its content is verified on each hit. Only the current tag prefix
+ * is cached, deferred records carry their own copy and are rendered directly.
+ */
+#define TAG_CACHE
+#define TAG_CACHE_SZ 32
+#define TAG_CACHE_BUF_SZ 64
+
+enum
+{
+	TAG_CACHE_EMPTY,
+	TAG_CACHE_OK,
+	TAG_CACHE_TOO_LONG
+};
+
+typedef struct tag_cache
+{
+	const char *prefix;
+	const char *tag;
+	const char *prefix_delim;
+	const char *tag_delim;
+	unsigned gen;
+	unsigned char state;
+	unsigned char len;
+	unsigned char tag_off;
+	unsigned char tag_sz;
+	char buf[TAG_CACHE_BUF_SZ];
+}
+tag_cache;
+
+static unsigned g_tag_prefix_gen;
+static __thread tag_cache g_tag_cache[TAG_CACHE_SZ];
+
+static INLINE tag_cache *tag_cache_lookup(const char *const prefix,
+										  const char *const tag,
+										  const char *const prefix_delim,
+										  const char *const tag_delim)
+{
+	const size_t h = (size_t)tag ^ (size_t)tag >> 7 ^ (size_t)prefix_delim;
+	tag_cache *const c = g_tag_cache + (h >> 3) % TAG_CACHE_SZ;
+	const unsigned gen = __atomic_load_n(&g_tag_prefix_gen, __ATOMIC_RELAXED);
+	if (c->tag != tag || c->prefix != prefix || c->gen != gen ||
+		c->prefix_delim != prefix_delim || c->tag_delim != tag_delim ||
+		(TAG_CACHE_OK == c->state && 0 != tag &&
+		 /* Tag could be shorter now, so its end is checked last. */
+		 (0 != strncmp(tag, c->buf + c->tag_off, c->tag_sz) ||
+		  0 != tag[c->tag_sz])))
+	{
+		c->prefix = prefix;
+		c->tag = tag;
+		c->prefix_delim = prefix_delim;
+		c->tag_delim = tag_delim;
+		c->gen = gen;
+		c->state = TAG_CACHE_EMPTY;
+	}
+	return c;
+}
+
+static void tag_cache_fill(tag_cache *const c, const zf_log_message *const t,
+						   const char *const tag)
+{
+	if (t->e == t->p)
+	{
+		/* Could be truncated. */
+		c->state = TAG_CACHE_TOO_LONG;
+		return;
+	}
+	c->len = (unsigned char)(t->p - c->buf);
+	c->tag_sz = (unsigned char)(0 != tag? strlen(tag): 0);
+	c->tag_off = (unsigned char)(t->tag_e - c->buf - c->tag_sz);
+	c->state = TAG_CACHE_OK;
+}
+
+#define PUT_TAG_CACHED(msg, prefix, tag, prefix_delim, tag_delim) \
+	do { \
+		tag_cache *const tc = prefix == _zf_log_tag_prefix? \
+			tag_cache_lookup(prefix, tag, prefix_delim, tag_delim): 0; \
+		if (0 != tc && TAG_CACHE_EMPTY == tc->state) { \
+			zf_log_message tm; \
+			tm.p = tc->buf; \
+			tm.e = tc->buf + sizeof(tc->buf); \
+			PUT_TAG((&tm), prefix, tag, prefix_delim, tag_delim); \
+			tag_cache_fill(tc, &tm, tag); \
+		} \
+		if (0 != tc && TAG_CACHE_OK == tc->state && \
+			tc->len <= msg->e - msg->p) { \
+			/* Fixed size copy is much cheaper than exact one. */ \
+			if ((ptrdiff_t)sizeof(tc->buf) <= msg->e - msg->p) { \
+				memcpy(msg->p, tc->buf, sizeof(tc->buf)); \
+			} \
+			else { \
+				memcpy(msg->p, tc->buf, tc->len); \
+			} \
+			msg->tag_b = msg->p; \
+			msg->tag_e = msg->p + tc->tag_off + tc->tag_sz; \
+			msg->p += tc->len; \
+		} \
+		else { \
+			PUT_TAG(msg, prefix, tag, prefix_delim, tag_delim); \
+		} \
+	} _ZF_LOG_ONCE
+#endif
+
 /* Implements simple put statements for log message specification.
  */
 #define _ZF_LOG_MESSAGE_FORMAT_PUT__
@@ -1140,12 +2116,25 @@ static void put_ctx(zf_log_message *const msg)
 #define _ZF_LOG_MESSAGE_FORMAT_PUT__MINUTE       UNDEFINED
 #define _ZF_LOG_MESSAGE_FORMAT_PUT__SECOND       UNDEFINED
 #define _ZF_LOG_MESSAGE_FORMAT_PUT__MILLISECOND  UNDEFINED
+#define _ZF_LOG_MESSAGE_FORMAT_PUT__MICROSECOND  UNDEFINED
+#define _ZF_LOG_MESSAGE_FORMAT_PUT__NANOSECOND   UNDEFINED
+#define _ZF_LOG_MESSAGE_FORMAT_PUT__UTC_YEAR     UNDEFINED
+#define _ZF_LOG_MESSAGE_FORMAT_PUT__UTC_MONTH    UNDEFINED
+#define _ZF_LOG_MESSAGE_FORMAT_PUT__UTC_DAY      UNDEFINED
+#define _ZF_LOG_MESSAGE_FORMAT_PUT__UTC_HOUR     UNDEFINED
+#define _ZF_LOG_MESSAGE_FORMAT_PUT__UTC_MINUTE   UNDEFINED
+#define _ZF_LOG_MESSAGE_FORMAT_PUT__UTC_SECOND   UNDEFINED
+#define _ZF_LOG_MESSAGE_FORMAT_PUT__EPOCH_US     UNDEFINED
 #define _ZF_LOG_MESSAGE_FORMAT_PUT__PID          UNDEFINED
 #define _ZF_LOG_MESSAGE_FORMAT_PUT__TID          UNDEFINED
 #define _ZF_LOG_MESSAGE_FORMAT_PUT__LEVEL        UNDEFINED
-#define _ZF_LOG_MESSAGE_FORMAT_PUT__TAG(pd, td)  PUT_TAG(msg, tag, pd, td);
+#ifndef TAG_CACHE
+	#define _ZF_LOG_MESSAGE_FORMAT_PUT__TAG(pd, td)  PUT_TAG(msg, prefix, tag, pd, td);
+#else
+	#define _ZF_LOG_MESSAGE_FORMAT_PUT__TAG(pd, td)  PUT_TAG_CACHED(msg, prefix, tag, pd, td);
+#endif
 #define _ZF_LOG_MESSAGE_FORMAT_PUT__FUNCTION     msg->p = put_string(funcname(src->func), msg->p, msg->e);
-#define _ZF_LOG_MESSAGE_FORMAT_PUT__FILENAME     msg->p = put_string(filename(src->file), msg->p, msg->e);
+#define _ZF_LOG_MESSAGE_FORMAT_PUT__FILENAME     msg->p = put_string(src->file, msg->p, msg->e);
 #define _ZF_LOG_MESSAGE_FORMAT_PUT__FILELINE     msg->p = put_uint(src->line, 0, '\0', msg->p, msg->e);
 #define _ZF_LOG_MESSAGE_FORMAT_PUT__S(s)         PUT_CSTR_CHECKED(msg->p, msg->e, s);
 #define _ZF_LOG_MESSAGE_FORMAT_PUT__F_INIT(expr)
@@ -1153,10 +2142,12 @@ static void put_ctx(zf_log_message *const msg)
 #define _ZF_LOG_MESSAGE_FORMAT_PUT(field) \
 	_PP_CONCAT_3(_ZF_LOG_MESSAGE_FORMAT_PUT_, _, field)
 
-static void put_tag(zf_log_message *const msg, const char *const tag)
+static void put_tag(zf_log_message *const msg,
+					const char *const prefix, const char *const tag)
 {
 	_PP_MAP(_ZF_LOG_MESSAGE_FORMAT_INIT, ZF_LOG_MESSAGE_TAG_FORMAT)
-#if !_ZF_LOG_MESSAGE_FORMAT_CONTAINS(TAG, ZF_LOG_MESSAGE_TAG_FORMAT)
+#if !_ZF_LOG_MESSAGE_FORMAT_CONTAINS(TAG(,), ZF_LOG_MESSAGE_TAG_FORMAT)
+	VAR_UNUSED(prefix);
 	VAR_UNUSED(tag);
 #endif
 #if !_ZF_LOG_MESSAGE_FORMAT_FIELDS(ZF_LOG_MESSAGE_TAG_FORMAT)
@@ -1166,80 +2157,4036 @@ static void put_tag(zf_log_message *const msg, const char *const tag)
 #endif
 }
 
-static void put_src(zf_log_message *const msg, const src_location *const src)
+static void put_src(zf_log_message *const msg, const src_location *const src)
+{
+	_PP_MAP(_ZF_LOG_MESSAGE_FORMAT_INIT, ZF_LOG_MESSAGE_SRC_FORMAT)
+#if !_ZF_LOG_MESSAGE_FORMAT_CONTAINS(FUNCTION, ZF_LOG_MESSAGE_SRC_FORMAT) && \
+	!_ZF_LOG_MESSAGE_FORMAT_CONTAINS(FILENAME, ZF_LOG_MESSAGE_SRC_FORMAT) && \
+	!_ZF_LOG_MESSAGE_FORMAT_CONTAINS(FILELINE, ZF_LOG_MESSAGE_SRC_FORMAT)
+	VAR_UNUSED(src);
+#endif
+#if !_ZF_LOG_MESSAGE_FORMAT_FIELDS(ZF_LOG_MESSAGE_SRC_FORMAT)
+	VAR_UNUSED(msg);
+#else
+	#if ZF_LOG_OPTIMIZE_SIZE
+	int n;
+	n = _ZF_LOG_SNPRINTF(msg->p, nprintf_size(msg),
+						 _PP_MAP(_ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT, ZF_LOG_MESSAGE_SRC_FORMAT)
+						 _PP_MAP(_ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL, ZF_LOG_MESSAGE_SRC_FORMAT));
+	put_nprintf(msg, n);
+	#else
+	_PP_MAP(_ZF_LOG_MESSAGE_FORMAT_PUT, ZF_LOG_MESSAGE_SRC_FORMAT)
+	#endif
+#endif
+}
+
+#if ZF_LOG_FAST_FORMAT
+/* Built-in formatter (see ZF_LOG_FAST_FORMAT). Whole specification is parsed
+ * before any argument is taken, so unsupported one could be handed over to
+ * vsnprintf() together with the rest of the format string and arguments.
+ * Positional arguments ("%1$d") are handed over too, which is fine since
+ * format can't mix them with regular ones. Integers are converted two digits
+ * at a time. Output stops at the end of the buffer, remaining arguments are
+ * not evaluated.
+ */
+enum
+{
+	FMT_LEFT = 1 << 0,
+	FMT_ZERO = 1 << 1,
+	FMT_WIDTH_ARG = 1 << 2,
+	FMT_PREC = 1 << 3,
+	FMT_PREC_ARG = 1 << 4,
+};
+
+static const char c_dec_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+static char *fmt_dec_r(unsigned long long v, char *p)
+{
+	for (; 0xffffffffu < v; v /= 100)
+	{
+		const unsigned i = 2 * (unsigned)(v % 100);
+		*--p = c_dec_pairs[i + 1];
+		*--p = c_dec_pairs[i];
+	}
+	unsigned u = (unsigned)v;
+	for (; 100 <= u; u /= 100)
+	{
+		const unsigned i = 2 * (u % 100);
+		*--p = c_dec_pairs[i + 1];
+		*--p = c_dec_pairs[i];
+	}
+	if (10 <= u)
+	{
+		*--p = c_dec_pairs[2 * u + 1];
+		*--p = c_dec_pairs[2 * u];
+	}
+	else
+	{
+		*--p = (char)('0' + u);
+	}
+	return p;
+}
+
+static char *fmt_hex_r(unsigned long long v, char *p, const char *const digits)
+{
+	do { *--p = digits[v & 0xf]; } while (0 != (v >>= 4));
+	return p;
+}
+
+static INLINE char *fmt_fill(char *p, char *const e, const char ch, size_t n)
+{
+	if (n > (size_t)(e - p))
+	{
+		n = (size_t)(e - p);
+	}
+	memset(p, ch, n);
+	return p + n;
+}
+
+/* Puts prefix (sign or "0x") and digits (or string) padded to the width.
+ */
+static char *fmt_field(char *p, char *const e, const unsigned flags,
+					   const size_t width, const char *const pre,
+					   const size_t pre_n, const char *const s, const size_t n)
+{
+	const size_t pad = width > pre_n + n? width - pre_n - n: 0;
+	if (0 == (flags & (FMT_LEFT | FMT_ZERO)))
+	{
+		p = fmt_fill(p, e, ' ', pad);
+	}
+	p = put_stringn(pre, pre + pre_n, p, e);
+	if (FMT_ZERO == (flags & (FMT_LEFT | FMT_ZERO)))
+	{
+		p = fmt_fill(p, e, '0', pad);
+	}
+	p = put_stringn(s, s + n, p, e);
+	if (FMT_LEFT & flags)
+	{
+		p = fmt_fill(p, e, ' ', pad);
+	}
+	return p;
+}
+
+static long long fmt_signed_arg(const char len, va_list *const va)
+{
+	switch (len)
+	{
+	case 'H': return (signed char)va_arg(*va, int);
+	case 'h': return (short)va_arg(*va, int);
+	case 'l': return va_arg(*va, long);
+	case 'q': return va_arg(*va, long long);
+	case 'j': return va_arg(*va, intmax_t);
+	case 'z': case 't': return va_arg(*va, ptrdiff_t);
+	default: return va_arg(*va, int);
+	}
+}
+
+static unsigned long long fmt_unsigned_arg(const char len, va_list *const va)
+{
+	switch (len)
+	{
+	case 'H': return (unsigned char)va_arg(*va, unsigned);
+	case 'h': return (unsigned short)va_arg(*va, unsigned);
+	case 'l': return va_arg(*va, unsigned long);
+	case 'q': return va_arg(*va, unsigned long long);
+	case 'j': return va_arg(*va, uintmax_t);
+	case 'z': return va_arg(*va, size_t);
+	case 't': return (size_t)va_arg(*va, ptrdiff_t);
+	default: return va_arg(*va, unsigned);
+	}
+}
+
+typedef struct fmt_spec
+{
+	unsigned flags;
+	unsigned width;
+	unsigned prec;
+	char len;
+	/* Conversion character or 0 if it must be handed over to vsnprintf(). */
+	char conv;
+}
+fmt_spec;
+
+/* Parses conversion specification that starts right after "%" and returns
+ * pointer to the character that follows it.
+ */
+static const char *fmt_parse(const char *fmt, fmt_spec *const s)
+{
+	const char *const b = fmt;
+	s->flags = 0;
+	s->width = 0;
+	s->prec = 0;
+	s->len = 0;
+	for (; '-' == *fmt || '0' == *fmt; ++fmt)
+	{
+		s->flags |= '-' == *fmt? FMT_LEFT: FMT_ZERO;
+	}
+	if ('*' == *fmt)
+	{
+		s->flags |= FMT_WIDTH_ARG;
+		++fmt;
+	}
+	for (; '0' <= *fmt && '9' >= *fmt; ++fmt)
+	{
+		s->width = 10 * s->width + (unsigned)(*fmt - '0');
+	}
+	if ('.' == *fmt)
+	{
+		s->flags |= FMT_PREC;
+		if ('*' == *++fmt)
+		{
+			s->flags |= FMT_PREC_ARG;
+			++fmt;
+		}
+		for (; '0' <= *fmt && '9' >= *fmt; ++fmt)
+		{
+			s->prec = 10 * s->prec + (unsigned)(*fmt - '0');
+		}
+	}
+	switch (*fmt)
+	{
+	case 'h':
+		s->len = 'h' == *++fmt? (++fmt, 'H'): 'h';
+		break;
+	case 'l':
+		s->len = 'l' == *++fmt? (++fmt, 'q'): 'l';
+		break;
+	case 'j': case 'z': case 't':
+		s->len = *fmt++;
+		break;
+	}
+	s->conv = *fmt;
+	switch (s->conv)
+	{
+	case 'd': case 'i': case 'u': case 'x': case 'X':
+		if (FMT_PREC & s->flags)
+		{
+			s->conv = 0;
+		}
+		break;
+	case 'p':
+#if !defined(__GLIBC__)
+		/* Only glibc is known to print it as "0x" and lowercase hex. */
+		s->conv = 0;
+		break;
+#endif
+	case 'c':
+		if ((FMT_ZERO | FMT_PREC) & s->flags || 0 != s->len)
+		{
+			s->conv = 0;
+		}
+		break;
+	case 's':
+		if (FMT_ZERO & s->flags || 0 != s->len)
+		{
+			s->conv = 0;
+		}
+		break;
+	case '%':
+		if (fmt != b)
+		{
+			s->conv = 0;
+		}
+		break;
+	default:
+		/* Including the end of the format string. */
+		s->conv = 0;
+		return fmt;
+	}
+	return fmt + 1;
+}
+
+/* Puts converted argument(s) and returns new end of the output. Returns 0 and
+ * takes no arguments when they must be handed over to vsnprintf().
+ */
+static char *fmt_put(char *p, char *const e, const fmt_spec *const s,
+					 va_list *const va)
+{
+	static const char lower[] = "0123456789abcdef";
+	static const char upper[] = "0123456789ABCDEF";
+	unsigned flags = s->flags;
+	size_t width = s->width, prec = s->prec;
+	if ('p' == s->conv || 's' == s->conv)
+	{
+		/* Null pointer is printed differently by different libraries,
+		 * so it's handed over too. Pointer to void and pointer to char
+		 * are interchangeable for va_arg().
+		 */
+		va_list peek;
+		va_copy(peek, *va);
+		if (FMT_WIDTH_ARG & flags)
+		{
+			(void)va_arg(peek, int);
+		}
+		if (FMT_PREC_ARG & flags)
+		{
+			(void)va_arg(peek, int);
+		}
+		const void *const v = va_arg(peek, const void *);
+		va_end(peek);
+		if (0 == v)
+		{
+			return 0;
+		}
+	}
+	if (FMT_WIDTH_ARG & flags)
+	{
+		const int w = va_arg(*va, int);
+		if (0 > w)
+		{
+			flags |= FMT_LEFT;
+		}
+		width = 0 > w? 0u - (unsigned)w: (unsigned)w;
+	}
+	if (FMT_PREC_ARG & flags)
+	{
+		const int pr = va_arg(*va, int);
+		if (0 > pr)
+		{
+			flags &= ~(unsigned)FMT_PREC;
+		}
+		prec = 0 > pr? 0: (size_t)pr;
+	}
+	char buf[24];
+	char *const buf_e = buf + sizeof(buf);
+	char *b;
+	switch (s->conv)
+	{
+	case 'd': case 'i':
+	{
+		const long long v = fmt_signed_arg(s->len, va);
+		b = fmt_dec_r(0 > v? 0 - (unsigned long long)v: (unsigned long long)v, buf_e);
+		return fmt_field(p, e, flags, width, "-", 0 > v, b, (size_t)(buf_e - b));
+	}
+	case 'u':
+		b = fmt_dec_r(fmt_unsigned_arg(s->len, va), buf_e);
+		return fmt_field(p, e, flags, width, "", 0, b, (size_t)(buf_e - b));
+	case 'x': case 'X':
+		b = fmt_hex_r(fmt_unsigned_arg(s->len, va), buf_e, 'x' == s->conv? lower: upper);
+		return fmt_field(p, e, flags, width, "", 0, b, (size_t)(buf_e - b));
+	case 'p':
+		b = fmt_hex_r((uintptr_t)va_arg(*va, const void *), buf_e, lower);
+		return fmt_field(p, e, flags, width, "0x", 2, b, (size_t)(buf_e - b));
+	case 'c':
+		buf[0] = (char)va_arg(*va, int);
+		return fmt_field(p, e, flags, width, "", 0, buf, 1);
+	case 's':
+	{
+		const char *const v = va_arg(*va, const char *);
+		if (0 == width && 0 == (FMT_PREC & flags))
+		{
+			char *const c = (char *)memccpy(p, v, '\0', (size_t)(e - p));
+			return 0 != c? c - 1: e;
+		}
+		const char *const v_e = FMT_PREC & flags? (const char *)memchr(v, 0, prec): 0;
+		const size_t n = FMT_PREC & flags? (0 != v_e? (size_t)(v_e - v): prec): strlen(v);
+		return fmt_field(p, e, flags, width, "", 0, v, n);
+	}
+	default:
+		if (e != p)
+		{
+			*p++ = '%';
+		}
+		return p;
+	}
+}
+
+static void put_msg_fast(zf_log_message *const msg, const char *fmt, va_list va_in)
+{
+	char *p = msg->p;
+	char *const e = msg->e;
+	/* Parameter of array type (e.g. on x86-64) decays to pointer, so its
+	 * address can't be passed around as a pointer to va_list.
+	 */
+	va_list va;
+	va_copy(va, va_in);
+	for (;;)
+	{
+		for (; '%' != *fmt; ++fmt)
+		{
+			if (0 == *fmt || e == p)
+			{
+				msg->p = p;
+				va_end(va);
+				return;
+			}
+			*p++ = *fmt;
+		}
+		fmt_spec s;
+		const char *const spec = fmt;
+		fmt = fmt_parse(fmt + 1, &s);
+		char *const q = 0 != s.conv? fmt_put(p, e, &s, &va): 0;
+		if (0 == q)
+		{
+			msg->p = p;
+			put_nprintf(msg, _ZF_LOG_VSNPRINTF(p, nprintf_size(msg), spec, va));
+			va_end(va);
+			return;
+		}
+		p = q;
+	}
+}
+
+#if ZF_LOG_FORMAT_CACHE
+/* Format cache (see ZF_LOG_FORMAT_CACHE). Plan is a sequence of operations,
+ * each puts a chunk of literal text followed by a conversion. Operation
+ * without conversion puts the rest of the format string with put_msg_fast(),
+ * so specifications that must be handed over to vsnprintf() and format strings
+ * with too many conversions are still handled. Slot is claimed with CAS on its
+ * key, filled and then published with the format string address. Slots are
+ * never reused, since format strings are static. Thread that meets a slot that
+ * is being filled parses format string itself and doesn't look further, so
+ * the same format never takes two slots.
+ */
+enum { FMT_PLAN_OPS = 8 };
+
+typedef struct fmt_op
+{
+	unsigned lit_n;
+	unsigned spec_n;
+	fmt_spec spec;
+}
+fmt_op;
+
+typedef struct fmt_plan
+{
+	const char *fmt;
+	fmt_op ops[FMT_PLAN_OPS];
+}
+fmt_plan;
+
+STATIC_ASSERT(format_cache_size_is_power_of_two,
+			  0 == (ZF_LOG_FORMAT_CACHE_SZ & (ZF_LOG_FORMAT_CACHE_SZ - 1)));
+static fmt_plan g_fmt_plans[ZF_LOG_FORMAT_CACHE_SZ];
+/* Key of the slot that is being filled. */
+static const char c_fmt_plan_busy[] = "";
+
+static void fmt_plan_build(fmt_plan *const plan, const char *const fmt)
+{
+	const char *f = fmt;
+	for (unsigned i = 0;; ++i)
+	{
+		fmt_op *const op = plan->ops + i;
+		const char *const lit = f;
+		for (; 0 != *f && '%' != *f; ++f) {}
+		op->lit_n = (unsigned)(f - lit);
+		op->spec.conv = 0;
+		if (0 == *f || FMT_PLAN_OPS - 1 == i)
+		{
+			return;
+		}
+		const char *const spec = f;
+		f = fmt_parse(f + 1, &op->spec);
+		if (0 == op->spec.conv)
+		{
+			return;
+		}
+		op->spec_n = (unsigned)(f - spec);
+	}
+}
+
+/* Returns index of the first slot to probe for the format string. */
+static unsigned fmt_plan_index(const char *const fmt)
+{
+	const uintptr_t h = (uintptr_t)fmt;
+	return (unsigned)(h ^ h >> 7 ^ h >> 17) % ZF_LOG_FORMAT_CACHE_SZ;
+}
+
+static const fmt_plan *fmt_plan_get(const char *const fmt)
+{
+	enum { PROBES = 4 };
+	unsigned i = fmt_plan_index(fmt);
+	for (unsigned k = 0; PROBES > k; ++k, ++i)
+	{
+		fmt_plan *const plan = g_fmt_plans + i % ZF_LOG_FORMAT_CACHE_SZ;
+		const char *key = __atomic_load_n(&plan->fmt, __ATOMIC_ACQUIRE);
+		if (0 == key &&
+			__atomic_compare_exchange_n(&plan->fmt, &key, c_fmt_plan_busy, 0,
+										__ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+		{
+			fmt_plan_build(plan, fmt);
+			__atomic_store_n(&plan->fmt, fmt, __ATOMIC_RELEASE);
+			return plan;
+		}
+		if (fmt == key)
+		{
+			return plan;
+		}
+		if (c_fmt_plan_busy == key)
+		{
+			/* Could be the plan for this format. */
+			return 0;
+		}
+	}
+	return 0;
+}
+
+static void put_msg_plan(zf_log_message *const msg, const fmt_plan *const plan,
+						 const char *fmt, va_list va_in)
+{
+	char *p = msg->p;
+	char *const e = msg->e;
+	va_list va;
+	va_copy(va, va_in);
+	for (const fmt_op *op = plan->ops;; ++op)
+	{
+		p = put_stringn(fmt, fmt + op->lit_n, p, e);
+		fmt += op->lit_n;
+		char *const q = 0 != op->spec.conv? fmt_put(p, e, &op->spec, &va): 0;
+		if (0 == q)
+		{
+			msg->p = p;
+			if (0 != *fmt)
+			{
+				put_msg_fast(msg, fmt, va);
+			}
+			va_end(va);
+			return;
+		}
+		p = q;
+		fmt += op->spec_n;
+	}
+}
+#endif
+#endif
+
+/* Returns length of the whole message text when it's known (vsnprintf() was
+ * used) or -1 otherwise.
+ */
+static int put_msg(zf_log_message *const msg,
+				   const char *const fmt, va_list va)
+{
+	msg->msg_b = msg->p;
+#if ZF_LOG_FORMAT_CACHE
+	const fmt_plan *const plan = fmt_plan_get(fmt);
+	if (0 != plan)
+	{
+		put_msg_plan(msg, plan, fmt, va);
+		return -1;
+	}
+#endif
+#if ZF_LOG_FAST_FORMAT
+	put_msg_fast(msg, fmt, va);
+	return -1;
+#else
+	int n;
+	n = _ZF_LOG_VSNPRINTF(msg->p, nprintf_size(msg), fmt, va);
+	put_nprintf(msg, n);
+	return n;
+#endif
+}
+
+#if ZF_LOG_LARGE_MESSAGES
+/* Formats the message that didn't fit once again, now into the per-thread
+ * buffer (but not larger than ZF_LOG_MAX_LINE_SZ). Line prefix (context, tag
+ * and source location) is copied over. Length of the message text n comes
+ * from the first formatting and is -1 when it's unknown. Then message is
+ * formatted into the buffer as it is and only when that's not enough, buffer
+ * grows and message is formatted one more time. Leaves message as is when it
+ * actually fits, buffer is already taken or can't grow.
+ */
+static void put_msg_large(zf_log_message *const msg, const int n,
+						  const char *const fmt, va_list va)
+{
+	/* Room for the suppressed messages count. */
+	enum { SUFFIX_SZ = 32 };
+	large_buf *const lb = &g_large_buf;
+	if (lb->taken || (0 <= n && (size_t)n < (size_t)(msg->e - msg->msg_b)))
+	{
+		return;
+	}
+	const size_t prefix_len = (size_t)(msg->msg_b - msg->buf);
+	const size_t extra_sz = prefix_len + SUFFIX_SZ + ZF_LOG_EOL_SZ;
+	size_t sz = 0 <= n? extra_sz + (size_t)n: 2 * ZF_LOG_BUF_SZ;
+	if (lb->sz > sz)
+	{
+		sz = lb->sz;
+	}
+	if (ZF_LOG_MAX_LINE_SZ < sz)
+	{
+		sz = ZF_LOG_MAX_LINE_SZ;
+	}
+	if (0 != large_buf_reserve(lb, sz))
+	{
+		return;
+	}
+	va_list va_n;
+	va_copy(va_n, va);
+	/* See nprintf_size() for the extra byte. */
+	int len = _ZF_LOG_VSNPRINTF(lb->buf + prefix_len,
+								sz - prefix_len - ZF_LOG_EOL_SZ + 1, fmt, va_n);
+	va_end(va_n);
+	if (0 > len)
+	{
+		return;
+	}
+	if (sz < extra_sz + (size_t)len && ZF_LOG_MAX_LINE_SZ > sz)
+	{
+		sz = extra_sz + (size_t)len;
+		if (ZF_LOG_MAX_LINE_SZ < sz)
+		{
+			sz = ZF_LOG_MAX_LINE_SZ;
+		}
+		if (0 != large_buf_reserve(lb, sz))
+		{
+			return;
+		}
+		len = _ZF_LOG_VSNPRINTF(lb->buf + prefix_len,
+								sz - prefix_len - ZF_LOG_EOL_SZ + 1, fmt, va);
+	}
+	lb->taken = 1;
+	memcpy(lb->buf, msg->buf, prefix_len);
+	msg->tag_b = lb->buf + (msg->tag_b - msg->buf);
+	msg->tag_e = lb->buf + (msg->tag_e - msg->buf);
+	msg->src_b = lb->buf + (msg->src_b - msg->buf);
+	msg->msg_b = msg->p = lb->buf + prefix_len;
+	msg->buf = lb->buf;
+	msg->e = lb->buf + sz - ZF_LOG_EOL_SZ;
+	put_nprintf(msg, len);
+}
+
+static INLINE void large_buf_release(const zf_log_message *const msg)
+{
+	if (g_large_buf.buf == msg->buf)
+	{
+		g_large_buf.taken = 0;
+	}
+}
+#endif
+
+static void put_suppressed(zf_log_message *const msg, const unsigned n)
+{
+	msg->p = put_string(" (suppressed ", msg->p, msg->e);
+	msg->p = put_uint(n, 0, '\0', msg->p, msg->e);
+	msg->p = put_string(")", msg->p, msg->e);
+}
+
+/* Puts hex and ASCII columns of the memory dump line. Vector kernels convert
+ * 16 or 32 bytes at a time and treat 0x20-0x7e as printable. That matches
+ * isprint() in "C" locale and is verified once, when kernel is selected on
+ * first use, so later locale changes are not picked up.
+ */
+static void mem_hex_scalar(const unsigned char *d, const size_t n,
+						   char *hex, char *ascii)
+{
+	for (const unsigned char *const e = d + n; e != d; ++d)
+	{
+		const unsigned char ch = *d;
+		*hex++ = c_hex[(0xf0 & ch) >> 4];
+		*hex++ = c_hex[(0x0f & ch)];
+		*ascii++ = isprint(ch)? (char)ch: '?';
+	}
+}
+
+#if defined(MEM_HEX_SSE2) || defined(MEM_HEX_NEON)
+typedef void (*mem_hex_fn)(const unsigned char *d, size_t n,
+						   char *hex, char *ascii);
+#endif
+
+#ifdef MEM_HEX_SSE2
+static INLINE __m128i mem_hex_digits_sse2(const __m128i n)
+{
+	const __m128i letter = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+	return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')),
+						_mm_and_si128(letter, _mm_set1_epi8('a' - '0' - 10)));
+}
+
+static void mem_hex_sse2(const unsigned char *d, size_t n,
+						 char *hex, char *ascii)
+{
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	for (; 16 <= n; n -= 16, d += 16, hex += 32, ascii += 16)
+	{
+		const __m128i v = _mm_loadu_si128((const __m128i *)d);
+		const __m128i hi = mem_hex_digits_sse2(_mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+		const __m128i lo = mem_hex_digits_sse2(_mm_and_si128(v, nibble));
+		_mm_storeu_si128((__m128i *)hex, _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(hex + 16), _mm_unpackhi_epi8(hi, lo));
+		/* Comparison is signed, so bytes above 0x7f fail the first one. */
+		const __m128i printable =
+				_mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+							  _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+		_mm_storeu_si128((__m128i *)ascii,
+						 _mm_or_si128(_mm_and_si128(printable, v),
+									  _mm_andnot_si128(printable, _mm_set1_epi8('?'))));
+	}
+	mem_hex_scalar(d, n, hex, ascii);
+}
+#endif
+
+#ifdef MEM_HEX_AVX2
+__attribute__((target("avx2")))
+static void mem_hex_avx2(const unsigned char *d, size_t n,
+						 char *hex, char *ascii)
+{
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	const __m256i nine = _mm256_set1_epi8(9);
+	const __m256i zero = _mm256_set1_epi8('0');
+	const __m256i letter = _mm256_set1_epi8('a' - '0' - 10);
+	for (; 32 <= n; n -= 32, d += 32, hex += 64, ascii += 32)
+	{
+		const __m256i v = _mm256_loadu_si256((const __m256i *)d);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+		__m256i lo = _mm256_and_si256(v, nibble);
+		hi = _mm256_add_epi8(_mm256_add_epi8(hi, zero),
+							 _mm256_and_si256(_mm256_cmpgt_epi8(hi, nine), letter));
+		lo = _mm256_add_epi8(_mm256_add_epi8(lo, zero),
+							 _mm256_and_si256(_mm256_cmpgt_epi8(lo, nine), letter));
+		/* Unpack works within 128-bit lanes, so lanes are put in order. */
+		const __m256i a = _mm256_unpacklo_epi8(hi, lo);
+		const __m256i b = _mm256_unpackhi_epi8(hi, lo);
+		_mm256_storeu_si256((__m256i *)hex, _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *)(hex + 32), _mm256_permute2x128_si256(a, b, 0x31));
+		const __m256i printable =
+				_mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x1f)),
+								 _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7f), v));
+		_mm256_storeu_si256((__m256i *)ascii,
+							_mm256_blendv_epi8(_mm256_set1_epi8('?'), v, printable));
+	}
+	mem_hex_sse2(d, n, hex, ascii);
+}
+#endif
+
+#ifdef MEM_HEX_NEON
+static void mem_hex_neon(const unsigned char *d, size_t n,
+						 char *hex, char *ascii)
+{
+	const uint8x16_t digits = vld1q_u8((const uint8_t *)c_hex);
+	for (; 16 <= n; n -= 16, d += 16, hex += 32, ascii += 16)
+	{
+		const uint8x16_t v = vld1q_u8(d);
+		uint8x16x2_t h;
+		h.val[0] = vqtbl1q_u8(digits, vshrq_n_u8(v, 4));
+		h.val[1] = vqtbl1q_u8(digits, vandq_u8(v, vdupq_n_u8(0x0f)));
+		vst2q_u8((uint8_t *)hex, h);
+		const uint8x16_t printable = vandq_u8(vcgtq_u8(v, vdupq_n_u8(0x1f)),
+											  vcltq_u8(v, vdupq_n_u8(0x7f)));
+		vst1q_u8((uint8_t *)ascii, vbslq_u8(printable, v, vdupq_n_u8('?')));
+	}
+	mem_hex_scalar(d, n, hex, ascii);
+}
+#endif
+
+#if defined(MEM_HEX_SSE2) || defined(MEM_HEX_NEON)
+static mem_hex_fn g_mem_hex;
+
+static int mem_hex_c_locale(void)
+{
+	for (int ch = 0; 256 > ch; ++ch)
+	{
+		if (!isprint(ch) != !(0x20 <= ch && 0x7f > ch))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static mem_hex_fn mem_hex_select(void)
+{
+	if (!mem_hex_c_locale())
+	{
+		return mem_hex_scalar;
+	}
+#ifdef MEM_HEX_AVX2
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return mem_hex_avx2;
+	}
+#endif
+#ifdef MEM_HEX_SSE2
+	return mem_hex_sse2;
+#else
+	return mem_hex_neon;
+#endif
+}
+
+static void mem_hex(const unsigned char *const d, const size_t n,
+					char *const hex, char *const ascii)
+{
+	/* Concurrent first calls select the same kernel. */
+	mem_hex_fn fn = __atomic_load_n(&g_mem_hex, __ATOMIC_RELAXED);
+	if (0 == fn)
+	{
+		fn = mem_hex_select();
+		__atomic_store_n(&g_mem_hex, fn, __ATOMIC_RELAXED);
+	}
+	fn(d, n, hex, ascii);
+}
+#else
+static INLINE void mem_hex(const unsigned char *const d, const size_t n,
+						   char *const hex, char *const ascii)
+{
+	mem_hex_scalar(d, n, hex, ascii);
+}
+#endif
+
+enum { MEM_OFFSET_LEN = 10 };
+
+static char *put_mem_offset(const size_t offset, char *const p)
+{
+	for (unsigned i = 0; 8 > i; ++i)
+	{
+		p[i] = c_hex[0x0f & (offset >> (28 - 4 * i))];
+	}
+	p[8] = ' ';
+	p[9] = ' ';
+	return p + MEM_OFFSET_LEN;
+}
+
+/* Puts memory dump line for n bytes (n <= mem_width) at p and returns its end.
+ */
+static char *put_mem_line(const unsigned char *const d, const size_t n,
+						  const size_t mem_width, char *p,
+						  const int offset, const size_t d_offset)
+{
+	if (offset)
+	{
+		p = put_mem_offset(d_offset, p);
+	}
+	char *const ascii = p + 2 * mem_width + 2;
+	mem_hex(d, n, p, ascii);
+	for (p += 2 * n; ascii != p; ++p)
+	{
+		*p = ' ';
+	}
+	return ascii + n;
+}
+
+/* Renders all memory dump lines into one heap buffer, each with a copy of the
+ * line prefix (context, tag and source location). Returns 0 when buffer could
+ * not be allocated.
+ */
+static int output_mem_batch(const zf_log_spec *log, const zf_log_message *const msg,
+							const mem_block *const mem, const int offset)
+{
+	const size_t eol_len = sizeof(ZF_LOG_EOL) - 1;
+	const size_t mem_width = log->format->mem_width;
+	const size_t prefix_len = (size_t)(msg->msg_b - msg->buf);
+	const size_t line_len = prefix_len + (offset? MEM_OFFSET_LEN: 0) + 3 * mem_width + 2;
+	const size_t lines = (mem->d_sz + mem_width - 1) / mem_width;
+	char *const buf = (char *)malloc(lines * (line_len + eol_len) + ZF_LOG_EOL_SZ);
+	if (0 == buf)
+	{
+		return 0;
+	}
+	const unsigned char *const mem_b = (const unsigned char *)mem->d;
+	char *p = buf;
+	for (size_t i = 0; mem->d_sz > i; i += mem_width)
+	{
+		if (buf != p)
+		{
+			memcpy(p, ZF_LOG_EOL, eol_len);
+			p += eol_len;
+		}
+		memcpy(p, msg->buf, prefix_len);
+		const size_t n = mem_width < mem->d_sz - i? mem_width: mem->d_sz - i;
+		p = put_mem_line(mem_b + i, n, mem_width, p + prefix_len, offset, i);
+	}
+	zf_log_message batch = *msg;
+	batch.buf = buf;
+	batch.e = p;
+	batch.p = p;
+	batch.tag_b = buf + (msg->tag_b - msg->buf);
+	batch.tag_e = buf + (msg->tag_e - msg->buf);
+	batch.src_b = buf + (msg->src_b - msg->buf);
+	batch.msg_b = buf + prefix_len;
+	log->output->callback(&batch, log->output->arg);
+	free(buf);
+	return 1;
+}
+
+static void output_mem(const zf_log_spec *log, zf_log_message *const msg,
+					   const mem_block *const mem)
+{
+	if (0 == mem->d || 0 == mem->d_sz)
+	{
+		return;
+	}
+	const int offset = 0 != (ZF_LOG_PUT_MEM_OFFSET & log->output->mask);
+	const size_t mem_width = log->format->mem_width;
+	const size_t line_len = (offset? MEM_OFFSET_LEN: 0) + 3 * mem_width + 2;
+	if ((size_t)(msg->e - msg->msg_b) < line_len)
+	{
+		return;
+	}
+	if (ZF_LOG_PUT_MEM_BATCH & log->output->mask &&
+		output_mem_batch(log, msg, mem, offset))
+	{
+		return;
+	}
+	const unsigned char *const mem_b = (const unsigned char *)mem->d;
+	for (size_t i = 0; mem->d_sz > i; i += mem_width)
+	{
+		const size_t n = mem_width < mem->d_sz - i? mem_width: mem->d_sz - i;
+		msg->p = put_mem_line(mem_b + i, n, mem_width, msg->msg_b, offset, i);
+		log->output->callback(msg, log->output->arg);
+	}
+}
+
+#if ZF_LOG_DEFERRED
+/* Deferred record is a header followed by the tag prefix and the tag strings
+ * (each with terminating 0), payload (args_sz bytes) and a copy of the memory
+ * block (mem_sz bytes):
+ *
+ *   deferred_hdr | prefix | 0 | tag | 0 | payload | memory
+ *
+ * Payload is a sequence of arguments in order they appear in the format
+ * string, each is a one byte kind followed by the value. Strings are copied
+ * with terminating 0. When format string contains conversions that can't be
+ * deferred (e.g. "%n" or "%ls"), message is formatted right away and payload
+ * holds its text instead (DEFERRED_F_TEXT). Record uses native byte order and
+ * contains pointers, so it's only meaningful inside the process that made it.
+ */
+enum
+{
+	DEFERRED_F_SRC = 1 << 0, /* func, file and line are valid */
+	DEFERRED_F_TEXT = 1 << 1, /* payload is a formatted message text */
+};
+
+enum
+{
+	DEFERRED_ARG_INT, /* long long */
+	DEFERRED_ARG_UINT, /* unsigned long long */
+	DEFERRED_ARG_DBL, /* double */
+	DEFERRED_ARG_LDBL, /* long double */
+	DEFERRED_ARG_PTR, /* const void * */
+	DEFERRED_ARG_STR, /* characters and 0 */
+	DEFERRED_ARG_NULL, /* null string pointer */
+};
+
+typedef struct deferred_hdr
+{
+	const char *fmt;
+	const char *func;
+	const char *file;
+	unsigned line;
+	int lvl;
+	int pid;
+	int tid;
+	long long sec;
+	unsigned nsec;
+	unsigned short year;
+	unsigned char month;
+	unsigned char day;
+	unsigned char hour;
+	unsigned char minute;
+	unsigned char second;
+	unsigned char flags;
+	unsigned short mem_width;
+	unsigned short args_sz;
+	unsigned short mem_sz;
+}
+deferred_hdr;
+
+STATIC_ASSERT(deferred_sizes_fit_hdr, ZF_LOG_BUF_SZ <= 0xffff);
+STATIC_ASSERT(deferred_hdr_fits_binary_hdr, sizeof(deferred_hdr) <= 0xffff);
+
+/* Conversion specification. Longer ones are not supported.
+ */
+#define FMT_SPEC_MAX_SZ 32
+
+typedef struct deferred_spec
+{
+	const char *b; /* Points to '%' */
+	const char *len_b; /* Length modifier start (flags, width, precision end) */
+	const char *e; /* Points past the conversion character */
+	int width_arg; /* Width is specified by an argument */
+	int prec_arg; /* Precision is specified by an argument */
+	int prec; /* Precision or -1 when not specified */
+	char len; /* 0, 'H' (hh), 'h', 'l', 'q' (ll), 'j', 'z', 't' or 'L' */
+	char conv; /* Conversion character, '%' for "%%" */
+}
+deferred_spec;
+
+static int is_digit(const char ch)
+{
+	return '0' <= ch && '9' >= ch;
+}
+
+/* Finds next conversion specification. Returns 0 when there are no more.
+ */
+static int next_spec(const char *const fmt, deferred_spec *const spec)
+{
+	const char *p = strchr(fmt, '%');
+	if (0 == p)
+	{
+		return 0;
+	}
+	spec->b = p++;
+	spec->width_arg = spec->prec_arg = 0;
+	spec->prec = -1;
+	spec->len = 0;
+	while (0 != *p && 0 != strchr("-+ #0'", *p))
+	{
+		++p;
+	}
+	if ('*' == *p)
+	{
+		spec->width_arg = 1;
+		++p;
+	}
+	for (; is_digit(*p); ++p) {}
+	if ('.' == *p)
+	{
+		if ('*' == *++p)
+		{
+			spec->prec_arg = 1;
+			++p;
+		}
+		else
+		{
+			for (spec->prec = 0; is_digit(*p); ++p)
+			{
+				spec->prec = 10 * spec->prec + (*p - '0');
+			}
+		}
+	}
+	spec->len_b = p;
+	switch (*p)
+	{
+	case 'h':
+		spec->len = 'h' == p[1]? (++p, 'H'): 'h';
+		++p;
+		break;
+	case 'l':
+		spec->len = 'l' == p[1]? (++p, 'q'): 'l';
+		++p;
+		break;
+	case 'q': case 'j': case 'z': case 't': case 'L':
+		spec->len = *p++;
+		break;
+	}
+	spec->conv = *p;
+	spec->e = 0 != *p? p + 1: p;
+	return 1;
+}
+
+/* Returns whether argument for the specification could be stored in the
+ * record and rendered later.
+ */
+static int deferrable_spec(const deferred_spec *const spec)
+{
+	if (FMT_SPEC_MAX_SZ < spec->e - spec->b)
+	{
+		return 0;
+	}
+	switch (spec->conv)
+	{
+	case '%':
+		return spec->e - spec->b == 2;
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+		return 'L' != spec->len;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		return 0 == spec->len || 'l' == spec->len || 'L' == spec->len;
+	case 'c': case 's': case 'p':
+		return 0 == spec->len;
+	}
+	return 0;
+}
+
+static char *put_deferred_arg(const char kind, const void *const v,
+							  const size_t sz, char *const p, char *const e)
+{
+	if (0 == p || (size_t)(e - p) < sz + 1)
+	{
+		return 0;
+	}
+	*p = kind;
+	memcpy(p + 1, v, sz);
+	return p + 1 + sz;
+}
+
+static char *put_deferred_str(const char *s, const int prec,
+							  char *p, char *const e)
+{
+	if (0 == p || 2 > e - p)
+	{
+		return 0;
+	}
+	*p++ = DEFERRED_ARG_STR;
+	for (const char *const s_e = 0 > prec? 0: s + prec;
+		 e - 1 != p && s_e != s && 0 != *s; ++p, ++s)
+	{
+		*p = *s;
+	}
+	*p++ = 0;
+	return p;
+}
+
+#define PUT_DEFERRED_ARG(kind, type, value) \
+	do { \
+		const type v = (value); \
+		p = put_deferred_arg(kind, &v, sizeof(v), p, e); \
+	} _ZF_LOG_ONCE
+
+/* Returns 0 when format string has conversions that can't be deferred. Stops
+ * storing arguments when record is full (rendered message will be truncated).
+ */
+static int put_deferred_args(zf_log_message *const msg,
+							 const char *fmt, va_list *const va)
+{
+	deferred_spec spec;
+	char *p = msg->p;
+	char *const e = msg->e;
+	for (; next_spec(fmt, &spec); fmt = spec.e)
+	{
+		if (!deferrable_spec(&spec))
+		{
+			return 0;
+		}
+		if (spec.width_arg)
+		{
+			PUT_DEFERRED_ARG(DEFERRED_ARG_INT, long long, va_arg(*va, int));
+		}
+		if (spec.prec_arg)
+		{
+			spec.prec = va_arg(*va, int);
+			PUT_DEFERRED_ARG(DEFERRED_ARG_INT, long long, spec.prec);
+		}
+		switch (spec.conv)
+		{
+		case 'd': case 'i':
+			switch (spec.len)
+			{
+			case 'H': PUT_DEFERRED_ARG(DEFERRED_ARG_INT, long long, (signed char)va_arg(*va, int)); break;
+			case 'h': PUT_DEFERRED_ARG(DEFERRED_ARG_INT, long long, (short)va_arg(*va, int)); break;
+			case 'l': PUT_DEFERRED_ARG(DEFERRED_ARG_INT, long long, va_arg(*va, long)); break;
+			case 'q': PUT_DEFERRED_ARG(DEFERRED_ARG_INT, long long, va_arg(*va, long long)); break;
+			case 'j': PUT_DEFERRED_ARG(DEFERRED_ARG_INT, long long, va_arg(*va, intmax_t)); break;
+			case 'z': PUT_DEFERRED_ARG(DEFERRED_ARG_INT, long long, (ptrdiff_t)va_arg(*va, size_t)); break;
+			case 't': PUT_DEFERRED_ARG(DEFERRED_ARG_INT, long long, va_arg(*va, ptrdiff_t)); break;
+			default: PUT_DEFERRED_ARG(DEFERRED_ARG_INT, long long, va_arg(*va, int)); break;
+			}
+			break;
+		case 'u': case 'o': case 'x': case 'X':
+			switch (spec.len)
+			{
+			case 'H': PUT_DEFERRED_ARG(DEFERRED_ARG_UINT, unsigned long long, (unsigned char)va_arg(*va, unsigned)); break;
+			case 'h': PUT_DEFERRED_ARG(DEFERRED_ARG_UINT, unsigned long long, (unsigned short)va_arg(*va, unsigned)); break;
+			case 'l': PUT_DEFERRED_ARG(DEFERRED_ARG_UINT, unsigned long long, va_arg(*va, unsigned long)); break;
+			case 'q': PUT_DEFERRED_ARG(DEFERRED_ARG_UINT, unsigned long long, va_arg(*va, unsigned long long)); break;
+			case 'j': PUT_DEFERRED_ARG(DEFERRED_ARG_UINT, unsigned long long, va_arg(*va, uintmax_t)); break;
+			case 'z': PUT_DEFERRED_ARG(DEFERRED_ARG_UINT, unsigned long long, va_arg(*va, size_t)); break;
+			case 't': PUT_DEFERRED_ARG(DEFERRED_ARG_UINT, unsigned long long, (size_t)va_arg(*va, ptrdiff_t)); break;
+			default: PUT_DEFERRED_ARG(DEFERRED_ARG_UINT, unsigned long long, va_arg(*va, unsigned)); break;
+			}
+			break;
+		case 'c':
+			PUT_DEFERRED_ARG(DEFERRED_ARG_INT, long long, va_arg(*va, int));
+			break;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			if ('L' == spec.len)
+			{
+				PUT_DEFERRED_ARG(DEFERRED_ARG_LDBL, long double, va_arg(*va, long double));
+			}
+			else
+			{
+				PUT_DEFERRED_ARG(DEFERRED_ARG_DBL, double, va_arg(*va, double));
+			}
+			break;
+		case 'p':
+			PUT_DEFERRED_ARG(DEFERRED_ARG_PTR, const void *, va_arg(*va, const void *));
+			break;
+		case 's':
+		{
+			const char *const s = va_arg(*va, const char *);
+			if (0 == s)
+			{
+				p = put_deferred_arg(DEFERRED_ARG_NULL, "", 0, p, e);
+			}
+			else
+			{
+				p = put_deferred_str(s, spec.prec, p, e);
+			}
+			break;
+		}
+		}
+		if (0 != p)
+		{
+			msg->p = p;
+		}
+	}
+	return 1;
+}
+
+/* Puts string with terminating 0, truncating it if necessary to leave space
+ * for (reserve - 1) more characters.
+ */
+static void put_deferred_cstr(zf_log_message *const msg, const char *s,
+							  const ptrdiff_t reserve)
+{
+	for (s = 0 != s? s: ""; msg->e - reserve > msg->p && 0 != *s; ++s)
+	{
+		*msg->p++ = *s;
+	}
+	*msg->p++ = 0;
+}
+
+static void put_deferred(zf_log_message *const msg,
+						 const src_location *const src, const mem_block *const mem,
+						 const unsigned mem_width, const char *const tag,
+						 const char *const fmt, va_list va)
+{
+	char *const hdr_p = msg->p;
+	deferred_hdr hdr;
+	ctx_values ctx;
+	msg->tag_b = msg->tag_e = msg->src_b = msg->msg_b = msg->p;
+	if (sizeof(hdr) + 2 > (size_t)(msg->e - msg->p))
+	{
+		return;
+	}
+	memset(&ctx, 0, sizeof(ctx));
+	get_ctx(&ctx);
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.fmt = fmt;
+	hdr.lvl = msg->lvl;
+	hdr.pid = ctx.pid;
+	hdr.tid = ctx.tid;
+	hdr.year = (unsigned short)(ctx.tm.tm_year + 1900);
+	hdr.month = (unsigned char)(ctx.tm.tm_mon + 1);
+	hdr.day = (unsigned char)ctx.tm.tm_mday;
+	hdr.hour = (unsigned char)ctx.tm.tm_hour;
+	hdr.minute = (unsigned char)ctx.tm.tm_min;
+	hdr.second = (unsigned char)ctx.tm.tm_sec;
+	hdr.sec = ctx.sec;
+	hdr.nsec = ctx.nsec;
+	hdr.mem_width = (unsigned short)mem_width;
+	if (0 != src)
+	{
+		hdr.flags |= DEFERRED_F_SRC;
+		hdr.func = src->func;
+		hdr.file = src->file;
+		hdr.line = src->line;
+	}
+	msg->p += sizeof(hdr);
+	put_deferred_cstr(msg, _zf_log_tag_prefix, 2);
+	put_deferred_cstr(msg, tag, 1);
+	char *const args_b = msg->p;
+	va_list args;
+	va_copy(args, va);
+	if (!put_deferred_args(msg, fmt, &args))
+	{
+		hdr.flags |= DEFERRED_F_TEXT;
+		msg->p = args_b;
+		put_msg(msg, fmt, va);
+	}
+	va_end(args);
+	hdr.args_sz = (unsigned short)(msg->p - args_b);
+	if (0 != mem && 0 != mem->d)
+	{
+		const size_t left = (size_t)(msg->e - msg->p);
+		hdr.mem_sz = (unsigned short)(mem->d_sz < left? mem->d_sz: left);
+		memcpy(msg->p, mem->d, hdr.mem_sz);
+		msg->p += hdr.mem_sz;
+	}
+	memcpy(hdr_p, &hdr, sizeof(hdr));
+	msg->tag_b = msg->tag_e = msg->src_b = msg->msg_b = msg->buf;
+}
+
+static const char *get_deferred_arg(const char kind, void *const v,
+									const size_t sz,
+									const char *const p, const char *const e)
+{
+	if (0 == p || (size_t)(e - p) < sz + 1 || kind != *p)
+	{
+		return 0;
+	}
+	memcpy(v, p + 1, sz);
+	return p + 1 + sz;
+}
+
+#define GET_DEFERRED_ARG(kind, v) \
+	(p = get_deferred_arg(kind, &v, sizeof(v), p, e))
+
+#define PUT_DEFERRED_SNPRINTF(f, args, n_args, v) \
+	(2 == n_args? _ZF_LOG_SNPRINTF(msg->p, nprintf_size(msg), f, (int)args[0], (int)args[1], v): \
+	 1 == n_args? _ZF_LOG_SNPRINTF(msg->p, nprintf_size(msg), f, (int)args[0], v): \
+				  _ZF_LOG_SNPRINTF(msg->p, nprintf_size(msg), f, v))
+
+/* Expands format string using arguments stored in the record. Stops at the
+ * first argument that is missing from the record.
+ */
+static void put_deferred_msg(zf_log_message *const msg, const char *fmt,
+							 const char *p, const char *const e)
+{
+	deferred_spec spec;
+	for (; next_spec(fmt, &spec); fmt = spec.e)
+	{
+		msg->p = put_stringn(fmt, spec.b, msg->p, msg->e);
+		if ('%' == spec.conv)
+		{
+			PUT_CSTR_CHECKED(msg->p, msg->e, "%");
+			continue;
+		}
+		/* Rebuild specification with length modifier that matches type of the
+		 * stored value.
+		 */
+		char f[FMT_SPEC_MAX_SZ + 2];
+		char *f_p = f;
+		long long args[2];
+		int n_args = 0;
+		memcpy(f_p, spec.b, (size_t)(spec.len_b - spec.b));
+		f_p += spec.len_b - spec.b;
+		if (spec.width_arg && !GET_DEFERRED_ARG(DEFERRED_ARG_INT, args[n_args++]))
+		{
+			return;
+		}
+		if (spec.prec_arg && !GET_DEFERRED_ARG(DEFERRED_ARG_INT, args[n_args++]))
+		{
+			return;
+		}
+		int n = 0;
+		switch (spec.conv)
+		{
+		case 'd': case 'i':
+		{
+			long long v;
+			*f_p++ = 'l';
+			*f_p++ = 'l';
+			*f_p++ = spec.conv;
+			*f_p = 0;
+			if (!GET_DEFERRED_ARG(DEFERRED_ARG_INT, v))
+			{
+				return;
+			}
+			n = PUT_DEFERRED_SNPRINTF(f, args, n_args, v);
+			break;
+		}
+		case 'u': case 'o': case 'x': case 'X':
+		{
+			unsigned long long v;
+			*f_p++ = 'l';
+			*f_p++ = 'l';
+			*f_p++ = spec.conv;
+			*f_p = 0;
+			if (!GET_DEFERRED_ARG(DEFERRED_ARG_UINT, v))
+			{
+				return;
+			}
+			n = PUT_DEFERRED_SNPRINTF(f, args, n_args, v);
+			break;
+		}
+		case 'c':
+		{
+			long long v;
+			*f_p++ = spec.conv;
+			*f_p = 0;
+			if (!GET_DEFERRED_ARG(DEFERRED_ARG_INT, v))
+			{
+				return;
+			}
+			n = PUT_DEFERRED_SNPRINTF(f, args, n_args, (int)v);
+			break;
+		}
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			if ('L' == spec.len)
+			{
+				long double v;
+				*f_p++ = 'L';
+				*f_p++ = spec.conv;
+				*f_p = 0;
+				if (!GET_DEFERRED_ARG(DEFERRED_ARG_LDBL, v))
+				{
+					return;
+				}
+				n = PUT_DEFERRED_SNPRINTF(f, args, n_args, v);
+			}
+			else
+			{
+				double v;
+				*f_p++ = spec.conv;
+				*f_p = 0;
+				if (!GET_DEFERRED_ARG(DEFERRED_ARG_DBL, v))
+				{
+					return;
+				}
+				n = PUT_DEFERRED_SNPRINTF(f, args, n_args, v);
+			}
+			break;
+		case 'p':
+		{
+			const void *v;
+			*f_p++ = spec.conv;
+			*f_p = 0;
+			if (!GET_DEFERRED_ARG(DEFERRED_ARG_PTR, v))
+			{
+				return;
+			}
+			n = PUT_DEFERRED_SNPRINTF(f, args, n_args, v);
+			break;
+		}
+		case 's':
+		{
+			const char *v = "(null)";
+			*f_p++ = spec.conv;
+			*f_p = 0;
+			if (0 != p && e != p && DEFERRED_ARG_NULL == *p)
+			{
+				++p;
+			}
+			else
+			{
+				const char *const s_e = 0 != p && e != p && DEFERRED_ARG_STR == *p?
+						(const char *)memchr(p, 0, (size_t)(e - p)): 0;
+				if (0 == s_e)
+				{
+					return;
+				}
+				v = p + 1;
+				p = s_e + 1;
+			}
+			n = PUT_DEFERRED_SNPRINTF(f, args, n_args, v);
+			break;
+		}
+		}
+		put_nprintf(msg, n);
+	}
+	msg->p = put_string(fmt, msg->p, msg->e);
+}
+
+void zf_log_render_deferred(const void *const record, const unsigned size,
+							const zf_log_output *const output)
+{
+	const char *const rec = (const char *)record;
+	const char *const rec_e = rec + size;
+	deferred_hdr hdr;
+	if (sizeof(hdr) >= size)
+	{
+		return;
+	}
+	memcpy(&hdr, rec, sizeof(hdr));
+	const char *const prefix = rec + sizeof(hdr);
+	const char *const prefix_e = (const char *)memchr(prefix, 0, (size_t)(rec_e - prefix));
+	if (0 == prefix_e)
+	{
+		return;
+	}
+	const char *const tag = prefix_e + 1;
+	const char *const tag_e = (const char *)memchr(tag, 0, (size_t)(rec_e - tag));
+	if (0 == tag_e || (size_t)(rec_e - tag_e - 1) < (size_t)hdr.args_sz + hdr.mem_sz)
+	{
+		return;
+	}
+	const char *const args_b = tag_e + 1;
+	const char *const args_e = args_b + hdr.args_sz;
+	zf_log_message msg;
+	char buf[ZF_LOG_BUF_SZ];
+	const unsigned mask = output->mask;
+	msg.lvl = hdr.lvl;
+	msg.tag = tag;
+	g_buffer_cb(&msg, buf);
+	if (ZF_LOG_PUT_CTX & mask)
+	{
+		ctx_values ctx;
+		memset(&ctx, 0, sizeof(ctx));
+		ctx.tm.tm_year = hdr.year - 1900;
+		ctx.tm.tm_mon = hdr.month - 1;
+		ctx.tm.tm_mday = hdr.day;
+		ctx.tm.tm_hour = hdr.hour;
+		ctx.tm.tm_min = hdr.minute;
+		ctx.tm.tm_sec = hdr.second;
+		ctx.sec = (time_t)hdr.sec;
+		ctx.nsec = hdr.nsec;
+		ctx.pid = hdr.pid;
+		ctx.tid = hdr.tid;
+		put_ctx_values(&msg, &ctx);
+	}
+	msg.tag_b = msg.tag_e = msg.p;
+	if (ZF_LOG_PUT_TAG & mask)
+	{
+		put_tag(&msg, prefix, tag);
+	}
+	msg.src_b = msg.p;
+	if (DEFERRED_F_SRC & hdr.flags && ZF_LOG_PUT_SRC & mask)
+	{
+		const src_location src = {hdr.func, hdr.file, hdr.line};
+		put_src(&msg, &src);
+	}
+	msg.msg_b = msg.p;
+	if (ZF_LOG_PUT_MSG & mask)
+	{
+		if (DEFERRED_F_TEXT & hdr.flags)
+		{
+			msg.p = put_stringn(args_b, args_e, msg.p, msg.e);
+		}
+		else
+		{
+			put_deferred_msg(&msg, hdr.fmt, args_b, args_e);
+		}
+	}
+	output->callback(&msg, output->arg);
+	if (0 != hdr.mem_sz && ZF_LOG_PUT_MSG & mask)
+	{
+		const zf_log_format format = {hdr.mem_width};
+		const zf_log_spec log = {&format, output};
+		const mem_block mem = {args_e, hdr.mem_sz};
+		output_mem(&log, &msg, &mem);
+	}
+}
+
+void zf_log_out_deferred_callback(const zf_log_message *const msg, void *arg)
+{
+	zf_log_render_deferred(msg->buf, (unsigned)(msg->p - msg->buf),
+						   (const zf_log_output *)arg);
+}
+
+/* Binary log file is a sequence of entries. Each entry is a one byte type and
+ * two byte payload size followed by the payload:
+ *
+ *   BINARY_ENTRY_HDR - binary_file_hdr. Starts the file and each session
+ *                      appended to it (pointers are only valid within one).
+ *   BINARY_ENTRY_STR - pointer value followed by characters of the string it
+ *                      points to (format string, function or file name).
+ *   BINARY_ENTRY_REC - deferred record.
+ *
+ * String entry is written before the first record that references it. Function
+ * and file names are literals, so they are written once per pointer. For
+ * format string writer remembers length and first BINARY_STR_PREFIX_SZ
+ * characters of what it wrote, so the entry is written again when the same
+ * pointer now points to a different string (e.g. format string in a reused
+ * buffer). Reader replaces the string it had for that pointer. See
+ * zf_log_decode.c for the reading side.
+ */
+#define BINARY_MAGIC "ZFLOGBIN"
+#define BINARY_VERSION 3
+#define BINARY_BOM 0x01020304u
+#define BINARY_ENTRY_HDR_SZ 3
+#define BINARY_ENTRY_MAX_SZ 0xffff
+#define BINARY_BUF_SZ (64 * 1024)
+#define BINARY_SEEN_MIN_SZ 256
+#define BINARY_STR_PREFIX_SZ 16
+
+enum
+{
+	BINARY_ENTRY_HDR = 'H',
+	BINARY_ENTRY_STR = 'S',
+	BINARY_ENTRY_REC = 'R',
+};
+
+typedef struct binary_file_hdr
+{
+	char magic[sizeof(BINARY_MAGIC) - 1];
+	unsigned char version;
+	unsigned char ptr_sz;
+	unsigned short rec_hdr_sz;
+	unsigned bom;
+}
+binary_file_hdr;
+
+#if defined(_WIN32) || defined(_WIN64)
+	#define BINARY_LOCK(f) _lock_file(f)
+	#define BINARY_UNLOCK(f) _unlock_file(f)
+#else
+	#define BINARY_LOCK(f) flockfile(f)
+	#define BINARY_UNLOCK(f) funlockfile(f)
+#endif
+
+typedef struct binary_str
+{
+	const char *s;
+	/* What was written for this pointer (checked for format strings) */
+	size_t len;
+	char prefix[BINARY_STR_PREFIX_SZ];
+}
+binary_str;
+
+struct zf_log_binary
+{
+	FILE *f;
+	binary_str *seen; /* Open addressing set of pointers already written */
+	size_t seen_mask;
+	size_t seen_n;
+};
+
+static size_t binary_hash(const char *const s)
+{
+	const uintptr_t v = (uintptr_t)s;
+	return (size_t)((v >> 3) ^ (v >> 17));
+}
+
+static binary_str *binary_seen_insert(zf_log_binary *const b,
+									  const binary_str *const e)
+{
+	size_t i = binary_hash(e->s) & b->seen_mask;
+	while (0 != b->seen[i].s)
+	{
+		i = (i + 1) & b->seen_mask;
+	}
+	b->seen[i] = *e;
+	++b->seen_n;
+	return b->seen + i;
+}
+
+static binary_str *binary_seen_find(zf_log_binary *const b, const char *const s)
+{
+	if (0 == b->seen)
+	{
+		return 0;
+	}
+	for (size_t i = binary_hash(s) & b->seen_mask; 0 != b->seen[i].s;
+		 i = (i + 1) & b->seen_mask)
+	{
+		if (s == b->seen[i].s)
+		{
+			return b->seen + i;
+		}
+	}
+	return 0;
+}
+
+/* Returns new entry for the pointer or 0 when memory is low (string will be
+ * written again then).
+ */
+static binary_str *binary_seen_add(zf_log_binary *const b, const char *const s)
+{
+	if (2 * (b->seen_n + 1) > b->seen_mask + 1 || 0 == b->seen)
+	{
+		const size_t n = 0 != b->seen? 2 * (b->seen_mask + 1): BINARY_SEEN_MIN_SZ;
+		binary_str *const seen = (binary_str *)calloc(n, sizeof(*seen));
+		if (0 == seen)
+		{
+			return 0;
+		}
+		binary_str *const old = b->seen;
+		const size_t old_n = 0 != old? b->seen_mask + 1: 0;
+		b->seen = seen;
+		b->seen_mask = n - 1;
+		b->seen_n = 0;
+		for (size_t i = 0; old_n > i; ++i)
+		{
+			if (0 != old[i].s)
+			{
+				binary_seen_insert(b, old + i);
+			}
+		}
+		free(old);
+	}
+	binary_str e;
+	memset(&e, 0, sizeof(e));
+	e.s = s;
+	return binary_seen_insert(b, &e);
+}
+
+static size_t binary_prefix_len(const size_t len)
+{
+	return len < BINARY_STR_PREFIX_SZ? len: BINARY_STR_PREFIX_SZ;
+}
+
+static void binary_put_entry(FILE *const f, const char type,
+							 const void *const p1, const size_t sz1,
+							 const void *const p2, const size_t sz2)
+{
+	unsigned char hdr[BINARY_ENTRY_HDR_SZ];
+	const unsigned short sz = (unsigned short)(sz1 + sz2);
+	hdr[0] = (unsigned char)type;
+	memcpy(hdr + 1, &sz, sizeof(sz));
+	RETVAL_UNUSED(fwrite(hdr, sizeof(hdr), 1, f));
+	RETVAL_UNUSED(fwrite(p1, sz1, 1, f));
+	if (0 != sz2)
+	{
+		RETVAL_UNUSED(fwrite(p2, sz2, 1, f));
+	}
+}
+
+/* String that is not a literal is checked by its length and prefix, so the
+ * whole string is never compared.
+ */
+static void binary_put_str(zf_log_binary *const b, const char *const s,
+						   const int literal)
+{
+	if (0 == s)
+	{
+		return;
+	}
+	binary_str *e = binary_seen_find(b, s);
+	if (0 != e && literal)
+	{
+		return;
+	}
+	const size_t len = strlen(s);
+	if (0 != e && e->len == len &&
+		0 == memcmp(e->prefix, s, binary_prefix_len(len)))
+	{
+		return;
+	}
+	if (0 != e || 0 != (e = binary_seen_add(b, s)))
+	{
+		e->len = len;
+		memcpy(e->prefix, s, binary_prefix_len(len));
+	}
+	const size_t max_len = BINARY_ENTRY_MAX_SZ - sizeof(s);
+	binary_put_entry(b->f, BINARY_ENTRY_STR, &s, sizeof(s),
+					 s, len < max_len? len: max_len);
+}
+
+zf_log_binary *zf_log_binary_open(const char *const path)
+{
+	zf_log_binary *const b = (zf_log_binary *)calloc(1, sizeof(zf_log_binary));
+	if (0 == b)
+	{
+		return 0;
+	}
+	if (0 == (b->f = fopen(path, "ab")))
+	{
+		free(b);
+		return 0;
+	}
+	setvbuf(b->f, 0, _IOFBF, BINARY_BUF_SZ);
+	binary_file_hdr hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, BINARY_MAGIC, sizeof(hdr.magic));
+	hdr.version = BINARY_VERSION;
+	hdr.ptr_sz = sizeof(const char *);
+	hdr.rec_hdr_sz = sizeof(deferred_hdr);
+	hdr.bom = BINARY_BOM;
+	binary_put_entry(b->f, BINARY_ENTRY_HDR, &hdr, sizeof(hdr), 0, 0);
+	return b;
+}
+
+void zf_log_binary_flush(zf_log_binary *const b)
+{
+	fflush(b->f);
+}
+
+void zf_log_binary_close(zf_log_binary *const b)
+{
+	if (0 == b)
+	{
+		return;
+	}
+	fclose(b->f);
+	free(b->seen);
+	free(b);
+}
+
+void zf_log_out_binary_callback(const zf_log_message *const msg, void *arg)
+{
+	zf_log_binary *const b = (zf_log_binary *)arg;
+	const size_t sz = (size_t)(msg->p - msg->buf);
+	deferred_hdr hdr;
+	if (sizeof(hdr) >= sz)
+	{
+		return;
+	}
+	memcpy(&hdr, msg->buf, sizeof(hdr));
+	BINARY_LOCK(b->f);
+	if (!(DEFERRED_F_TEXT & hdr.flags))
+	{
+		binary_put_str(b, hdr.fmt, 0);
+	}
+	if (DEFERRED_F_SRC & hdr.flags)
+	{
+		binary_put_str(b, hdr.func, 1);
+		binary_put_str(b, hdr.file, 1);
+	}
+	binary_put_entry(b->f, BINARY_ENTRY_REC, msg->buf, sz, 0, 0);
+	if (ZF_LOG_FATAL <= hdr.lvl)
+	{
+		fflush(b->f);
+	}
+	BINARY_UNLOCK(b->f);
+}
+#endif
+
+#if ZF_LOG_ASYNC
+/* Asynchronous output is a bounded multi-producer single-consumer queue of
+ * fixed size slots. Each slot has a sequence number that tells who owns it:
+ * producer that claimed position pos can write the slot when its sequence is
+ * pos, consumer can read it when sequence is pos + 1. Producers compete only
+ * for the tail position, consumer is the only one who touches head.
+ *
+ * With ZF_LOG_ASYNC_PER_THREAD, each producer thread has its own ring of
+ * slots instead, so there is nothing to compete for. Thread creates its ring
+ * on first use and adds it to the list of rings (under the lock). Producer
+ * owns tail, consumer owns head. Slot is stamped with time of the line
+ * context (or monotonic time when context has no time) and consumer always
+ * takes the oldest line among ring heads, so lines from different threads come
+ * out in the order they were written (lines that are still being queued could
+ * be a little late). Slot also carries flush generation, so flush doesn't
+ * depend on the clock. Rings are removed from the
+ * list only by consumer (or under the lock when there is no consumer), so it
+ * walks the list without locking. When thread exits, its ring is marked as
+ * orphaned and consumer frees it once it's empty.
+ */
+#define CACHE_LINE_SZ 64
+#define ASYNC_IDLE_WAIT_MS 100
+#define ASYNC_FLUSH_WAIT_MS 10
+
+typedef struct async_slot
+{
+	unsigned seq;
+	int lvl;
+	const char *tag;
+	const zf_log_output *output;
+	unsigned len;
+	unsigned short tag_b;
+	unsigned short tag_e;
+	unsigned short src_b;
+	unsigned short msg_b;
+#if ZF_LOG_LARGE_MESSAGES
+	char *large; /* Line that doesn't fit into buf (freed by consumer) */
+#endif
+#if ZF_LOG_ASYNC_PER_THREAD
+	unsigned long long ts;
+	unsigned gen;
+#endif
+	char buf[ZF_LOG_BUF_SZ];
+}
+async_slot;
+
+#if ZF_LOG_ASYNC_PER_THREAD
+typedef struct async_ring
+{
+	unsigned tail; /* Next position to be written by producer */
+	unsigned head_cache; /* Producer's copy of head */
+	int busy; /* Producer is inside zf_log_out_async_callback() */
+	char tail_pad[CACHE_LINE_SZ - 2 * sizeof(unsigned) - sizeof(int)];
+	unsigned head; /* Next position to be consumed */
+	int orphaned; /* Producer thread exited */
+	char head_pad[CACHE_LINE_SZ - sizeof(unsigned) - sizeof(int)];
+	struct async_ring *next;
+	async_slot *slots;
+	unsigned mask;
+}
+async_ring;
+
+typedef struct async_queue
+{
+	async_ring *rings;
+	unsigned ring_sz; /* Size of new rings */
+	int running; /* Queue accepts new lines */
+	int consumer; /* Consumer thread exists */
+	int stop; /* Consumer must exit once queue is empty */
+	int sleeping; /* Consumer is waiting for g_async_wake */
+	unsigned flush_waiters;
+	unsigned flush_gen; /* Bumped by each zf_log_async_flush() */
+	pthread_t thread;
+}
+async_queue;
+#else
+/* Producers inside zf_log_out_async_callback() are counted in several
+ * counters, each on its own cache line. Thread always uses the same one, so
+ * threads don't compete for it (unless there are more of them than counters).
+ */
+#define ASYNC_USERS_SZ 16
+
+typedef struct async_users
+{
+	int n;
+	char pad[CACHE_LINE_SZ - sizeof(int)];
+}
+async_users;
+
+typedef struct async_queue
+{
+	unsigned tail; /* Next position to be claimed by producer */
+	char tail_pad[CACHE_LINE_SZ - sizeof(unsigned)];
+	unsigned head; /* Next position to be consumed */
+	unsigned done; /* Copy of head published for zf_log_async_flush() */
+	char head_pad[CACHE_LINE_SZ - 2 * sizeof(unsigned)];
+	async_users users[ASYNC_USERS_SZ];
+	async_slot *slots;
+	unsigned mask;
+	int running; /* Queue accepts new lines */
+	int stop; /* Consumer must exit once queue is empty */
+	int sleeping; /* Consumer is waiting for g_async_wake */
+	unsigned flush_waiters;
+	pthread_t thread;
+}
+async_queue;
+#endif
+
+static async_queue g_async;
+static pthread_mutex_t g_async_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Serializes zf_log_async_start() and zf_log_async_stop(). Stop can't hold
+ * g_async_lock, since it waits for consumer that needs it.
+ */
+static pthread_mutex_t g_async_ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_async_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_async_flushed = PTHREAD_COND_INITIALIZER;
+
+STATIC_ASSERT(async_offsets_fit_slot, ZF_LOG_BUF_SZ <= 0xffff);
+
+static void async_timedwait(pthread_cond_t *const cond, const unsigned ms)
+{
+	struct timespec ts;
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	ts.tv_sec = tv.tv_sec + ms / 1000;
+	ts.tv_nsec = (long)tv.tv_usec * 1000 + (long)(ms % 1000) * 1000000;
+	if (1000000000 <= ts.tv_nsec)
+	{
+		++ts.tv_sec;
+		ts.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(cond, &g_async_lock, &ts);
+}
+
+static void async_wake(void)
+{
+	pthread_mutex_lock(&g_async_lock);
+	pthread_cond_signal(&g_async_wake);
+	pthread_mutex_unlock(&g_async_lock);
+}
+
+#if !ZF_LOG_ASYNC_PER_THREAD
+static async_slot *async_claim(unsigned *const pos)
+{
+	unsigned tail = __atomic_load_n(&g_async.tail, __ATOMIC_RELAXED);
+	for (;;)
+	{
+		async_slot *const slot = g_async.slots + (tail & g_async.mask);
+		const int dif = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - tail);
+		if (0 == dif)
+		{
+			if (__atomic_compare_exchange_n(&g_async.tail, &tail, tail + 1, 1,
+											__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				*pos = tail;
+				return slot;
+			}
+		}
+		else if (0 > dif)
+		{
+			/* Queue is full. Don't drop the line, let consumer catch up. */
+			async_wake();
+			sched_yield();
+		}
+		tail = __atomic_load_n(&g_async.tail, __ATOMIC_RELAXED);
+	}
+}
+
+static void async_publish(async_slot *const slot, const unsigned pos)
+{
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&g_async.sleeping, __ATOMIC_RELAXED))
+	{
+		async_wake();
+	}
+}
+
+static __thread int *g_async_users;
+static unsigned g_async_users_next;
+
+static int *async_users_counter(void)
+{
+	if (0 == g_async_users)
+	{
+		const unsigned i = __atomic_fetch_add(&g_async_users_next, 1,
+											  __ATOMIC_RELAXED);
+		g_async_users = &g_async.users[i % ASYNC_USERS_SZ].n;
+	}
+	return g_async_users;
+}
+#endif
+
+/* Line that doesn't fit into the slot (see ZF_LOG_LARGE_MESSAGES) is copied
+ * to the heap instead. It's truncated only when there is no memory for it.
+ */
+static void async_fill(async_slot *const slot, const zf_log_message *const msg,
+					   const zf_log_output *const output)
+{
+	const unsigned max_len = ZF_LOG_BUF_SZ - ZF_LOG_EOL_SZ;
+	const unsigned len = (unsigned)(msg->p - msg->buf);
+	slot->lvl = msg->lvl;
+	slot->tag = msg->tag;
+	slot->output = output;
+	slot->len = len < max_len? len: max_len;
+	slot->tag_b = (unsigned short)(msg->tag_b - msg->buf);
+	slot->tag_e = (unsigned short)(msg->tag_e - msg->buf);
+	slot->src_b = (unsigned short)(msg->src_b - msg->buf);
+	slot->msg_b = (unsigned short)(msg->msg_b - msg->buf);
+#if ZF_LOG_LARGE_MESSAGES
+	slot->large = 0;
+	if (max_len < len && 0 != (slot->large = (char *)malloc(len + ZF_LOG_EOL_SZ)))
+	{
+		slot->len = len;
+		memcpy(slot->large, msg->buf, len);
+		return;
+	}
+#endif
+	memcpy(slot->buf, msg->buf, slot->len);
+}
+
+static void async_output(async_slot *const slot)
+{
+	char *buf = slot->buf;
+	char *e = buf + (ZF_LOG_BUF_SZ - ZF_LOG_EOL_SZ);
+#if ZF_LOG_LARGE_MESSAGES
+	if (0 != slot->large)
+	{
+		buf = slot->large;
+		e = buf + slot->len;
+	}
+#endif
+	zf_log_message msg;
+	msg.lvl = slot->lvl;
+	msg.tag = slot->tag;
+	msg.buf = buf;
+	msg.e = e;
+	msg.p = buf + slot->len;
+	msg.tag_b = buf + slot->tag_b;
+	msg.tag_e = buf + slot->tag_e;
+	msg.src_b = buf + slot->src_b;
+	msg.msg_b = buf + slot->msg_b;
+	slot->output->callback(&msg, slot->output->arg);
+#if ZF_LOG_LARGE_MESSAGES
+	free(slot->large);
+	slot->large = 0;
+#endif
+}
+
+#if ZF_LOG_ASYNC_PER_THREAD
+static __thread async_ring *g_async_ring;
+static pthread_key_t g_async_ring_key;
+static pthread_once_t g_async_ring_once = PTHREAD_ONCE_INIT;
+
+/* Reuses time taken for the line context when there is one. Otherwise reads
+ * the same clock, so stamps from all threads are comparable.
+ */
+static unsigned long long async_stamp(void)
+{
+#ifdef CTX_TS
+	unsigned long long ns = g_ctx_ts;
+	if (0 == ns)
+	{
+		struct tm tm;
+		time_t sec;
+		unsigned nsec;
+		g_time_cb(&tm, &sec, &nsec);
+		ns = (unsigned long long)sec * 1000000000u + nsec;
+	}
+	g_ctx_ts = 0;
+	return ns;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000u + (unsigned long long)ts.tv_nsec;
+#endif
+}
+
+static void async_ring_unlink(async_ring *const r)
+{
+	async_ring **p = &g_async.rings;
+	while (r != *p)
+	{
+		p = &(*p)->next;
+	}
+	*p = r->next;
+	free(r);
+}
+
+/* Called on the thread that exits.
+ */
+static void async_ring_orphan(void *const arg)
+{
+	async_ring *const r = (async_ring *)arg;
+	g_async_ring = 0;
+	pthread_mutex_lock(&g_async_lock);
+	if (g_async.consumer)
+	{
+		__atomic_store_n(&r->orphaned, 1, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		async_ring_unlink(r);
+	}
+	pthread_mutex_unlock(&g_async_lock);
+}
+
+static void async_ring_key_create(void)
+{
+	if (0 != pthread_key_create(&g_async_ring_key, async_ring_orphan))
+	{
+		/* Rings will leak when threads exit. */
+		g_async_ring_key = (pthread_key_t)-1;
+	}
+}
+
+static async_ring *async_ring_create(void)
+{
+	pthread_once(&g_async_ring_once, async_ring_key_create);
+	pthread_mutex_lock(&g_async_lock);
+	const unsigned n = g_async.ring_sz;
+	async_ring *const r = (async_ring *)calloc(1, sizeof(async_ring) +
+											   n * sizeof(async_slot));
+	if (0 != r)
+	{
+		r->slots = (async_slot *)(r + 1);
+		r->mask = n - 1;
+		r->next = g_async.rings;
+		__atomic_store_n(&g_async.rings, r, __ATOMIC_RELEASE);
+		if ((pthread_key_t)-1 != g_async_ring_key)
+		{
+			pthread_setspecific(g_async_ring_key, r);
+		}
+	}
+	pthread_mutex_unlock(&g_async_lock);
+	return g_async_ring = r;
+}
+
+static int async_ring_empty(async_ring *const r)
+{
+	return __atomic_load_n(&r->head, __ATOMIC_RELAXED) ==
+		   __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Returns the ring with the oldest line at its head (0 when all are empty)
+ * and time of the oldest line among other rings. Sets orphans when there are
+ * empty rings of exited threads.
+ */
+static async_ring *async_pick(unsigned long long *const next_ts,
+							  int *const orphans)
+{
+	async_ring *best = 0;
+	unsigned long long best_ts = 0;
+	*next_ts = ~0ull;
+	*orphans = 0;
+	async_ring *r = __atomic_load_n(&g_async.rings, __ATOMIC_ACQUIRE);
+	for (; 0 != r; r = r->next)
+	{
+		if (async_ring_empty(r))
+		{
+			*orphans |= __atomic_load_n(&r->orphaned, __ATOMIC_RELAXED);
+			continue;
+		}
+		const async_slot *const slot = r->slots + (r->head & r->mask);
+		const unsigned long long ts = __atomic_load_n(&slot->ts, __ATOMIC_RELAXED);
+		if (0 == best || best_ts > ts)
+		{
+			if (0 != best)
+			{
+				*next_ts = best_ts;
+			}
+			best = r;
+			best_ts = ts;
+		}
+		else if (*next_ts > ts)
+		{
+			*next_ts = ts;
+		}
+	}
+	return best;
+}
+
+/* Passes lines from the ring to the output while they are not newer than
+ * the oldest line in other rings.
+ */
+static void async_drain(async_ring *const r, const unsigned long long next_ts)
+{
+	do
+	{
+		async_slot *const slot = r->slots + (r->head & r->mask);
+		if (__atomic_load_n(&slot->ts, __ATOMIC_RELAXED) > next_ts)
+		{
+			break;
+		}
+		async_output(slot);
+		__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+	}
+	while (!async_ring_empty(r));
+}
+
+/* Frees empty rings of exited threads. Orphaned flag is set after the last
+ * line was queued, so ring that is empty after that stays empty.
+ */
+static void async_reclaim(void)
+{
+	pthread_mutex_lock(&g_async_lock);
+	async_ring *r = g_async.rings;
+	while (0 != r)
+	{
+		async_ring *const next = r->next;
+		if (__atomic_load_n(&r->orphaned, __ATOMIC_ACQUIRE) && async_ring_empty(r))
+		{
+			async_ring_unlink(r);
+		}
+		r = next;
+	}
+	pthread_mutex_unlock(&g_async_lock);
+}
+
+static int async_pending(void)
+{
+	for (async_ring *r = g_async.rings; 0 != r; r = r->next)
+	{
+		if (!async_ring_empty(r))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int async_busy(void)
+{
+	for (async_ring *r = g_async.rings; 0 != r; r = r->next)
+	{
+		if (__atomic_load_n(&r->busy, __ATOMIC_ACQUIRE))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Producers that saw the queue running are busy until their line is queued,
+ * so consumer checks them before it checks for lines when stopping.
+ */
+static void *async_thread(void *arg)
+{
+	VAR_UNUSED(arg);
+	for (;;)
+	{
+		unsigned long long next_ts;
+		int orphans;
+		async_ring *const r = async_pick(&next_ts, &orphans);
+		if (0 != r)
+		{
+			async_drain(r, next_ts);
+			continue;
+		}
+		if (orphans)
+		{
+			async_reclaim();
+		}
+		pthread_mutex_lock(&g_async_lock);
+		if (0 != g_async.flush_waiters)
+		{
+			pthread_cond_broadcast(&g_async_flushed);
+		}
+		__atomic_store_n(&g_async.sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		const int busy = g_async.stop && async_busy();
+		if (!async_pending())
+		{
+			if (g_async.stop && !busy)
+			{
+				pthread_mutex_unlock(&g_async_lock);
+				break;
+			}
+			if (!g_async.stop)
+			{
+				async_timedwait(&g_async_wake, ASYNC_IDLE_WAIT_MS);
+			}
+		}
+		__atomic_store_n(&g_async.sleeping, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&g_async_lock);
+		if (busy)
+		{
+			sched_yield();
+		}
+	}
+	return 0;
+}
+
+int zf_log_async_start(const unsigned capacity)
+{
+	pthread_mutex_lock(&g_async_ctl_lock);
+	if (__atomic_load_n(&g_async.running, __ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_unlock(&g_async_ctl_lock);
+		return 0;
+	}
+	unsigned n = 1;
+	while (n < (0 != capacity? capacity: ZF_LOG_ASYNC_THREAD_QUEUE_SZ))
+	{
+		n <<= 1;
+	}
+	pthread_mutex_lock(&g_async_lock);
+	g_async.ring_sz = n;
+	g_async.stop = 0;
+	g_async.consumer = 0 == pthread_create(&g_async.thread, 0, async_thread, 0);
+	const int ok = g_async.consumer;
+	pthread_mutex_unlock(&g_async_lock);
+	if (ok)
+	{
+		__atomic_store_n(&g_async.running, 1, __ATOMIC_SEQ_CST);
+	}
+	pthread_mutex_unlock(&g_async_ctl_lock);
+	return ok? 0: -1;
+}
+
+/* Rings are FIFO and their lines are stamped with flush generation, so lines
+ * queued before this call are out once no ring has line of generation gen (or
+ * older) at its head. When head moves while its line is checked, the slot
+ * could already hold a newer line, so the ring is checked again later.
+ */
+static int async_behind(const unsigned gen)
+{
+	for (async_ring *r = g_async.rings; 0 != r; r = r->next)
+	{
+		const unsigned head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if (head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+		{
+			continue;
+		}
+		const async_slot *const slot = r->slots + (head & r->mask);
+		if (0 <= (int)(gen - __atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE)) ||
+			head != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void zf_log_async_flush(void)
+{
+	if (!__atomic_load_n(&g_async.running, __ATOMIC_SEQ_CST))
+	{
+		return;
+	}
+	const unsigned gen = __atomic_fetch_add(&g_async.flush_gen, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&g_async_lock);
+	++g_async.flush_waiters;
+	while (async_behind(gen))
+	{
+		pthread_cond_signal(&g_async_wake);
+		async_timedwait(&g_async_flushed, ASYNC_FLUSH_WAIT_MS);
+	}
+	--g_async.flush_waiters;
+	pthread_mutex_unlock(&g_async_lock);
+}
+
+void zf_log_async_stop(void)
+{
+	pthread_mutex_lock(&g_async_ctl_lock);
+	if (!__atomic_load_n(&g_async.running, __ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_unlock(&g_async_ctl_lock);
+		return;
+	}
+	/* New lines will go directly to the target output from now on. Consumer
+	 * waits for producers that already decided to use the queue.
+	 */
+	__atomic_store_n(&g_async.running, 0, __ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&g_async_lock);
+	g_async.stop = 1;
+	pthread_cond_signal(&g_async_wake);
+	pthread_mutex_unlock(&g_async_lock);
+	pthread_join(g_async.thread, 0);
+	pthread_mutex_lock(&g_async_lock);
+	g_async.consumer = 0;
+	async_ring *r = g_async.rings;
+	while (0 != r)
+	{
+		async_ring *const next = r->next;
+		if (r->orphaned)
+		{
+			async_ring_unlink(r);
+		}
+		r = next;
+	}
+	pthread_mutex_unlock(&g_async_lock);
+	pthread_mutex_unlock(&g_async_ctl_lock);
+}
+
+void zf_log_out_async_callback(const zf_log_message *const msg, void *arg)
+{
+	const zf_log_output *const output = (const zf_log_output *)arg;
+	async_ring *r = g_async_ring;
+	if (!__atomic_load_n(&g_async.running, __ATOMIC_RELAXED) ||
+		(0 == r && 0 == (r = async_ring_create())))
+	{
+		output->callback(msg, output->arg);
+		return;
+	}
+	/* Pairs with the fence consumer makes before it checks busy producers:
+	 * either consumer sees this producer busy or producer sees the queue
+	 * stopped. Other accesses to busy need no more than release / acquire.
+	 */
+	__atomic_store_n(&r->busy, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&g_async.running, __ATOMIC_RELAXED))
+	{
+		__atomic_store_n(&r->busy, 0, __ATOMIC_RELEASE);
+		output->callback(msg, output->arg);
+		return;
+	}
+	const unsigned tail = r->tail;
+	while (r->mask < tail - r->head_cache)
+	{
+		r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if (r->mask < tail - r->head_cache)
+		{
+			/* Ring is full. Don't drop the line, let consumer catch up. */
+			async_wake();
+			sched_yield();
+		}
+	}
+	async_slot *const slot = r->slots + (tail & r->mask);
+	async_fill(slot, msg, output);
+	__atomic_store_n(&slot->ts, async_stamp(), __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->gen, __atomic_load_n(&g_async.flush_gen, __ATOMIC_RELAXED),
+					 __ATOMIC_RELAXED);
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&g_async.sleeping, __ATOMIC_RELAXED))
+	{
+		async_wake();
+	}
+	__atomic_store_n(&r->busy, 0, __ATOMIC_RELEASE);
+}
+#else
+static int async_ready(const async_slot *const slot)
+{
+	return g_async.head + 1 == __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+}
+
+static void *async_thread(void *arg)
+{
+	VAR_UNUSED(arg);
+	for (;;)
+	{
+		async_slot *const slot = g_async.slots + (g_async.head & g_async.mask);
+		if (async_ready(slot))
+		{
+			async_output(slot);
+			__atomic_store_n(&slot->seq, g_async.head + g_async.mask + 1,
+							 __ATOMIC_RELEASE);
+			__atomic_store_n(&g_async.done, ++g_async.head, __ATOMIC_RELEASE);
+			continue;
+		}
+		pthread_mutex_lock(&g_async_lock);
+		if (0 != g_async.flush_waiters)
+		{
+			pthread_cond_broadcast(&g_async_flushed);
+		}
+		__atomic_store_n(&g_async.sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (!async_ready(slot))
+		{
+			if (g_async.stop)
+			{
+				pthread_mutex_unlock(&g_async_lock);
+				break;
+			}
+			async_timedwait(&g_async_wake, ASYNC_IDLE_WAIT_MS);
+		}
+		__atomic_store_n(&g_async.sleeping, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&g_async_lock);
+	}
+	return 0;
+}
+
+int zf_log_async_start(const unsigned capacity)
+{
+	pthread_mutex_lock(&g_async_ctl_lock);
+	if (__atomic_load_n(&g_async.running, __ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_unlock(&g_async_ctl_lock);
+		return 0;
+	}
+	unsigned n = 1;
+	while (n < (0 != capacity? capacity: ZF_LOG_ASYNC_QUEUE_SZ))
+	{
+		n <<= 1;
+	}
+	async_slot *const slots = (async_slot *)calloc(n, sizeof(async_slot));
+	if (0 == slots)
+	{
+		pthread_mutex_unlock(&g_async_ctl_lock);
+		return -1;
+	}
+	for (unsigned i = 0; n > i; ++i)
+	{
+		slots[i].seq = i;
+	}
+	pthread_mutex_lock(&g_async_lock);
+	g_async.slots = slots;
+	g_async.mask = n - 1;
+	g_async.tail = g_async.head = g_async.done = 0;
+	g_async.stop = 0;
+	const int ok = 0 == pthread_create(&g_async.thread, 0, async_thread, 0);
+	if (!ok)
+	{
+		g_async.slots = 0;
+		free(slots);
+	}
+	pthread_mutex_unlock(&g_async_lock);
+	if (ok)
+	{
+		__atomic_store_n(&g_async.running, 1, __ATOMIC_SEQ_CST);
+	}
+	pthread_mutex_unlock(&g_async_ctl_lock);
+	return ok? 0: -1;
+}
+
+void zf_log_async_flush(void)
+{
+	if (!__atomic_load_n(&g_async.running, __ATOMIC_SEQ_CST))
+	{
+		return;
+	}
+	const unsigned tail = __atomic_load_n(&g_async.tail, __ATOMIC_ACQUIRE);
+	pthread_mutex_lock(&g_async_lock);
+	++g_async.flush_waiters;
+	while (0 > (int)(__atomic_load_n(&g_async.done, __ATOMIC_ACQUIRE) - tail))
+	{
+		pthread_cond_signal(&g_async_wake);
+		async_timedwait(&g_async_flushed, ASYNC_FLUSH_WAIT_MS);
+	}
+	--g_async.flush_waiters;
+	pthread_mutex_unlock(&g_async_lock);
+}
+
+void zf_log_async_stop(void)
+{
+	pthread_mutex_lock(&g_async_ctl_lock);
+	if (!__atomic_load_n(&g_async.running, __ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_unlock(&g_async_ctl_lock);
+		return;
+	}
+	/* New lines will go directly to the target output from now on. Wait for
+	 * producers that already decided to use the queue. Producer that wasn't
+	 * counted yet when its counter was checked will see the queue stopped.
+	 */
+	__atomic_store_n(&g_async.running, 0, __ATOMIC_SEQ_CST);
+	for (unsigned i = 0; ASYNC_USERS_SZ > i; ++i)
+	{
+		while (0 != __atomic_load_n(&g_async.users[i].n, __ATOMIC_SEQ_CST))
+		{
+			sched_yield();
+		}
+	}
+	pthread_mutex_lock(&g_async_lock);
+	g_async.stop = 1;
+	pthread_cond_signal(&g_async_wake);
+	pthread_mutex_unlock(&g_async_lock);
+	pthread_join(g_async.thread, 0);
+	free(g_async.slots);
+	g_async.slots = 0;
+	pthread_mutex_unlock(&g_async_ctl_lock);
+}
+
+void zf_log_out_async_callback(const zf_log_message *const msg, void *arg)
+{
+	const zf_log_output *const output = (const zf_log_output *)arg;
+	int *const users = async_users_counter();
+	__atomic_fetch_add(users, 1, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&g_async.running, __ATOMIC_SEQ_CST))
+	{
+		__atomic_sub_fetch(users, 1, __ATOMIC_SEQ_CST);
+		output->callback(msg, output->arg);
+		return;
+	}
+	unsigned pos;
+	async_slot *const slot = async_claim(&pos);
+	async_fill(slot, msg, output);
+	async_publish(slot, pos);
+	__atomic_sub_fetch(users, 1, __ATOMIC_RELEASE);
+}
+#endif
+#endif
+
+#if ZF_LOG_BUFFERED_FILE
+/* Lines are appended to the buffer under the lock and the buffer is always
+ * written as a whole, so lines from different threads never interleave. File
+ * is opened with O_APPEND, so several processes can share it as well.
+ *
+ * Rotation is split in two parts. Logging thread only renames current file
+ * into a pending name ("<path>.rotated.<n>") and opens a new one, so no lines
+ * are lost and caller is never blocked by anything heavier than that. Rotation
+ * thread then shifts old generations ("<path>.1" is the newest) and runs
+ * compression of the pending file.
+ */
+#if defined(O_CLOEXEC)
+	#define FILE_OPEN_FLAGS (O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC)
+#else
+	#define FILE_OPEN_FLAGS (O_WRONLY | O_CREAT | O_APPEND)
+#endif
+#if defined(CLOCK_MONOTONIC_COARSE)
+	/* Resolution of few milliseconds is good enough for flush deadlines. */
+	#define FILE_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+	#define FILE_CLOCK CLOCK_MONOTONIC
+#endif
+/* Enough for ".rotated.<n>" or ".<n><compress_suffix>" after the path */
+#define FILE_NAME_EXTRA_SZ 64
+
+extern char **environ;
+
+struct zf_log_file
+{
+	pthread_mutex_t lock;
+	int fd;
+	unsigned flush_ms;
+	unsigned long long deadline; /* Buffered lines must be written by then */
+	char *buf;
+	size_t sz;
+	size_t len;
+	/* Rotation, used only when rotation.max_bytes or rotation.period_s set */
+	zf_log_rotation rotation;
+	unsigned long long written; /* Bytes in current file */
+	time_t rotate_at;
+	char *path;
+	char *pending; /* Used by logging thread */
+	char *src; /* Used by rotation thread */
+	char *dst; /* Used by rotation thread */
+	size_t name_sz;
+	pthread_t thread;
+	pthread_mutex_t rlock;
+	pthread_cond_t rwake;
+	unsigned rotated; /* Number of pending files produced */
+	unsigned retired; /* Number of pending files processed */
+	int stop;
+#if ZF_LOG_CRASH_HANDLER
+	zf_log_file *next; /* Next open file (see file_register()) */
+#endif
+};
+
+static unsigned long long file_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(FILE_CLOCK, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 +
+		   (unsigned long long)ts.tv_nsec / 1000000;
+}
+
+static int file_rotating(const zf_log_file *const f)
+{
+	return 0 != f->rotation.max_bytes || 0 != f->rotation.period_s;
+}
+
+/* Next multiple of the period counting from the local midnight.
+ */
+static time_t file_next_boundary(const time_t now, const unsigned period)
+{
+	struct tm tm;
+	localtime_r(&now, &tm);
+	tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	const time_t day = mktime(&tm);
+	return day + ((now - day) / period + 1) * period;
+}
+
+static void file_gen_name(const zf_log_file *const f, char *const name,
+						  const unsigned gen, const char *const suffix)
+{
+	snprintf(name, f->name_sz, "%s.%u%s", f->path, gen, suffix);
+}
+
+/* Moves pending file into the first generation. Runs on rotation thread.
+ */
+static void file_retire(zf_log_file *const f, const unsigned n)
+{
+	const zf_log_rotation *const r = &f->rotation;
+	const char *const suffix = 0 != r->compress? r->compress_suffix: "";
+	snprintf(f->src, f->name_sz, "%s.rotated.%u", f->path, n);
+	if (0 != access(f->src, F_OK))
+	{
+		/* Gap in numbers of pending files left by another process. */
+		return;
+	}
+	if (0 == r->keep)
+	{
+		remove(f->src);
+		return;
+	}
+	for (unsigned i = r->keep; 0 < i; --i)
+	{
+		/* Compression could fail, so look for both file names. */
+		for (int compressed = 0; 2 > compressed; ++compressed)
+		{
+			const char *const sfx = compressed? suffix: "";
+			if (compressed && 0 == *sfx)
+			{
+				break;
+			}
+			file_gen_name(f, f->dst, i, sfx);
+			if (r->keep == i)
+			{
+				remove(f->dst);
+				continue;
+			}
+			file_gen_name(f, f->dst + f->name_sz, i + 1, sfx);
+			rename(f->dst, f->dst + f->name_sz);
+		}
+	}
+	if (0 != r->compress)
+	{
+		file_gen_name(f, f->dst, 1, suffix);
+		if (0 == r->compress(f->src, f->dst, r->compress_arg))
+		{
+			remove(f->src);
+			return;
+		}
+		remove(f->dst);
+	}
+	file_gen_name(f, f->dst, 1, "");
+	rename(f->src, f->dst);
+}
+
+static void *file_rotation_thread(void *arg)
+{
+	zf_log_file *const f = (zf_log_file *)arg;
+	pthread_mutex_lock(&f->rlock);
+	for (;;)
+	{
+		if (f->retired != f->rotated)
+		{
+			const unsigned n = f->retired;
+			pthread_mutex_unlock(&f->rlock);
+			file_retire(f, n);
+			pthread_mutex_lock(&f->rlock);
+			++f->retired;
+		}
+		else if (f->stop)
+		{
+			break;
+		}
+		else
+		{
+			pthread_cond_wait(&f->rwake, &f->rlock);
+		}
+	}
+	pthread_mutex_unlock(&f->rlock);
+	return 0;
+}
+
+/* Finds pending files left by previous process (e.g. it was killed before
+ * rotation thread got to them). Numbering continues after them, so they are
+ * not overwritten, and rotation thread retires them first.
+ */
+static void file_scan_pending(zf_log_file *const f)
+{
+	const char *const sep = strrchr(f->path, '/');
+	const size_t dir_len = 0 != sep? (size_t)(sep - f->path) + 1: 0;
+	memcpy(f->src, f->path, dir_len);
+	memcpy(f->src + dir_len, ".", 2);
+	DIR *const dir = opendir(f->src);
+	if (0 == dir)
+	{
+		return;
+	}
+	snprintf(f->dst, f->name_sz, "%s.rotated.", f->path + dir_len);
+	const size_t prefix_len = strlen(f->dst);
+	unsigned lo = 0, hi = 0;
+	int found = 0;
+	const struct dirent *e;
+	while (0 != (e = readdir(dir)))
+	{
+		const char *const name = e->d_name;
+		char *end;
+		if (0 != strncmp(name, f->dst, prefix_len) ||
+			!isdigit((unsigned char)name[prefix_len]))
+		{
+			continue;
+		}
+		const unsigned long n = strtoul(name + prefix_len, &end, 10);
+		if (0 != *end || n != (unsigned)n)
+		{
+			continue;
+		}
+		lo = !found || lo > n? (unsigned)n: lo;
+		hi = !found || hi < n? (unsigned)n: hi;
+		found = 1;
+	}
+	closedir(dir);
+	if (found)
+	{
+		f->retired = lo;
+		f->rotated = hi + 1;
+	}
+}
+
+/* Replaces current file with a new one. Runs on logging thread.
+ */
+static void file_rotate(zf_log_file *const f)
+{
+	f->written = 0;
+	snprintf(f->pending, f->name_sz, "%s.rotated.%u", f->path, f->rotated);
+	if (0 != rename(f->path, f->pending))
+	{
+		return;
+	}
+	const int fd = open(f->path, FILE_OPEN_FLAGS, 0644);
+	if (0 > fd)
+	{
+		/* Keep writing to the old file then. */
+		rename(f->pending, f->path);
+		return;
+	}
+	close(f->fd);
+	f->fd = fd;
+	pthread_mutex_lock(&f->rlock);
+	++f->rotated;
+	pthread_cond_signal(&f->rwake);
+	pthread_mutex_unlock(&f->rlock);
+}
+
+static void file_writev(const int fd, struct iovec *iov, int n)
+{
+	while (0 < n)
+	{
+		const ssize_t r = writev(fd, iov, n);
+		if (0 > r)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			/* Nothing sensible could be done about it here. */
+			return;
+		}
+		size_t written = (size_t)r;
+		for (; 0 < n && iov->iov_len <= written; ++iov, --n)
+		{
+			written -= iov->iov_len;
+		}
+		if (0 < n)
+		{
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+}
+
+static void file_write(zf_log_file *const f, struct iovec *const iov,
+					   const int n)
+{
+	size_t sz = 0;
+	for (int i = 0; n > i; ++i)
+	{
+		sz += iov[i].iov_len;
+	}
+	if (0 != f->rotation.max_bytes && 0 != f->written &&
+		f->rotation.max_bytes < f->written + sz)
+	{
+		file_rotate(f);
+	}
+	file_writev(f->fd, iov, n);
+	f->written += sz;
+}
+
+static void file_write_buf(zf_log_file *const f)
+{
+	struct iovec iov;
+	iov.iov_base = f->buf;
+	iov.iov_len = f->len;
+	file_write(f, &iov, 1);
+	f->len = 0;
+}
+
+static void file_free(zf_log_file *const f)
+{
+	if (0 <= f->fd)
+	{
+		close(f->fd);
+	}
+	free(f->path);
+	free(f->buf);
+	free(f);
+}
+
+#if ZF_LOG_CRASH_HANDLER
+/* List of open files, so crash handler could write their buffers. Handler reads
+ * it without the lock.
+ */
+static zf_log_file *g_files;
+static pthread_mutex_t g_files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void file_register(zf_log_file *const f)
+{
+	pthread_mutex_lock(&g_files_lock);
+	f->next = g_files;
+	__atomic_store_n(&g_files, f, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&g_files_lock);
+}
+
+static void file_unregister(zf_log_file *const f)
+{
+	pthread_mutex_lock(&g_files_lock);
+	zf_log_file **p = &g_files;
+	for (; 0 != *p && f != *p; p = &(*p)->next) {}
+	if (0 != *p)
+	{
+		__atomic_store_n(p, f->next, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&g_files_lock);
+}
+#endif
+
+zf_log_file *zf_log_file_open_rotating(const char *const path,
+									   const unsigned buf_sz,
+									   const unsigned flush_ms,
+									   const zf_log_rotation *const rotation)
+{
+	zf_log_file *const f = (zf_log_file *)calloc(1, sizeof(zf_log_file));
+	if (0 == f)
+	{
+		return 0;
+	}
+	const size_t path_len = strlen(path);
+	f->sz = 0 != buf_sz? buf_sz: ZF_LOG_FILE_BUF_SZ;
+	f->flush_ms = flush_ms;
+	f->buf = (char *)malloc(f->sz);
+	f->fd = -1;
+	if (0 != rotation)
+	{
+		f->rotation = *rotation;
+	}
+	if (file_rotating(f))
+	{
+		/* One block for the path and all generated file names. */
+		f->name_sz = path_len + FILE_NAME_EXTRA_SZ;
+		f->path = (char *)malloc(path_len + 1 + 4 * f->name_sz);
+		if (0 == f->path)
+		{
+			file_free(f);
+			return 0;
+		}
+		memcpy(f->path, path, path_len + 1);
+		f->pending = f->path + path_len + 1;
+		f->src = f->pending + f->name_sz;
+		f->dst = f->src + f->name_sz;
+	}
+	if (0 != f->buf)
+	{
+		f->fd = open(path, FILE_OPEN_FLAGS, 0644);
+	}
+	if (0 > f->fd || 0 != pthread_mutex_init(&f->lock, 0))
+	{
+		file_free(f);
+		return 0;
+	}
+	if (file_rotating(f))
+	{
+		const off_t end = lseek(f->fd, 0, SEEK_END);
+		f->written = 0 < end? (unsigned long long)end: 0;
+		if (0 != f->rotation.period_s)
+		{
+			f->rotate_at = file_next_boundary(time(0), f->rotation.period_s);
+		}
+		file_scan_pending(f);
+		if (0 != pthread_mutex_init(&f->rlock, 0))
+		{
+			pthread_mutex_destroy(&f->lock);
+			file_free(f);
+			return 0;
+		}
+		if (0 != pthread_cond_init(&f->rwake, 0) ||
+			0 != pthread_create(&f->thread, 0, file_rotation_thread, f))
+		{
+			pthread_mutex_destroy(&f->rlock);
+			pthread_mutex_destroy(&f->lock);
+			file_free(f);
+			return 0;
+		}
+	}
+#if ZF_LOG_CRASH_HANDLER
+	file_register(f);
+#endif
+	return f;
+}
+
+zf_log_file *zf_log_file_open(const char *const path, const unsigned buf_sz,
+							  const unsigned flush_ms)
+{
+	return zf_log_file_open_rotating(path, buf_sz, flush_ms, 0);
+}
+
+void zf_log_file_flush(zf_log_file *const f)
+{
+	pthread_mutex_lock(&f->lock);
+	if (0 != f->len)
+	{
+		file_write_buf(f);
+	}
+	pthread_mutex_unlock(&f->lock);
+}
+
+void zf_log_file_close(zf_log_file *const f)
+{
+#if ZF_LOG_CRASH_HANDLER
+	file_unregister(f);
+#endif
+	zf_log_file_flush(f);
+	if (file_rotating(f))
+	{
+		pthread_mutex_lock(&f->rlock);
+		f->stop = 1;
+		pthread_cond_signal(&f->rwake);
+		pthread_mutex_unlock(&f->rlock);
+		pthread_join(f->thread, 0);
+		pthread_cond_destroy(&f->rwake);
+		pthread_mutex_destroy(&f->rlock);
+	}
+	pthread_mutex_destroy(&f->lock);
+	file_free(f);
+}
+
+int zf_log_gzip(const char *const src, const char *const dst, void *arg)
+{
+	VAR_UNUSED(arg);
+	char *const argv[] = {(char *)"gzip", (char *)"-c", (char *)src, 0};
+	posix_spawn_file_actions_t actions;
+	pid_t pid;
+	int status;
+	if (0 != posix_spawn_file_actions_init(&actions))
+	{
+		return -1;
+	}
+	int ret = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, dst,
+											   O_WRONLY | O_CREAT | O_TRUNC,
+											   0644);
+	if (0 == ret)
+	{
+		ret = posix_spawnp(&pid, argv[0], &actions, 0, argv, environ);
+	}
+	posix_spawn_file_actions_destroy(&actions);
+	if (0 != ret)
+	{
+		return -1;
+	}
+	while (0 > waitpid(pid, &status, 0))
+	{
+		if (EINTR != errno)
+		{
+			return -1;
+		}
+	}
+	return WIFEXITED(status) && 0 == WEXITSTATUS(status)? 0: -1;
+}
+
+void zf_log_out_file_callback(const zf_log_message *const msg, void *arg)
+{
+	zf_log_file *const f = (zf_log_file *)arg;
+	const size_t eol_len = sizeof(ZF_LOG_EOL) - 1;
+	memcpy(msg->p, ZF_LOG_EOL, eol_len);
+	const size_t len = (size_t)(msg->p - msg->buf) + eol_len;
+	pthread_mutex_lock(&f->lock);
+	if (0 != f->rotation.period_s)
+	{
+		const time_t now = time(0);
+		if (f->rotate_at <= now)
+		{
+			if (0 != f->len)
+			{
+				file_write_buf(f);
+			}
+			if (0 != f->written)
+			{
+				file_rotate(f);
+			}
+			f->rotate_at = file_next_boundary(now, f->rotation.period_s);
+		}
+	}
+	if (f->sz - f->len < len)
+	{
+		/* Line doesn't fit, write it together with the buffer. */
+		struct iovec iov[2];
+		iov[0].iov_base = f->buf;
+		iov[0].iov_len = f->len;
+		iov[1].iov_base = msg->buf;
+		iov[1].iov_len = len;
+		file_write(f, iov, 2);
+		f->len = 0;
+	}
+	else
+	{
+		if (0 == f->len)
+		{
+			f->deadline = file_now_ms() + f->flush_ms;
+		}
+		memcpy(f->buf + f->len, msg->buf, len);
+		f->len += len;
+		if (ZF_LOG_FATAL <= msg->lvl || f->sz == f->len ||
+			f->deadline <= file_now_ms())
+		{
+			file_write_buf(f);
+		}
+	}
+	pthread_mutex_unlock(&f->lock);
+}
+#endif
+
+#if ZF_LOG_DEDUP
+/* Line that was passed to the output last is kept together with the hash of
+ * its level, tag and message text. Identical lines that follow are not passed,
+ * only the copy of the latest one is updated, so summary line gets its context
+ * (e.g. time). FATAL lines are never held.
+ */
+struct zf_log_dedup
+{
+	pthread_mutex_t lock;
+	const zf_log_output *output;
+	unsigned timeout_ms;
+	unsigned hash;
+	unsigned repeats; /* Lines held since the last passed or summary line */
+	unsigned long long deadline; /* Summary must be written by then */
+	int lvl;
+	int has_tag;
+	unsigned short len;
+	unsigned short tag_b;
+	unsigned short tag_e;
+	unsigned short src_b;
+	unsigned short msg_b;
+	char buf[ZF_LOG_BUF_SZ];
+	char tag[ZF_LOG_BUF_SZ];
+};
+
+STATIC_ASSERT(dedup_offsets_fit, ZF_LOG_BUF_SZ <= 0xffff);
+
+static unsigned long long dedup_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 +
+		   (unsigned long long)ts.tv_nsec / 1000000;
+}
+
+/* FNV-1a */
+static unsigned dedup_hash_add(unsigned h, const char *p, const char *const e)
+{
+	for (; e != p; ++p)
+	{
+		h = (h ^ (unsigned char)*p) * 16777619u;
+	}
+	return h;
+}
+
+static unsigned dedup_hash(const zf_log_message *const msg)
+{
+	const unsigned h = 2166136261u ^ (unsigned)msg->lvl;
+	return dedup_hash_add(dedup_hash_add(h, msg->tag_b, msg->tag_e),
+						  msg->msg_b, msg->p);
+}
+
+static int dedup_same(const zf_log_dedup *const d,
+					  const zf_log_message *const msg, const unsigned hash)
+{
+	const size_t tag_len = (size_t)(msg->tag_e - msg->tag_b);
+	const size_t msg_len = (size_t)(msg->p - msg->msg_b);
+	return 0 != d->len && hash == d->hash && msg->lvl == d->lvl &&
+		   tag_len == (size_t)(d->tag_e - d->tag_b) &&
+		   msg_len == (size_t)(d->len - d->msg_b) &&
+		   0 == memcmp(msg->tag_b, d->buf + d->tag_b, tag_len) &&
+		   0 == memcmp(msg->msg_b, d->buf + d->msg_b, msg_len);
+}
+
+static void dedup_copy(zf_log_dedup *const d, const zf_log_message *const msg)
+{
+	/* Longer lines (see ZF_LOG_LARGE_MESSAGES) are cut and never match. */
+	const ptrdiff_t max_len = ZF_LOG_BUF_SZ - ZF_LOG_EOL_SZ;
+	const ptrdiff_t len = msg->p - msg->buf;
+	d->len = (unsigned short)(len < max_len? len: max_len);
+	d->tag_b = (unsigned short)(msg->tag_b - msg->buf);
+	d->tag_e = (unsigned short)(msg->tag_e - msg->buf);
+	d->src_b = (unsigned short)(msg->src_b - msg->buf);
+	d->msg_b = (unsigned short)(msg->msg_b - msg->buf);
+	memcpy(d->buf, msg->buf, d->len);
+}
+
+static void dedup_summary(zf_log_dedup *const d)
+{
+	zf_log_message msg;
+	char buf[ZF_LOG_BUF_SZ];
+	msg.lvl = d->lvl;
+	msg.tag = d->has_tag? d->tag: 0;
+	msg.buf = buf;
+	msg.e = buf + (ZF_LOG_BUF_SZ - ZF_LOG_EOL_SZ);
+	msg.tag_b = buf + d->tag_b;
+	msg.tag_e = buf + d->tag_e;
+	msg.src_b = buf + d->src_b;
+	msg.msg_b = buf + d->msg_b;
+	memcpy(buf, d->buf, d->msg_b);
+	msg.p = put_string("last message repeated ", msg.msg_b, msg.e);
+	msg.p = put_uint(d->repeats, 0, '\0', msg.p, msg.e);
+	msg.p = put_string(1 == d->repeats? " time": " times", msg.p, msg.e);
+	d->repeats = 0;
+	d->output->callback(&msg, d->output->arg);
+}
+
+void zf_log_out_dedup_callback(const zf_log_message *const msg, void *arg)
+{
+	zf_log_dedup *const d = (zf_log_dedup *)arg;
+	const unsigned hash = dedup_hash(msg);
+	pthread_mutex_lock(&d->lock);
+	if (ZF_LOG_FATAL > msg->lvl && dedup_same(d, msg, hash))
+	{
+		const unsigned long long now = 0 != d->timeout_ms? dedup_now_ms(): 0;
+		dedup_copy(d, msg);
+		if (0 == d->repeats++)
+		{
+			d->deadline = now + d->timeout_ms;
+		}
+		else if (0 != d->timeout_ms && d->deadline <= now)
+		{
+			dedup_summary(d);
+		}
+		pthread_mutex_unlock(&d->lock);
+		return;
+	}
+	if (0 != d->repeats)
+	{
+		dedup_summary(d);
+	}
+	dedup_copy(d, msg);
+	d->hash = hash;
+	d->lvl = msg->lvl;
+	d->has_tag = 0 != msg->tag;
+	if (d->has_tag)
+	{
+		const size_t n = strlen(msg->tag);
+		const size_t m = n < sizeof(d->tag)? n: sizeof(d->tag) - 1;
+		memcpy(d->tag, msg->tag, m);
+		d->tag[m] = 0;
+	}
+	d->output->callback(msg, d->output->arg);
+	pthread_mutex_unlock(&d->lock);
+}
+
+zf_log_dedup *zf_log_dedup_open(const zf_log_output *const output,
+								const unsigned timeout_ms)
+{
+	zf_log_dedup *const d = (zf_log_dedup *)calloc(1, sizeof(zf_log_dedup));
+	if (0 == d)
+	{
+		return 0;
+	}
+	if (0 != pthread_mutex_init(&d->lock, 0))
+	{
+		free(d);
+		return 0;
+	}
+	d->output = output;
+	d->timeout_ms = timeout_ms;
+	return d;
+}
+
+void zf_log_dedup_flush(zf_log_dedup *const d)
+{
+	pthread_mutex_lock(&d->lock);
+	if (0 != d->repeats)
+	{
+		dedup_summary(d);
+	}
+	pthread_mutex_unlock(&d->lock);
+}
+
+void zf_log_dedup_close(zf_log_dedup *const d)
+{
+	zf_log_dedup_flush(d);
+	pthread_mutex_destroy(&d->lock);
+	free(d);
+}
+#endif
+
+/* Flight recorder (see zf_log_set_capture_level() in zf_log.h). Writers claim
+ * positions in the ring with a single atomic increment. Slot sequence is odd
+ * while the line is written and holds its position after that, so reader can
+ * detect lines that were overwritten while it was copying them. Writer drops
+ * the line when slot is still written by a thread that wrapped the ring.
+ */
+#if ZF_LOG_RECORDER
+typedef struct recorder_slot
+{
+	unsigned seq;
+	int lvl;
+	unsigned char deferred;
+	unsigned short len;
+	unsigned short tag_b, tag_e, src_b, msg_b;
+	char buf[ZF_LOG_BUF_SZ];
+}
+recorder_slot;
+
+STATIC_ASSERT(recorder_sz_is_pow2,
+			  0 == (ZF_LOG_RECORDER_SZ & (ZF_LOG_RECORDER_SZ - 1)));
+STATIC_ASSERT(recorder_offsets_fit_slot, ZF_LOG_BUF_SZ <= 0xffff);
+
+static recorder_slot g_recorder[ZF_LOG_RECORDER_SZ];
+static unsigned g_recorder_pos;
+static const zf_log_output *g_recorder_fatal_output;
+
+static void recorder_put(const zf_log_message *const msg, const int deferred)
+{
+	const unsigned pos = __atomic_fetch_add(&g_recorder_pos, 1, __ATOMIC_RELAXED);
+	recorder_slot *const slot = g_recorder + pos % ZF_LOG_RECORDER_SZ;
+	unsigned seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+	if (1 & seq || 0 < (int)(seq - 2 * pos) ||
+		!__atomic_compare_exchange_n(&slot->seq, &seq, 2 * pos + 1, 0,
+									 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	{
+		return;
+	}
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	/* Line could be longer (see ZF_LOG_LARGE_MESSAGES). */
+	const size_t max_len = ZF_LOG_BUF_SZ - ZF_LOG_EOL_SZ;
+	const size_t len = (size_t)(msg->p - msg->buf) < max_len?
+			(size_t)(msg->p - msg->buf): max_len;
+	slot->lvl = msg->lvl;
+	slot->deferred = (unsigned char)deferred;
+	slot->len = (unsigned short)len;
+	slot->tag_b = (unsigned short)(msg->tag_b - msg->buf);
+	slot->tag_e = (unsigned short)(msg->tag_e - msg->buf);
+	slot->src_b = (unsigned short)(msg->src_b - msg->buf);
+	slot->msg_b = (unsigned short)(msg->msg_b - msg->buf);
+	memcpy(slot->buf, msg->buf, len);
+	__atomic_store_n(&slot->seq, 2 * pos + 2, __ATOMIC_RELEASE);
+}
+
+/* Copies the line at the position. Returns -1 when line is not there (not
+ * written yet, dropped or overwritten).
+ */
+static int recorder_get(const unsigned pos, recorder_slot *const copy)
+{
+	const recorder_slot *const slot = g_recorder + pos % ZF_LOG_RECORDER_SZ;
+	const unsigned seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	if (2 * pos + 2 != seq)
+	{
+		return -1;
+	}
+	memcpy(copy, slot, sizeof(*copy));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return seq == __atomic_load_n(&slot->seq, __ATOMIC_RELAXED)? 0: -1;
+}
+#endif
+
+void zf_log_recorder_dump(const zf_log_output *const output)
+{
+#if ZF_LOG_RECORDER
+	const unsigned e = __atomic_load_n(&g_recorder_pos, __ATOMIC_ACQUIRE);
+	const unsigned n = ZF_LOG_RECORDER_SZ < e? ZF_LOG_RECORDER_SZ: e;
+	for (unsigned pos = e - n; e != pos; ++pos)
+	{
+		recorder_slot slot;
+		if (0 != recorder_get(pos, &slot))
+		{
+			continue;
+		}
+	#if ZF_LOG_DEFERRED
+		if (slot.deferred)
+		{
+			zf_log_render_deferred(slot.buf, slot.len, output);
+			continue;
+		}
+	#endif
+		zf_log_message msg;
+		msg.lvl = slot.lvl;
+		msg.tag = 0;
+		msg.buf = slot.buf;
+		msg.e = slot.buf + (ZF_LOG_BUF_SZ - ZF_LOG_EOL_SZ);
+		msg.p = slot.buf + slot.len;
+		msg.tag_b = slot.buf + slot.tag_b;
+		msg.tag_e = slot.buf + slot.tag_e;
+		msg.src_b = slot.buf + slot.src_b;
+		msg.msg_b = slot.buf + slot.msg_b;
+		output->callback(&msg, output->arg);
+	}
+#else
+	VAR_UNUSED(output);
+#endif
+}
+
+void zf_log_recorder_set_fatal_output(const zf_log_output *const output)
+{
+#if ZF_LOG_RECORDER
+	g_recorder_fatal_output = output;
+#else
+	VAR_UNUSED(output);
+#endif
+}
+
+/* Signal-safe path (see zf_log_crash_handler_install() in zf_log.h). Uses only
+ * functions that POSIX lists as async-signal-safe: clock_gettime(), getpid(),
+ * write() and string functions. Crash handler writes pending lines of the
+ * asynchronous queue and the flight recorder to the crash descriptor and
+ * buffered lines of open log files to their own files. All of them are read
+ * without locks, since thread that holds the lock could be the one that
+ * crashed. Line that is being written concurrently could come out garbled.
+ * Backtrace is written with backtrace_symbols_fd(), which doesn't allocate.
+ */
+#if ZF_LOG_CRASH_HANDLER
+#define CRASH_STACK_SZ (64 * 1024)
+#define CRASH_FRAMES 64
+
+static const int c_crash_signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+static struct sigaction g_crash_prev[_countof(c_crash_signals)];
+static int g_crash_fd = STDERR_FILENO;
+static int g_crash_installed;
+static int g_crashed;
+/* Alternative signal stack of the thread. Stack is freed by key destructor
+ * when thread exits, since only that thread can unregister it.
+ */
+static __thread void *g_crash_thread_stack;
+static pthread_key_t g_crash_stack_key;
+static pthread_once_t g_crash_stack_once = PTHREAD_ONCE_INIT;
+
+static void crash_write(const int fd, const char *p, size_t n)
+{
+	while (0 != n)
+	{
+		const ssize_t r = write(fd, p, n);
+		if (0 > r)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			return;
+		}
+		p += r;
+		n -= (size_t)r;
+	}
+}
+
+	#if ZF_LOG_ASYNC || ZF_LOG_RECORDER
+static void crash_write_line(const int fd, const char *const p, const size_t n)
+{
+	crash_write(fd, p, n);
+	crash_write(fd, ZF_LOG_EOL, sizeof(ZF_LOG_EOL) - 1);
+}
+	#endif
+
+	#if ZF_LOG_ASYNC_PER_THREAD
+/* Starts with lines consumer is passing to the output right now, since one
+ * of them could be the one that crashed. Rings are drained one by one.
+ */
+static void crash_drain_async(const int fd)
+{
+	if (!__atomic_load_n(&g_async.running, __ATOMIC_ACQUIRE))
+	{
+		return;
+	}
+	async_ring *r = __atomic_load_n(&g_async.rings, __ATOMIC_ACQUIRE);
+	for (; 0 != r; r = r->next)
+	{
+		const unsigned tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		unsigned pos = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		for (; tail != pos; ++pos)
+		{
+			const async_slot *const slot = r->slots + (pos & r->mask);
+			crash_write_line(fd, slot->buf, slot->len);
+		}
+	}
+}
+	#elif ZF_LOG_ASYNC
+/* Starts with the line consumer is passing to the output right now, since it
+ * could be the one that crashed.
+ */
+static void crash_drain_async(const int fd)
+{
+	if (!__atomic_load_n(&g_async.running, __ATOMIC_ACQUIRE))
+	{
+		return;
+	}
+	const unsigned tail = __atomic_load_n(&g_async.tail, __ATOMIC_ACQUIRE);
+	unsigned pos = __atomic_load_n(&g_async.done, __ATOMIC_ACQUIRE);
+	for (; tail != pos; ++pos)
+	{
+		const async_slot *const slot = g_async.slots + (pos & g_async.mask);
+		if (pos + 1 == __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE))
+		{
+			crash_write_line(fd, slot->buf, slot->len);
+		}
+	}
+}
+	#endif
+
+	#if ZF_LOG_BUFFERED_FILE
+static void crash_drain_files(void)
+{
+	zf_log_file *f = __atomic_load_n(&g_files, __ATOMIC_ACQUIRE);
+	for (; 0 != f; f = f->next)
+	{
+		crash_write(f->fd, f->buf, f->len);
+	}
+}
+	#endif
+
+	#if ZF_LOG_RECORDER
+/* Binary records are skipped, rendering them is not signal-safe.
+ */
+static void crash_drain_recorder(const int fd)
+{
+	const unsigned e = __atomic_load_n(&g_recorder_pos, __ATOMIC_ACQUIRE);
+	const unsigned n = ZF_LOG_RECORDER_SZ < e? ZF_LOG_RECORDER_SZ: e;
+	for (unsigned pos = e - n; e != pos; ++pos)
+	{
+		recorder_slot slot;
+		if (0 == recorder_get(pos, &slot) && !slot.deferred)
+		{
+			crash_write_line(fd, slot.buf, slot.len);
+		}
+	}
+}
+	#endif
+
+static void crash_handler(const int sig, siginfo_t *const info, void *const ctx)
+{
+	VAR_UNUSED(info);
+	VAR_UNUSED(ctx);
+	const int saved_errno = errno;
+	if (0 == __atomic_fetch_add(&g_crashed, 1, __ATOMIC_SEQ_CST))
+	{
+		char msg[32];
+		char *p = put_string("Crashed with signal ", msg, msg + sizeof(msg) - 1);
+		p = put_uint((unsigned)sig, 0, 0, p, msg + sizeof(msg) - 1);
+		*p = 0;
+		zf_log_write_signal_safe(ZF_LOG_FATAL, 0, msg);
+	#if ZF_LOG_ASYNC
+		crash_drain_async(g_crash_fd);
+	#endif
+	#if ZF_LOG_BUFFERED_FILE
+		crash_drain_files();
+	#endif
+	#if ZF_LOG_RECORDER
+		crash_drain_recorder(g_crash_fd);
+	#endif
+	#ifdef CRASH_BACKTRACE
+		void *frames[CRASH_FRAMES];
+		backtrace_symbols_fd(frames, backtrace(frames, CRASH_FRAMES), g_crash_fd);
+	#endif
+	}
+	/* Signal is blocked while handler runs, so it will be delivered to the
+	 * previous handler (or default action) right after this one returns.
+	 */
+	for (unsigned i = 0; _countof(c_crash_signals) > i; ++i)
+	{
+		if (sig == c_crash_signals[i])
+		{
+			sigaction(sig, g_crash_prev + i, 0);
+		}
+	}
+	raise(sig);
+	errno = saved_errno;
+}
+#endif
+
+void zf_log_write_signal_safe(const int lvl, const char *const tag,
+							  const char *const msg)
+{
+#if ZF_LOG_CRASH_HANDLER
+	static const char lvl_chars[] = "?VDIWEF";
+	char buf[ZF_LOG_BUF_SZ];
+	char num[24];
+	char *const e = buf + (ZF_LOG_BUF_SZ - ZF_LOG_EOL_SZ);
+	char *const num_e = num + sizeof(num);
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	char *p = put_stringn(put_ullong_r((unsigned long long)ts.tv_sec, num_e),
+						  num_e, buf, e);
+	p = put_string(".", p, e);
+	p = put_uint((unsigned)(ts.tv_nsec / 1000000), 3, '0', p, e);
+	p = put_string(" ", p, e);
+	p = put_uint((unsigned)getpid(), 0, 0, p, e);
+	#if defined(__ANDROID__)
+	p = put_string(" ", p, e);
+	p = put_uint((unsigned)gettid(), 0, 0, p, e);
+	#elif defined(__linux__)
+	p = put_string(" ", p, e);
+	p = put_uint((unsigned)syscall(SYS_gettid), 0, 0, p, e);
+	#endif
+	p = put_string(" ", p, e);
+	if (e > p)
+	{
+		*p++ = lvl_chars[ZF_LOG_VERBOSE <= lvl && ZF_LOG_FATAL >= lvl? lvl: 0];
+	}
+	const char *const prefix = _zf_log_tag_prefix;
+	const int has_prefix = 0 != prefix && 0 != *prefix;
+	const int has_tag = 0 != tag && 0 != *tag;
+	if (has_prefix || has_tag)
+	{
+		p = put_string(" ", p, e);
+		if (has_prefix)
+		{
+			p = put_string(prefix, p, e);
+			if (has_tag)
+			{
+				p = put_string(".", p, e);
+			}
+		}
+		if (has_tag)
+		{
+			p = put_string(tag, p, e);
+		}
+	}
+	p = put_string(" ", p, e);
+	p = put_string(0 != msg? msg: "", p, e);
+	p = put_string(ZF_LOG_EOL, p, buf + ZF_LOG_BUF_SZ);
+	crash_write(g_crash_fd, buf, (size_t)(p - buf));
+#else
+	VAR_UNUSED(lvl);
+	VAR_UNUSED(tag);
+	VAR_UNUSED(msg);
+#endif
+}
+
+#if ZF_LOG_CRASH_HANDLER
+/* Unregisters alternative signal stack of the calling thread and frees it.
+ * Stack is kept when it's not the one that thread uses (or uses right now).
+ */
+static void crash_stack_free(void *const sp)
+{
+	stack_t ss;
+	if (0 != sigaltstack(0, &ss) || (SS_DISABLE & ss.ss_flags) ||
+		sp != ss.ss_sp || (SS_ONSTACK & ss.ss_flags))
+	{
+		return;
+	}
+	ss.ss_flags = SS_DISABLE;
+	if (0 == sigaltstack(&ss, 0))
+	{
+		free(sp);
+	}
+}
+
+static void crash_stack_key_create(void)
+{
+	if (0 != pthread_key_create(&g_crash_stack_key, crash_stack_free))
+	{
+		/* Stacks will leak when threads exit. */
+		g_crash_stack_key = (pthread_key_t)-1;
+	}
+}
+#endif
+
+int zf_log_crash_handler_thread_install(void)
+{
+#if ZF_LOG_CRASH_HANDLER
+	if (0 != g_crash_thread_stack)
+	{
+		return 0;
+	}
+	stack_t ss;
+	ss.ss_sp = malloc(CRASH_STACK_SZ);
+	ss.ss_size = CRASH_STACK_SZ;
+	ss.ss_flags = 0;
+	if (0 == ss.ss_sp || 0 != sigaltstack(&ss, 0))
+	{
+		free(ss.ss_sp);
+		return -1;
+	}
+	pthread_once(&g_crash_stack_once, crash_stack_key_create);
+	if ((pthread_key_t)-1 != g_crash_stack_key)
+	{
+		pthread_setspecific(g_crash_stack_key, ss.ss_sp);
+	}
+	g_crash_thread_stack = ss.ss_sp;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+int zf_log_crash_handler_install(const int fd)
+{
+#if ZF_LOG_CRASH_HANDLER
+	g_crash_fd = 0 <= fd? fd: STDERR_FILENO;
+	if (g_crash_installed)
+	{
+		return 0;
+	}
+	#ifdef CRASH_BACKTRACE
+	/* First call loads unwinder library, which is not safe in the handler. */
+	void *frame;
+	backtrace(&frame, 1);
+	#endif
+	if (0 != zf_log_crash_handler_thread_install())
+	{
+		return -1;
+	}
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = crash_handler;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&sa.sa_mask);
+	for (unsigned i = 0; _countof(c_crash_signals) > i; ++i)
+	{
+		sigaction(c_crash_signals[i], &sa, g_crash_prev + i);
+	}
+	g_crash_installed = 1;
+	return 0;
+#else
+	VAR_UNUSED(fd);
+	return -1;
+#endif
+}
+
+void zf_log_crash_handler_remove(void)
+{
+#if ZF_LOG_CRASH_HANDLER
+	if (!g_crash_installed)
+	{
+		return;
+	}
+	for (unsigned i = 0; _countof(c_crash_signals) > i; ++i)
+	{
+		sigaction(c_crash_signals[i], g_crash_prev + i, 0);
+	}
+	/* Stacks of other threads are freed when they exit. */
+	void *const sp = g_crash_thread_stack;
+	if (0 != sp)
+	{
+		if ((pthread_key_t)-1 != g_crash_stack_key)
+		{
+			pthread_setspecific(g_crash_stack_key, 0);
+		}
+		g_crash_thread_stack = 0;
+		crash_stack_free(sp);
+	}
+	g_crash_installed = 0;
+#endif
+}
+
+/* Output log levels of tags (see zf_log_set_tag_level() in zf_log.h). Slots
+ * are only added, so names published so far could be read without locking.
+ * Writers are serialized with a spin lock, since they are rare. Slot holds
+ * effective level of the tag, so statements check it with a single load.
+ */
+#if defined(__GNUC__)
+	#define TAG_LEVELS
+	#define TAG_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+	#define TAG_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+	#define TAG_TRY_LOCK(p) \
+			__atomic_exchange_n((p), 1, __ATOMIC_ACQUIRE) == 0
+#elif defined(_WIN32) || defined(_WIN64)
+	#define TAG_LEVELS
+	#define TAG_LOAD(p) InterlockedCompareExchange((volatile LONG *)(p), 0, 0)
+	#define TAG_STORE(p, v) InterlockedExchange((volatile LONG *)(p), (LONG)(v))
+	#define TAG_TRY_LOCK(p) \
+			(0 == InterlockedCompareExchange((volatile LONG *)(p), 1, 0))
+#endif
+
+#ifdef TAG_LEVELS
+static const char *g_tag_names[ZF_LOG_TAG_SLOTS];
+static int g_tag_own_lvls[ZF_LOG_TAG_SLOTS];
+static int g_tag_lvls[ZF_LOG_TAG_SLOTS];
+static unsigned g_tag_slots;
+static int g_tag_lock;
+
+static void tag_lock(void)
+{
+	while (!TAG_TRY_LOCK(&g_tag_lock))
+	{
+	}
+}
+
+static void tag_unlock(void)
+{
+	TAG_STORE(&g_tag_lock, 0);
+}
+
+/* Returns level that statements check for the tag with its own output level
+ * (0 when it doesn't have one).
+ */
+static int tag_slot_lvl(const int own_lvl)
+{
+	return 0 == own_lvl? _zf_log_global_output_lvl: own_lvl;
+}
+
+static unsigned tag_find(const char *const tag, const unsigned n)
+{
+	unsigned i = 0;
+	while (n > i && 0 != strcmp(g_tag_names[i], tag))
+	{
+		++i;
+	}
+	return i;
+}
+
+/* Returns slot of the tag, adds new one when necessary. Must be called with
+ * the lock held. Returns ZF_LOG_TAG_SLOTS when there are no free slots.
+ */
+static unsigned tag_add(const char *const tag)
+{
+	const unsigned n = g_tag_slots;
+	const unsigned i = tag_find(tag, n);
+	if (n != i || ZF_LOG_TAG_SLOTS == n)
+	{
+		return i;
+	}
+	const size_t len = strlen(tag) + 1;
+	char *const name = (char *)malloc(len);
+	if (0 == name)
+	{
+		return ZF_LOG_TAG_SLOTS;
+	}
+	memcpy(name, tag, len);
+	g_tag_names[n] = name;
+	g_tag_own_lvls[n] = 0;
+	g_tag_lvls[n] = _zf_log_global_output_lvl;
+	TAG_STORE(&g_tag_slots, n + 1);
+	return n;
+}
+
+static int tag_output_lvl(const char *const tag)
+{
+	if (0 != tag)
+	{
+		const unsigned n = (unsigned)TAG_LOAD(&g_tag_slots);
+		const unsigned i = tag_find(tag, n);
+		if (n != i)
+		{
+			return (int)TAG_LOAD(g_tag_lvls + i);
+		}
+	}
+	return _zf_log_global_output_lvl;
+}
+#endif
+
+/* Records of dynamic log statements (see ZF_LOG_DYNAMIC_SITES in zf_log.h).
+ * Linker defines start and stop symbols for sections that have C identifier
+ * names. They are weak, because module could have no such statements at all.
+ * Hidden visibility makes each module see only its own records.
+ */
+#if defined(__GNUC__) && defined(__ELF__)
+	#define DYNAMIC_SITES
+	#define SITES_START _PP_CONCAT_2(__start_, _zf_log_sites)
+	#define SITES_STOP _PP_CONCAT_2(__stop_, _zf_log_sites)
+#endif
+
+#ifdef DYNAMIC_SITES
+extern zf_log_dynamic_site SITES_START[]
+		__attribute__((weak, visibility("hidden")));
+extern zf_log_dynamic_site SITES_STOP[]
+		__attribute__((weak, visibility("hidden")));
+
+typedef struct site_filter
+{
+	const char *file, *file_e;
+	const char *func, *func_e;
+	const char *tag, *tag_e;
+	unsigned line_b, line_e;
+}
+site_filter;
+
+static int site_output_lvl(const zf_log_dynamic_site *const site)
+{
+#ifdef TAG_LEVELS
+	return tag_output_lvl(site->tag);
+#else
+	VAR_UNUSED(site);
+	return _zf_log_global_output_lvl;
+#endif
+}
+
+static void site_update(zf_log_dynamic_site *const site)
+{
+	const unsigned char mode = __atomic_load_n(&site->mode, __ATOMIC_RELAXED);
+	unsigned char on = _ZF_LOG_SITE_UNRESOLVED;
+	if (ZF_LOG_SITE_DEFAULT != mode)
+	{
+		on = ZF_LOG_SITE_ON == mode;
+	}
+	else if (0 != site->lvl)
+	{
+		on = site->lvl >= site_output_lvl(site);
+	}
+	__atomic_store_n(&site->on, on, __ATOMIC_RELAXED);
+}
+
+static void sites_update(void)
+{
+	for (zf_log_dynamic_site *site = SITES_START; SITES_STOP != site; ++site)
+	{
+		site_update(site);
+	}
+}
+
+/* Matches string against [p, e) pattern with '*' and '?' wildcards.
+ */
+static int glob_match(const char *p, const char *const e, const char *s)
+{
+	const char *star = 0, *star_s = 0;
+	for (;;)
+	{
+		if (e != p && '*' == *p)
+		{
+			star = ++p;
+			star_s = s;
+			continue;
+		}
+		if (0 == *s)
+		{
+			break;
+		}
+		if (e != p && ('?' == *p || *p == *s))
+		{
+			++p;
+			++s;
+			continue;
+		}
+		if (0 == star)
+		{
+			return 0;
+		}
+		p = star;
+		s = ++star_s;
+	}
+	while (e != p && '*' == *p)
+	{
+		++p;
+	}
+	return e == p;
+}
+
+static const char *parse_uint(const char *p, const char *const e,
+							  unsigned *const v)
+{
+	if (e == p || '0' > *p || '9' < *p)
+	{
+		return 0;
+	}
+	for (*v = 0; e != p && '0' <= *p && '9' >= *p; ++p)
+	{
+		*v = 10 * *v + (unsigned)(*p - '0');
+	}
+	return p;
+}
+
+static int parse_site_filter(const char *p, site_filter *const f)
 {
-	_PP_MAP(_ZF_LOG_MESSAGE_FORMAT_INIT, ZF_LOG_MESSAGE_SRC_FORMAT)
-#if !_ZF_LOG_MESSAGE_FORMAT_CONTAINS(FUNCTION, ZF_LOG_MESSAGE_SRC_FORMAT) && \
-	!_ZF_LOG_MESSAGE_FORMAT_CONTAINS(FILENAME, ZF_LOG_MESSAGE_SRC_FORMAT) && \
-	!_ZF_LOG_MESSAGE_FORMAT_CONTAINS(FILELINE, ZF_LOG_MESSAGE_SRC_FORMAT)
-	VAR_UNUSED(src);
-#endif
-#if !_ZF_LOG_MESSAGE_FORMAT_FIELDS(ZF_LOG_MESSAGE_SRC_FORMAT)
-	VAR_UNUSED(msg);
-#else
-	#if ZF_LOG_OPTIMIZE_SIZE
-	int n;
-	n = _ZF_LOG_SNPRINTF(msg->p, nprintf_size(msg),
-						 _PP_MAP(_ZF_LOG_MESSAGE_FORMAT_PRINTF_FMT, ZF_LOG_MESSAGE_SRC_FORMAT)
-						 _PP_MAP(_ZF_LOG_MESSAGE_FORMAT_PRINTF_VAL, ZF_LOG_MESSAGE_SRC_FORMAT));
-	put_nprintf(msg, n);
-	#else
-	_PP_MAP(_ZF_LOG_MESSAGE_FORMAT_PUT, ZF_LOG_MESSAGE_SRC_FORMAT)
-	#endif
-#endif
+	memset(f, 0, sizeof(*f));
+	f->line_e = ~0u;
+	while (0 != p)
+	{
+		while (' ' == *p)
+		{
+			++p;
+		}
+		if (0 == *p)
+		{
+			break;
+		}
+		const char *const k = p;
+		while (0 != *p && ' ' != *p && '=' != *p)
+		{
+			++p;
+		}
+		if ('=' != *p)
+		{
+			return -1;
+		}
+		const size_t k_len = (size_t)(p - k);
+		const char *const v = ++p;
+		while (0 != *p && ' ' != *p)
+		{
+			++p;
+		}
+		if (4 == k_len && 0 == memcmp("file", k, k_len))
+		{
+			f->file = v;
+			f->file_e = p;
+		}
+		else if (4 == k_len && 0 == memcmp("func", k, k_len))
+		{
+			f->func = v;
+			f->func_e = p;
+		}
+		else if (3 == k_len && 0 == memcmp("tag", k, k_len))
+		{
+			f->tag = v;
+			f->tag_e = p;
+		}
+		else if (4 == k_len && 0 == memcmp("line", k, k_len))
+		{
+			const char *l = parse_uint(v, p, &f->line_b);
+			f->line_e = f->line_b;
+			if (0 != l && p != l && '-' == *l)
+			{
+				l = parse_uint(l + 1, p, &f->line_e);
+			}
+			if (p != l)
+			{
+				return -1;
+			}
+		}
+		else
+		{
+			return -1;
+		}
+	}
+	return 0;
 }
 
-static void put_msg(zf_log_message *const msg,
-					const char *const fmt, va_list va)
+static int site_match(const site_filter *const f,
+					  const zf_log_dynamic_site *const site)
 {
-	int n;
-	msg->msg_b = msg->p;
-	n = _ZF_LOG_VSNPRINTF(msg->p, nprintf_size(msg), fmt, va);
-	put_nprintf(msg, n);
+	const _zf_log_site *const src = &site->src;
+	const char *const func = 0 != src->func? src->func: "";
+	const char *const tag = 0 != site->tag? site->tag: "";
+	return (0 == f->file || glob_match(f->file, f->file_e, src->file)) &&
+		   (0 == f->func || glob_match(f->func, f->func_e, func)) &&
+		   (0 == f->tag || glob_match(f->tag, f->tag_e, tag)) &&
+		   f->line_b <= src->line && f->line_e >= src->line;
 }
 
-static void output_mem(const zf_log_spec *log, zf_log_message *const msg,
-					   const mem_block *const mem)
+int _zf_log_site_resolve(zf_log_dynamic_site *const site, const int lvl)
 {
-	if (0 == mem->d || 0 == mem->d_sz)
+	const unsigned char mode = __atomic_load_n(&site->mode, __ATOMIC_RELAXED);
+	if (ZF_LOG_SITE_DEFAULT != mode)
 	{
-		return;
+		return ZF_LOG_SITE_ON == mode;
 	}
-	const unsigned char *mem_p = (const unsigned char *)mem->d;
-	const unsigned char *const mem_e = mem_p + mem->d_sz;
-	const unsigned char *mem_cut;
-	const ptrdiff_t mem_width = (ptrdiff_t)log->format->mem_width;
-	char *const hex_b = msg->msg_b;
-	char *const ascii_b = hex_b + 2 * mem_width + 2;
-	char *const ascii_e = ascii_b + mem_width;
-	if (msg->e < ascii_e)
+	const unsigned char on = lvl >= site_output_lvl(site);
+	if (0 != site->lvl)
 	{
-		return;
+		/* Concurrent update already stored value that is more recent. */
+		unsigned char unresolved = _ZF_LOG_SITE_UNRESOLVED;
+		__atomic_compare_exchange_n(&site->on, &unresolved, on, 0,
+									__ATOMIC_RELAXED, __ATOMIC_RELAXED);
 	}
-	while (mem_p != mem_e)
+	return on;
+}
+#endif
+
+unsigned zf_log_enum_sites(const zf_log_site_cb cb, void *arg)
+{
+	unsigned n = 0;
+#ifdef DYNAMIC_SITES
+	for (zf_log_dynamic_site *site = SITES_START; SITES_STOP != site; ++site)
 	{
-		char *hex = hex_b;
-		char *ascii = ascii_b;
-		for (mem_cut = mem_width < mem_e - mem_p? mem_p + mem_width: mem_e;
-			 mem_cut != mem_p; ++mem_p)
-		{
-			const unsigned char ch = *mem_p;
-			*hex++ = c_hex[(0xf0 & ch) >> 4];
-			*hex++ = c_hex[(0x0f & ch)];
-			*ascii++ = isprint(ch)? (char)ch: '?';
-		}
-		while (hex != ascii_b)
+		cb(site, arg);
+		++n;
+	}
+#else
+	VAR_UNUSED(cb);
+	VAR_UNUSED(arg);
+#endif
+	return n;
+}
+
+int zf_log_set_sites(const char *const pattern, const int mode)
+{
+	int n = 0;
+#ifdef DYNAMIC_SITES
+	site_filter filter;
+	if (0 != parse_site_filter(pattern, &filter) ||
+		ZF_LOG_SITE_DEFAULT > mode || ZF_LOG_SITE_OFF < mode)
+	{
+		return -1;
+	}
+	for (zf_log_dynamic_site *site = SITES_START; SITES_STOP != site; ++site)
+	{
+		if (site_match(&filter, site))
 		{
-			*hex++ = ' ';
+			__atomic_store_n(&site->mode, (unsigned char)mode, __ATOMIC_RELAXED);
+			site_update(site);
+			++n;
 		}
-		msg->p = ascii;
-		log->output->callback(msg, log->output->arg);
 	}
+#else
+	VAR_UNUSED(pattern);
+	VAR_UNUSED(mode);
+#endif
+	return n;
 }
 
 void zf_log_set_tag_prefix(const char *const prefix)
 {
 	_zf_log_tag_prefix = prefix;
+#ifdef TAG_CACHE
+	__atomic_fetch_add(&g_tag_prefix_gen, 1, __ATOMIC_RELAXED);
+#endif
 }
 
 void zf_log_set_mem_width(const unsigned w)
@@ -1249,7 +6196,83 @@ void zf_log_set_mem_width(const unsigned w)
 
 void zf_log_set_output_level(const int lvl)
 {
+#ifdef TAG_LEVELS
+	tag_lock();
+#endif
 	_zf_log_global_output_lvl = lvl;
+#ifdef TAG_LEVELS
+	for (unsigned i = 0; g_tag_slots > i; ++i)
+	{
+		TAG_STORE(g_tag_lvls + i, tag_slot_lvl(g_tag_own_lvls[i]));
+	}
+	tag_unlock();
+#endif
+#ifdef DYNAMIC_SITES
+	sites_update();
+#endif
+}
+
+void zf_log_set_capture_level(const int lvl)
+{
+#if ZF_LOG_RECORDER
+	_zf_log_global_capture_lvl = lvl;
+#else
+	VAR_UNUSED(lvl);
+#endif
+}
+
+int zf_log_set_tag_level(const char *const tag, const int lvl)
+{
+#ifdef TAG_LEVELS
+	if (0 == tag || 0 == *tag || 0 > lvl)
+	{
+		return -1;
+	}
+	tag_lock();
+	const unsigned i = tag_add(tag);
+	if (ZF_LOG_TAG_SLOTS != i)
+	{
+		TAG_STORE(g_tag_own_lvls + i, lvl);
+		TAG_STORE(g_tag_lvls + i, tag_slot_lvl(lvl));
+	}
+	tag_unlock();
+	if (ZF_LOG_TAG_SLOTS == i)
+	{
+		return -1;
+	}
+	#ifdef DYNAMIC_SITES
+	sites_update();
+	#endif
+	return 0;
+#else
+	VAR_UNUSED(tag);
+	VAR_UNUSED(lvl);
+	return -1;
+#endif
+}
+
+const int *_zf_log_tag_output_lvl(const char *const tag)
+{
+#ifdef TAG_LEVELS
+	if (0 != tag && 0 != *tag)
+	{
+		const unsigned n = (unsigned)TAG_LOAD(&g_tag_slots);
+		unsigned i = tag_find(tag, n);
+		if (n == i)
+		{
+			tag_lock();
+			i = tag_add(tag);
+			tag_unlock();
+		}
+		if (ZF_LOG_TAG_SLOTS != i)
+		{
+			return g_tag_lvls + i;
+		}
+	}
+#else
+	VAR_UNUSED(tag);
+#endif
+	return &_zf_log_global_output_lvl;
 }
 
 void zf_log_set_output_v(const unsigned mask, void *const arg,
@@ -1260,38 +6283,189 @@ void zf_log_set_output_v(const unsigned mask, void *const arg,
 	_zf_log_global_output.callback = callback;
 }
 
+enum
+{
+	FANOUT_FIELDS = ZF_LOG_PUT_CTX | ZF_LOG_PUT_TAG | ZF_LOG_PUT_SRC | ZF_LOG_PUT_MSG,
+};
+
+unsigned zf_log_fanout_mask(const zf_log_fanout *const f)
+{
+	unsigned mask = 0, batch = 0 != f->count? ZF_LOG_PUT_MEM_BATCH: 0;
+	for (unsigned i = 0; f->count > i; ++i)
+	{
+		mask |= f->sinks[i].output.mask;
+	}
+	/* Batched memory dump has a copy of the prefix in each line, so sink
+	 * can't get a view of it without fields it didn't ask for.
+	 */
+	for (unsigned i = 0; f->count > i; ++i)
+	{
+		const unsigned sink_mask = f->sinks[i].output.mask;
+		if ((mask & FANOUT_FIELDS) != (sink_mask & FANOUT_FIELDS))
+		{
+			batch = 0;
+		}
+		batch &= sink_mask;
+	}
+	return (mask & ~(unsigned)(ZF_LOG_PUT_DEFERRED | ZF_LOG_PUT_MEM_BATCH)) | batch;
+}
+
+/* View is made by copying fields the sink asked for from the saved prefix,
+ * so they end right where the message starts. First bytes of the message are
+ * restored after each sink, since they are overwritten by EOL when message is
+ * not wanted (or by 0 at tag_e, when there is no tag).
+ */
+void zf_log_out_fanout_callback(const zf_log_message *const msg, void *arg)
+{
+	const zf_log_fanout *const f = (const zf_log_fanout *)arg;
+	const size_t ctx_len = (size_t)(msg->tag_b - msg->buf);
+	const size_t tag_len = (size_t)(msg->src_b - msg->tag_b);
+	const size_t src_len = (size_t)(msg->msg_b - msg->src_b);
+	char prefix[ZF_LOG_BUF_SZ];
+	char head[ZF_LOG_EOL_SZ];
+	memcpy(prefix, msg->buf, ctx_len + tag_len + src_len);
+	memcpy(head, msg->msg_b, sizeof(head));
+	for (unsigned i = 0; f->count > i; ++i)
+	{
+		const zf_log_sink *const sink = f->sinks + i;
+		if (msg->lvl < sink->lvl)
+		{
+			continue;
+		}
+		zf_log_message view = *msg;
+		char *p = msg->msg_b;
+		view.src_b = p;
+		if (ZF_LOG_PUT_SRC & sink->output.mask)
+		{
+			p -= src_len;
+			memcpy(p, prefix + ctx_len + tag_len, src_len);
+			view.src_b = p;
+		}
+		view.tag_b = view.tag_e = p;
+		if (ZF_LOG_PUT_TAG & sink->output.mask)
+		{
+			p -= tag_len;
+			memcpy(p, prefix + ctx_len, tag_len);
+			view.tag_b = p;
+			view.tag_e = p + (msg->tag_e - msg->tag_b);
+		}
+		if (ZF_LOG_PUT_CTX & sink->output.mask)
+		{
+			p -= ctx_len;
+			memcpy(p, prefix, ctx_len);
+		}
+		view.buf = p;
+		if (0 == (ZF_LOG_PUT_MSG & sink->output.mask))
+		{
+			view.p = view.msg_b;
+		}
+		sink->output.callback(&view, sink->output.arg);
+		memcpy(msg->msg_b, head, sizeof(head));
+	}
+}
+
+/* Number of suppressed messages is appended to the message text. It's not
+ * reported by deferred output, since message is rendered later. Flight
+ * recorder gets the line (or the binary record) before the output, since
+ * output callback is allowed to modify the buffer. Memory dump lines are not
+ * recorded. Statement sets _ZF_LOG_CAPTURE_ONLY bit in the level when line is
+ * below its "output" log level (see ZF_LOG_CAPTURE in zf_log.h).
+ */
 static void _zf_log_write_imp(
 		const zf_log_spec *log,
 		const src_location *const src, const mem_block *const mem,
-		const int lvl, const char *const tag, const char *const fmt, va_list va)
+		const unsigned suppressed,
+		const int stmt_lvl, const char *const tag, const char *const fmt,
+		va_list va)
 {
+	const int lvl = ~_ZF_LOG_CAPTURE_ONLY & stmt_lvl;
+	const int out = lvl == stmt_lvl;
+#if ZF_LOG_RECORDER
+	if (!out && lvl < _zf_log_global_capture_lvl)
+#else
+	if (!out)
+#endif
+	{
+		return;
+	}
 	zf_log_message msg;
 	char buf[ZF_LOG_BUF_SZ];
 	const unsigned mask = log->output->mask;
+	int deferred = 0;
 	msg.lvl = lvl;
 	msg.tag = tag;
 	g_buffer_cb(&msg, buf);
-	if (ZF_LOG_PUT_CTX & mask)
+#if ZF_LOG_DEFERRED
+	if (ZF_LOG_PUT_DEFERRED & mask)
 	{
-		put_ctx(&msg);
+		put_deferred(&msg, src, mem, log->format->mem_width, tag, fmt, va);
+		deferred = 1;
 	}
-	if (ZF_LOG_PUT_TAG & mask)
+	else
+#endif
 	{
-		put_tag(&msg, tag);
+		if (ZF_LOG_PUT_CTX & mask)
+		{
+			put_ctx(&msg);
+		}
+		msg.tag_b = msg.tag_e = msg.p;
+		if (ZF_LOG_PUT_TAG & mask)
+		{
+			put_tag(&msg, _zf_log_tag_prefix, tag);
+		}
+		msg.src_b = msg.p;
+		if (0 != src && ZF_LOG_PUT_SRC & mask)
+		{
+			put_src(&msg, src);
+		}
+		msg.msg_b = msg.p;
+		if (ZF_LOG_PUT_MSG & mask)
+		{
+#if ZF_LOG_LARGE_MESSAGES
+			va_list va_large;
+			va_copy(va_large, va);
+			const int n = put_msg(&msg, fmt, va);
+			if (msg.e == msg.p)
+			{
+				put_msg_large(&msg, n, fmt, va_large);
+			}
+			va_end(va_large);
+#else
+			put_msg(&msg, fmt, va);
+#endif
+			if (0 != suppressed)
+			{
+				put_suppressed(&msg, suppressed);
+			}
+		}
 	}
-	if (0 != src && ZF_LOG_PUT_SRC & mask)
+#if ZF_LOG_RECORDER
+	if (lvl >= _zf_log_global_capture_lvl)
 	{
-		put_src(&msg, src);
+		recorder_put(&msg, deferred);
 	}
-	if (ZF_LOG_PUT_MSG & mask)
+	if (!out)
 	{
-		put_msg(&msg, fmt, va);
+	#if ZF_LOG_LARGE_MESSAGES
+		large_buf_release(&msg);
+	#endif
+		return;
 	}
+#endif
 	log->output->callback(&msg, log->output->arg);
-	if (0 != mem && ZF_LOG_PUT_MSG & mask)
+	if (!deferred && 0 != mem && ZF_LOG_PUT_MSG & mask)
 	{
 		output_mem(log, &msg, mem);
 	}
+#if ZF_LOG_LARGE_MESSAGES
+	large_buf_release(&msg);
+#endif
+#if ZF_LOG_RECORDER
+	if (ZF_LOG_FATAL <= lvl && 0 != g_recorder_fatal_output)
+	{
+		zf_log_recorder_dump(g_recorder_fatal_output);
+	}
+#endif
 }
 
 void _zf_log_write_d(
@@ -1299,10 +6473,10 @@ void _zf_log_write_d(
 		const int lvl, const char *const tag,
 		const char *const fmt, ...)
 {
-	const src_location src = {func, file, line};
+	const src_location src = {func, SRC_FILE(file), line};
 	va_list va;
 	va_start(va, fmt);
-	_zf_log_write_imp(&global_spec, &src, 0, lvl, tag, fmt, va);
+	_zf_log_write_imp(&global_spec, &src, 0, 0, lvl, tag, fmt, va);
 	va_end(va);
 }
 
@@ -1311,10 +6485,33 @@ void _zf_log_write_aux_d(
 		const zf_log_spec *const log, const int lvl, const char *const tag,
 		const char *const fmt, ...)
 {
-	const src_location src = {func, file, line};
+	const src_location src = {func, SRC_FILE(file), line};
+	va_list va;
+	va_start(va, fmt);
+	_zf_log_write_imp(log, &src, 0, 0, lvl, tag, fmt, va);
+	va_end(va);
+}
+
+void _zf_log_write_site(
+		const _zf_log_site *const site, const int lvl, const char *const tag,
+		const char *const fmt, ...)
+{
+	const src_location src = {site->func, site->file, site->line};
+	va_list va;
+	va_start(va, fmt);
+	_zf_log_write_imp(&global_spec, &src, 0, 0, lvl, tag, fmt, va);
+	va_end(va);
+}
+
+void _zf_log_write_aux_site(
+		const _zf_log_site *const site,
+		const zf_log_spec *const log, const int lvl, const char *const tag,
+		const char *const fmt, ...)
+{
+	const src_location src = {site->func, site->file, site->line};
 	va_list va;
 	va_start(va, fmt);
-	_zf_log_write_imp(log, &src, 0, lvl, tag, fmt, va);
+	_zf_log_write_imp(log, &src, 0, 0, lvl, tag, fmt, va);
 	va_end(va);
 }
 
@@ -1323,7 +6520,7 @@ void _zf_log_write(const int lvl, const char *const tag,
 {
 	va_list va;
 	va_start(va, fmt);
-	_zf_log_write_imp(&global_spec, 0, 0, lvl, tag, fmt, va);
+	_zf_log_write_imp(&global_spec, 0, 0, 0, lvl, tag, fmt, va);
 	va_end(va);
 }
 
@@ -1333,7 +6530,7 @@ void _zf_log_write_aux(
 {
 	va_list va;
 	va_start(va, fmt);
-	_zf_log_write_imp(log, 0, 0, lvl, tag, fmt, va);
+	_zf_log_write_imp(log, 0, 0, 0, lvl, tag, fmt, va);
 	va_end(va);
 }
 
@@ -1343,11 +6540,11 @@ void _zf_log_write_mem_d(
 		const void *const d, const unsigned d_sz,
 		const char *const fmt, ...)
 {
-	const src_location src = {func, file, line};
+	const src_location src = {func, SRC_FILE(file), line};
 	const mem_block mem = {d, d_sz};
 	va_list va;
 	va_start(va, fmt);
-	_zf_log_write_imp(&global_spec, &src, &mem, lvl, tag, fmt, va);
+	_zf_log_write_imp(&global_spec, &src, &mem, 0, lvl, tag, fmt, va);
 	va_end(va);
 }
 
@@ -1357,11 +6554,38 @@ void _zf_log_write_mem_aux_d(
 		const void *const d, const unsigned d_sz,
 		const char *const fmt, ...)
 {
-	const src_location src = {func, file, line};
+	const src_location src = {func, SRC_FILE(file), line};
+	const mem_block mem = {d, d_sz};
+	va_list va;
+	va_start(va, fmt);
+	_zf_log_write_imp(log, &src, &mem, 0, lvl, tag, fmt, va);
+	va_end(va);
+}
+
+void _zf_log_write_mem_site(
+		const _zf_log_site *const site, const int lvl, const char *const tag,
+		const void *const d, const unsigned d_sz,
+		const char *const fmt, ...)
+{
+	const src_location src = {site->func, site->file, site->line};
+	const mem_block mem = {d, d_sz};
+	va_list va;
+	va_start(va, fmt);
+	_zf_log_write_imp(&global_spec, &src, &mem, 0, lvl, tag, fmt, va);
+	va_end(va);
+}
+
+void _zf_log_write_mem_aux_site(
+		const _zf_log_site *const site,
+		const zf_log_spec *const log, const int lvl, const char *const tag,
+		const void *const d, const unsigned d_sz,
+		const char *const fmt, ...)
+{
+	const src_location src = {site->func, site->file, site->line};
 	const mem_block mem = {d, d_sz};
 	va_list va;
 	va_start(va, fmt);
-	_zf_log_write_imp(log, &src, &mem, lvl, tag, fmt, va);
+	_zf_log_write_imp(log, &src, &mem, 0, lvl, tag, fmt, va);
 	va_end(va);
 }
 
@@ -1372,7 +6596,7 @@ void _zf_log_write_mem(const int lvl, const char *const tag,
 	const mem_block mem = {d, d_sz};
 	va_list va;
 	va_start(va, fmt);
-	_zf_log_write_imp(&global_spec, 0, &mem, lvl, tag, fmt, va);
+	_zf_log_write_imp(&global_spec, 0, &mem, 0, lvl, tag, fmt, va);
 	va_end(va);
 }
 
@@ -1384,6 +6608,130 @@ void _zf_log_write_mem_aux(
 	const mem_block mem = {d, d_sz};
 	va_list va;
 	va_start(va, fmt);
-	_zf_log_write_imp(log, 0, &mem, lvl, tag, fmt, va);
+	_zf_log_write_imp(log, 0, &mem, 0, lvl, tag, fmt, va);
+	va_end(va);
+}
+
+/* Per statement limits (see ZF_LOGW_EVERY_N and others in zf_log.h). State is
+ * updated with atomic operations, so concurrent calls never lose counts. Plain
+ * operations are used when compiler has no atomics available.
+ */
+#if defined(__GNUC__)
+	#define LIMIT_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+	#define LIMIT_ADD(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+	#define LIMIT_SUB(p, v) __atomic_sub_fetch((p), (v), __ATOMIC_RELAXED)
+	#define LIMIT_CAS(p, e, d) \
+			__atomic_compare_exchange_n((p), (e), (d), 0, \
+										__ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#elif defined(_WIN32) || defined(_WIN64)
+	#define LIMIT_LOAD(p) (*(volatile const LONG64 *)(p) + 0ull)
+	#define LIMIT_ADD(p, v) \
+			((unsigned long long)InterlockedExchangeAdd64((volatile LONG64 *)(p), \
+														  (LONG64)(v)))
+	#define LIMIT_SUB(p, v) (LIMIT_ADD((p), 0ull - (v)) - (v))
+	#define LIMIT_CAS(p, e, d) \
+			(*(e) == (unsigned long long)InterlockedCompareExchange64( \
+					(volatile LONG64 *)(p), (LONG64)(d), (LONG64)*(e)))
+#else
+	#define LIMIT_LOAD(p) (*(p))
+	#define LIMIT_ADD(p, v) ((*(p) += (v)) - (v))
+	#define LIMIT_SUB(p, v) (*(p) -= (v))
+	#define LIMIT_CAS(p, e, d) (*(p) = (d), 1)
+#endif
+
+static INLINE int limit_suppress(_zf_log_limit *const l)
+{
+	LIMIT_ADD(&l->suppressed, 1);
+	return 0;
+}
+
+static unsigned long long limit_now_ns(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	return GetTickCount64() * 1000000ull;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000 + (unsigned)ts.tv_nsec;
+#endif
+}
+
+int _zf_log_every_n(_zf_log_limit *const l, const unsigned n)
+{
+	const unsigned long long c = LIMIT_ADD(&l->v, 1);
+	return 1 >= n || 0 == c % n? 1: limit_suppress(l);
+}
+
+int _zf_log_first_n(_zf_log_limit *const l, const unsigned n)
+{
+	/* Counter stops growing once limit is reached, so it never wraps. */
+	return n > LIMIT_LOAD(&l->v) && n > LIMIT_ADD(&l->v, 1);
+}
+
+/* Generic cell rate algorithm: state is the time when the bucket will be full
+ * again. Message passes when that time is not further than burst intervals in
+ * the future, and each message moves it one interval forward.
+ */
+int _zf_log_rate(_zf_log_limit *const l, const unsigned per_sec,
+				 const unsigned burst)
+{
+	if (0 == per_sec)
+	{
+		return limit_suppress(l);
+	}
+	const unsigned long long interval = 1000000000ull / per_sec;
+	const unsigned long long tolerance = 1 < burst? interval * (burst - 1): 0;
+	const unsigned long long now = limit_now_ns();
+	for (;;)
+	{
+		unsigned long long tat = LIMIT_LOAD(&l->v);
+		const unsigned long long t = tat > now? tat: now;
+		if (t - now > tolerance)
+		{
+			return limit_suppress(l);
+		}
+		if (LIMIT_CAS(&l->v, &tat, t + interval))
+		{
+			return 1;
+		}
+	}
+}
+
+/* Weyl sequence per statement mixed with splitmix64 finalizer gives uniformly
+ * distributed values without any shared state.
+ */
+int _zf_log_sample(_zf_log_limit *const l, const unsigned one_in)
+{
+	unsigned long long z = LIMIT_ADD(&l->v, 0x9e3779b97f4a7c15ull) +
+						   (unsigned long long)(size_t)l;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	z ^= z >> 31;
+	return 1 >= one_in || 0 == z % one_in? 1: limit_suppress(l);
+}
+
+void _zf_log_write_limited(
+		const _zf_log_site *const site, _zf_log_limit *const l,
+		const int lvl, const char *const tag,
+		const char *const fmt, ...)
+{
+	unsigned long long n = LIMIT_LOAD(&l->suppressed);
+	if (0 != n)
+	{
+		/* Calls suppressed concurrently will be reported next time. */
+		LIMIT_SUB(&l->suppressed, n);
+		n = ~0u > n? n: ~0u;
+	}
+	va_list va;
+	va_start(va, fmt);
+	if (0 != site)
+	{
+		const src_location src = {site->func, SRC_FILE(site->file), site->line};
+		_zf_log_write_imp(&global_spec, &src, 0, (unsigned)n, lvl, tag, fmt, va);
+	}
+	else
+	{
+		_zf_log_write_imp(&global_spec, 0, 0, (unsigned)n, lvl, tag, fmt, va);
+	}
 	va_end(va);
 }
@@ -95,9 +95,11 @@
  * which can be called at any time.
  *
  * Though in some cases it could be useful to configure output log level per
- * compilation module or per library. There are two ways to achieve that:
+ * compilation module or per library. There are three ways to achieve that:
  * - Define ZF_LOG_OUTPUT_LEVEL to expresion that evaluates to desired output
  *   log level.
+ * - Define ZF_LOG_TAG_LEVELS and use zf_log_set_tag_level() function to
+ *   configure output log level per tag at run time.
  * - Copy zf_log.h and zf_log.c files into your library and build it with
  *   ZF_LOG_LIBRARY_PREFIX defined to library specific prefix. See
  *   ZF_LOG_LIBRARY_PREFIX for more details.
@@ -143,7 +145,12 @@
  * overhead even further.
  */
 #if defined(ZF_LOG_OUTPUT_LEVEL)
+	#if defined(ZF_LOG_TAG_LEVELS)
+		#error ZF_LOG_TAG_LEVELS is not compatible with ZF_LOG_OUTPUT_LEVEL
+	#endif
 	#define _ZF_LOG_OUTPUT_LEVEL ZF_LOG_OUTPUT_LEVEL
+#elif defined(ZF_LOG_TAG_LEVELS)
+	#define _ZF_LOG_OUTPUT_LEVEL (*_zf_log_tag_lvl_)
 #else
 	#define _ZF_LOG_OUTPUT_LEVEL _zf_log_global_output_lvl
 #endif
@@ -407,6 +414,7 @@
 	#define zf_log_set_tag_prefix _ZF_LOG_DECOR(zf_log_set_tag_prefix)
 	#define zf_log_set_mem_width _ZF_LOG_DECOR(zf_log_set_mem_width)
 	#define zf_log_set_output_level _ZF_LOG_DECOR(zf_log_set_output_level)
+	#define zf_log_set_tag_level _ZF_LOG_DECOR(zf_log_set_tag_level)
 	#define zf_log_set_output_v _ZF_LOG_DECOR(zf_log_set_output_v)
 	#define zf_log_set_output_p _ZF_LOG_DECOR(zf_log_set_output_p)
 	#define zf_log_out_stderr_callback _ZF_LOG_DECOR(zf_log_out_stderr_callback)
@@ -414,6 +422,8 @@
 	#define _zf_log_global_format _ZF_LOG_DECOR(_zf_log_global_format)
 	#define _zf_log_global_output _ZF_LOG_DECOR(_zf_log_global_output)
 	#define _zf_log_global_output_lvl _ZF_LOG_DECOR(_zf_log_global_output_lvl)
+	#define _zf_log_global_capture_lvl _ZF_LOG_DECOR(_zf_log_global_capture_lvl)
+	#define _zf_log_tag_output_lvl _ZF_LOG_DECOR(_zf_log_tag_output_lvl)
 	#define _zf_log_write_d _ZF_LOG_DECOR(_zf_log_write_d)
 	#define _zf_log_write_aux_d _ZF_LOG_DECOR(_zf_log_write_aux_d)
 	#define _zf_log_write _ZF_LOG_DECOR(_zf_log_write)
@@ -422,7 +432,49 @@
 	#define _zf_log_write_mem_aux_d _ZF_LOG_DECOR(_zf_log_write_mem_aux_d)
 	#define _zf_log_write_mem _ZF_LOG_DECOR(_zf_log_write_mem)
 	#define _zf_log_write_mem_aux _ZF_LOG_DECOR(_zf_log_write_mem_aux)
+	#define _zf_log_write_site _ZF_LOG_DECOR(_zf_log_write_site)
+	#define _zf_log_write_aux_site _ZF_LOG_DECOR(_zf_log_write_aux_site)
+	#define _zf_log_write_mem_site _ZF_LOG_DECOR(_zf_log_write_mem_site)
+	#define _zf_log_write_mem_aux_site _ZF_LOG_DECOR(_zf_log_write_mem_aux_site)
+	#define _zf_log_write_limited _ZF_LOG_DECOR(_zf_log_write_limited)
+	#define _zf_log_every_n _ZF_LOG_DECOR(_zf_log_every_n)
+	#define _zf_log_first_n _ZF_LOG_DECOR(_zf_log_first_n)
+	#define _zf_log_rate _ZF_LOG_DECOR(_zf_log_rate)
+	#define _zf_log_sample _ZF_LOG_DECOR(_zf_log_sample)
+	#define _zf_log_site_resolve _ZF_LOG_DECOR(_zf_log_site_resolve)
+	#define _zf_log_sites _ZF_LOG_DECOR(_zf_log_sites)
+	#define zf_log_enum_sites _ZF_LOG_DECOR(zf_log_enum_sites)
+	#define zf_log_set_sites _ZF_LOG_DECOR(zf_log_set_sites)
 	#define _zf_log_stderr_spec _ZF_LOG_DECOR(_zf_log_stderr_spec)
+	#define zf_log_out_fanout_callback _ZF_LOG_DECOR(zf_log_out_fanout_callback)
+	#define zf_log_fanout_mask _ZF_LOG_DECOR(zf_log_fanout_mask)
+	#define zf_log_async_start _ZF_LOG_DECOR(zf_log_async_start)
+	#define zf_log_async_flush _ZF_LOG_DECOR(zf_log_async_flush)
+	#define zf_log_async_stop _ZF_LOG_DECOR(zf_log_async_stop)
+	#define zf_log_out_async_callback _ZF_LOG_DECOR(zf_log_out_async_callback)
+	#define zf_log_out_deferred_callback _ZF_LOG_DECOR(zf_log_out_deferred_callback)
+	#define zf_log_render_deferred _ZF_LOG_DECOR(zf_log_render_deferred)
+	#define zf_log_out_binary_callback _ZF_LOG_DECOR(zf_log_out_binary_callback)
+	#define zf_log_binary_open _ZF_LOG_DECOR(zf_log_binary_open)
+	#define zf_log_binary_flush _ZF_LOG_DECOR(zf_log_binary_flush)
+	#define zf_log_binary_close _ZF_LOG_DECOR(zf_log_binary_close)
+	#define zf_log_out_file_callback _ZF_LOG_DECOR(zf_log_out_file_callback)
+	#define zf_log_file_open _ZF_LOG_DECOR(zf_log_file_open)
+	#define zf_log_file_flush _ZF_LOG_DECOR(zf_log_file_flush)
+	#define zf_log_file_close _ZF_LOG_DECOR(zf_log_file_close)
+	#define zf_log_file_open_rotating _ZF_LOG_DECOR(zf_log_file_open_rotating)
+	#define zf_log_gzip _ZF_LOG_DECOR(zf_log_gzip)
+	#define zf_log_out_dedup_callback _ZF_LOG_DECOR(zf_log_out_dedup_callback)
+	#define zf_log_dedup_open _ZF_LOG_DECOR(zf_log_dedup_open)
+	#define zf_log_dedup_flush _ZF_LOG_DECOR(zf_log_dedup_flush)
+	#define zf_log_dedup_close _ZF_LOG_DECOR(zf_log_dedup_close)
+	#define zf_log_set_capture_level _ZF_LOG_DECOR(zf_log_set_capture_level)
+	#define zf_log_recorder_dump _ZF_LOG_DECOR(zf_log_recorder_dump)
+	#define zf_log_recorder_set_fatal_output _ZF_LOG_DECOR(zf_log_recorder_set_fatal_output)
+	#define zf_log_write_signal_safe _ZF_LOG_DECOR(zf_log_write_signal_safe)
+	#define zf_log_crash_handler_install _ZF_LOG_DECOR(zf_log_crash_handler_install)
+	#define zf_log_crash_handler_remove _ZF_LOG_DECOR(zf_log_crash_handler_remove)
+	#define zf_log_crash_handler_thread_install _ZF_LOG_DECOR(zf_log_crash_handler_thread_install)
 #endif
 
 #if defined(__printflike)
@@ -441,6 +493,30 @@
 	#define _ZF_LOG_FUNCTION __func__
 #endif
 
+/* File base name known at compile time. When available, source location of
+ * each log statement is stored in a static _zf_log_site record and only
+ * pointer to it is passed to the library. Otherwise full path is passed and
+ * library finds the base name at run time.
+ */
+#if defined(__FILE_NAME__)
+	#define _ZF_LOG_FILE_NAME __FILE_NAME__
+#elif defined(__GNUC__) && (defined(_WIN32) || defined(_WIN64))
+	#define _ZF_LOG_BASENAME(f, c) \
+		(__builtin_strrchr(f, c)? __builtin_strrchr(f, c) + 1: f)
+	#define _ZF_LOG_FILE_NAME \
+		_ZF_LOG_BASENAME(_ZF_LOG_BASENAME(__FILE__, '/'), '\\')
+#elif defined(__GNUC__)
+	#define _ZF_LOG_FILE_NAME \
+		(__builtin_strrchr(__FILE__, '/')? __builtin_strrchr(__FILE__, '/') + 1: \
+				__FILE__)
+#elif defined(__cplusplus) && (201103L <= __cplusplus || 1900 <= _MSC_VER)
+	static constexpr const char *_zf_log_basename(const char *s, const char *b)
+	{
+		return *s? _zf_log_basename(s + 1, '/' == *s || '\\' == *s? s + 1: b): b;
+	}
+	#define _ZF_LOG_FILE_NAME _zf_log_basename(__FILE__, __FILE__)
+#endif
+
 #if defined(_MSC_VER) && !defined(__INTEL_COMPILER)
 	#define _ZF_LOG_INLINE __inline
 	#define _ZF_LOG_IF(cond) \
@@ -489,12 +565,49 @@ void zf_log_set_mem_width(const unsigned w);
  */
 void zf_log_set_output_level(const int lvl);
 
+/* Set "output" log level of the tag. Level 0 makes tag follow "output" log
+ * level set by zf_log_set_output_level() again. Tag is compared without tag
+ * prefix. Allows to change verbosity of particular components at run time:
+ *
+ *   zf_log_set_output_level(ZF_LOG_WARN);
+ *   zf_log_set_tag_level("net", ZF_LOG_DEBUG);
+ *
+ * Only compilation modules built with ZF_LOG_TAG_LEVELS defined respect tag
+ * levels. In such modules all statements check level of the module tag (see
+ * ZF_LOG_TAG), even when they specify different tag explicitly. Module tag is
+ * resolved once to a slot in the table of levels when module is loaded, so the
+ * check costs two loads instead of one. ZF_LOG_TAG must be a constant string
+ * and ZF_LOG_OUTPUT_LEVEL can't be used together with ZF_LOG_TAG_LEVELS.
+ * Requires GCC compatible compiler or C++ on Windows (library itself must be
+ * built with one of them as well). Dynamic log statements (see
+ * ZF_LOG_DYNAMIC_SITES) respect tag levels regardless, using their own tag.
+ * Number of distinct tags is limited by ZF_LOG_TAG_SLOTS (64 by default).
+ * Returns 0 on success or -1 when tag is empty, level is negative or there are
+ * no free slots.
+ */
+int zf_log_set_tag_level(const char *const tag, const int lvl);
+
 /* Put mask is a set of flags that define what fields will be added to each
  * log message. Default value is ZF_LOG_PUT_STD and other flags could be used to
  * alter its behavior. See zf_log_set_output_v() for more details.
  *
  * Note about ZF_LOG_PUT_SRC: it will be added only in debug builds (NDEBUG is
  * not defined).
+ *
+ * ZF_LOG_PUT_MEM_OFFSET adds offset of the first byte (8 hex digits) in front
+ * of each memory dump line. ZF_LOG_PUT_MEM_BATCH makes memory dump lines go to
+ * the output callback in one call instead of one call per line: lines are
+ * rendered into a single heap buffer and separated with ZF_LOG_EOL. Message
+ * fields describe the first line, except p, which points to the end of the
+ * last one. So callback that writes everything from buf to p followed by
+ * ZF_LOG_EOL (e.g. zf_log_out_stderr_callback or zf_log_out_file_callback)
+ * will write the whole dump at once. Don't use it with callbacks that expect
+ * a single line or rely on line being shorter than ZF_LOG_BUF_SZ (e.g.
+ * asynchronous output). When allocation fails, lines are passed one by one.
+ * Neither is part of ZF_LOG_PUT_STD. Example:
+ *
+ *   zf_log_set_output_v(ZF_LOG_PUT_STD | ZF_LOG_PUT_MEM_OFFSET |
+ *                       ZF_LOG_PUT_MEM_BATCH, 0, zf_log_out_stderr_callback);
  */
 enum
 {
@@ -503,6 +616,9 @@ enum
 	ZF_LOG_PUT_SRC = 1 << 2, /* source location (file, line, function) */
 	ZF_LOG_PUT_MSG = 1 << 3, /* message text (formatted string) */
 	ZF_LOG_PUT_STD = 0xffff, /* everything (default) */
+	ZF_LOG_PUT_DEFERRED = 1 << 16, /* binary record (see ZF_LOG_OUT_DEFERRED) */
+	ZF_LOG_PUT_MEM_OFFSET = 1 << 17, /* offset column in memory dump lines */
+	ZF_LOG_PUT_MEM_BATCH = 1 << 18, /* all memory dump lines in one call */
 };
 
 typedef struct zf_log_message
@@ -514,6 +630,7 @@ typedef struct zf_log_message
 	char *p; /* Buffer content end (append position) */
 	char *tag_b; /* Prefixed tag start */
 	char *tag_e; /* Prefixed tag end (if != tag_b, points to msg separator) */
+	char *src_b; /* Source location start (if != msg_b) */
 	char *msg_b; /* Message start (expanded format string) */
 }
 zf_log_message;
@@ -600,7 +717,7 @@ zf_log_spec;
  *   ZF_LOG_SECRET(ZF_LOGI("Credit card: %s", credit_card));
  *   ZF_LOG_SECRET(ZF_LOGD_MEM(cipher, cipher_sz, "Cipher bytes:"));
  */
-#define ZF_LOG_SECRET(f) ZF_LOG_IF(ZF_LOG_SECRETS, f)
+#define ZF_LOG_SECRET(f) do { _ZF_LOG_IF(ZF_LOG_SECRETS) { f; } } _ZF_LOG_ONCE
 
 /* Check "current" log level at compile time (ignoring "output" log level).
  * Evaluates to true when specified log level is enabled. For example:
@@ -625,9 +742,25 @@ zf_log_spec;
 #define ZF_LOG_ENABLED_ERROR    ZF_LOG_ENABLED(ZF_LOG_ERROR)
 #define ZF_LOG_ENABLED_FATAL    ZF_LOG_ENABLED(ZF_LOG_FATAL)
 
+/* Statements in compilation modules built with ZF_LOG_CAPTURE defined also
+ * check "capture" log level (see zf_log_set_capture_level()). Level passed to
+ * the library has _ZF_LOG_CAPTURE_ONLY bit set when line is below "output" log
+ * level of the statement and must be only recorded.
+ */
+#define _ZF_LOG_CAPTURE_ONLY 0x100
+#if defined(ZF_LOG_CAPTURE)
+	#define _ZF_LOG_CAPTURE_ON(lvl) ((lvl) >= _zf_log_global_capture_lvl)
+	#define _ZF_LOG_LVL(lvl) \
+			((lvl) >= _ZF_LOG_OUTPUT_LEVEL? (lvl): (lvl) | _ZF_LOG_CAPTURE_ONLY)
+#else
+	#define _ZF_LOG_CAPTURE_ON(lvl) 0
+	#define _ZF_LOG_LVL(lvl) (lvl)
+#endif
+
 /* Check "output" log level at run time (taking into account "current" log
  * level as well). Evaluates to true when specified log level is turned on AND
- * enabled. For example:
+ * enabled. In modules built with ZF_LOG_CAPTURE defined it's also true when
+ * log level is only captured by the flight recorder. For example:
  *
  *   if (ZF_LOG_ON_DEBUG)
  *   {
@@ -639,7 +772,8 @@ zf_log_spec;
  * See ZF_LOG_OUTPUT_LEVEL for details.
  */
 #define ZF_LOG_ON(lvl) \
-		(ZF_LOG_ENABLED((lvl)) && (lvl) >= _ZF_LOG_OUTPUT_LEVEL)
+		(ZF_LOG_ENABLED((lvl)) && \
+		 ((lvl) >= _ZF_LOG_OUTPUT_LEVEL || _ZF_LOG_CAPTURE_ON(lvl)))
 #define ZF_LOG_ON_VERBOSE   ZF_LOG_ON(ZF_LOG_VERBOSE)
 #define ZF_LOG_ON_DEBUG     ZF_LOG_ON(ZF_LOG_DEBUG)
 #define ZF_LOG_ON_INFO      ZF_LOG_ON(ZF_LOG_INFO)
@@ -655,8 +789,38 @@ extern const char *_zf_log_tag_prefix;
 extern zf_log_format _zf_log_global_format;
 extern zf_log_output _zf_log_global_output;
 extern int _zf_log_global_output_lvl;
+extern int _zf_log_global_capture_lvl;
 extern const zf_log_spec _zf_log_stderr_spec;
 
+/* Returns pointer to the output log level of the tag. Slot is assigned on the
+ * first call and never changes.
+ */
+const int *_zf_log_tag_output_lvl(const char *const tag);
+
+#if defined(ZF_LOG_TAG_LEVELS)
+	#if defined(__GNUC__)
+static const int *_zf_log_tag_lvl_ = &_zf_log_global_output_lvl;
+static void __attribute__((__constructor__)) _zf_log_tag_lvl_init(void)
+{
+	_zf_log_tag_lvl_ = _zf_log_tag_output_lvl(_ZF_LOG_TAG);
+}
+	#elif defined(__cplusplus) && (defined(_WIN32) || defined(_WIN64))
+static const int *const _zf_log_tag_lvl_ = _zf_log_tag_output_lvl(_ZF_LOG_TAG);
+	#else
+		#error ZF_LOG_TAG_LEVELS requires GCC compatible compiler or C++ on Windows
+	#endif
+#endif
+
+/* Source location of the log statement. File is a base name already.
+ */
+typedef struct _zf_log_site
+{
+	const char *func;
+	const char *file;
+	unsigned line;
+}
+_zf_log_site;
+
 void _zf_log_write_d(
 		const char *const func, const char *const file, const unsigned line,
 		const int lvl, const char *const tag,
@@ -689,6 +853,43 @@ void _zf_log_write_mem_aux(
 		const zf_log_spec *const log, const int lvl, const char *const tag,
 		const void *const d, const unsigned d_sz,
 		const char *const fmt, ...) _ZF_LOG_PRINTFLIKE(6, 7);
+void _zf_log_write_site(
+		const _zf_log_site *const site, const int lvl, const char *const tag,
+		const char *const fmt, ...) _ZF_LOG_PRINTFLIKE(4, 5);
+void _zf_log_write_aux_site(
+		const _zf_log_site *const site,
+		const zf_log_spec *const log, const int lvl, const char *const tag,
+		const char *const fmt, ...) _ZF_LOG_PRINTFLIKE(5, 6);
+void _zf_log_write_mem_site(
+		const _zf_log_site *const site, const int lvl, const char *const tag,
+		const void *const d, const unsigned d_sz,
+		const char *const fmt, ...) _ZF_LOG_PRINTFLIKE(6, 7);
+void _zf_log_write_mem_aux_site(
+		const _zf_log_site *const site,
+		const zf_log_spec *const log, const int lvl, const char *const tag,
+		const void *const d, const unsigned d_sz,
+		const char *const fmt, ...) _ZF_LOG_PRINTFLIKE(7, 8);
+
+/* State of the statement with limited output.
+ */
+typedef struct _zf_log_limit
+{
+	unsigned long long v;
+	unsigned long long suppressed;
+}
+_zf_log_limit;
+
+int _zf_log_every_n(_zf_log_limit *const l, const unsigned n);
+int _zf_log_first_n(_zf_log_limit *const l, const unsigned n);
+int _zf_log_rate(_zf_log_limit *const l, const unsigned per_sec,
+				 const unsigned burst);
+int _zf_log_sample(_zf_log_limit *const l, const unsigned one_in);
+/* Site is 0 when source location is not logged.
+ */
+void _zf_log_write_limited(
+		const _zf_log_site *const site, _zf_log_limit *const l,
+		const int lvl, const char *const tag,
+		const char *const fmt, ...) _ZF_LOG_PRINTFLIKE(5, 6);
 
 #ifdef __cplusplus
 }
@@ -748,51 +949,165 @@ void _zf_log_write_mem_aux(
  * Library assuming UTF-8 encoding for all strings (char *), including format
  * string itself.
  */
-#if ZF_LOG_SRCLOC_NONE == _ZF_LOG_SRCLOC
+/* Compilers tend to over-align static data, which adds padding to every site
+ * record.
+ */
+#if defined(__GNUC__)
+	#define _ZF_LOG_SITE_ALIGN __attribute__((__aligned__(sizeof(void *))))
+#else
+	#define _ZF_LOG_SITE_ALIGN
+#endif
+#if defined(ZF_LOG_DYNAMIC_SITES)
+	#if !defined(__GNUC__) || !defined(__ELF__)
+		#error ZF_LOG_DYNAMIC_SITES requires GCC compatible compiler and ELF target
+	#endif
+	#if defined(ZF_LOG_OUTPUT_LEVEL)
+		#error ZF_LOG_DYNAMIC_SITES is not compatible with ZF_LOG_OUTPUT_LEVEL
+	#endif
+	#define _ZF_LOG_STR(s) #s
+	#define _ZF_LOG_XSTR(s) _ZF_LOG_STR(s)
+	#if ZF_LOG_SRCLOC_NONE == _ZF_LOG_SRCLOC
+		#define _ZF_LOG_DSITE_FUNCTION _ZF_LOG_FUNCTION
+		#define _ZF_LOG_DSITE_CALL(f, ...) \
+				_zf_log_write##f(__VA_ARGS__)
+	#else
+		#define _ZF_LOG_DSITE_FUNCTION _ZF_LOG_SRCLOC_FUNCTION
+		#define _ZF_LOG_DSITE_CALL(f, ...) \
+				_zf_log_write##f##_site(&_zf_log_site_.src, __VA_ARGS__)
+	#endif
+	/* Level and tag are recorded only when known at compile time. Records
+	 * must not be over-aligned, since library walks them as an array.
+	 */
+	#define _ZF_LOG_DSITE(lvl, tag) \
+			static zf_log_dynamic_site \
+			__attribute__((__section__(_ZF_LOG_XSTR(_zf_log_sites)), \
+						   __aligned__(sizeof(void *)))) _zf_log_site_ = \
+					{{_ZF_LOG_DSITE_FUNCTION, _ZF_LOG_FILE_NAME, __LINE__}, \
+					 __builtin_constant_p(tag)? (tag): (const char *)0, \
+					 __builtin_constant_p(lvl)? (lvl): 0, \
+					 _ZF_LOG_SITE_UNRESOLVED, ZF_LOG_SITE_DEFAULT}
+	#define _ZF_LOG_DSITE_ON(lvl) \
+			(__atomic_load_n(&_zf_log_site_.on, __ATOMIC_RELAXED) && \
+			 (1 == _zf_log_site_.on || _zf_log_site_resolve(&_zf_log_site_, lvl)))
+	#if defined(ZF_LOG_CAPTURE)
+		/* Site state tells whether line goes to the output. */
+		#define _ZF_LOG_DSITE_WRITE(lvl, tag, f, ...) \
+				do { \
+					_ZF_LOG_IF(ZF_LOG_ENABLED(lvl)) { \
+						_ZF_LOG_DSITE(lvl, tag); \
+						const int _zf_log_out_ = _ZF_LOG_DSITE_ON(lvl); \
+						if (_zf_log_out_ || _ZF_LOG_CAPTURE_ON(lvl)) \
+							_ZF_LOG_DSITE_CALL(f, __VA_ARGS__); \
+					} \
+				} _ZF_LOG_ONCE
+		#define _ZF_LOG_DSITE_LVL(lvl) \
+				(_zf_log_out_? (lvl): (lvl) | _ZF_LOG_CAPTURE_ONLY)
+	#else
+		#define _ZF_LOG_DSITE_WRITE(lvl, tag, f, ...) \
+				do { \
+					_ZF_LOG_IF(ZF_LOG_ENABLED(lvl)) { \
+						_ZF_LOG_DSITE(lvl, tag); \
+						if (_ZF_LOG_DSITE_ON(lvl)) \
+							_ZF_LOG_DSITE_CALL(f, __VA_ARGS__); \
+					} \
+				} _ZF_LOG_ONCE
+		#define _ZF_LOG_DSITE_LVL(lvl) (lvl)
+	#endif
+	#define ZF_LOG_WRITE(lvl, tag, ...) \
+			_ZF_LOG_DSITE_WRITE(lvl, tag, , \
+					_ZF_LOG_DSITE_LVL(lvl), tag, __VA_ARGS__)
+	#define ZF_LOG_WRITE_MEM(lvl, tag, d, d_sz, ...) \
+			_ZF_LOG_DSITE_WRITE(lvl, tag, _mem, \
+					_ZF_LOG_DSITE_LVL(lvl), tag, d, d_sz, __VA_ARGS__)
+	#define ZF_LOG_WRITE_AUX(log, lvl, tag, ...) \
+			_ZF_LOG_DSITE_WRITE(lvl, tag, _aux, \
+					log, _ZF_LOG_DSITE_LVL(lvl), tag, __VA_ARGS__)
+	#define ZF_LOG_WRITE_MEM_AUX(log, lvl, tag, d, d_sz, ...) \
+			_ZF_LOG_DSITE_WRITE(lvl, tag, _mem_aux, \
+					log, _ZF_LOG_DSITE_LVL(lvl), tag, d, d_sz, __VA_ARGS__)
+#elif ZF_LOG_SRCLOC_NONE == _ZF_LOG_SRCLOC
 	#define ZF_LOG_WRITE(lvl, tag, ...) \
 			do { \
 				if (ZF_LOG_ON(lvl)) \
-					_zf_log_write(lvl, tag, __VA_ARGS__); \
+					_zf_log_write(_ZF_LOG_LVL(lvl), tag, __VA_ARGS__); \
 			} _ZF_LOG_ONCE
 	#define ZF_LOG_WRITE_MEM(lvl, tag, d, d_sz, ...) \
 			do { \
 				if (ZF_LOG_ON(lvl)) \
-					_zf_log_write_mem(lvl, tag, d, d_sz, __VA_ARGS__); \
+					_zf_log_write_mem(_ZF_LOG_LVL(lvl), tag, \
+							d, d_sz, __VA_ARGS__); \
 			} _ZF_LOG_ONCE
 	#define ZF_LOG_WRITE_AUX(log, lvl, tag, ...) \
 			do { \
 				if (ZF_LOG_ON(lvl)) \
-					_zf_log_write_aux(log, lvl, tag, __VA_ARGS__); \
+					_zf_log_write_aux(log, _ZF_LOG_LVL(lvl), tag, __VA_ARGS__); \
 			} _ZF_LOG_ONCE
 	#define ZF_LOG_WRITE_MEM_AUX(log, lvl, tag, d, d_sz, ...) \
 			do { \
 				if (ZF_LOG_ON(lvl)) \
-					_zf_log_write_mem_aux(log, lvl, tag, d, d_sz, __VA_ARGS__); \
+					_zf_log_write_mem_aux(log, _ZF_LOG_LVL(lvl), tag, \
+							d, d_sz, __VA_ARGS__); \
+			} _ZF_LOG_ONCE
+#elif defined(_ZF_LOG_FILE_NAME)
+	#define _ZF_LOG_SITE \
+			static const _zf_log_site _ZF_LOG_SITE_ALIGN _zf_log_site_ = \
+					{_ZF_LOG_SRCLOC_FUNCTION, _ZF_LOG_FILE_NAME, __LINE__}
+	#define ZF_LOG_WRITE(lvl, tag, ...) \
+			do { \
+				if (ZF_LOG_ON(lvl)) { \
+					_ZF_LOG_SITE; \
+					_zf_log_write_site(&_zf_log_site_, \
+							_ZF_LOG_LVL(lvl), tag, __VA_ARGS__); \
+				} \
+			} _ZF_LOG_ONCE
+	#define ZF_LOG_WRITE_MEM(lvl, tag, d, d_sz, ...) \
+			do { \
+				if (ZF_LOG_ON(lvl)) { \
+					_ZF_LOG_SITE; \
+					_zf_log_write_mem_site(&_zf_log_site_, \
+							_ZF_LOG_LVL(lvl), tag, d, d_sz, __VA_ARGS__); \
+				} \
+			} _ZF_LOG_ONCE
+	#define ZF_LOG_WRITE_AUX(log, lvl, tag, ...) \
+			do { \
+				if (ZF_LOG_ON(lvl)) { \
+					_ZF_LOG_SITE; \
+					_zf_log_write_aux_site(&_zf_log_site_, \
+							log, _ZF_LOG_LVL(lvl), tag, __VA_ARGS__); \
+				} \
+			} _ZF_LOG_ONCE
+	#define ZF_LOG_WRITE_MEM_AUX(log, lvl, tag, d, d_sz, ...) \
+			do { \
+				if (ZF_LOG_ON(lvl)) { \
+					_ZF_LOG_SITE; \
+					_zf_log_write_mem_aux_site(&_zf_log_site_, \
+							log, _ZF_LOG_LVL(lvl), tag, d, d_sz, __VA_ARGS__); \
+				} \
 			} _ZF_LOG_ONCE
 #else
 	#define ZF_LOG_WRITE(lvl, tag, ...) \
 			do { \
 				if (ZF_LOG_ON(lvl)) \
 					_zf_log_write_d(_ZF_LOG_SRCLOC_FUNCTION, __FILE__, __LINE__, \
-							lvl, tag, __VA_ARGS__); \
+							_ZF_LOG_LVL(lvl), tag, __VA_ARGS__); \
 			} _ZF_LOG_ONCE
 	#define ZF_LOG_WRITE_MEM(lvl, tag, d, d_sz, ...) \
 			do { \
 				if (ZF_LOG_ON(lvl)) \
 					_zf_log_write_mem_d(_ZF_LOG_SRCLOC_FUNCTION, __FILE__, __LINE__, \
-							lvl, tag, d, d_sz, __VA_ARGS__); \
+							_ZF_LOG_LVL(lvl), tag, d, d_sz, __VA_ARGS__); \
 			} _ZF_LOG_ONCE
 	#define ZF_LOG_WRITE_AUX(log, lvl, tag, ...) \
 			do { \
 				if (ZF_LOG_ON(lvl)) \
 					_zf_log_write_aux_d(_ZF_LOG_SRCLOC_FUNCTION, __FILE__, __LINE__, \
-							log, lvl, tag, __VA_ARGS__); \
+							log, _ZF_LOG_LVL(lvl), tag, __VA_ARGS__); \
 			} _ZF_LOG_ONCE
 	#define ZF_LOG_WRITE_MEM_AUX(log, lvl, tag, d, d_sz, ...) \
 			do { \
 				if (ZF_LOG_ON(lvl)) \
 					_zf_log_write_mem_aux_d(_ZF_LOG_SRCLOC_FUNCTION, __FILE__, __LINE__, \
-							log, lvl, tag, d, d_sz, __VA_ARGS__); \
+							log, _ZF_LOG_LVL(lvl), tag, d, d_sz, __VA_ARGS__); \
 			} _ZF_LOG_ONCE
 #endif
 
@@ -904,6 +1219,154 @@ static _ZF_LOG_INLINE void _zf_log_unused(const int dummy, ...) {(void)dummy;}
 #define ZF_LOGE_STR(s) ZF_LOGE("%s", (s))
 #define ZF_LOGF_STR(s) ZF_LOGF("%s", (s))
 
+/* Limited logging macros. Each statement keeps its own state, so limit applies
+ * to the particular statement and not to the whole program:
+ * - ZF_LOGW_EVERY_N(n, "format string", args, ...) - logs first call and then
+ *   every n-th call;
+ * - ZF_LOGW_FIRST_N(n, "format string", args, ...) - logs only first n calls;
+ * - ZF_LOGW_RATE(per_sec, burst, "format string", args, ...) - logs no more
+ *   than per_sec messages per second on average, but allows bursts of up to
+ *   burst messages;
+ * - ZF_LOGW_SAMPLE(one_in, "format string", args, ...) - logs randomly
+ *   chosen calls, one of one_in calls on average.
+ * Same macros exist for other log levels. Useful for statements in hot loops,
+ * that otherwise could flood the output. Arguments of suppressed calls are not
+ * evaluated. Number of calls suppressed since the previous message is appended
+ * to the next message logged by the statement:
+ *
+ *   W disk write failed: errno=28 (suppressed 1234)
+ *
+ * Calls are counted only when log level is "turned on". Limited statements
+ * always use global output and they are not dynamic (see
+ * ZF_LOG_DYNAMIC_SITES).
+ */
+#if ZF_LOG_SRCLOC_NONE == _ZF_LOG_SRCLOC
+	#define _ZF_LOG_LIMITED_SITE
+	#define _ZF_LOG_LIMITED_SITE_PTR 0
+#else
+	#if defined(_ZF_LOG_FILE_NAME)
+		#define _ZF_LOG_LIMITED_FILE _ZF_LOG_FILE_NAME
+	#else
+		#define _ZF_LOG_LIMITED_FILE __FILE__
+	#endif
+	#define _ZF_LOG_LIMITED_SITE \
+			static const _zf_log_site _ZF_LOG_SITE_ALIGN _zf_log_site_ = \
+					{_ZF_LOG_SRCLOC_FUNCTION, _ZF_LOG_LIMITED_FILE, __LINE__};
+	#define _ZF_LOG_LIMITED_SITE_PTR &_zf_log_site_
+#endif
+#define _ZF_LOG_LIMITED(lvl, pass, ...) \
+		do { \
+			if (ZF_LOG_ON(lvl)) { \
+				static _zf_log_limit _zf_log_limit_; \
+				_ZF_LOG_LIMITED_SITE \
+				if (pass) \
+					_zf_log_write_limited(_ZF_LOG_LIMITED_SITE_PTR, &_zf_log_limit_, \
+							_ZF_LOG_LVL(lvl), _ZF_LOG_TAG, __VA_ARGS__); \
+			} \
+		} _ZF_LOG_ONCE
+
+#if ZF_LOG_ENABLED_VERBOSE
+	#define ZF_LOGV_EVERY_N(n, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_VERBOSE, _zf_log_every_n(&_zf_log_limit_, (n)), __VA_ARGS__)
+	#define ZF_LOGV_FIRST_N(n, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_VERBOSE, _zf_log_first_n(&_zf_log_limit_, (n)), __VA_ARGS__)
+	#define ZF_LOGV_RATE(per_sec, burst, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_VERBOSE, \
+					_zf_log_rate(&_zf_log_limit_, (per_sec), (burst)), __VA_ARGS__)
+	#define ZF_LOGV_SAMPLE(one_in, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_VERBOSE, _zf_log_sample(&_zf_log_limit_, (one_in)), __VA_ARGS__)
+#else
+	#define ZF_LOGV_EVERY_N(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGV_FIRST_N(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGV_RATE(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGV_SAMPLE(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+#endif
+
+#if ZF_LOG_ENABLED_DEBUG
+	#define ZF_LOGD_EVERY_N(n, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_DEBUG, _zf_log_every_n(&_zf_log_limit_, (n)), __VA_ARGS__)
+	#define ZF_LOGD_FIRST_N(n, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_DEBUG, _zf_log_first_n(&_zf_log_limit_, (n)), __VA_ARGS__)
+	#define ZF_LOGD_RATE(per_sec, burst, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_DEBUG, \
+					_zf_log_rate(&_zf_log_limit_, (per_sec), (burst)), __VA_ARGS__)
+	#define ZF_LOGD_SAMPLE(one_in, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_DEBUG, _zf_log_sample(&_zf_log_limit_, (one_in)), __VA_ARGS__)
+#else
+	#define ZF_LOGD_EVERY_N(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGD_FIRST_N(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGD_RATE(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGD_SAMPLE(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+#endif
+
+#if ZF_LOG_ENABLED_INFO
+	#define ZF_LOGI_EVERY_N(n, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_INFO, _zf_log_every_n(&_zf_log_limit_, (n)), __VA_ARGS__)
+	#define ZF_LOGI_FIRST_N(n, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_INFO, _zf_log_first_n(&_zf_log_limit_, (n)), __VA_ARGS__)
+	#define ZF_LOGI_RATE(per_sec, burst, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_INFO, \
+					_zf_log_rate(&_zf_log_limit_, (per_sec), (burst)), __VA_ARGS__)
+	#define ZF_LOGI_SAMPLE(one_in, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_INFO, _zf_log_sample(&_zf_log_limit_, (one_in)), __VA_ARGS__)
+#else
+	#define ZF_LOGI_EVERY_N(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGI_FIRST_N(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGI_RATE(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGI_SAMPLE(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+#endif
+
+#if ZF_LOG_ENABLED_WARN
+	#define ZF_LOGW_EVERY_N(n, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_WARN, _zf_log_every_n(&_zf_log_limit_, (n)), __VA_ARGS__)
+	#define ZF_LOGW_FIRST_N(n, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_WARN, _zf_log_first_n(&_zf_log_limit_, (n)), __VA_ARGS__)
+	#define ZF_LOGW_RATE(per_sec, burst, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_WARN, \
+					_zf_log_rate(&_zf_log_limit_, (per_sec), (burst)), __VA_ARGS__)
+	#define ZF_LOGW_SAMPLE(one_in, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_WARN, _zf_log_sample(&_zf_log_limit_, (one_in)), __VA_ARGS__)
+#else
+	#define ZF_LOGW_EVERY_N(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGW_FIRST_N(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGW_RATE(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGW_SAMPLE(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+#endif
+
+#if ZF_LOG_ENABLED_ERROR
+	#define ZF_LOGE_EVERY_N(n, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_ERROR, _zf_log_every_n(&_zf_log_limit_, (n)), __VA_ARGS__)
+	#define ZF_LOGE_FIRST_N(n, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_ERROR, _zf_log_first_n(&_zf_log_limit_, (n)), __VA_ARGS__)
+	#define ZF_LOGE_RATE(per_sec, burst, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_ERROR, \
+					_zf_log_rate(&_zf_log_limit_, (per_sec), (burst)), __VA_ARGS__)
+	#define ZF_LOGE_SAMPLE(one_in, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_ERROR, _zf_log_sample(&_zf_log_limit_, (one_in)), __VA_ARGS__)
+#else
+	#define ZF_LOGE_EVERY_N(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGE_FIRST_N(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGE_RATE(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGE_SAMPLE(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+#endif
+
+#if ZF_LOG_ENABLED_FATAL
+	#define ZF_LOGF_EVERY_N(n, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_FATAL, _zf_log_every_n(&_zf_log_limit_, (n)), __VA_ARGS__)
+	#define ZF_LOGF_FIRST_N(n, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_FATAL, _zf_log_first_n(&_zf_log_limit_, (n)), __VA_ARGS__)
+	#define ZF_LOGF_RATE(per_sec, burst, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_FATAL, \
+					_zf_log_rate(&_zf_log_limit_, (per_sec), (burst)), __VA_ARGS__)
+	#define ZF_LOGF_SAMPLE(one_in, ...) \
+			_ZF_LOG_LIMITED(ZF_LOG_FATAL, _zf_log_sample(&_zf_log_limit_, (one_in)), __VA_ARGS__)
+#else
+	#define ZF_LOGF_EVERY_N(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGF_FIRST_N(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGF_RATE(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+	#define ZF_LOGF_SAMPLE(...) _ZF_LOG_UNUSED(__VA_ARGS__)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -934,6 +1397,466 @@ void zf_log_out_stderr_callback(const zf_log_message *const msg, void *arg);
  */
 #define ZF_LOG_STDERR (&_zf_log_stderr_spec)
 
+/* Fan-out output. Passes each log line to several sinks, each with its own
+ * minimum log level and put mask. Line is formatted once with a union of sink
+ * masks (see zf_log_fanout_mask()) and each sink gets a view of it without the
+ * fields it didn't ask for (context, tag, source location or message), so
+ * nothing is formatted twice. Sink log level can only make output stricter,
+ * since line must pass the usual log level checks first. Example:
+ *
+ *   static const zf_log_sink sinks[] = {
+ *       {ZF_LOG_ERROR, {ZF_LOG_PUT_STD, 0, file_output_callback}},
+ *       {ZF_LOG_VERBOSE, {ZF_LOG_PUT_MSG, 0, socket_output_callback}},
+ *   };
+ *   static const zf_log_fanout fanout = {sinks, 2};
+ *   zf_log_set_output_v(ZF_LOG_OUT_FANOUT(&fanout));
+ *
+ * Could be used with zf_log_spec structure as well. Since zf_log_fanout_mask()
+ * is a function call, static zf_log_output for the spec must spell the union
+ * mask explicitly (e.g. ZF_LOG_PUT_STD, a wider mask is fine too):
+ *
+ *   static const zf_log_output fanout_output = {
+ *       ZF_LOG_PUT_STD, (void *)&fanout, zf_log_out_fanout_callback
+ *   };
+ *
+ * Sinks are called in order on the same buffer, line prefix is restored
+ * before each of them, but message text is not. So sink callbacks must not
+ * modify the message text. Sinks must accept text lines (ZF_LOG_PUT_DEFERRED
+ * is not supported). Memory dump lines get the offset column when any sink
+ * asks for it and are batched only when all sinks ask for that and put the
+ * same fields. Fan-out and its sinks must remain valid while used.
+ */
+typedef struct zf_log_sink
+{
+	int lvl; /* Minimum log level of lines passed to the sink */
+	zf_log_output output;
+}
+zf_log_sink;
+
+typedef struct zf_log_fanout
+{
+	const zf_log_sink *sinks;
+	unsigned count;
+}
+zf_log_fanout;
+
+#define ZF_LOG_OUT_FANOUT(f) \
+	zf_log_fanout_mask(f), (void *)(f), zf_log_out_fanout_callback
+void zf_log_out_fanout_callback(const zf_log_message *const msg, void *arg);
+
+/* Returns put mask the line must be formatted with for the fan-out output.
+ */
+unsigned zf_log_fanout_mask(const zf_log_fanout *const f);
+
+/* Asynchronous output. Log line is still formatted on the calling thread, but
+ * instead of invoking output callback it's copied into a bounded lock-free
+ * queue. Dedicated writer thread takes lines from that queue and passes them
+ * to the target output facility. Lines are never dropped - when the queue is
+ * full, caller will wait until there is a free slot. Available only when
+ * zf_log library is compiled with ZF_LOG_ASYNC defined. Example:
+ *
+ *   static const zf_log_output file_output = {
+ *       ZF_LOG_PUT_STD, 0, file_output_callback
+ *   };
+ *   zf_log_async_start(0);
+ *   zf_log_set_output_v(ZF_LOG_OUT_ASYNC(&file_output));
+ *   [...]
+ *   zf_log_async_stop();
+ *
+ * Target output (and its argument) must remain valid until zf_log_async_stop()
+ * returns. The same applies to the tag string, since output callback receives
+ * it on the writer thread. When asynchronous output is not running (not yet
+ * started or already stopped), target output callback is invoked directly.
+ * Could be used with zf_log_spec structure as well.
+ */
+#define ZF_LOG_OUT_ASYNC(output) \
+	(output)->mask, (void *)(output), zf_log_out_async_callback
+void zf_log_out_async_callback(const zf_log_message *const msg, void *arg);
+
+/* Start writer thread. Capacity is a number of lines the queue can hold (will
+ * be rounded up to the power of two), 0 means default (ZF_LOG_ASYNC_QUEUE_SZ in
+ * zf_log.c). When zf_log library is compiled with ZF_LOG_ASYNC_PER_THREAD,
+ * each logging thread gets its own queue of that capacity on first use (0
+ * means ZF_LOG_ASYNC_THREAD_QUEUE_SZ) and writer thread takes lines from all
+ * of them in the order of their time. Queue is freed after its thread
+ * exits. Returns 0 on success and non-zero value on failure. Does nothing
+ * when already started. Could be called from several threads concurrently
+ * (as well as zf_log_async_stop()).
+ */
+int zf_log_async_start(const unsigned capacity);
+
+/* Wait until all lines queued before this call reach target output.
+ */
+void zf_log_async_flush(void);
+
+/* Flush the queue and stop writer thread.
+ */
+void zf_log_async_stop(void);
+
+/* Deferred output. When output mask has ZF_LOG_PUT_DEFERRED flag, log line is
+ * not formatted on the calling thread. Instead, buffer pointed by msg (from
+ * msg->buf to msg->p) contains a binary record with level, tag, time, pid, tid,
+ * source location, format string pointer and raw argument values (strings are
+ * copied). Record could be stored and rendered later by zf_log_render_deferred()
+ * into a text line with the usual layout (ZF_LOG_MESSAGE_CTX_FORMAT, etc).
+ * Available only when zf_log library is compiled with ZF_LOG_DEFERRED defined.
+ *
+ * ZF_LOG_OUT_DEFERRED renders record right away, so it's mostly useful in
+ * combination with ZF_LOG_OUT_ASYNC to move formatting to the writer thread:
+ *
+ *   static const zf_log_output file_output = {
+ *       ZF_LOG_PUT_STD, 0, file_output_callback
+ *   };
+ *   static const zf_log_output deferred_output = {
+ *       ZF_LOG_OUT_DEFERRED(&file_output)
+ *   };
+ *   zf_log_async_start(0);
+ *   zf_log_set_output_v(ZF_LOG_OUT_ASYNC(&deferred_output));
+ *
+ * Format string, function and file name are stored as pointers and must remain
+ * valid until the record is rendered (string literals are fine). Custom fields
+ * in ZF_LOG_MESSAGE_XXX_FORMAT are evaluated at render time. Conversions that
+ * can't be deferred (e.g. "%n", "%ls", positional arguments) cause message to
+ * be formatted on the calling thread as usual and stored as text.
+ */
+#define ZF_LOG_OUT_DEFERRED(output) \
+	ZF_LOG_PUT_DEFERRED, (void *)(output), zf_log_out_deferred_callback
+void zf_log_out_deferred_callback(const zf_log_message *const msg, void *arg);
+
+/* Render deferred record into a text line and pass it to the output. Output
+ * mask defines what fields will be put into the line. Malformed records are
+ * ignored.
+ */
+void zf_log_render_deferred(const void *const record, const unsigned size,
+							const zf_log_output *const output);
+
+/* Binary log file. Deferred records are appended to the file together with
+ * strings referenced by them, so the file could be rendered into text later by
+ * zf_log_decode tool (see zf_log_decode.c). Available only when zf_log library
+ * is compiled with ZF_LOG_DEFERRED defined. Example:
+ *
+ *   zf_log_binary *const b = zf_log_binary_open("app.zlog");
+ *   zf_log_set_output_v(ZF_LOG_OUT_BINARY(b));
+ *   [...]
+ *   zf_log_binary_close(b);
+ *
+ * Writes are buffered, the buffer is flushed when full, on ZF_LOG_FATAL and by
+ * zf_log_binary_flush(). Safe to use from multiple threads. Binary file could
+ * only be decoded on the platform it was written on. Strings are copied into
+ * the file, so format string doesn't have to be a literal: when the same
+ * buffer holds a format of different length or beginning later, it's written
+ * again.
+ */
+typedef struct zf_log_binary zf_log_binary;
+#define ZF_LOG_OUT_BINARY(b) \
+	ZF_LOG_PUT_DEFERRED, (void *)(b), zf_log_out_binary_callback
+void zf_log_out_binary_callback(const zf_log_message *const msg, void *arg);
+
+/* Open binary log file for appending. Returns 0 on failure.
+ */
+zf_log_binary *zf_log_binary_open(const char *const path);
+
+/* Write buffered records to the file.
+ */
+void zf_log_binary_flush(zf_log_binary *const b);
+
+/* Flush and close binary log file. Output must not be used after that.
+ */
+void zf_log_binary_close(zf_log_binary *const b);
+
+/* Duplicate collapsing output. Consecutive log lines with the same level, tag
+ * and message text are not passed to the target output. Instead, when the run
+ * of identical lines ends, a single summary line is written:
+ *
+ *   04-29 22:43:20.244 40059  1299 W net connect failed: ECONNREFUSED
+ *   04-29 22:43:25.871 40059  1299 W net last message repeated 1234 times
+ *
+ * Summary line has context of the last held line. Context and source location
+ * are not compared. Target output receives lines with all fields
+ * (ZF_LOG_PUT_STD), regardless of its mask. Safe to use from multiple
+ * threads, all of them share the same state. FATAL lines are always passed.
+ * Available only when zf_log library is compiled with ZF_LOG_DEDUP defined.
+ * Example:
+ *
+ *   static const zf_log_output file_output = {
+ *       ZF_LOG_PUT_STD, 0, file_output_callback
+ *   };
+ *   zf_log_dedup *const d = zf_log_dedup_open(&file_output, 10000);
+ *   if (d)
+ *       zf_log_set_output_v(ZF_LOG_OUT_DEDUP(d));
+ *   [...]
+ *   zf_log_set_output_v(ZF_LOG_OUT_STDERR);
+ *   zf_log_dedup_close(d);
+ *
+ * Timeout is checked only when new line is logged, so held lines could stay
+ * unreported while nothing is logged. Call zf_log_dedup_flush() when that
+ * matters (e.g. periodically or before exit).
+ */
+typedef struct zf_log_dedup zf_log_dedup;
+#define ZF_LOG_OUT_DEDUP(d) \
+	ZF_LOG_PUT_STD, (void *)(d), zf_log_out_dedup_callback
+void zf_log_out_dedup_callback(const zf_log_message *const msg, void *arg);
+
+/* Create duplicate collapsing output. Target output must remain valid until
+ * zf_log_dedup_close() returns. Timeout is a maximum time in milliseconds
+ * identical lines could be held before the summary line is written, 0 means no
+ * limit. Returns 0 on failure.
+ */
+zf_log_dedup *zf_log_dedup_open(const zf_log_output *const output,
+								const unsigned timeout_ms);
+
+/* Write summary line for the lines that are held right now.
+ */
+void zf_log_dedup_flush(zf_log_dedup *const d);
+
+/* Flush and destroy duplicate collapsing output. Output must not be used after
+ * that.
+ */
+void zf_log_dedup_close(zf_log_dedup *const d);
+
+/* Buffered file output. Log lines are collected in a large buffer and written
+ * to the file with a single writev() call when the buffer is full, when the
+ * oldest buffered line is older than flush interval or when ZF_LOG_FATAL line
+ * is logged. Lines never interleave, even when output is used from multiple
+ * threads. Available only when zf_log library is compiled with
+ * ZF_LOG_BUFFERED_FILE defined. Example:
+ *
+ *   zf_log_file *const f = zf_log_file_open("app.log", 0, 1000);
+ *   if (f)
+ *       zf_log_set_output_v(ZF_LOG_OUT_FILE(f));
+ *   [...]
+ *   zf_log_set_output_v(ZF_LOG_OUT_STDERR);
+ *   zf_log_file_close(f);
+ *
+ * Flush deadline is checked only when new line is logged, so lines could stay
+ * in the buffer while nothing is logged. Call zf_log_file_flush() when that
+ * matters (e.g. periodically or before exit).
+ */
+typedef struct zf_log_file zf_log_file;
+#define ZF_LOG_OUT_FILE(f) \
+	ZF_LOG_PUT_STD, (void *)(f), zf_log_out_file_callback
+void zf_log_out_file_callback(const zf_log_message *const msg, void *arg);
+
+/* Open log file for appending. Buffer size is in bytes, 0 means default
+ * (ZF_LOG_FILE_BUF_SZ in zf_log.c). Flush interval is a maximum time in
+ * milliseconds line could stay in the buffer, 0 means that each line is
+ * written right away. Returns 0 on failure.
+ */
+zf_log_file *zf_log_file_open(const char *const path, const unsigned buf_sz,
+							  const unsigned flush_ms);
+
+/* Log file rotation options. File is rotated when it would grow over max_bytes
+ * (0 means no limit) and at local wall-clock boundaries that are multiples of
+ * period_s seconds since midnight (0 means no time-based rotation), e.g. 3600
+ * rotates every hour and 86400 at midnight. Rotated files are named
+ * "<path>.1" (the newest) to "<path>.<keep>", older ones are removed.
+ *
+ * When compress callback is not 0, it's invoked for each rotated file and must
+ * write compressed content of src file into dst file ("<path>.1" followed by
+ * compress_suffix) and return 0 on success. Source file is removed after that.
+ * On failure, file is kept uncompressed. Compression and generation shifting
+ * run on a dedicated rotation thread, logging thread only renames current file
+ * and opens a new one. Example:
+ *
+ *   static const zf_log_rotation rotation = {
+ *       64 * 1024 * 1024, 86400, 7, zf_log_gzip, 0, ".gz"
+ *   };
+ *   zf_log_file *const f = zf_log_file_open_rotating("app.log", 0, 1000,
+ *                                                    &rotation);
+ */
+typedef struct zf_log_rotation
+{
+	unsigned long long max_bytes;
+	unsigned period_s;
+	unsigned keep;
+	int (*compress)(const char *const src, const char *const dst, void *arg);
+	void *compress_arg;
+	const char *compress_suffix;
+}
+zf_log_rotation;
+
+/* Same as zf_log_file_open(), but file will be rotated as specified. Rotation
+ * options are copied, compress_suffix must remain valid until file is closed.
+ */
+zf_log_file *zf_log_file_open_rotating(const char *const path,
+									   const unsigned buf_sz,
+									   const unsigned flush_ms,
+									   const zf_log_rotation *const rotation);
+
+/* Compression callback for zf_log_rotation that runs "gzip -c src > dst" (use
+ * with ".gz" suffix). Argument is not used.
+ */
+int zf_log_gzip(const char *const src, const char *const dst, void *arg);
+
+/* Write buffered lines to the file.
+ */
+void zf_log_file_flush(zf_log_file *const f);
+
+/* Flush and close log file. Waits until rotated files are processed. Output
+ * must not be used after that.
+ */
+void zf_log_file_close(zf_log_file *const f);
+
+/* Flight recorder. Keeps last ZF_LOG_RECORDER_SZ (256 by default) log lines in
+ * memory, including lines with log level below "output" log level, so context
+ * that preceded a failure could be written after the fact. Lines with log
+ * level at or above "capture" log level are recorded, ZF_LOG_NONE (default)
+ * turns recording off. Available only when zf_log library is compiled with
+ * ZF_LOG_RECORDER defined. Example:
+ *
+ *   zf_log_set_output_level(ZF_LOG_WARN);
+ *   zf_log_set_capture_level(ZF_LOG_DEBUG);
+ *   zf_log_recorder_set_fatal_output(&crash_output);
+ *   [...]
+ *   ZF_LOGD("Only recorded");
+ *   ZF_LOGF("Written to the output, then recorded lines to crash_output");
+ *
+ * Lines below "output" log level reach the library only from compilation
+ * modules built with ZF_LOG_CAPTURE defined (CMake build adds it to the users
+ * of zf_log target when ZF_LOG_RECORDER option is on). Statements in such
+ * modules check "capture" log level as well and tell the library whether line
+ * is at or above their own "output" log level (ZF_LOG_OUTPUT_LEVEL, tag level
+ * or global one), so lines that are only recorded are still formatted, but
+ * not passed to the output. That costs one more load and compare per
+ * statement.
+ * Other modules pass only lines that go to the output and they are recorded
+ * when their level is at or above "capture" log level. Lines are formatted for
+ * the current output (binary records when it's a deferred output). Recording
+ * is lock-free and never blocks: line is dropped when its slot is still being
+ * written by another thread. Memory dump lines are not recorded.
+ */
+void zf_log_set_capture_level(const int lvl);
+
+/* Pass recorded lines to the output, oldest first. Lines are not removed from
+ * the recorder. Message tag field is 0 (prefixed tag is still in the line),
+ * binary records are rendered to text, so output must accept text lines. Safe
+ * to call while other threads log.
+ */
+void zf_log_recorder_dump(const zf_log_output *const output);
+
+/* Set output that recorded lines are dumped to after each ZF_LOG_FATAL line
+ * (0 to disable, default). Output must remain valid while it's set.
+ */
+void zf_log_recorder_set_fatal_output(const zf_log_output *const output);
+
+/* Crash handler. Regular log statements are not safe to use from a signal
+ * handler (they take locks, allocate and call localtime()), and lines held by
+ * asynchronous output, buffered log files and flight recorder are lost when
+ * process crashes. Crash handler is installed for SIGSEGV, SIGBUS, SIGILL,
+ * SIGFPE and SIGABRT. When one of them arrives, handler:
+ * - writes "Crashed with signal N" line with zf_log_write_signal_safe();
+ * - writes lines that are still in asynchronous output queue and then lines
+ *   kept by flight recorder to the crash descriptor;
+ * - writes buffered lines of open log files (see ZF_LOG_OUT_FILE) to them;
+ * - writes backtrace to the crash descriptor (glibc and Apple platforms);
+ * - restores previous handler and raises the signal again.
+ * Available only when zf_log library is compiled with ZF_LOG_CRASH_HANDLER
+ * defined. Pending lines are read without locks, so line that was being
+ * written at the moment of the crash could come out garbled. Binary records
+ * (see ZF_LOG_OUT_DEFERRED) are not written. Example:
+ *
+ *   zf_log_crash_handler_install(STDERR_FILENO);
+ *
+ * Crash descriptor is used by zf_log_write_signal_safe() as well, negative
+ * value means STDERR_FILENO. Handler runs on an alternative signal stack, so
+ * it works for stack overflows too. Alternative signal stack is a per-thread
+ * setting (see sigaltstack()), so only the thread that installed the handler
+ * gets one. Other threads get theirs with
+ * zf_log_crash_handler_thread_install(). Calling it again only changes the
+ * descriptor. Returns 0 on success or -1 on failure.
+ */
+int zf_log_crash_handler_install(const int fd);
+
+/* Give the calling thread alternative signal stack, so crash handler works
+ * for stack overflows in that thread too. Stack is freed when thread exits.
+ * Does nothing when thread already has one. Returns 0 on success or -1 on
+ * failure (or when library is compiled without ZF_LOG_CRASH_HANDLER).
+ */
+int zf_log_crash_handler_thread_install(void);
+
+/* Restore signal handlers that were replaced by zf_log_crash_handler_install().
+ * Alternative signal stack of the calling thread is freed. Stacks of other
+ * threads (including the one that installed the handler) stay registered until
+ * those threads exit.
+ */
+void zf_log_crash_handler_remove(void);
+
+/* Async-signal-safe log line. Formats line with raw timestamp (seconds and
+ * milliseconds since Epoch), pid, tid (Linux), log level, tag with tag prefix
+ * and message text without formatting:
+ *
+ *   1482496440.123 9876 5432 F hello.MAIN Crashed with signal 11
+ *
+ * and writes it to the crash descriptor (see zf_log_crash_handler_install())
+ * with a single write() call. Doesn't use "output" log level and output
+ * callback. Could be used from signal handlers and after fork() in a
+ * multithreaded process.
+ */
+void zf_log_write_signal_safe(const int lvl, const char *const tag,
+							  const char *const msg);
+
+/* Dynamic log statements. When code that uses zf_log is compiled with
+ * ZF_LOG_DYNAMIC_SITES defined, each log statement gets a record in a
+ * dedicated linker section. Record holds statement's source location, tag,
+ * level and a one-byte flag that statement checks before doing anything else.
+ * Flag of each statement could be changed at run time to log particular
+ * statements without lowering "output" log level for the whole program (e.g.
+ * in production). Requires GCC compatible compiler and ELF target (Linux,
+ * Android, BSD). Example:
+ *
+ *   CC_ARGS := -DZF_LOG_DYNAMIC_SITES -DZF_LOG_LEVEL=ZF_LOG_DEBUG
+ *   [...]
+ *   zf_log_set_output_level(ZF_LOG_INFO);
+ *   zf_log_set_sites("file=net*.c func=send_*", ZF_LOG_SITE_ON);
+ *
+ * Statements must still be enabled at compile time (see ZF_LOG_LEVEL). Output
+ * level must be changed with zf_log_set_output_level() (ZF_LOG_OUTPUT_LEVEL is
+ * not supported). Only statements in the module (executable or shared library)
+ * that contains zf_log library are visible to it. Mode of the statement:
+ * - ZF_LOG_SITE_DEFAULT - statement follows "output" log level (default);
+ * - ZF_LOG_SITE_ON - statement is always executed;
+ * - ZF_LOG_SITE_OFF - statement is never executed.
+ */
+#define ZF_LOG_SITE_DEFAULT 0
+#define ZF_LOG_SITE_ON      1
+#define ZF_LOG_SITE_OFF     2
+#define _ZF_LOG_SITE_UNRESOLVED 2
+
+/* Record of the dynamic log statement. Function is 0 when compiled with
+ * ZF_LOG_SRCLOC_SHORT, tag is 0 and level is 0 when they are not known at
+ * compile time.
+ */
+typedef struct zf_log_dynamic_site
+{
+	_zf_log_site src;
+	const char *tag;
+	int lvl;
+	unsigned char on;
+	unsigned char mode;
+}
+zf_log_dynamic_site;
+
+int _zf_log_site_resolve(zf_log_dynamic_site *const site, const int lvl);
+
+/* Invoke callback for each dynamic log statement. Returns number of
+ * statements.
+ */
+typedef void (*zf_log_site_cb)(const zf_log_dynamic_site *const site,
+							   void *arg);
+unsigned zf_log_enum_sites(const zf_log_site_cb cb, void *arg);
+
+/* Set mode of dynamic log statements that match the pattern. Pattern is a
+ * space separated list of "key=value" terms and statement must match all of
+ * them (empty pattern matches all statements):
+ * - file=GLOB - file base name;
+ * - func=GLOB - function name;
+ * - tag=GLOB - tag (without tag prefix);
+ * - line=N or line=N-M - line number or range of line numbers.
+ * GLOB could contain '*' (any number of characters) and '?' (one character).
+ * Returns number of matched statements or -1 when pattern is malformed.
+ */
+int zf_log_set_sites(const char *const pattern, const int mode);
+
 #ifdef __cplusplus
 }
 #endif
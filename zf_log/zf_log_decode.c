@@ -0,0 +1,386 @@
+/* zf_log_decode renders binary log files (see ZF_LOG_OUT_BINARY) into text,
+ * exactly as zf_log would have written them. Must be compiled with the same
+ * ZF_LOG_MESSAGE_XXX_FORMAT, ZF_LOG_EOL and ZF_LOG_BUF_SZ definitions as the
+ * library that wrote the files. Usage:
+ *
+ *   zf_log_decode [-l LEVEL] [-t TAG] [-b TIME] [-e TIME] [FILE...]
+ *
+ *   -l LEVEL  only records with this or higher level (V, D, I, W, E or F)
+ *   -t TAG    only records with this tag (without tag prefix)
+ *   -b TIME   only records made at or after TIME
+ *   -e TIME   only records made before TIME
+ *
+ * TIME is a local time in "YYYY-MM-DD[ HH:MM[:SS[.mmm]]]" format. Reads
+ * standard input when no files are specified. Files are processed one entry
+ * at a time, so memory usage doesn't depend on the file size.
+ */
+#define ZF_LOG_DEFERRED
+#include "zf_log.c"
+
+#define DECODE_IN_BUF_SZ (1024 * 1024)
+#define DECODE_OUT_BUF_SZ (1024 * 1024)
+#define DECODE_DICT_MIN_SZ 256
+
+typedef struct decode_filter
+{
+	int lvl;
+	const char *tag;
+	unsigned long long time_b;
+	unsigned long long time_e;
+}
+decode_filter;
+
+/* Maps pointer values from the file to strings they were pointing to.
+ */
+typedef struct decode_dict
+{
+	const char **keys;
+	char **vals;
+	size_t mask;
+	size_t n;
+}
+decode_dict;
+
+static size_t dict_find(const decode_dict *const d, const char *const key)
+{
+	size_t i = binary_hash(key) & d->mask;
+	while (0 != d->keys[i] && key != d->keys[i])
+	{
+		i = (i + 1) & d->mask;
+	}
+	return i;
+}
+
+static const char *dict_get(const decode_dict *const d, const char *const key,
+							const char *const def)
+{
+	if (0 == d->keys || 0 == key)
+	{
+		return def;
+	}
+	const size_t i = dict_find(d, key);
+	return 0 != d->keys[i]? d->vals[i]: def;
+}
+
+static void dict_clear(decode_dict *const d)
+{
+	for (size_t i = 0; 0 != d->keys && d->mask >= i; ++i)
+	{
+		free(d->vals[i]);
+	}
+	free((void *)d->keys);
+	free(d->vals);
+	d->keys = 0;
+	d->vals = 0;
+	d->mask = 0;
+	d->n = 0;
+}
+
+static int dict_put(decode_dict *const d, const char *const key,
+					const char *const s, const size_t len)
+{
+	if (0 == d->keys || 2 * (d->n + 1) > d->mask + 1)
+	{
+		decode_dict g;
+		const size_t n = 0 != d->keys? 2 * (d->mask + 1): DECODE_DICT_MIN_SZ;
+		g.keys = (const char **)calloc(n, sizeof(*g.keys));
+		g.vals = (char **)calloc(n, sizeof(*g.vals));
+		g.mask = n - 1;
+		g.n = d->n;
+		if (0 == g.keys || 0 == g.vals)
+		{
+			free((void *)g.keys);
+			free(g.vals);
+			return -1;
+		}
+		for (size_t i = 0; 0 != d->keys && d->mask >= i; ++i)
+		{
+			if (0 != d->keys[i])
+			{
+				const size_t j = dict_find(&g, d->keys[i]);
+				g.keys[j] = d->keys[i];
+				g.vals[j] = d->vals[i];
+			}
+		}
+		free((void *)d->keys);
+		free(d->vals);
+		*d = g;
+	}
+	char *const v = (char *)malloc(len + 1);
+	if (0 == v)
+	{
+		return -1;
+	}
+	memcpy(v, s, len);
+	v[len] = 0;
+	const size_t i = dict_find(d, key);
+	if (0 == d->keys[i])
+	{
+		d->keys[i] = key;
+		++d->n;
+	}
+	free(d->vals[i]);
+	d->vals[i] = v;
+	return 0;
+}
+
+/* Time filter compares milliseconds since epoch. Records have it regardless
+ * of context format (calendar fields are only stored when local time is used).
+ */
+static unsigned long long time_key(const long long sec, const unsigned msec)
+{
+	return 0 < sec? (unsigned long long)sec * 1000 + msec: 0;
+}
+
+static int parse_time(const char *const s, unsigned long long *const key)
+{
+	unsigned v[7] = {0, 0, 0, 0, 0, 0, 0};
+	const int n = sscanf(s, "%u-%u-%u %u:%u:%u.%u",
+						 v + 0, v + 1, v + 2, v + 3, v + 4, v + 5, v + 6);
+	if (3 > n || 4 == n)
+	{
+		return -1;
+	}
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = (int)v[0] - 1900;
+	tm.tm_mon = (int)v[1] - 1;
+	tm.tm_mday = (int)v[2];
+	tm.tm_hour = (int)v[3];
+	tm.tm_min = (int)v[4];
+	tm.tm_sec = (int)v[5];
+	tm.tm_isdst = -1;
+	const time_t t = mktime(&tm);
+	if ((time_t)-1 == t)
+	{
+		return -1;
+	}
+	*key = time_key((long long)t, v[6]);
+	return 0;
+}
+
+static int parse_level(const char *const s)
+{
+	static const char levels[] = "VDIWEF";
+	const char *const l = 0 != s[0] && 0 == s[1]? strchr(levels, s[0]): 0;
+	return 0 != l? ZF_LOG_VERBOSE + (int)(l - levels): -1;
+}
+
+static int filter_record(const decode_filter *const filter,
+						 const deferred_hdr *const hdr, const char *const tag)
+{
+	if (hdr->lvl < filter->lvl)
+	{
+		return 0;
+	}
+	if (0 != filter->tag && 0 != strcmp(filter->tag, tag))
+	{
+		return 0;
+	}
+	if (0 != filter->time_b || ~0ull != filter->time_e)
+	{
+		const unsigned long long t = time_key(hdr->sec, hdr->nsec / 1000000);
+		if (t < filter->time_b || t >= filter->time_e)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int check_file_hdr(const char *const p, const size_t sz)
+{
+	binary_file_hdr hdr;
+	if (sizeof(hdr) != sz)
+	{
+		return -1;
+	}
+	memcpy(&hdr, p, sizeof(hdr));
+	if (0 != memcmp(hdr.magic, BINARY_MAGIC, sizeof(hdr.magic)) ||
+		BINARY_VERSION != hdr.version || BINARY_BOM != hdr.bom ||
+		sizeof(const char *) != hdr.ptr_sz ||
+		sizeof(deferred_hdr) != hdr.rec_hdr_sz)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/* Replaces pointers in the record with pointers to the decoded strings and
+ * passes it to the output.
+ */
+static void decode_record(char *const rec, const size_t sz,
+						  const decode_filter *const filter,
+						  const decode_dict *const dict,
+						  const zf_log_output *const output)
+{
+	deferred_hdr hdr;
+	if (sizeof(hdr) >= sz)
+	{
+		return;
+	}
+	memcpy(&hdr, rec, sizeof(hdr));
+	const char *const prefix = rec + sizeof(hdr);
+	const char *const prefix_e = (const char *)memchr(prefix, 0, sz - sizeof(hdr));
+	if (0 == prefix_e || rec + sz == prefix_e + 1 ||
+		0 == memchr(prefix_e + 1, 0, (size_t)(rec + sz - prefix_e - 1)))
+	{
+		return;
+	}
+	if (!filter_record(filter, &hdr, prefix_e + 1))
+	{
+		return;
+	}
+	hdr.fmt = dict_get(dict, hdr.fmt, "");
+	hdr.func = dict_get(dict, hdr.func, "?");
+	hdr.file = dict_get(dict, hdr.file, "?");
+	memcpy(rec, &hdr, sizeof(hdr));
+	zf_log_render_deferred(rec, (unsigned)sz, output);
+}
+
+static int decode_stream(FILE *const in, const char *const name,
+						 const decode_filter *const filter,
+						 decode_dict *const dict,
+						 const zf_log_output *const output)
+{
+	static char buf[BINARY_ENTRY_MAX_SZ + 1];
+	int session = 0;
+	for (;;)
+	{
+		unsigned char entry[BINARY_ENTRY_HDR_SZ];
+		unsigned short sz;
+		const size_t n = fread(entry, 1, sizeof(entry), in);
+		if (0 == n && feof(in))
+		{
+			return 0;
+		}
+		memcpy(&sz, entry + 1, sizeof(sz));
+		if (sizeof(entry) != n || sz != fread(buf, 1, sz, in))
+		{
+			fprintf(stderr, "%s: unexpected end of file\n", name);
+			return -1;
+		}
+		if (BINARY_ENTRY_HDR == entry[0])
+		{
+			if (0 != check_file_hdr(buf, sz))
+			{
+				fprintf(stderr, "%s: unsupported file format\n", name);
+				return -1;
+			}
+			dict_clear(dict);
+			session = 1;
+			continue;
+		}
+		if (!session)
+		{
+			fprintf(stderr, "%s: not a binary log file\n", name);
+			return -1;
+		}
+		if (BINARY_ENTRY_STR == entry[0] && sizeof(const char *) <= sz)
+		{
+			const char *key;
+			memcpy(&key, buf, sizeof(key));
+			if (0 != dict_put(dict, key, buf + sizeof(key), sz - sizeof(key)))
+			{
+				fprintf(stderr, "%s: out of memory\n", name);
+				return -1;
+			}
+		}
+		else if (BINARY_ENTRY_REC == entry[0])
+		{
+			decode_record(buf, sz, filter, dict, output);
+		}
+	}
+}
+
+#ifndef ZF_LOG_DECODE_NO_MAIN
+static void file_output_callback(const zf_log_message *msg, void *arg)
+{
+	const size_t eol_len = sizeof(ZF_LOG_EOL) - 1;
+	memcpy(msg->p, ZF_LOG_EOL, eol_len);
+	RETVAL_UNUSED(fwrite(msg->buf, (size_t)(msg->p - msg->buf) + eol_len, 1,
+						 (FILE *)arg));
+}
+
+static int usage(const char *const argv0)
+{
+	fprintf(stderr, "Usage: %s [-l LEVEL] [-t TAG] [-b TIME] [-e TIME] [FILE...]\n"
+					"  -l LEVEL  only records with this or higher level (V, D, I, W, E or F)\n"
+					"  -t TAG    only records with this tag (without tag prefix)\n"
+					"  -b TIME   only records made at or after TIME\n"
+					"  -e TIME   only records made before TIME\n"
+					"TIME format is \"YYYY-MM-DD[ HH:MM[:SS[.mmm]]]\" (local time).\n",
+			argv0);
+	return 2;
+}
+
+int main(int argc, char *argv[])
+{
+	decode_filter filter = {0, 0, 0, ~0ull};
+	decode_dict dict = {0, 0, 0, 0};
+	int i = 1;
+	for (; argc > i + 1 && '-' == argv[i][0]; i += 2)
+	{
+		const char *const v = argv[i + 1];
+		if (0 == strcmp("-l", argv[i]))
+		{
+			if (0 > (filter.lvl = parse_level(v)))
+			{
+				return usage(argv[0]);
+			}
+		}
+		else if (0 == strcmp("-t", argv[i]))
+		{
+			filter.tag = v;
+		}
+		else if (0 == strcmp("-b", argv[i]))
+		{
+			if (0 != parse_time(v, &filter.time_b))
+			{
+				return usage(argv[0]);
+			}
+		}
+		else if (0 == strcmp("-e", argv[i]))
+		{
+			if (0 != parse_time(v, &filter.time_e))
+			{
+				return usage(argv[0]);
+			}
+		}
+		else
+		{
+			return usage(argv[0]);
+		}
+	}
+	if (argc > i && '-' == argv[i][0])
+	{
+		return usage(argv[0]);
+	}
+	const zf_log_output output = {ZF_LOG_PUT_STD, stdout, file_output_callback};
+	setvbuf(stdout, 0, _IOFBF, DECODE_OUT_BUF_SZ);
+	int ret = 0;
+	if (argc == i)
+	{
+		ret = decode_stream(stdin, "<stdin>", &filter, &dict, &output);
+	}
+	for (; argc > i && 0 == ret; ++i)
+	{
+		FILE *const in = fopen(argv[i], "rb");
+		if (0 == in)
+		{
+			fprintf(stderr, "%s: can't open\n", argv[i]);
+			ret = -1;
+			break;
+		}
+		setvbuf(in, 0, _IOFBF, DECODE_IN_BUF_SZ);
+		ret = decode_stream(in, argv[i], &filter, &dict, &output);
+		fclose(in);
+	}
+	dict_clear(&dict);
+	if (0 != fflush(stdout))
+	{
+		ret = -1;
+	}
+	return 0 == ret? 0: 1;
+}
+#endif